@@ -0,0 +1,458 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "coalesce.h"
+#include "fsops.h"
+#include "realpath.h"
+
+static int64_t exechelp_coalesce_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* FNV-1a, to name the batch of a key */
+static uint64_t exechelp_coalesce_hash(const char *buf, size_t len)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  size_t i;
+
+  for (i = 0; i < len; ++i)
+    hash = (hash ^ (unsigned char) buf[i]) * 0x100000001b3ULL;
+
+  return hash;
+}
+
+static int exechelp_coalesce_leader_alive(pid_t pid)
+{
+  return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+/**
+ * @fn exechelp_coalesce_default_dir
+ * @brief Returns the spool directory used when EXECHELP_COALESCE_DIR is not
+ * set: $XDG_RUNTIME_DIR/exechelper, or /tmp/exechelper-<uid>
+ *
+ * @return a newly-allocated path, or NULL on error
+ */
+char *exechelp_coalesce_default_dir(void)
+{
+  const char *runtime = getenv("XDG_RUNTIME_DIR");
+  char *path = NULL;
+
+  if (runtime && runtime[0] == '/')
+  {
+    if (asprintf(&path, "%s/exechelper", runtime) < 0)
+      path = NULL;
+  }
+  else if (asprintf(&path, "/tmp/exechelper-%u", (unsigned int) geteuid()) < 0)
+    path = NULL;
+
+  return path;
+}
+
+/**
+ * @fn exechelp_coalesce_open_spool
+ * @brief Opens the spool directory, creating it if needed. Since it can be
+ * in a shared directory like /tmp, it must be a real directory that only
+ * belongs to the current user.
+ *
+ * @return a file descriptor on the directory, or -1 on error
+ */
+static int exechelp_coalesce_open_spool(const char *spool)
+{
+  struct stat sb;
+  int fd;
+
+  if (mkdir(spool, 0700) != 0 && errno != EEXIST)
+    return -1;
+
+  fd = open(spool, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  if (fstat(fd, &sb) != 0 || sb.st_uid != geteuid() || (sb.st_mode & 077))
+  {
+    close(fd);
+    errno = EPERM;
+    return -1;
+  }
+
+  return fd;
+}
+
+static int exechelp_coalesce_pwrite(int fd, const void *buf, size_t len, off_t offset)
+{
+  while (len)
+  {
+    ssize_t written = pwrite(fd, buf, len, offset);
+
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return -1;
+
+    buf = (const char *) buf + written;
+    len -= written;
+    offset += written;
+  }
+
+  return 0;
+}
+
+/**
+ * @fn exechelp_coalesce_file_arg
+ * @brief Tells whether an argument is a file, see coalesce.h
+ *
+ * @return a newly-allocated canonical path if arg is a file argument, or NULL
+ */
+static char *exechelp_coalesce_file_arg(const char *arg)
+{
+  struct stat sb;
+
+  if (arg[0] == '-' || exechelp_arg_exceeds_len_limit(arg))
+    return NULL;
+  if (!strchr(arg, '/') && exechelp_fs_stat(arg, &sb) != 0)
+    return NULL;
+
+  return exechelp_coreutils_realpath(arg);
+}
+
+/**
+ * @fn exechelp_coalesce_read_batch
+ * @brief Reads a batch file whole, checking that it is an open batch for key
+ *
+ * @return a newly-allocated copy of the file, or NULL if the batch is closed,
+ * is not key's or cannot be read
+ */
+static char *exechelp_coalesce_read_batch(int fd, const char *key, size_t key_len, size_t *size)
+{
+  ExecHelpBatchHeader header;
+  size_t done = 0;
+  struct stat sb;
+  char *buf;
+
+  if (fstat(fd, &sb) != 0 || (size_t) sb.st_size < sizeof(header) + key_len)
+    return NULL;
+
+  buf = malloc(sb.st_size);
+  if (!buf)
+    return NULL;
+
+  while (done < (size_t) sb.st_size)
+  {
+    ssize_t got = pread(fd, buf + done, sb.st_size - done, done);
+
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      break;
+    done += got;
+  }
+
+  memcpy(&header, buf, sizeof(header));
+  if (done != (size_t) sb.st_size || header.magic != EXECHELP_COALESCE_MAGIC ||
+      header.key_len != key_len ||
+      memcmp(buf + sizeof(header), key, key_len) != 0)
+  {
+    free(buf);
+    return NULL;
+  }
+
+  *size = done;
+  return buf;
+}
+
+/**
+ * @fn exechelp_coalesce_merge
+ * @brief Builds the argv of a batch: the leader's argv, with its file
+ * arguments in canonical form, followed by the file arguments of all members
+ * in the order they joined. Each file only occurs once.
+ *
+ * @param argv: the leader's argv
+ * @param files: the canonical form of each of the leader's file arguments,
+ * and NULL for its other arguments
+ * @return a NULL-terminated vector to be freed with a single free(), or NULL
+ * if memory could not be allocated
+ */
+static char **exechelp_coalesce_merge(char *const argv[], char *const files[], const char *batch, size_t size)
+{
+  ExecHelpBatchHeader header;
+  const char *args, *end = batch + size, *iter;
+  size_t strings_len = 0, argc, n_args, i, n = 0;
+
+  memcpy(&header, batch, sizeof(header));
+  args = batch + sizeof(header) + header.key_len;
+
+  /* Only whole arguments are used, in case a member's write failed */
+  for (iter = args, n_args = 0; n_args < header.nargs && iter < end; ++n_args)
+  {
+    const char *nul = memchr(iter, '\0', end - iter);
+    if (!nul)
+      break;
+    iter = nul + 1;
+  }
+  end = iter;
+
+  for (argc = 0; argv[argc]; ++argc)
+    strings_len += strlen(files[argc] ? files[argc] : argv[argc]) + 1;
+
+  char **merged = malloc(sizeof(char *) * (argc + n_args + 1) + strings_len + (end - args));
+  ExecHelpHashTable *seen = exechelp_hash_table_new(exechelp_str_hash, exechelp_str_equal);
+  if (!merged || !seen)
+  {
+    free(merged);
+    if (seen)
+      exechelp_hash_table_destroy(seen);
+    return NULL;
+  }
+
+  char *strings = (char *) (merged + argc + n_args + 1);
+  for (i = 0; i < argc; ++i)
+  {
+    const char *arg = files[i] ? files[i] : argv[i];
+    size_t len = strlen(arg) + 1;
+
+    memcpy(strings, arg, len);
+    if (!files[i] || exechelp_hash_table_add(seen, strings))
+      merged[n++] = strings;
+    strings += len;
+  }
+
+  /* The leader's own file arguments are in the batch too */
+  memcpy(strings, args, end - args);
+  for (iter = strings; iter < strings + (end - args); iter += strlen(iter) + 1)
+    if (exechelp_hash_table_add(seen, (void *) iter))
+      merged[n++] = (char *) iter;
+  merged[n] = NULL;
+
+  exechelp_hash_table_destroy(seen);
+  return merged;
+}
+
+/**
+ * @fn exechelp_coalesce_delegation
+ * @brief Joins a delegated execution to the batch of its target, working
+ * directory and non-file arguments, see coalesce.h. A process that starts a
+ * batch waits for window_ms before it returns with the batch to delegate.
+ * The batch is then delegated with the leader's environment, and those of
+ * the members are dropped.
+ *
+ * @param spool: the spool directory, created if needed
+ * @param window_ms: the coalescing window, at most EXECHELP_COALESCE_MAX_WINDOW
+ * @param target: the full path of the binary to be delegated
+ * @param argv: the arguments of the delegated execution
+ * @param batch_argv: set to the argv to delegate when returning 0, to be
+ * freed with free()
+ * @return 1 if the execution joined a batch that another process delegates,
+ * 0 if the caller must delegate the batch, or -1 on error, in which case the
+ * caller should delegate its own execution
+ */
+int exechelp_coalesce_delegation(const char *spool, long window_ms, const char *target,
+                                 char *const argv[], char ***batch_argv)
+{
+  ExecHelpBatchHeader header;
+  size_t key_len, args_len = 0, batch_size = 0, len;
+  uint32_t nargs = 0;
+  char name[32], *cwd = NULL, *key = NULL, *args = NULL, *batch = NULL, **files = NULL;
+  int dirfd, fd, ret = -1, argc, i;
+
+  *batch_argv = NULL;
+  if (!spool || window_ms <= 0 || !target || target[0] != '/' || !argv || !argv[0])
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  if (window_ms > EXECHELP_COALESCE_MAX_WINDOW)
+    window_ms = EXECHELP_COALESCE_MAX_WINDOW;
+
+  if (exechelp_argv_exceeds_limits(argv))
+  {
+    errno = E2BIG;
+    return -1;
+  }
+
+  for (argc = 0; argv[argc]; ++argc);
+  cwd = getcwd(NULL, 0);
+  files = calloc(argc, sizeof(char *));
+  if (!cwd || !files)
+    goto out;
+
+  /* The key is made of the target, cwd and non-file arguments, and the
+   * batch receives the file arguments */
+  key_len = strlen(target) + 1 + strlen(cwd) + 1;
+  for (i = 1; i < argc; ++i)
+  {
+    files[i] = exechelp_coalesce_file_arg(argv[i]);
+    if (files[i])
+    {
+      args_len += strlen(files[i]) + 1;
+      nargs++;
+    }
+    else
+      key_len += strlen(argv[i]) + 1;
+  }
+
+  key = malloc(key_len);
+  args = malloc(args_len ? args_len : 1);
+  if (!key || !args)
+    goto out;
+
+  len = strlen(target) + 1;
+  memcpy(key, target, len);
+  key_len = len;
+  len = strlen(cwd) + 1;
+  memcpy(key + key_len, cwd, len);
+  key_len += len;
+  for (i = 1, args_len = 0; i < argc; ++i)
+  {
+    if (files[i])
+    {
+      len = strlen(files[i]) + 1;
+      memcpy(args + args_len, files[i], len);
+      args_len += len;
+    }
+    else
+    {
+      len = strlen(argv[i]) + 1;
+      memcpy(key + key_len, argv[i], len);
+      key_len += len;
+    }
+  }
+
+  dirfd = exechelp_coalesce_open_spool(spool);
+  if (dirfd < 0)
+    goto out;
+
+  snprintf(name, sizeof(name), "%016llx.batch", (unsigned long long) exechelp_coalesce_hash(key, key_len));
+  fd = openat(dirfd, name, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+  close(dirfd);
+  if (fd < 0)
+    goto out;
+
+  if (flock(fd, LOCK_EX) != 0)
+    goto out_close;
+
+  int64_t now = exechelp_coalesce_now();
+  batch = exechelp_coalesce_read_batch(fd, key, key_len, &batch_size);
+
+  if (batch)
+    memcpy(&header, batch, sizeof(header));
+  else
+  {
+    /* Closed, or the batch of another key with the same hash */
+    header.magic = EXECHELP_COALESCE_MAGIC;
+    header.key_len = key_len;
+    header.leader = 0;
+    header.nargs = 0;
+    header.deadline = 0;
+    batch_size = sizeof(header) + key_len;
+
+    if (ftruncate(fd, 0) != 0 ||
+        exechelp_coalesce_pwrite(fd, key, key_len, sizeof(header)) != 0)
+      goto out_unlock;
+  }
+  free(batch);
+  batch = NULL;
+
+  if (header.nargs + nargs > EXECHELP_MAX_ARGS)
+  {
+    errno = E2BIG;
+    goto out_unlock;
+  }
+
+  int joining = header.leader && exechelp_coalesce_leader_alive(header.leader) &&
+                now < header.deadline + EXECHELP_COALESCE_GRACE * 1000000LL;
+
+  /* Otherwise, start the batch, or take over the one of a dead leader */
+  if (!joining)
+  {
+    header.leader = getpid();
+    header.deadline = now + window_ms * 1000000LL;
+  }
+  header.nargs += nargs;
+
+  if (exechelp_coalesce_pwrite(fd, args, args_len, batch_size) != 0 ||
+      exechelp_coalesce_pwrite(fd, &header, sizeof(header), 0) != 0)
+    goto out_unlock;
+
+  if (joining)
+  {
+    ret = 1;
+    goto out_unlock;
+  }
+
+  flock(fd, LOCK_UN);
+
+  struct timespec deadline = {
+    .tv_sec = header.deadline / 1000000000LL,
+    .tv_nsec = header.deadline % 1000000000LL
+  };
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+
+  if (flock(fd, LOCK_EX) != 0)
+    goto out_close;
+
+  batch = exechelp_coalesce_read_batch(fd, key, key_len, &batch_size);
+  if (batch)
+    memcpy(&header, batch, sizeof(header));
+
+  if (!batch || header.leader != getpid())
+  {
+    /* We were taken for dead and another process delegates the batch */
+    ret = 1;
+    goto out_unlock;
+  }
+
+  if (ftruncate(fd, 0) != 0)
+    goto out_unlock;
+
+  *batch_argv = exechelp_coalesce_merge(argv, files, batch, batch_size);
+  ret = *batch_argv ? 0 : -1;
+
+  out_unlock:
+  flock(fd, LOCK_UN);
+  out_close:
+  close(fd);
+  out:
+  for (i = 0; files && i < argc; ++i)
+    free(files[i]);
+  free(files);
+  free(batch);
+  free(args);
+  free(key);
+  free(cwd);
+  return ret;
+}
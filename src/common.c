@@ -19,8 +19,11 @@
 #define _GNU_SOURCE
 
 #include "common.h"
+#include "fsops.h"
+#include "realpath.h"
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -44,7 +47,7 @@ char *exechelp_resolve_path(const char *file)
   /* Don't search when it contains a slash.  */
   if (strchr(file, '/') != NULL)
   {
-    char *real = realpath(file, NULL);
+    char *real = exechelp_coreutils_canonicalize_existing(file);
     return real;
   }
   else
@@ -104,7 +107,7 @@ char *exechelp_resolve_path(const char *file)
       
       /* Try to execute this name.  If it works, execve will not return. */
       errno = 0;
-      if (access(startp, X_OK))
+      if (exechelp_fs_access(startp, X_OK))
       {
         switch (errno)
         {
@@ -131,6 +134,7 @@ char *exechelp_resolve_path(const char *file)
             /* Some other error means we found an executable file, but
                something went wrong executing it; return the error to our
                caller.  */
+            free (path_malloc);
             return NULL;
         }
       }
@@ -165,6 +169,81 @@ char *exechelp_get_self_name()
     return strndup(buf, read);
 }
 
+#define FD_TARGET_CACHE_SIZE 16
+typedef struct _ExecHelpFdTarget {
+  dev_t            dev;
+  ino_t            ino;
+  struct timespec  ctime;
+  char            *path;
+} ExecHelpFdTarget;
+
+/**
+ * @fn exechelp_fd_target
+ * @brief Finds the path of the file an open file descriptor refers to, e.g.
+ * to decide on a fexecve() call.
+ *
+ * The file is identified with a single fstat() on the descriptor, and its
+ * path is only read from /proc/self/fd when the file's identity is not in a
+ * small process-wide cache. Cached paths are dropped when the file's ctime
+ * changes, which renaming, linking or unlinking it does. A file that already
+ * had several hard links resolves to the name it was first seen under.
+ * @param fd: the file descriptor to resolve
+ * @return a newly-allocated absolute path, or NULL on error
+ */
+char *exechelp_fd_target(int fd)
+{
+  static ExecHelpFdTarget cache[FD_TARGET_CACHE_SIZE];
+  static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+  char fdpath[32], buf[PATH_MAX];
+  struct stat sb;
+  ssize_t len;
+
+  if (fd < 0)
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (fstat(fd, &sb))
+    return NULL;
+
+  ExecHelpFdTarget *slot = &cache[(sb.st_ino ^ sb.st_dev) % FD_TARGET_CACHE_SIZE];
+  char *path = NULL;
+
+  pthread_mutex_lock(&lock);
+  if (slot->path && slot->dev == sb.st_dev && slot->ino == sb.st_ino
+      && slot->ctime.tv_sec == sb.st_ctim.tv_sec && slot->ctime.tv_nsec == sb.st_ctim.tv_nsec)
+    path = strdup(slot->path);
+  pthread_mutex_unlock(&lock);
+
+  if (path)
+    return path;
+
+  snprintf(fdpath, sizeof(fdpath), "/proc/self/fd/%d", fd);
+  len = readlink(fdpath, buf, sizeof(buf) - 1);
+  if (len <= 0)
+    return NULL;
+  buf[len] = '\0';
+
+  /* Pipes, sockets and the like have no path to decide on */
+  if (buf[0] != '/')
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  pthread_mutex_lock(&lock);
+  free(slot->path);
+  slot->dev = sb.st_dev;
+  slot->ino = sb.st_ino;
+  slot->ctime = sb.st_ctim;
+  slot->path = strdup(buf);
+  pthread_mutex_unlock(&lock);
+
+  return strdup(buf);
+}
+
 char *exechelp_read_list_from_file(const char *file_path)
 {
   static ExecHelpHashTable *cache = NULL;
@@ -194,7 +273,7 @@ char *exechelp_read_list_from_file(const char *file_path)
   time_t cached_access = 0;
   int must_refresh = 1;
 
-  if(stat(file_path, &sb) == 0)
+  if(exechelp_fs_stat(file_path, &sb) == 0)
     last_access = sb.st_mtim.tv_sec;
   if (exechelp_hash_table_contains(mtime, file_path))
     cached_access = EH_POINTER_TO_ULONG(exechelp_hash_table_lookup(mtime, file_path));
@@ -202,31 +281,16 @@ char *exechelp_read_list_from_file(const char *file_path)
     
   if (must_refresh)
   {
-    FILE *f = fopen(file_path, "rb");
-    if(f)
+    char *new_list = exechelp_fs_read_file(file_path, NULL);
+    if(new_list)
     {
-      fseek(f, 0, SEEK_END);
-      long fsize = ftell(f);
-      rewind(f);
-      
-      char *new_list = malloc(sizeof(char) * (fsize + 1));
-      if(new_list)
-      {
-        int read = fread(new_list, 1, fsize, f);
-        new_list[read] = 0;
+      exechelp_hash_table_remove(cache, file_path);
+      exechelp_hash_table_remove(mtime, file_path);
 
-        fclose(f);
-
-        exechelp_hash_table_remove(cache, file_path);
-        exechelp_hash_table_remove(mtime, file_path);
-
-        exechelp_hash_table_insert(cache, (void *)file_path, new_list);
-        exechelp_hash_table_insert(mtime, (void *)file_path, EH_ULONG_TO_POINTER(last_access));
-
-        return new_list;
-      }
+      exechelp_hash_table_insert(cache, (void *)file_path, new_list);
+      exechelp_hash_table_insert(mtime, (void *)file_path, EH_ULONG_TO_POINTER(last_access));
 
-      fclose(f);
+      return new_list;
     }
   }
 
@@ -373,6 +437,8 @@ int exechelp_is_associated_helper(const char *caller, const char *callee)
   return associated;
 }
 
+const char exechelp_no_associations[] = "";
+
 char *exechelp_extract_associations_for_binary(const char *receiving_binary)
 {
   if (receiving_binary)
@@ -417,7 +483,7 @@ char *exechelp_extract_associations_for_binary(const char *receiving_binary)
       DEBUG2("DEBUG: %s", "receiving binary is not associated with other apps\n");
   }
 
-  return "";
+  return (char *) exechelp_no_associations;
 }
 
 int exechelp_file_list_contains_path(const char *managed, const char *real)
@@ -437,6 +503,41 @@ int exechelp_file_list_contains_path(const char *managed, const char *real)
   return matched_a_line;
 }
 
+/**
+ * @fn exechelp_argv_exceeds_limits
+ * @brief Tells whether an argument vector has more arguments than the
+ * decision pipeline is willing to check
+ *
+ * @param argv: the list of arguments forwarded to execve
+ * @return 1 if the execution should be delegated without checking its
+ * arguments, 0 otherwise
+ */
+int exechelp_argv_exceeds_limits(char *const argv[])
+{
+  int i;
+
+  for (i = 0; argv && argv[i]; ++i)
+    if (i >= EXECHELP_MAX_ARGS)
+      return 1;
+
+  return 0;
+}
+
+/**
+ * @fn exechelp_arg_exceeds_len_limit
+ * @brief Tells whether an argument is too long to be a path. Such arguments,
+ * e.g. scripts passed to sh -c, cannot name a managed file since the kernel
+ * refuses to resolve them, so they are not canonicalized.
+ *
+ * @param arg: an argument forwarded to execve
+ * @return 1 if the argument is EXECHELP_MAX_ARG_LEN bytes long or more, 0
+ * otherwise
+ */
+int exechelp_arg_exceeds_len_limit(const char *arg)
+{
+  return strnlen(arg, EXECHELP_MAX_ARG_LEN) == EXECHELP_MAX_ARG_LEN;
+}
+
 void *exechelp_malloc0(size_t size)
 {
   void *mem = malloc(size);
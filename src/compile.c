@@ -0,0 +1,961 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Policy compiler, used by exechelper-compile. Each list is read, validated,
+ * deduplicated and indexed by its own thread (at most `threads` at a time),
+ * and the indexes are then laid out in a single file, written next to the
+ * output and renamed over it so that processes mapping the previous version
+ * keep a consistent view.
+ *
+ * Snapshots are compiled the same way, with one job per list of each profile,
+ * except that lines are only indexed once all lists are read, after being
+ * deduplicated across all of them.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "compiled.h"
+#include "fsops.h"
+
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t) 7)
+
+typedef struct _CompileLine {
+  const char *str;
+  uint32_t    length;
+  uint32_t    line;      /* line number in the list file */
+} CompileLine;
+
+typedef struct _CompileJob {
+  const char             *path;
+  int                     strict;
+  int                     shared;    /* part of a snapshot, see compile_snapshot_merge */
+  FILE                   *log;
+  pthread_mutex_t        *log_lock;
+
+  /* Results */
+  int                     failed;
+  int                     error;
+  struct stat             sb;
+  char                   *contents;
+  CompileLine            *lines;
+  ExecHelpCompiledEntry  *entries;
+  uint32_t               *slots;
+  uint32_t               *lengths;
+  uint64_t                strings_size;
+  uint64_t               *bitmap;    /* entries of the list, for snapshots */
+  ExecHelpCompileStats    stats;
+} CompileJob;
+
+typedef struct _CompileQueue {
+  CompileJob      *jobs;
+  int              n_jobs;
+  int              next;
+  pthread_mutex_t  lock;
+} CompileQueue;
+
+static void compile_warn(CompileJob *job, const CompileLine *line, const char *reason)
+{
+  job->stats.warnings++;
+
+  if (!job->log)
+    return;
+
+  pthread_mutex_lock(job->log_lock);
+  fprintf(job->log, "%s:%u: %s: '%.*s'%s\n", job->path, line->line,
+          job->strict ? "error" : "warning", (int) line->length, line->str, reason);
+  pthread_mutex_unlock(job->log_lock);
+}
+
+/* Flags lines that are valid but most likely not what the author meant.
+ * They are compiled as they are, so that the compiled policy makes the same
+ * decisions as the list files would. */
+static int compile_validate(CompileJob *job, const CompileLine *line)
+{
+  const char *s = line->str;
+  uint32_t i;
+
+  if (line->length == 0)
+  {
+    compile_warn(job, line, " (a blank line is a prefix of every path)");
+    return 0;
+  }
+
+  if (s[0] != '/')
+  {
+    compile_warn(job, line, " (not an absolute path, cannot match a canonical path)");
+    return 0;
+  }
+
+  if (line->length >= PATH_MAX)
+  {
+    compile_warn(job, line, " (longer than PATH_MAX)");
+    return 0;
+  }
+
+  for (i = 0; i + 1 < line->length; ++i)
+  {
+    if (s[i] != '/')
+      continue;
+
+    if (s[i + 1] == '/')
+    {
+      compile_warn(job, line, " (contains '//', cannot match a canonical path)");
+      return 0;
+    }
+
+    if (s[i + 1] == '.' &&
+        (i + 2 == line->length || s[i + 2] == '/' ||
+         (s[i + 2] == '.' && (i + 3 == line->length || s[i + 3] == '/'))))
+    {
+      compile_warn(job, line, " (contains '.' or '..', cannot match a canonical path)");
+      return 0;
+    }
+  }
+
+  char last = s[line->length - 1];
+  if (last == ' ' || last == '\t' || last == '\r')
+  {
+    compile_warn(job, line, " (trailing whitespace)");
+    return 0;
+  }
+
+  return 1;
+}
+
+static int compile_compare_lines(const void *a, const void *b)
+{
+  const CompileLine *la = a, *lb = b;
+  uint32_t min = la->length < lb->length ? la->length : lb->length;
+  int cmp = memcmp(la->str, lb->str, min);
+
+  if (cmp)
+    return cmp;
+  return (la->length > lb->length) - (la->length < lb->length);
+}
+
+static int compile_compare_lengths(const void *a, const void *b)
+{
+  uint32_t la = *(const uint32_t *) a, lb = *(const uint32_t *) b;
+
+  return (la > lb) - (la < lb);
+}
+
+/* Builds the entries of sorted distinct lines, and an open addressing table
+ * of the entries. Returns 0 on success, -1 with errno set otherwise */
+static int compile_build_index(const CompileLine *lines, size_t n_lines, ExecHelpCompiledEntry **entries,
+                               uint32_t **slots, size_t *n_slots, uint64_t *strings_size)
+{
+  uint64_t offset = 0;
+  size_t i;
+
+  /* Keep the load factor under 1/2 */
+  *n_slots = 1;
+  while (*n_slots <= n_lines * 2)
+    *n_slots <<= 1;
+
+  *entries = malloc(sizeof(ExecHelpCompiledEntry) * (n_lines ? n_lines : 1));
+  *slots = calloc(*n_slots, sizeof(uint32_t));
+  if (!*entries || !*slots)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  for (i = 0; i < n_lines; ++i)
+  {
+    ExecHelpCompiledEntry *entry = &(*entries)[i];
+    uint32_t hash = EXECHELP_COMPILED_HASH_INIT, j;
+
+    for (j = 0; j < lines[i].length; ++j)
+      hash = exechelp_compiled_hash_step(hash, lines[i].str[j]);
+
+    entry->hash = hash;
+    entry->offset = offset;
+    entry->length = lines[i].length;
+    offset += entry->length + 1;
+
+    uint32_t slot = hash & (*n_slots - 1);
+    while ((*slots)[slot])
+      slot = (slot + 1) & (*n_slots - 1);
+    (*slots)[slot] = i + 1;
+  }
+  *strings_size = offset;
+
+  if (offset > UINT32_MAX)
+  {
+    errno = EFBIG;
+    return -1;
+  }
+
+  return 0;
+}
+
+static int compile_index(CompileJob *job, size_t n_lines)
+{
+  size_t n_slots;
+
+  if (compile_build_index(job->lines, n_lines, &job->entries, &job->slots, &n_slots, &job->strings_size))
+  {
+    job->error = errno;
+    job->failed = 1;
+    return -1;
+  }
+  job->stats.slots = n_slots;
+
+  return 0;
+}
+
+/* Reads, validates, deduplicates and indexes one list */
+static void compile_list(CompileJob *job)
+{
+  struct timespec start, end;
+  size_t n_lines = 0, n, i;
+  char *line;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  /* A missing list is compiled as an empty one, which the engine never uses
+   * since it only looks at compiled lists whose file exists */
+  if (exechelp_fs_stat(job->path, &job->sb) != 0 && errno == ENOENT)
+  {
+    if (job->log)
+    {
+      pthread_mutex_lock(job->log_lock);
+      fprintf(job->log, "%s: warning: missing, compiled as an empty list\n", job->path);
+      pthread_mutex_unlock(job->log_lock);
+    }
+    job->stats.warnings++;
+    memset(&job->sb, 0, sizeof(job->sb));
+    job->contents = strdup("");
+  }
+  else
+    job->contents = exechelp_fs_read_file(job->path, NULL);
+
+  if (!job->contents)
+  {
+    job->error = errno;
+    job->failed = 1;
+    return;
+  }
+
+  for (line = job->contents; *line; ++line)
+    n_lines += (*line == EXECHELP_FILE_SEPARATOR_CHR);
+  n_lines++;
+
+  if (!(job->lines = malloc(sizeof(CompileLine) * n_lines)))
+    goto oom;
+
+  /* Split lines exactly like exechelp_policy_list_load does */
+  n = 0;
+  line = job->contents;
+  while (*line)
+  {
+    char *sep = strchr(line, EXECHELP_FILE_SEPARATOR_CHR);
+    if (sep)
+      *sep = '\0';
+
+    job->lines[n].str = line;
+    job->lines[n].length = sep ? (uint32_t) (sep - line) : (uint32_t) strlen(line);
+    job->lines[n].line = n + 1;
+    if (!compile_validate(job, &job->lines[n]) && job->strict)
+      job->failed = 1;
+    n++;
+
+    if (!sep)
+      break;
+    line = sep + 1;
+  }
+  job->stats.lines = n;
+
+  /* Sorting makes the output reproducible, and duplicates adjacent */
+  qsort(job->lines, n, sizeof(CompileLine), compile_compare_lines);
+  n_lines = 0;
+  for (i = 0; i < n; ++i)
+    if (n_lines == 0 || compile_compare_lines(&job->lines[n_lines - 1], &job->lines[i]))
+      job->lines[n_lines++] = job->lines[i];
+  job->stats.duplicates = n - n_lines;
+  job->stats.entries = n_lines;
+
+  job->lengths = malloc(sizeof(uint32_t) * (n_lines ? n_lines : 1));
+  if (!job->lengths)
+    goto oom;
+  for (i = 0; i < n_lines; ++i)
+    job->lengths[i] = job->lines[i].length;
+
+  /* Lines of a snapshot are indexed once all lists are read */
+  if (!job->shared && compile_index(job, n_lines))
+    return;
+
+  qsort(job->lengths, n_lines, sizeof(uint32_t), compile_compare_lengths);
+  size_t n_lengths = 0;
+  for (i = 0; i < n_lines; ++i)
+    if (n_lengths == 0 || job->lengths[n_lengths - 1] != job->lengths[i])
+      job->lengths[n_lengths++] = job->lengths[i];
+
+  job->stats.lengths = n_lengths;
+  job->stats.bytes = ALIGN8(job->strings_size) + ALIGN8(sizeof(ExecHelpCompiledEntry) * job->stats.entries) +
+                     ALIGN8(sizeof(uint32_t) * job->stats.slots) + ALIGN8(sizeof(uint32_t) * n_lengths);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  job->stats.build_ns = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+  return;
+
+oom:
+  job->error = ENOMEM;
+  job->failed = 1;
+}
+
+static void *compile_worker(void *data)
+{
+  CompileQueue *queue = data;
+
+  for (;;)
+  {
+    int next;
+
+    pthread_mutex_lock(&queue->lock);
+    next = queue->next < queue->n_jobs ? queue->next++ : -1;
+    pthread_mutex_unlock(&queue->lock);
+
+    if (next < 0)
+      return NULL;
+    compile_list(&queue->jobs[next]);
+  }
+}
+
+static void compile_job_clear(CompileJob *job)
+{
+  free(job->contents);
+  free(job->lines);
+  free(job->entries);
+  free(job->slots);
+  free(job->lengths);
+  free(job->bitmap);
+}
+
+/* Runs jobs on up to threads threads, the calling thread included. Returns
+ * 0 if all jobs succeeded, 1 if one failed validation in strict mode and -1
+ * if one failed with an error, stored in *error */
+static int compile_run(CompileJob *jobs, int n_jobs, int threads, FILE *log, int *error)
+{
+  CompileQueue queue = { jobs, n_jobs, 0, PTHREAD_MUTEX_INITIALIZER };
+  pthread_t *workers;
+  int i, started = 0, ret = 0;
+
+  if (threads > n_jobs)
+    threads = n_jobs;
+  if (threads < 1)
+    threads = 1;
+
+  workers = malloc(sizeof(pthread_t) * threads);
+  for (i = 0; workers && i < threads - 1; ++i)
+    if (pthread_create(&workers[i], NULL, compile_worker, &queue) == 0)
+      started++;
+  compile_worker(&queue);
+  for (i = 0; i < started; ++i)
+    pthread_join(workers[i], NULL);
+  free(workers);
+
+  *error = 0;
+  for (i = 0; i < n_jobs; ++i)
+  {
+    if (jobs[i].failed && ret != -1)
+    {
+      *error = jobs[i].error;
+      ret = *error ? -1 : 1;
+      if (*error && log)
+        fprintf(log, "%s: %s\n", jobs[i].path, strerror(*error));
+    }
+  }
+
+  return ret;
+}
+
+static int compile_write_all(int fd, const void *buf, size_t len)
+{
+  const char *p = buf;
+
+  while (len)
+  {
+    ssize_t w = write(fd, p, len);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+      return -1;
+    p += w;
+    len -= w;
+  }
+
+  return 0;
+}
+
+static int compile_write_padding(int fd, uint64_t len)
+{
+  static const char zeros[8];
+
+  return compile_write_all(fd, zeros, ALIGN8(len) - len);
+}
+
+static int compile_write_padded(int fd, const void *buf, size_t len)
+{
+  if (compile_write_all(fd, buf, len))
+    return -1;
+
+  return compile_write_padding(fd, len);
+}
+
+/* Creates the temporary file the output is written to */
+static int compile_create(const char *output, char **tmp)
+{
+  int fd;
+
+  if (asprintf(tmp, "%s.XXXXXX", output) < 0)
+    return -1;
+  if ((fd = mkstemp(*tmp)) < 0)
+    free(*tmp);
+
+  return fd;
+}
+
+/* Renames the temporary file over the output if it was written successfully,
+ * so that processes never map a partially written file */
+static int compile_commit(int fd, char *tmp, const char *output, int ret)
+{
+  if (ret == 0 && (fchmod(fd, 0644) || fsync(fd)))
+    ret = -1;
+  close(fd);
+  if (ret == 0 && rename(tmp, output))
+    ret = -1;
+  if (ret)
+  {
+    int saved = errno;
+    unlink(tmp);
+    errno = saved;
+  }
+  free(tmp);
+
+  return ret;
+}
+
+static int compile_write(CompileJob *jobs, const char *output)
+{
+  ExecHelpCompiledHeader header;
+  char *tmp;
+  uint64_t offset = ALIGN8(sizeof(header));
+  int fd, i, ret = -1;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, EXECHELP_COMPILED_MAGIC, sizeof(header.magic));
+  header.version = EXECHELP_COMPILED_VERSION;
+
+  for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+  {
+    ExecHelpCompiledListHeader *lh = &header.lists[i];
+    CompileJob *job = &jobs[i];
+
+    lh->source.mtime_sec = job->sb.st_mtim.tv_sec;
+    lh->source.mtime_nsec = job->sb.st_mtim.tv_nsec;
+    lh->source.size = job->sb.st_size;
+    lh->source.ino = job->sb.st_ino;
+    lh->source.indexed_size = job->sb.st_size;
+    lh->n_entries = job->stats.entries;
+    lh->n_slots = job->stats.slots;
+    lh->n_lengths = job->stats.lengths;
+
+    lh->strings_off = offset;
+    lh->strings_size = job->strings_size;
+    offset += ALIGN8(job->strings_size);
+    lh->entries_off = offset;
+    offset += ALIGN8(sizeof(ExecHelpCompiledEntry) * lh->n_entries);
+    lh->slots_off = offset;
+    offset += ALIGN8(sizeof(uint32_t) * lh->n_slots);
+    lh->lengths_off = offset;
+    offset += ALIGN8(sizeof(uint32_t) * lh->n_lengths);
+  }
+  header.size = offset;
+
+  if ((fd = compile_create(output, &tmp)) < 0)
+    return -1;
+
+  if (compile_write_padded(fd, &header, sizeof(header)))
+    goto out;
+
+  for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+  {
+    CompileJob *job = &jobs[i];
+    size_t j;
+
+    /* String pool, in the order of the sorted entries */
+    for (j = 0; j < job->stats.entries; ++j)
+      if (compile_write_all(fd, job->lines[j].str, job->lines[j].length) ||
+          compile_write_all(fd, "", 1))
+        goto out;
+    if (compile_write_padding(fd, job->strings_size) ||
+        compile_write_padded(fd, job->entries, sizeof(ExecHelpCompiledEntry) * job->stats.entries) ||
+        compile_write_padded(fd, job->slots, sizeof(uint32_t) * job->stats.slots) ||
+        compile_write_padded(fd, job->lengths, sizeof(uint32_t) * job->stats.lengths))
+      goto out;
+  }
+
+  ret = 0;
+
+out:
+  return compile_commit(fd, tmp, output, ret);
+}
+
+/**
+ * @fn exechelp_compile_policy
+ * @brief Compiles the policy lists into a policy file for the indexed engine
+ *
+ * @param paths: the helper-bins, managed-bins and managed-files lists
+ * @param output: the compiled policy to write, replaced atomically
+ * @param threads: the maximum number of lists indexed in parallel
+ * @param strict: if set, lines that would warrant a warning are errors
+ * @param log: where to report warnings and errors, or NULL
+ * @param stats: filled in with the statistics of each list
+ * @return 0 on success, 1 if a list did not validate in strict mode, -1 on
+ * error with errno set
+ */
+int exechelp_compile_policy(const char *paths[EXECHELP_COMPILED_N_LISTS], const char *output,
+                            int threads, int strict, FILE *log,
+                            ExecHelpCompileStats stats[EXECHELP_COMPILED_N_LISTS])
+{
+  CompileJob jobs[EXECHELP_COMPILED_N_LISTS];
+  pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+  int i, ret, error = 0;
+
+  memset(jobs, 0, sizeof(jobs));
+  for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+  {
+    jobs[i].path = paths[i];
+    jobs[i].strict = strict;
+    jobs[i].log = log;
+    jobs[i].log_lock = &log_lock;
+  }
+
+  ret = compile_run(jobs, EXECHELP_COMPILED_N_LISTS, threads, log, &error);
+  for (i = 0; stats && i < EXECHELP_COMPILED_N_LISTS; ++i)
+    stats[i] = jobs[i].stats;
+
+  if (ret == 0 && compile_write(jobs, output))
+  {
+    error = errno;
+    ret = -1;
+  }
+
+  for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+    compile_job_clear(&jobs[i]);
+
+  errno = error;
+  return ret;
+}
+
+/**
+ * @fn exechelp_compiled_append_source
+ * @brief Records in a compiled policy that lines were appended to one of its
+ * list files, so that processes keep using the compiled index for the lines
+ * it has and only index the appended ones. The header is patched in place:
+ * a process that reads it while it changes sees a version of the file that
+ * does not match, and loads the list from its file.
+ *
+ * @param output: the compiled policy
+ * @param index: the list that was appended to
+ * @param before: the stat information of the list file before the append
+ * @param after: the stat information of the list file after the append
+ * @return 1 if the compiled policy is up to date with the list file, 0 if
+ * it must be compiled again, -1 on error with errno set
+ */
+int exechelp_compiled_append_source(const char *output, int index,
+                                    const struct stat *before, const struct stat *after)
+{
+  ExecHelpCompiledHeader header;
+  ExecHelpCompiledSource *source = &header.lists[index].source;
+  off_t offset = offsetof(ExecHelpCompiledHeader, lists) + index * sizeof(ExecHelpCompiledListHeader) +
+                 offsetof(ExecHelpCompiledListHeader, source);
+  int fd, ret = 0;
+
+  if ((fd = open(output, O_RDWR | O_CLOEXEC)) < 0)
+    return errno == ENOENT ? 0 : -1;
+
+  if (pread(fd, &header, sizeof(header), 0) != sizeof(header))
+    goto out;
+
+  /* Only a policy compiled from the version that was appended to covers
+   * the lines before the append */
+  if (memcmp(header.magic, EXECHELP_COMPILED_MAGIC, sizeof(header.magic)) ||
+      header.version != EXECHELP_COMPILED_VERSION ||
+      source->mtime_sec != before->st_mtim.tv_sec || source->mtime_nsec != before->st_mtim.tv_nsec ||
+      source->size != before->st_size || source->ino != (uint64_t) before->st_ino ||
+      after->st_ino != before->st_ino || after->st_size < before->st_size ||
+      source->indexed_size < 0 || source->indexed_size > source->size ||
+      after->st_size - source->indexed_size > EXECHELP_COMPILED_MAX_TAIL(source->indexed_size))
+    goto out;
+
+  source->mtime_sec = after->st_mtim.tv_sec;
+  source->mtime_nsec = after->st_mtim.tv_nsec;
+  source->size = after->st_size;
+  ret = pwrite(fd, source, sizeof(*source), offset) == sizeof(*source) ? 1 : -1;
+
+out:
+  close(fd);
+  return ret;
+}
+
+static const char *compile_list_names[EXECHELP_COMPILED_N_LISTS] = {
+  "helper-bins.list", "managed-bins.list", "managed-files.list"
+};
+
+static int compile_compare_names(const void *a, const void *b)
+{
+  return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/* Lists the subdirectories of root holding at least one policy list, sorted
+ * by name like the profiles of a snapshot */
+static char **compile_find_profiles(const char *root, size_t *n_profiles)
+{
+  char **names = NULL;
+  struct dirent *entry;
+  size_t n = 0;
+  DIR *dir;
+
+  if (!(dir = opendir(root)))
+    return NULL;
+
+  while ((entry = readdir(dir)))
+  {
+    struct stat sb;
+    char *path;
+    int i, found = 0;
+
+    if (entry->d_name[0] == '.')
+      continue;
+
+    for (i = 0; i < EXECHELP_COMPILED_N_LISTS && !found; ++i)
+    {
+      if (asprintf(&path, "%s/%s/%s", root, entry->d_name, compile_list_names[i]) < 0)
+        goto oom;
+      found = stat(path, &sb) == 0 && S_ISREG(sb.st_mode);
+      free(path);
+    }
+    if (!found)
+      continue;
+
+    char **grown = realloc(names, sizeof(char *) * (n + 1));
+    if (!grown)
+      goto oom;
+    names = grown;
+    if (!(names[n] = strdup(entry->d_name)))
+      goto oom;
+    n++;
+  }
+  closedir(dir);
+
+  qsort(names, n, sizeof(char *), compile_compare_names);
+  *n_profiles = n;
+  if (!n)
+    errno = ENOENT;
+  return names;
+
+oom:
+  closedir(dir);
+  while (n)
+    free(names[--n]);
+  free(names);
+  errno = ENOMEM;
+  return NULL;
+}
+
+/* Deduplicates the lines of all lists into shared entries, and sets the bit
+ * of each entry in the bitmap of the lists it is in */
+static int compile_snapshot_merge(CompileJob *jobs, size_t n_jobs, CompileLine **shared, size_t *n_shared,
+                                  uint32_t *bitmap_words)
+{
+  size_t total = 0, n = 0, i, j;
+  CompileLine *all;
+
+  for (i = 0; i < n_jobs; ++i)
+    total += jobs[i].stats.entries;
+
+  if (!(all = malloc(sizeof(CompileLine) * (total ? total : 1))))
+    return -1;
+  for (i = 0; i < n_jobs; ++i)
+    for (j = 0; j < jobs[i].stats.entries; ++j)
+      all[n++] = jobs[i].lines[j];
+
+  qsort(all, n, sizeof(CompileLine), compile_compare_lines);
+  total = n;
+  n = 0;
+  for (i = 0; i < total; ++i)
+    if (n == 0 || compile_compare_lines(&all[n - 1], &all[i]))
+      all[n++] = all[i];
+
+  if (n > UINT32_MAX - 1)
+  {
+    free(all);
+    errno = EFBIG;
+    return -1;
+  }
+
+  uint32_t words = (n + 63) / 64;
+  for (i = 0; i < n_jobs; ++i)
+  {
+    CompileJob *job = &jobs[i];
+
+    if (!(job->bitmap = calloc(words ? words : 1, sizeof(uint64_t))))
+    {
+      free(all);
+      return -1;
+    }
+
+    for (j = 0; j < job->stats.entries; ++j)
+    {
+      const CompileLine *found = bsearch(&job->lines[j], all, n, sizeof(CompileLine), compile_compare_lines);
+      size_t index = found - all;
+
+      job->bitmap[index / 64] |= (uint64_t) 1 << (index % 64);
+    }
+  }
+
+  *shared = all;
+  *n_shared = n;
+  *bitmap_words = words;
+  return 0;
+}
+
+static int compile_write_snapshot(CompileJob *jobs, char **names, size_t n_profiles, const CompileLine *shared,
+                                  size_t n_shared, uint32_t bitmap_words, const char *output,
+                                  ExecHelpSnapshotStats *stats)
+{
+  ExecHelpCompiledEntry *entries = NULL;
+  ExecHelpSnapshotProfile *profiles;
+  ExecHelpSnapshotHeader header;
+  uint32_t *slots = NULL;
+  size_t n_slots, i, j;
+  uint64_t strings_size, offset;
+  char *tmp;
+  int fd, ret = -1;
+
+  if (!(profiles = calloc(n_profiles ? n_profiles : 1, sizeof(ExecHelpSnapshotProfile))))
+    return -1;
+  if (compile_build_index(shared, n_shared, &entries, &slots, &n_slots, &strings_size))
+    goto out_free;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, EXECHELP_SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = EXECHELP_SNAPSHOT_VERSION;
+  header.n_profiles = n_profiles;
+  header.n_entries = n_shared;
+  header.n_slots = n_slots;
+  header.bitmap_words = bitmap_words;
+
+  /* Profile names follow the lines in the string pool */
+  for (i = 0; i < n_profiles; ++i)
+  {
+    profiles[i].name_offset = strings_size;
+    profiles[i].name_length = strlen(names[i]);
+    strings_size += profiles[i].name_length + 1;
+  }
+  if (strings_size > UINT32_MAX)
+  {
+    errno = EFBIG;
+    goto out_free;
+  }
+
+  offset = ALIGN8(sizeof(header));
+  header.strings_off = offset;
+  header.strings_size = strings_size;
+  offset += ALIGN8(strings_size);
+  header.entries_off = offset;
+  offset += ALIGN8(sizeof(ExecHelpCompiledEntry) * n_shared);
+  header.slots_off = offset;
+  offset += ALIGN8(sizeof(uint32_t) * n_slots);
+  header.profiles_off = offset;
+  offset += ALIGN8(sizeof(ExecHelpSnapshotProfile) * n_profiles);
+
+  stats->strings_bytes = ALIGN8(strings_size);
+  stats->index_bytes = header.profiles_off - header.entries_off;
+  stats->profile_bytes = ALIGN8(sizeof(ExecHelpSnapshotProfile) * n_profiles);
+
+  for (i = 0; i < n_profiles; ++i)
+  {
+    for (j = 0; j < EXECHELP_COMPILED_N_LISTS; ++j)
+    {
+      CompileJob *job = &jobs[i * EXECHELP_COMPILED_N_LISTS + j];
+      ExecHelpSnapshotList *sl = &profiles[i].lists[j];
+
+      sl->source.mtime_sec = job->sb.st_mtim.tv_sec;
+      sl->source.mtime_nsec = job->sb.st_mtim.tv_nsec;
+      sl->source.size = job->sb.st_size;
+      sl->source.ino = job->sb.st_ino;
+      sl->source.indexed_size = job->sb.st_size;
+      sl->n_entries = job->stats.entries;
+      sl->n_lengths = job->stats.lengths;
+      sl->bitmap_off = offset;
+      offset += sizeof(uint64_t) * bitmap_words;
+      sl->lengths_off = offset;
+      offset += ALIGN8(sizeof(uint32_t) * sl->n_lengths);
+      stats->profile_bytes += sizeof(uint64_t) * bitmap_words + ALIGN8(sizeof(uint32_t) * sl->n_lengths);
+    }
+  }
+  header.size = offset;
+  stats->bytes = offset;
+
+  if ((fd = compile_create(output, &tmp)) < 0)
+    goto out_free;
+
+  if (compile_write_padded(fd, &header, sizeof(header)))
+    goto out;
+
+  for (i = 0; i < n_shared; ++i)
+    if (compile_write_all(fd, shared[i].str, shared[i].length) || compile_write_all(fd, "", 1))
+      goto out;
+  for (i = 0; i < n_profiles; ++i)
+    if (compile_write_all(fd, names[i], profiles[i].name_length + 1))
+      goto out;
+  if (compile_write_padding(fd, strings_size) ||
+      compile_write_padded(fd, entries, sizeof(ExecHelpCompiledEntry) * n_shared) ||
+      compile_write_padded(fd, slots, sizeof(uint32_t) * n_slots) ||
+      compile_write_padded(fd, profiles, sizeof(ExecHelpSnapshotProfile) * n_profiles))
+    goto out;
+
+  for (i = 0; i < n_profiles * EXECHELP_COMPILED_N_LISTS; ++i)
+    if (compile_write_all(fd, jobs[i].bitmap, sizeof(uint64_t) * bitmap_words) ||
+        compile_write_padded(fd, jobs[i].lengths, sizeof(uint32_t) * jobs[i].stats.lengths))
+      goto out;
+
+  ret = 0;
+
+out:
+  ret = compile_commit(fd, tmp, output, ret);
+out_free:
+  free(entries);
+  free(slots);
+  free(profiles);
+  return ret;
+}
+
+/**
+ * @fn exechelp_compile_snapshot
+ * @brief Compiles the policy lists of many profiles into a multi-profile
+ * snapshot. Each subdirectory of root that holds at least one of the policy
+ * lists is a profile named after the subdirectory; its other lists are
+ * compiled as empty lists. All lists are read and validated in parallel.
+ *
+ * @param root: the directory holding one policy directory per profile
+ * @param output: the snapshot to write, replaced atomically
+ * @param threads: the maximum number of lists read in parallel
+ * @param strict: if set, lines that would warrant a warning are errors
+ * @param log: where to report warnings and errors, or NULL
+ * @param stats: filled in with the statistics of the snapshot
+ * @return 0 on success, 1 if a list did not validate in strict mode, -1 on
+ * error with errno set
+ */
+int exechelp_compile_snapshot(const char *root, const char *output, int threads, int strict,
+                              FILE *log, ExecHelpSnapshotStats *stats)
+{
+  pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+  struct timespec start, end;
+  CompileLine *shared = NULL;
+  CompileJob *jobs = NULL;
+  size_t n_profiles = 0, n_jobs = 0, n_shared = 0, i;
+  uint32_t bitmap_words = 0;
+  char **names;
+  int ret = -1, error = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  memset(stats, 0, sizeof(ExecHelpSnapshotStats));
+
+  if (!(names = compile_find_profiles(root, &n_profiles)) || !n_profiles)
+  {
+    error = errno;
+    goto out;
+  }
+
+  n_jobs = n_profiles * EXECHELP_COMPILED_N_LISTS;
+  if (!(jobs = calloc(n_jobs, sizeof(CompileJob))))
+  {
+    error = ENOMEM;
+    goto out;
+  }
+  for (i = 0; i < n_jobs; ++i)
+  {
+    char *path;
+
+    if (asprintf(&path, "%s/%s/%s", root, names[i / EXECHELP_COMPILED_N_LISTS],
+                 compile_list_names[i % EXECHELP_COMPILED_N_LISTS]) < 0)
+    {
+      n_jobs = i;
+      error = ENOMEM;
+      goto out;
+    }
+    jobs[i].path = path;
+    jobs[i].strict = strict;
+    jobs[i].shared = 1;
+    jobs[i].log = log;
+    jobs[i].log_lock = &log_lock;
+  }
+
+  if ((ret = compile_run(jobs, n_jobs, threads, log, &error)))
+    goto out;
+
+  ret = -1;
+  if (compile_snapshot_merge(jobs, n_jobs, &shared, &n_shared, &bitmap_words) ||
+      compile_write_snapshot(jobs, names, n_profiles, shared, n_shared, bitmap_words, output, stats))
+  {
+    error = errno;
+    goto out;
+  }
+  ret = 0;
+
+out:
+  stats->profiles = n_profiles;
+  stats->entries = n_shared;
+  for (i = 0; i < n_jobs; ++i)
+  {
+    stats->lines += jobs[i].stats.lines;
+    stats->list_entries += jobs[i].stats.entries;
+    stats->warnings += jobs[i].stats.warnings;
+    free((char *) jobs[i].path);
+    compile_job_clear(&jobs[i]);
+  }
+  for (i = 0; i < n_profiles; ++i)
+    free(names[i]);
+  free(names);
+  free(jobs);
+  free(shared);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  stats->build_ns = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+
+  errno = error;
+  return ret;
+}
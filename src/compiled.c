@@ -0,0 +1,408 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "compiled.h"
+#include "fsops.h"
+
+/* Checks that a region of count elements of size bytes lies within the file
+ * and is aligned for its elements */
+static int exechelp_compiled_region_ok(const ExecHelpCompiledPolicy *compiled,
+                                       uint64_t offset, uint64_t count, size_t size)
+{
+  if (offset % 8 || offset > compiled->size)
+    return 0;
+
+  return count <= (compiled->size - offset) / size;
+}
+
+static int exechelp_compiled_map_list(ExecHelpCompiledPolicy *compiled, int index)
+{
+  const ExecHelpCompiledHeader *header = compiled->data;
+  const ExecHelpCompiledListHeader *lh = &header->lists[index];
+  ExecHelpCompiledList *list = &compiled->lists[index];
+  const char *base = compiled->data;
+
+  if (!exechelp_compiled_region_ok(compiled, lh->strings_off, lh->strings_size, 1) ||
+      !exechelp_compiled_region_ok(compiled, lh->entries_off, lh->n_entries, sizeof(ExecHelpCompiledEntry)) ||
+      !exechelp_compiled_region_ok(compiled, lh->slots_off, lh->n_slots, sizeof(uint32_t)) ||
+      !exechelp_compiled_region_ok(compiled, lh->lengths_off, lh->n_lengths, sizeof(uint32_t)) ||
+      lh->n_slots == 0 || (lh->n_slots & (lh->n_slots - 1)) || lh->n_slots <= lh->n_entries)
+    return -1;
+
+  list->source = &lh->source;
+  list->strings = base + lh->strings_off;
+  list->strings_size = lh->strings_size;
+  list->entries = (const ExecHelpCompiledEntry *) (base + lh->entries_off);
+  list->slots = (const uint32_t *) (base + lh->slots_off);
+  list->lengths = (const uint32_t *) (base + lh->lengths_off);
+  list->n_entries = lh->n_entries;
+  list->n_slots = lh->n_slots;
+  list->n_lengths = lh->n_lengths;
+
+  return 0;
+}
+
+/* Maps or reads a compiled policy or snapshot, whose header is at least
+ * min_size bytes long */
+static int exechelp_compiled_map(ExecHelpCompiledPolicy *compiled, const char *path, size_t min_size)
+{
+  struct stat sb;
+
+  memset(compiled, 0, sizeof(ExecHelpCompiledPolicy));
+
+  if (exechelp_fs_stat(path, &sb) != 0)
+    return -1;
+
+  if (sb.st_size < (off_t) min_size)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* Other backends cannot map files, read the policy into memory instead */
+  if (exechelp_fs == &exechelp_fs_real)
+  {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return -1;
+
+    compiled->data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (compiled->data == MAP_FAILED)
+    {
+      compiled->data = NULL;
+      return -1;
+    }
+    compiled->mapped = 1;
+    compiled->size = sb.st_size;
+  }
+  else if (!(compiled->data = exechelp_fs_read_file(path, &compiled->size)))
+    return -1;
+
+  compiled->mtime = sb.st_mtim;
+  compiled->ino = sb.st_ino;
+
+  if (compiled->size < min_size)
+  {
+    exechelp_compiled_close(compiled);
+    errno = EINVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
+static int exechelp_compiled_invalid(ExecHelpCompiledPolicy *compiled, const char *path)
+{
+  DEBUG("ExecHelper: ignoring invalid compiled policy '%s'\n", path);
+  exechelp_compiled_close(compiled);
+  errno = EINVAL;
+  return -1;
+}
+
+/**
+ * @fn exechelp_compiled_open
+ * @brief Maps a compiled policy and checks its structure. Entries are only
+ * checked when they are looked up, so that opening a large policy does not
+ * cost more than mapping it.
+ *
+ * @param compiled: the compiled policy to fill in
+ * @param path: the path of the compiled policy
+ * @return 0 on success, -1 on error with errno set
+ */
+int exechelp_compiled_open(ExecHelpCompiledPolicy *compiled, const char *path)
+{
+  int i;
+
+  if (exechelp_compiled_map(compiled, path, sizeof(ExecHelpCompiledHeader)))
+    return -1;
+
+  const ExecHelpCompiledHeader *header = compiled->data;
+  int valid = memcmp(header->magic, EXECHELP_COMPILED_MAGIC, sizeof(header->magic)) == 0 &&
+              header->version == EXECHELP_COMPILED_VERSION &&
+              header->size == compiled->size;
+
+  for (i = 0; valid && i < EXECHELP_COMPILED_N_LISTS; ++i)
+    valid = exechelp_compiled_map_list(compiled, i) == 0;
+
+  if (!valid)
+    return exechelp_compiled_invalid(compiled, path);
+
+  return 0;
+}
+
+static int exechelp_snapshot_compare_name(const char *profile, size_t len,
+                                          const char *strings, const ExecHelpSnapshotProfile *p)
+{
+  size_t min = len < p->name_length ? len : p->name_length;
+  int cmp = memcmp(profile, strings + p->name_offset, min);
+
+  if (cmp)
+    return cmp;
+  return (len > p->name_length) - (len < p->name_length);
+}
+
+/**
+ * @fn exechelp_snapshot_get_profile
+ * @brief Finds a profile in a snapshot, and fills in a view of each of its
+ * lists. The views point into the snapshot and are valid until it is closed,
+ * so a process serving many sandboxes can map a snapshot once and look up
+ * the lists of each sandbox in it.
+ *
+ * @param snapshot: a snapshot opened with exechelp_snapshot_open
+ * @param profile: the name of the profile
+ * @param lists: filled in with the lists of the profile
+ * @return 0 on success, -1 with errno set to ENOENT if there is no such
+ * profile or to EINVAL if the profile is corrupted
+ */
+int exechelp_snapshot_get_profile(const ExecHelpCompiledPolicy *snapshot, const char *profile,
+                                  ExecHelpCompiledList lists[EXECHELP_COMPILED_N_LISTS])
+{
+  const ExecHelpSnapshotHeader *header = snapshot->data;
+  const ExecHelpSnapshotProfile *profiles, *found = NULL;
+  const char *base = snapshot->data;
+  size_t len = strlen(profile), lo = 0, hi;
+  int i;
+
+  if (!header || memcmp(header->magic, EXECHELP_SNAPSHOT_MAGIC, sizeof(header->magic)))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  profiles = (const ExecHelpSnapshotProfile *) (base + header->profiles_off);
+  hi = header->n_profiles;
+  while (lo < hi && !found)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    const ExecHelpSnapshotProfile *p = &profiles[mid];
+    int cmp;
+
+    if ((uint64_t) p->name_offset + p->name_length > header->strings_size)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+    cmp = exechelp_snapshot_compare_name(profile, len, base + header->strings_off, p);
+    if (cmp == 0)
+      found = p;
+    else if (cmp < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  if (!found)
+  {
+    errno = ENOENT;
+    return -1;
+  }
+
+  for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+  {
+    const ExecHelpSnapshotList *sl = &found->lists[i];
+    ExecHelpCompiledList *list = &lists[i];
+
+    if (!exechelp_compiled_region_ok(snapshot, sl->bitmap_off, header->bitmap_words, sizeof(uint64_t)) ||
+        !exechelp_compiled_region_ok(snapshot, sl->lengths_off, sl->n_lengths, sizeof(uint32_t)))
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+    list->source = &sl->source;
+    list->strings = base + header->strings_off;
+    list->strings_size = header->strings_size;
+    list->entries = (const ExecHelpCompiledEntry *) (base + header->entries_off);
+    list->slots = (const uint32_t *) (base + header->slots_off);
+    list->lengths = (const uint32_t *) (base + sl->lengths_off);
+    list->bitmap = (const uint64_t *) (base + sl->bitmap_off);
+    list->n_entries = header->n_entries;
+    list->n_slots = header->n_slots;
+    list->n_lengths = sl->n_lengths;
+  }
+
+  return 0;
+}
+
+/**
+ * @fn exechelp_snapshot_open
+ * @brief Maps a multi-profile snapshot and checks its structure, like
+ * exechelp_compiled_open. The lists of the compiled policy are those of the
+ * given profile, so that the snapshot can be used wherever a compiled policy
+ * can.
+ *
+ * @param compiled: the compiled policy to fill in
+ * @param path: the path of the snapshot
+ * @param profile: the profile whose lists to use, or NULL to only map the
+ * snapshot for exechelp_snapshot_get_profile
+ * @return 0 on success, -1 on error with errno set (ENOENT if there is no
+ * such profile)
+ */
+int exechelp_snapshot_open(ExecHelpCompiledPolicy *compiled, const char *path, const char *profile)
+{
+  if (exechelp_compiled_map(compiled, path, sizeof(ExecHelpSnapshotHeader)))
+    return -1;
+
+  const ExecHelpSnapshotHeader *header = compiled->data;
+  int valid = memcmp(header->magic, EXECHELP_SNAPSHOT_MAGIC, sizeof(header->magic)) == 0 &&
+              header->version == EXECHELP_SNAPSHOT_VERSION &&
+              header->size == compiled->size &&
+              exechelp_compiled_region_ok(compiled, header->strings_off, header->strings_size, 1) &&
+              exechelp_compiled_region_ok(compiled, header->entries_off, header->n_entries, sizeof(ExecHelpCompiledEntry)) &&
+              exechelp_compiled_region_ok(compiled, header->slots_off, header->n_slots, sizeof(uint32_t)) &&
+              exechelp_compiled_region_ok(compiled, header->profiles_off, header->n_profiles, sizeof(ExecHelpSnapshotProfile)) &&
+              header->n_slots && !(header->n_slots & (header->n_slots - 1)) && header->n_slots > header->n_entries &&
+              header->bitmap_words == (header->n_entries + 63) / 64;
+
+  if (!valid)
+    return exechelp_compiled_invalid(compiled, path);
+
+  if (profile && exechelp_snapshot_get_profile(compiled, profile, compiled->lists))
+  {
+    int saved = errno;
+
+    if (saved == EINVAL)
+      return exechelp_compiled_invalid(compiled, path);
+    exechelp_compiled_close(compiled);
+    errno = saved;
+    return -1;
+  }
+
+  return 0;
+}
+
+void exechelp_compiled_close(ExecHelpCompiledPolicy *compiled)
+{
+  if (!compiled || !compiled->data)
+    return;
+
+  if (compiled->mapped)
+    munmap(compiled->data, compiled->size);
+  else
+    free(compiled->data);
+
+  memset(compiled, 0, sizeof(ExecHelpCompiledPolicy));
+}
+
+/**
+ * @fn exechelp_compiled_source_matches
+ * @brief Tells whether a compiled list was compiled from the current version
+ * of its list file
+ *
+ * @param list: a list of a compiled policy
+ * @param sb: the stat information of the list file
+ * @return 1 if the compiled list can be used in place of the file, 0 otherwise
+ */
+int exechelp_compiled_source_matches(const ExecHelpCompiledList *list, const struct stat *sb)
+{
+  if (!list || !list->source)
+    return 0;
+
+  return list->source->mtime_sec == sb->st_mtim.tv_sec &&
+         list->source->mtime_nsec == sb->st_mtim.tv_nsec &&
+         list->source->size == sb->st_size &&
+         list->source->ino == (uint64_t) sb->st_ino;
+}
+
+static int exechelp_compiled_list_lookup(const ExecHelpCompiledList *list, const char *line,
+                                         size_t len, uint32_t hash)
+{
+  uint32_t mask = list->n_slots - 1, slot = hash & mask, probes;
+
+  for (probes = 0; probes < list->n_slots; ++probes, slot = (slot + 1) & mask)
+  {
+    uint32_t index = list->slots[slot];
+    if (index == 0)
+      return 0;
+    if (index > list->n_entries)
+      return 0;
+
+    /* Entries are distinct, a matching entry that is not in the list of a
+     * snapshot profile means the line is not in the list */
+    const ExecHelpCompiledEntry *entry = &list->entries[index - 1];
+    if (entry->hash == hash && entry->length == len &&
+        (uint64_t) entry->offset + len < list->strings_size &&
+        memcmp(list->strings + entry->offset, line, len) == 0)
+      return !list->bitmap || (list->bitmap[(index - 1) / 64] >> ((index - 1) % 64)) & 1;
+  }
+
+  return 0;
+}
+
+/**
+ * @fn exechelp_compiled_list_contains
+ * @brief Tells whether a compiled list contains a line, like
+ * exechelp_policy_list_contains
+ */
+int exechelp_compiled_list_contains(const ExecHelpCompiledList *list, const char *line)
+{
+  uint32_t hash = EXECHELP_COMPILED_HASH_INIT;
+  size_t len;
+
+  if (!list || !line)
+    return 0;
+
+  for (len = 0; line[len]; ++len)
+    hash = exechelp_compiled_hash_step(hash, line[len]);
+
+  return exechelp_compiled_list_lookup(list, line, len, hash);
+}
+
+/**
+ * @fn exechelp_compiled_list_has_prefix_of
+ * @brief Tells whether a line of a compiled list is a prefix of a path, like
+ * exechelp_policy_list_has_prefix_of. The hash of each candidate prefix is
+ * computed along a single pass over the path.
+ */
+int exechelp_compiled_list_has_prefix_of(const ExecHelpCompiledList *list, const char *path)
+{
+  uint32_t hash = EXECHELP_COMPILED_HASH_INIT, i;
+  size_t len = 0;
+
+  if (!list || !path)
+    return 0;
+
+  for (i = 0; i < list->n_lengths; ++i)
+  {
+    size_t target = list->lengths[i];
+
+    for (; len < target && path[len]; ++len)
+      hash = exechelp_compiled_hash_step(hash, path[len]);
+    if (len < target)
+      return 0;
+
+    if (exechelp_compiled_list_lookup(list, path, len, hash))
+      return 1;
+  }
+
+  return 0;
+}
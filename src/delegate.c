@@ -0,0 +1,502 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "delegate.h"
+
+static int exechelp_delegate_write_all(int fd, const void *buf, size_t len)
+{
+  while (len)
+  {
+    ssize_t written = send(fd, buf, len, MSG_NOSIGNAL);
+
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return -1;
+
+    buf = (const char *) buf + written;
+    len -= written;
+  }
+
+  return 0;
+}
+
+static int exechelp_delegate_read_all(int fd, void *buf, size_t len)
+{
+  while (len)
+  {
+    ssize_t got = recv(fd, buf, len, 0);
+
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got == 0)
+      errno = ECONNRESET;
+    if (got <= 0)
+      return -1;
+
+    buf = (char *) buf + got;
+    len -= got;
+  }
+
+  return 0;
+}
+
+static int exechelp_delegate_address(const char *socket_path, struct sockaddr_un *addr)
+{
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+
+  if (!socket_path || strlen(socket_path) >= sizeof(addr->sun_path))
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  strcpy(addr->sun_path, socket_path);
+  return 0;
+}
+
+/**
+ * @fn exechelp_delegate_request
+ * @brief Asks the delegation daemon to execute target, see delegate.h
+ *
+ * @param socket_path: the path of the daemon's socket
+ * @param cwd: the full path of the directory to execute target in, or NULL
+ * for the current directory
+ * @param home: the HOME that '~/' arguments expand against, or NULL for the
+ * current one
+ * @param target: the full path of the binary to be executed
+ * @param argv: the arguments of the execution
+ * @param pid: set to the pid of the delegated process, if not NULL
+ * @return a file descriptor that becomes readable when the delegated process
+ * exits, or -1 with errno set if the daemon could not be reached, refused the
+ * execution or could not execute target
+ */
+int exechelp_delegate_request(const char *socket_path, const char *cwd, const char *home,
+                              const char *target, char *const argv[], pid_t *pid)
+{
+  ExecHelpDelegateRequest request;
+  ExecHelpDelegateReply reply;
+  struct sockaddr_un addr;
+  size_t size, cwd_len, home_len, target_len;
+  char *current_dir = NULL;
+  int i, sock = -1, fd = -1;
+
+  if (!target || target[0] != '/' || !argv || (cwd && cwd[0] != '/'))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  if (exechelp_delegate_address(socket_path, &addr) != 0)
+    return -1;
+
+  /* A working directory that is gone cannot be sent, like when it is too
+   * deep for getcwd */
+  if (!cwd)
+  {
+    cwd = current_dir = get_current_dir_name();
+    if (!cwd)
+      return -1;
+  }
+
+  if (!home && !(home = getenv("HOME")))
+    home = "";
+
+  cwd_len = strlen(cwd) + 1;
+  home_len = strlen(home) + 1;
+  target_len = strlen(target) + 1;
+  size = cwd_len + home_len + target_len;
+  for (i = 0; argv[i] && size <= EXECHELP_DELEGATE_MAX_SIZE; ++i)
+    size += strlen(argv[i]) + 1;
+  if (size > EXECHELP_DELEGATE_MAX_SIZE)
+  {
+    errno = E2BIG;
+    goto out;
+  }
+
+  request.magic = EXECHELP_DELEGATE_MAGIC;
+  request.nargs = i;
+  request.size = size;
+
+  sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0)
+    goto out;
+
+  struct timeval timeout = { EXECHELP_DELEGATE_TIMEOUT / 1000, (EXECHELP_DELEGATE_TIMEOUT % 1000) * 1000 };
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    goto out;
+
+  if (exechelp_delegate_write_all(sock, &request, sizeof(request)) != 0 ||
+      exechelp_delegate_write_all(sock, cwd, cwd_len) != 0 ||
+      exechelp_delegate_write_all(sock, home, home_len) != 0 ||
+      exechelp_delegate_write_all(sock, target, target_len) != 0)
+    goto out;
+  for (i = 0; argv[i]; ++i)
+    if (exechelp_delegate_write_all(sock, argv[i], strlen(argv[i]) + 1) != 0)
+      goto out;
+
+  /* The reply is small enough to arrive in one message, with its descriptor */
+  char control[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = { &reply, sizeof(reply) };
+  struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                        .msg_control = control, .msg_controllen = sizeof(control) };
+  ssize_t got;
+
+  do
+    got = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+  while (got < 0 && errno == EINTR);
+
+  struct cmsghdr *cmsg = got > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+      cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+  if (got != sizeof(reply) || reply.magic != EXECHELP_DELEGATE_MAGIC)
+  {
+    if (got >= 0)
+      errno = EPROTO;
+  }
+  else if (reply.error)
+    errno = reply.error;
+  else if (fd < 0)
+    errno = EPROTO;
+  else
+  {
+    if (pid)
+      *pid = reply.pid;
+    close(sock);
+    free(current_dir);
+    return fd;
+  }
+
+  if (fd >= 0)
+    close(fd);
+  fd = -1;
+
+out:
+  {
+    int saved_errno = errno;
+    if (sock >= 0)
+      close(sock);
+    free(current_dir);
+    errno = saved_errno;
+  }
+  return fd;
+}
+
+/**
+ * @fn exechelp_delegate_listen
+ * @brief Creates the socket of a delegation daemon, replacing a stale one.
+ * The socket is only accessible to the current user.
+ *
+ * @param socket_path: the path of the socket
+ * @return a listening socket, or -1 with errno set
+ */
+int exechelp_delegate_listen(const char *socket_path)
+{
+  struct sockaddr_un addr;
+
+  if (exechelp_delegate_address(socket_path, &addr) != 0)
+    return -1;
+
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0)
+    return -1;
+
+  unlink(socket_path);
+  mode_t mask = umask(077);
+  int ret = bind(sock, (struct sockaddr *) &addr, sizeof(addr));
+  umask(mask);
+
+  if (ret != 0 || listen(sock, SOMAXCONN) != 0)
+  {
+    int saved_errno = errno;
+    close(sock);
+    errno = saved_errno;
+    return -1;
+  }
+
+  return sock;
+}
+
+/**
+ * @fn exechelp_delegate_receive
+ * @brief Reads a delegation request from a connection
+ *
+ * @param conn: a connection accepted on the daemon's socket
+ * @param cwd: set to the full path of the directory of the app
+ * @param home: set to the HOME of the app, empty if it has none
+ * @param target: set to the full path of the binary to be executed
+ * @param argv: set to the arguments of the execution, a vector to be freed
+ * with a single free() which also holds cwd, home and target
+ * @return 0 on success, or -1 with errno set on a malformed request
+ */
+int exechelp_delegate_receive(int conn, char **cwd, char **home, char **target, char ***argv)
+{
+  ExecHelpDelegateRequest request;
+  char **vector, *strings, *iter, *end, *home_start, *target_start;
+  uint32_t i;
+
+  *cwd = NULL;
+  *home = NULL;
+  *target = NULL;
+  *argv = NULL;
+
+  if (exechelp_delegate_read_all(conn, &request, sizeof(request)) != 0)
+    return -1;
+
+  /* Every string takes at least its '\0', so nargs is bounded by size */
+  if (request.magic != EXECHELP_DELEGATE_MAGIC || request.size < 3 ||
+      request.size > EXECHELP_DELEGATE_MAX_SIZE || request.nargs >= request.size - 2)
+  {
+    errno = EPROTO;
+    return -1;
+  }
+
+  vector = malloc(sizeof(char *) * (request.nargs + 1) + request.size);
+  if (!vector)
+    return -1;
+  strings = (char *) (vector + request.nargs + 1);
+
+  if (exechelp_delegate_read_all(conn, strings, request.size) != 0)
+  {
+    free(vector);
+    return -1;
+  }
+
+  end = strings + request.size;
+  iter = memchr(strings, '\0', request.size);
+  home_start = iter ? iter + 1 : NULL;
+  iter = home_start && home_start < end ? memchr(home_start, '\0', end - home_start) : NULL;
+  target_start = iter ? iter + 1 : NULL;
+  iter = target_start && target_start < end ? memchr(target_start, '\0', end - target_start) : NULL;
+  for (i = 0; iter && i < request.nargs; ++i)
+  {
+    vector[i] = ++iter;
+    iter = iter < end ? memchr(iter, '\0', end - iter) : NULL;
+  }
+
+  if (!iter || iter + 1 != end || strings[0] != '/' || target_start[0] != '/')
+  {
+    free(vector);
+    errno = EPROTO;
+    return -1;
+  }
+
+  vector[request.nargs] = NULL;
+  *cwd = strings;
+  *home = home_start;
+  *target = target_start;
+  *argv = vector;
+  return 0;
+}
+
+/**
+ * @fn exechelp_delegate_check
+ * @brief Checks that a request is one the policy delegates, as the daemon
+ * must not run on behalf of an app what the app could run itself, nor what
+ * the policy forbids
+ *
+ * @param policy: the policy to enforce
+ * @param cwd: the directory of the app, as received
+ * @param home: the HOME of the app, as received
+ * @param target: the full path of the binary to be executed
+ * @param argv: the arguments of the execution
+ * @return 0 if the execution is delegated, or -1 with errno set to EPERM
+ */
+int exechelp_delegate_check(ExecHelpPolicy *policy, const char *cwd, const char *home,
+                            const char *target, char *const argv[])
+{
+  ExecHelpCheckRequest request = { cwd, target, argv, home };
+  ExecHelpVerdict verdict;
+
+  if (exechelp_check_batch(policy, &request, 1, &verdict) != 0 || verdict != EXECHELP_VERDICT_DELEGATE)
+  {
+    errno = EPERM;
+    return -1;
+  }
+
+  return 0;
+}
+
+static int exechelp_delegate_pidfd_open(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+  return syscall(SYS_pidfd_open, pid, 0);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+/**
+ * @fn exechelp_delegate_spawn
+ * @brief Starts a delegated execution on behalf of an app
+ *
+ * @param cwd: the directory to execute target in, or NULL for the current one
+ * @param target: the full path of the binary to be executed
+ * @param argv: the arguments of the execution
+ * @param envp: the environment of the execution
+ * @param pid: set to the pid of the new process
+ * @param exit_fd: set to -1 if a pidfd is returned or pid is already reaped,
+ * or else to the write end of the returned pipe, which the caller must close
+ * once it has reaped pid
+ * @return a file descriptor that becomes readable when the new process exits,
+ * or -1 with errno set to the reason why target could not be executed
+ */
+int exechelp_delegate_spawn(const char *cwd, const char *target, char *const argv[],
+                            char *const envp[], pid_t *pid, int *exit_fd)
+{
+  int status[2], completion[2] = { -1, -1 }, error = 0;
+  ssize_t got;
+
+  *exit_fd = -1;
+
+  /* The child reports a failed exec through a close-on-exec pipe */
+  if (pipe2(status, O_CLOEXEC) != 0)
+    return -1;
+
+  *pid = fork();
+  if (*pid < 0)
+  {
+    close(status[0]);
+    close(status[1]);
+    return -1;
+  }
+
+  if (*pid == 0)
+  {
+    /* Daemons often block signals to handle them with a signalfd */
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    /* The daemon may be linked with or preloaded with ExecHelper, whose
+     * execve would delegate the execution again */
+    typeof(execve) *original_execve = dlsym(RTLD_NEXT, "execve");
+
+    close(status[0]);
+    if (cwd && chdir(cwd) != 0)
+      error = errno;
+    else if (original_execve)
+    {
+      (*original_execve)(target, argv, envp);
+      error = errno;
+    }
+    else
+      error = ENOSYS;
+    if (write(status[1], &error, sizeof(error)) != sizeof(error))
+      _exit(126);
+    _exit(127);
+  }
+
+  close(status[1]);
+  do
+    got = read(status[0], &error, sizeof(error));
+  while (got < 0 && errno == EINTR);
+  close(status[0]);
+
+  if (got == sizeof(error))
+  {
+    /* The child has exited or is about to, and is left for the caller to reap */
+    errno = error;
+    return -1;
+  }
+
+  int fd = exechelp_delegate_pidfd_open(*pid);
+  if (fd >= 0)
+    return fd;
+  int reaped = errno == ESRCH;
+
+  if (pipe2(completion, O_CLOEXEC) != 0)
+    return -1;
+
+  /* A process that exits at once may already be reaped, e.g. by a daemon
+   * that ignores SIGCHLD, in which case its handle is readable right away */
+  if (reaped)
+    close(completion[1]);
+  else
+    *exit_fd = completion[1];
+  return completion[0];
+}
+
+/**
+ * @fn exechelp_delegate_reply
+ * @brief Answers a delegation request
+ *
+ * @param conn: the connection the request was read from
+ * @param error: the errno of the failed execution, or 0
+ * @param pid: the pid of the delegated process
+ * @param fd: the descriptor to send when error is 0
+ * @return 0 on success, or -1 with errno set
+ */
+int exechelp_delegate_reply(int conn, int error, pid_t pid, int fd)
+{
+  ExecHelpDelegateReply reply = { EXECHELP_DELEGATE_MAGIC, error, error ? 0 : pid };
+  char control[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = { &reply, sizeof(reply) };
+  struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+  ssize_t sent;
+
+  if (!error)
+  {
+    memset(control, 0, sizeof(control));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+
+  do
+    sent = sendmsg(conn, &msg, MSG_NOSIGNAL);
+  while (sent < 0 && errno == EINTR);
+
+  if (sent != sizeof(reply))
+  {
+    if (sent >= 0)
+      errno = EPIPE;
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,350 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/auxv.h>
+
+#include "common.h"
+#include "env.h"
+
+#define PRELOAD_PREFIX       EXECHELP_ENV_PRELOAD "="
+#define PRELOAD_PREFIX_LEN   (sizeof(PRELOAD_PREFIX) - 1)
+#define ASSOC_PREFIX         EXECHELP_ENV_ASSOCIATIONS "="
+#define ASSOC_PREFIX_LEN     (sizeof(ASSOC_PREFIX) - 1)
+
+/* What is known of the last envp given to exechelp_env_build. The strings of
+ * environ are only read when its pointer array differs from the snapshot, so
+ * an unchanged environ is neither scanned nor parsed again: setenv, putenv
+ * and unsetenv replace or move pointers rather than the strings they point
+ * to, and glibc never frees the strings setenv made. Other vectors are
+ * indexed on every call, as their strings may have been freed and others
+ * allocated at the same addresses.
+ */
+typedef struct _ExecHelpEnvIndex {
+  char   **snapshot;       /* copy of the pointer array that was indexed */
+  size_t   len;            /* entries in snapshot, without the final NULL */
+  size_t   capacity;
+  size_t  *rewritten;      /* ascending ENV_ENTRY()s of the entries we replace */
+  size_t   n_rewritten;
+  size_t   preload;        /* index of the first LD_PRELOAD entry, or len */
+  size_t   preload_last;   /* index of the last one, which the linker uses */
+  size_t   associations;   /* index of the first associations entry, or len */
+  char    *preload_lib;    /* library the preload entry was computed for */
+  char    *preload_entry;  /* LD_PRELOAD entry to use, NULL to keep envp's */
+} ExecHelpEnvIndex;
+
+#define ENV_ENTRY(index, is_preload)  (((index) << 1) | (is_preload))
+#define ENV_ENTRY_INDEX(entry)        ((entry) >> 1)
+#define ENV_ENTRY_IS_PRELOAD(entry)   ((entry) & 1)
+
+static ExecHelpEnvIndex index_cache;
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @fn exechelp_env_index_matches
+ * @brief Tells whether envp is the pointer array that was last indexed,
+ * without reading any of its strings
+ */
+static int exechelp_env_index_matches(ExecHelpEnvIndex *index, char *const envp[])
+{
+  size_t i;
+
+  if (!index->snapshot)
+    return 0;
+
+  for (i = 0; i < index->len; ++i)
+    if (envp[i] != index->snapshot[i])
+      return 0;
+
+  return envp[i] == NULL;
+}
+
+/**
+ * @fn exechelp_env_preload_has_lib
+ * @brief Tells whether a LD_PRELOAD value lists a library, whose entries the
+ * dynamic linker separates with colons or spaces
+ */
+static int exechelp_env_preload_has_lib(const char *value, const char *lib)
+{
+  size_t lib_len = strlen(lib);
+
+  while (value && *value)
+  {
+    size_t len = strcspn(value, ": ");
+
+    if (len == lib_len && strncmp(value, lib, len) == 0)
+      return 1;
+
+    value += len;
+    value += strspn(value, ": ");
+  }
+
+  return 0;
+}
+
+/**
+ * @fn exechelp_env_index_preload
+ * @brief Computes the LD_PRELOAD entry children must get for lib to be
+ * preloaded in them, before any library the app itself preloads. The dynamic
+ * linker reads every LD_PRELOAD entry and keeps the last one, so that is the
+ * one the app meant.
+ *
+ * @return 0 on success, -1 if memory could not be allocated
+ */
+static int exechelp_env_index_preload(ExecHelpEnvIndex *index, const char *lib)
+{
+  const char *value = NULL;
+
+  free(index->preload_lib);
+  free(index->preload_entry);
+  index->preload_lib = NULL;
+  index->preload_entry = NULL;
+
+  if (!lib || !lib[0])
+    return 0;
+
+  if (index->preload < index->len)
+    value = index->snapshot[index->preload_last] + PRELOAD_PREFIX_LEN;
+
+  if (!exechelp_env_preload_has_lib(value, lib) &&
+      asprintf(&index->preload_entry, "%s%s%s%s", PRELOAD_PREFIX, lib,
+               (value && value[0] ? ":" : ""), (value ? value : "")) < 0)
+  {
+    index->preload_entry = NULL;
+    return -1;
+  }
+
+  index->preload_lib = strdup(lib);
+  if (!index->preload_lib)
+  {
+    free(index->preload_entry);
+    index->preload_entry = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * @fn exechelp_env_index_build
+ * @brief Indexes envp: copies its pointer array and finds the entries that
+ * children get rewritten
+ *
+ * @return 0 on success, -1 if memory could not be allocated
+ */
+static int exechelp_env_index_build(ExecHelpEnvIndex *index, char *const envp[], const char *lib)
+{
+  size_t len = 0, i;
+
+  while (envp[len])
+    ++len;
+
+  if (len + 1 > index->capacity || !index->snapshot)
+  {
+    char **snapshot = realloc(index->snapshot, sizeof(char *) * (len + 1));
+    size_t *rewritten = realloc(index->rewritten, sizeof(size_t) * (len + 1));
+
+    if (snapshot)
+      index->snapshot = snapshot;
+    if (rewritten)
+      index->rewritten = rewritten;
+    if (!snapshot || !rewritten)
+      goto fail;
+
+    index->capacity = len + 1;
+  }
+
+  memcpy(index->snapshot, envp, sizeof(char *) * (len + 1));
+  index->len = len;
+  index->n_rewritten = 0;
+  index->preload = len;
+  index->preload_last = len;
+  index->associations = len;
+
+  for (i = 0; i < len; ++i)
+  {
+    if (strncmp(envp[i], PRELOAD_PREFIX, PRELOAD_PREFIX_LEN) == 0)
+    {
+      if (index->preload == len)
+        index->preload = i;
+      index->preload_last = i;
+      index->rewritten[index->n_rewritten++] = ENV_ENTRY(i, 1);
+    }
+    else if (strncmp(envp[i], ASSOC_PREFIX, ASSOC_PREFIX_LEN) == 0)
+    {
+      if (index->associations == len)
+        index->associations = i;
+      index->rewritten[index->n_rewritten++] = ENV_ENTRY(i, 0);
+    }
+  }
+
+  if (exechelp_env_index_preload(index, lib) == 0)
+    return 0;
+
+  fail:
+  /* Forget envp entirely so the next call indexes it again */
+  free(index->snapshot);
+  index->snapshot = NULL;
+  index->capacity = 0;
+  index->len = 0;
+  return -1;
+}
+
+/**
+ * @fn exechelp_env_build
+ * @brief Builds the environment of a child from the environment given to an
+ * exec function. LD_PRELOAD is fixed so that it lists preload, and the
+ * binary associations variable is set to associations, or removed if the
+ * child has none. Every other entry is passed on as is, in the same order.
+ *
+ * The caller's strings are shared rather than copied. The index of environ
+ * is kept while its pointers do not change, so building the environment of a
+ * process that did not change it only costs comparing and copying them.
+ * @param envp: the environment forwarded to exec, NULL being an empty one
+ * @param preload: the library children must preload, or NULL to leave
+ * LD_PRELOAD untouched
+ * @param associations: the associations of the child, or NULL
+ * @return a NULL-terminated vector to be freed with a single free(), or NULL
+ * with errno set on error
+ */
+char **exechelp_env_build(char *const envp[], const char *preload, const char *associations)
+{
+  static char *const empty[] = { NULL };
+  ExecHelpEnvIndex *index = &index_cache;
+  char **result = NULL;
+
+  if (!envp)
+    envp = empty;
+
+  pthread_mutex_lock(&index_lock);
+
+  if (envp != environ || !exechelp_env_index_matches(index, envp))
+  {
+    if (exechelp_env_index_build(index, envp, preload) != 0)
+      goto out;
+  }
+  else if ((preload == NULL) != (index->preload_lib == NULL) ||
+           (preload && strcmp(preload, index->preload_lib) != 0))
+  {
+    if (exechelp_env_index_preload(index, preload) != 0)
+      goto out;
+  }
+
+  size_t preload_len = index->preload_entry ? strlen(index->preload_entry) + 1 : 0;
+  size_t assoc_len = associations ? ASSOC_PREFIX_LEN + strlen(associations) + 1 : 0;
+  size_t slots = index->len + 3;
+
+  result = malloc(sizeof(char *) * slots + preload_len + assoc_len);
+  if (!result)
+    goto out;
+
+  char *strings = (char *) (result + slots);
+  char *preload_entry = NULL, *assoc_entry = NULL;
+
+  if (preload_len)
+  {
+    preload_entry = memcpy(strings, index->preload_entry, preload_len);
+    strings += preload_len;
+  }
+  if (assoc_len)
+  {
+    assoc_entry = strings;
+    memcpy(assoc_entry, ASSOC_PREFIX, ASSOC_PREFIX_LEN);
+    memcpy(assoc_entry + ASSOC_PREFIX_LEN, associations, assoc_len - ASSOC_PREFIX_LEN);
+  }
+
+  /* Entries between rewritten ones are copied in runs. When LD_PRELOAD is
+   * enforced, the first entry is replaced and the others are dropped, and so
+   * are the associations entries */
+  size_t from = 0, n = 0, r;
+  for (r = 0; r <= index->n_rewritten; ++r)
+  {
+    size_t to = r < index->n_rewritten ? ENV_ENTRY_INDEX(index->rewritten[r]) : index->len;
+
+    memcpy(result + n, envp + from, sizeof(char *) * (to - from));
+    n += to - from;
+
+    if (to == index->len)
+      break;
+
+    if (ENV_ENTRY_IS_PRELOAD(index->rewritten[r]))
+    {
+      if (!index->preload_lib)
+        result[n++] = envp[to];
+      else if (to == index->preload)
+        result[n++] = preload_entry ? preload_entry : envp[index->preload_last];
+    }
+    else if (to == index->associations && assoc_entry)
+      result[n++] = assoc_entry;
+
+    from = to + 1;
+  }
+
+  if (index->preload == index->len && preload_entry)
+    result[n++] = preload_entry;
+  if (index->associations == index->len && assoc_entry)
+    result[n++] = assoc_entry;
+  result[n] = NULL;
+
+  out:
+  pthread_mutex_unlock(&index_lock);
+  return result;
+}
+
+static char *preload_path = NULL;
+
+static void exechelp_env_find_preload_path(void)
+{
+  Dl_info self, program;
+
+  if (!dladdr((void *) exechelp_env_find_preload_path, &self) || !self.dli_fname ||
+      !self.dli_fname[0])
+    return;
+
+  /* The object holding the program headers of the process is the program */
+  if (dladdr((void *) getauxval(AT_PHDR), &program) && program.dli_fbase == self.dli_fbase)
+    return;
+
+  if (self.dli_fname[0] == '/')
+    preload_path = strdup(self.dli_fname);
+  else
+    preload_path = realpath(self.dli_fname, NULL);
+}
+
+/**
+ * @fn exechelp_env_preload_path
+ * @brief Finds the path under which the dynamic linker loaded ExecHelper, so
+ * that children can be made to preload it too
+ *
+ * @return the path of the library, or NULL if ExecHelper is not running as a
+ * library, e.g. when built into a test program
+ */
+const char *exechelp_env_preload_path(void)
+{
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+  pthread_once(&once, exechelp_env_find_preload_path);
+  return preload_path;
+}
@@ -0,0 +1,68 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __EH_COALESCE_H__
+#define __EH_COALESCE_H__
+
+#include <stdint.h>
+
+/* Coalescing of delegated executions. When an app delegates many executions
+ * of the same binary at once, e.g. a file manager opening 50 selected files,
+ * the first delegating process becomes the leader of a batch and waits for
+ * the coalescing window to close, while the others append their file
+ * arguments to the batch and return at once. The leader then delegates one
+ * execution of the binary with its own arguments followed by the file
+ * arguments of every member, and the sandbox launches a single instance that
+ * opens them all.
+ *
+ * Only executions that differ by their file arguments alone are coalesced: a
+ * batch is keyed by the target, the working directory and the arguments that
+ * are not files, in order. File arguments are those that do not start with
+ * '-' and either contain a '/' or name an existing file. They are written to
+ * the batch in canonical form, and each file is only delegated once. Members'
+ * environments are dropped: the batch runs with the leader's.
+ *
+ * Batches live in a spool directory private to the user, one file per key,
+ * locked with flock():
+ *
+ *   uint32 magic, uint32 key length, int32 leader pid, uint32 nargs,
+ *   int64 deadline (CLOCK_MONOTONIC, in ns),
+ *   target\0 cwd\0 non-file arg\0 ... non-file arg\0
+ *   file arg\0 ... file arg\0
+ *
+ * An empty file is a closed batch. A batch whose leader died is taken over by
+ * the next member.
+ */
+#define EXECHELP_COALESCE_MAGIC        0x32424845  /* "EHB2" */
+#define EXECHELP_COALESCE_MAX_WINDOW   2000        /* ms */
+/* Batches whose deadline is this far behind are abandoned, see above */
+#define EXECHELP_COALESCE_GRACE        1000        /* ms */
+
+typedef struct _ExecHelpBatchHeader {
+  uint32_t magic;
+  uint32_t key_len;     /* including the final '\0' */
+  int32_t  leader;
+  uint32_t nargs;
+  int64_t  deadline;
+} ExecHelpBatchHeader;
+
+char *exechelp_coalesce_default_dir(void);
+int exechelp_coalesce_delegation(const char *spool, long window_ms, const char *target,
+                                 char *const argv[], char ***batch_argv);
+
+#endif /* __EH_COALESCE_H__ */
@@ -0,0 +1,214 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __EH_COMPILED_H__
+#define __EH_COMPILED_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* Compiled policy, written by exechelper-compile and mapped by the indexed
+ * decision engine instead of indexing the policy lists in every process.
+ *
+ * The file holds a header followed by, for each list, the deduplicated lines
+ * sorted in a NUL-separated string pool, an entry per line, an open
+ * addressing table of entry indexes (0 for an empty slot) and the distinct
+ * line lengths in ascending order. Hashes are djb hashes like those of
+ * exechelp_str_hash, so that the hash of every prefix of a path is obtained
+ * in a single pass over it. All offsets are relative to the start of the
+ * file and aligned on 8 bytes. The file is in host byte order.
+ *
+ * The header records the mtime, size and inode of each list file it was
+ * compiled from; a list whose file does not match is loaded from the file
+ * as if there was no compiled policy.
+ *
+ * It also records how much of the file the index covers. Lines appended to
+ * a list after it was compiled can be published without compiling it again:
+ * exechelp_compiled_append_source() records the new version of the file in
+ * the header, and processes index the lines after the indexed ones on their
+ * own. Once those lines are too many for that to be cheaper than mapping a
+ * compiled index, the list must be compiled again.
+ */
+#define EXECHELP_COMPILED_MAGIC           "EHC1"
+#define EXECHELP_COMPILED_VERSION         2
+
+/* Bytes that may be appended to a list of indexed_size bytes before it must
+ * be compiled again */
+#define EXECHELP_COMPILED_MAX_TAIL(indexed_size) \
+  ((indexed_size) / 8 > 4096 ? (indexed_size) / 8 : 4096)
+
+#define EXECHELP_COMPILED_HELPER_BINS     0
+#define EXECHELP_COMPILED_MANAGED_BINS    1
+#define EXECHELP_COMPILED_MANAGED_FILES   2
+#define EXECHELP_COMPILED_N_LISTS         3
+
+typedef struct _ExecHelpCompiledSource {
+  int64_t   mtime_sec;
+  int64_t   mtime_nsec;
+  int64_t   size;
+  uint64_t  ino;
+  int64_t   indexed_size;  /* lines after this offset are not in the index */
+} ExecHelpCompiledSource;
+
+typedef struct _ExecHelpCompiledListHeader {
+  ExecHelpCompiledSource source;
+  uint32_t  n_entries;
+  uint32_t  n_slots;       /* power of two */
+  uint32_t  n_lengths;
+  uint32_t  reserved;
+  uint64_t  strings_off;
+  uint64_t  strings_size;
+  uint64_t  entries_off;   /* ExecHelpCompiledEntry[n_entries] */
+  uint64_t  slots_off;     /* uint32_t[n_slots] */
+  uint64_t  lengths_off;   /* uint32_t[n_lengths] */
+} ExecHelpCompiledListHeader;
+
+typedef struct _ExecHelpCompiledHeader {
+  char      magic[4];
+  uint32_t  version;
+  uint64_t  size;
+  ExecHelpCompiledListHeader lists[EXECHELP_COMPILED_N_LISTS];
+} ExecHelpCompiledHeader;
+
+typedef struct _ExecHelpCompiledEntry {
+  uint32_t  hash;
+  uint32_t  offset;        /* in the string pool */
+  uint32_t  length;
+} ExecHelpCompiledEntry;
+
+/* Multi-profile snapshot, written by exechelper-compile -m for a directory
+ * holding one policy directory per profile (e.g. per sandbox name). The
+ * lines of all lists of all profiles are deduplicated into one string pool
+ * and one table of entries, indexed by one open addressing table like those
+ * of a compiled policy. Each list of each profile is a bitmap over the shared
+ * entries, with its own distinct line lengths.
+ *
+ * Profiles are sorted by name, their names are stored after the lines in the
+ * string pool. A profile's lists record the stat information of their files
+ * like the lists of a compiled policy.
+ */
+#define EXECHELP_SNAPSHOT_MAGIC           "EHS1"
+#define EXECHELP_SNAPSHOT_VERSION         2
+
+typedef struct _ExecHelpSnapshotList {
+  ExecHelpCompiledSource source;
+  uint32_t  n_entries;     /* bits set in the bitmap */
+  uint32_t  n_lengths;
+  uint64_t  bitmap_off;    /* uint64_t[bitmap_words] */
+  uint64_t  lengths_off;   /* uint32_t[n_lengths] */
+} ExecHelpSnapshotList;
+
+typedef struct _ExecHelpSnapshotProfile {
+  uint32_t  name_offset;   /* in the string pool */
+  uint32_t  name_length;
+  ExecHelpSnapshotList lists[EXECHELP_COMPILED_N_LISTS];
+} ExecHelpSnapshotProfile;
+
+typedef struct _ExecHelpSnapshotHeader {
+  char      magic[4];
+  uint32_t  version;
+  uint64_t  size;
+  uint32_t  n_profiles;
+  uint32_t  n_entries;
+  uint32_t  n_slots;       /* power of two */
+  uint32_t  bitmap_words;
+  uint64_t  strings_off;
+  uint64_t  strings_size;
+  uint64_t  entries_off;   /* ExecHelpCompiledEntry[n_entries] */
+  uint64_t  slots_off;     /* uint32_t[n_slots] */
+  uint64_t  profiles_off;  /* ExecHelpSnapshotProfile[n_profiles] */
+} ExecHelpSnapshotHeader;
+
+/* A list of a mapped compiled policy or of a profile of a snapshot */
+typedef struct _ExecHelpCompiledList {
+  const ExecHelpCompiledSource *source;
+  const ExecHelpCompiledEntry  *entries;
+  const uint32_t               *slots;
+  const uint32_t               *lengths;
+  const uint64_t               *bitmap;   /* entries of the list, NULL for all */
+  const char                   *strings;
+  uint64_t                      strings_size;
+  uint32_t                      n_entries;
+  uint32_t                      n_slots;
+  uint32_t                      n_lengths;
+} ExecHelpCompiledList;
+
+typedef struct _ExecHelpCompiledPolicy {
+  void                 *data;
+  size_t                size;
+  int                   mapped;   /* data is mmap'd rather than malloc'd */
+  struct timespec       mtime;
+  ino_t                 ino;
+  ExecHelpCompiledList  lists[EXECHELP_COMPILED_N_LISTS];
+} ExecHelpCompiledPolicy;
+
+static inline uint32_t exechelp_compiled_hash_step(uint32_t h, char c)
+{
+  return (h << 5) + h + (signed char) c;
+}
+#define EXECHELP_COMPILED_HASH_INIT 5381
+
+/* Loading (compiled.c, part of the library) */
+int exechelp_compiled_open(ExecHelpCompiledPolicy *compiled, const char *path);
+int exechelp_snapshot_open(ExecHelpCompiledPolicy *compiled, const char *path, const char *profile);
+int exechelp_snapshot_get_profile(const ExecHelpCompiledPolicy *snapshot, const char *profile,
+                                  ExecHelpCompiledList lists[EXECHELP_COMPILED_N_LISTS]);
+void exechelp_compiled_close(ExecHelpCompiledPolicy *compiled);
+int exechelp_compiled_source_matches(const ExecHelpCompiledList *list, const struct stat *sb);
+int exechelp_compiled_list_contains(const ExecHelpCompiledList *list, const char *line);
+int exechelp_compiled_list_has_prefix_of(const ExecHelpCompiledList *list, const char *path);
+
+/* Compilation (compile.c, not part of the library) */
+typedef struct _ExecHelpCompileStats {
+  size_t  lines;         /* lines read */
+  size_t  entries;       /* distinct lines kept */
+  size_t  duplicates;
+  size_t  warnings;
+  size_t  lengths;
+  size_t  slots;
+  size_t  bytes;         /* bytes of the list in the compiled policy */
+  long    build_ns;      /* time spent indexing the list */
+} ExecHelpCompileStats;
+
+int exechelp_compile_policy(const char *paths[EXECHELP_COMPILED_N_LISTS], const char *output,
+                            int threads, int strict, FILE *log,
+                            ExecHelpCompileStats stats[EXECHELP_COMPILED_N_LISTS]);
+int exechelp_compiled_append_source(const char *output, int index,
+                                    const struct stat *before, const struct stat *after);
+
+typedef struct _ExecHelpSnapshotStats {
+  size_t  profiles;
+  size_t  lines;          /* lines read, in all lists of all profiles */
+  size_t  list_entries;   /* distinct lines of each list, summed */
+  size_t  entries;        /* distinct lines shared by all lists */
+  size_t  warnings;
+  size_t  strings_bytes;  /* shared string pool, including profile names */
+  size_t  index_bytes;    /* shared entries and slots */
+  size_t  profile_bytes;  /* bitmaps and lengths of all profiles */
+  size_t  bytes;          /* whole snapshot */
+  long    build_ns;
+} ExecHelpSnapshotStats;
+
+int exechelp_compile_snapshot(const char *root, const char *output, int threads, int strict,
+                              FILE *log, ExecHelpSnapshotStats *stats);
+
+#endif /* __EH_COMPILED_H__ */
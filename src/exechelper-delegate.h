@@ -0,0 +1,86 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __EH_DELEGATE_H__
+#define __EH_DELEGATE_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "policy.h"
+
+/* Delegation channel. The fake exec used to notify the sandbox of a delegated
+ * execution (see exechelp_delegate_exec) tells the app nothing about the
+ * process that the sandbox starts. When EXECHELP_DELEGATE_SOCKET names the
+ * unix socket of a delegation daemon, executions are delegated to it instead,
+ * and the daemon replies with a file descriptor that becomes readable when
+ * the delegated process exits: a pidfd, or the read end of a pipe that the
+ * daemon closes once it has reaped the process on kernels without pidfds.
+ *
+ * The exec call still fails with EACCES, and the app can then claim the file
+ * descriptor with exechelp_last_delegation_fd(), which it finds with
+ * dlsym(RTLD_DEFAULT, ...) as the library is preloaded. The process is not a
+ * child of the app, so the descriptor can be polled but not waited for.
+ *
+ * Requests and replies are sent over a SOCK_STREAM connection, one request
+ * per connection. A request carries the working directory of the app, which
+ * relative arguments are resolved against, and its HOME, which '~/'
+ * arguments are expanded against (empty if it has none). The daemon checks
+ * the request against the policy with both, refuses it with EPERM unless
+ * the policy delegates it (see exechelp_delegate_check), and starts the
+ * process in that directory. The delegated process gets the environment of
+ * the daemon.
+ *
+ *   request: ExecHelpDelegateRequest, then cwd\0 home\0 target\0 arg\0 ... arg\0
+ *   reply:   ExecHelpDelegateReply, with the descriptor attached as
+ *            SCM_RIGHTS when error is 0
+ *
+ * When the daemon cannot be reached, the fake exec is used as before.
+ */
+#define EXECHELP_DELEGATE_MAGIC        0x32444845  /* "EHD2" */
+#define EXECHELP_DELEGATE_MAX_SIZE     (8 << 20)   /* bytes of cwd, home, target and args */
+/* Time after which the app gives up on the daemon and falls back */
+#define EXECHELP_DELEGATE_TIMEOUT      5000        /* ms */
+
+typedef struct _ExecHelpDelegateRequest {
+  uint32_t magic;
+  uint32_t nargs;
+  uint32_t size;
+} ExecHelpDelegateRequest;
+
+typedef struct _ExecHelpDelegateReply {
+  uint32_t magic;
+  int32_t  error;  /* errno of the failed spawn, or 0 */
+  int32_t  pid;    /* in the namespace of the daemon */
+} ExecHelpDelegateReply;
+
+/* App side */
+int exechelp_delegate_request(const char *socket_path, const char *cwd, const char *home,
+                              const char *target, char *const argv[], pid_t *pid);
+int exechelp_last_delegation_fd(void);
+
+/* Daemon side */
+int exechelp_delegate_listen(const char *socket_path);
+int exechelp_delegate_receive(int conn, char **cwd, char **home, char **target, char ***argv);
+int exechelp_delegate_check(ExecHelpPolicy *policy, const char *cwd, const char *home,
+                            const char *target, char *const argv[]);
+int exechelp_delegate_spawn(const char *cwd, const char *target, char *const argv[],
+                            char *const envp[], pid_t *pid, int *exit_fd);
+int exechelp_delegate_reply(int conn, int error, pid_t pid, int fd);
+
+#endif /* __EH_DELEGATE_H__ */
@@ -0,0 +1,37 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __EH_ENV_H__
+#define __EH_ENV_H__
+
+/* Environment of the children of sandboxed processes. The environment given
+ * to an allowed exec is rewritten so that the child is still preloaded with
+ * ExecHelper and carries the binary associations of its own binary, e.g.:
+ *
+ *   LD_PRELOAD=/usr/lib/libExecHelper.so:<whatever the app had>
+ *   FIREJAIL_ASSOCIATIONS=<associations of the target, if any>
+ *
+ * The vector handed to exec shares its strings with the caller's envp; only
+ * the pointer array and the rewritten variables are new.
+ */
+#define EXECHELP_ENV_PRELOAD              "LD_PRELOAD"
+
+char **exechelp_env_build(char *const envp[], const char *preload, const char *associations);
+const char *exechelp_env_preload_path(void);
+
+#endif /* __EH_ENV_H__ */
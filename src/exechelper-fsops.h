@@ -0,0 +1,81 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __EH_FSOPS_H__
+#define __EH_FSOPS_H__
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/* Filesystem operations used by the decision pipeline. The library always
+ * uses the real filesystem, but tests, benchmarks and tools can swap in
+ * another backend, such as the in-memory tree below, to run the pipeline
+ * deterministically and measure its CPU cost in isolation.
+ */
+typedef struct _ExecHelpFsOps {
+  void     *data;
+  int     (*stat)(void *data, const char *path, struct stat *sb);
+  int     (*lstat)(void *data, const char *path, struct stat *sb);
+  ssize_t (*readlink)(void *data, const char *path, char *buf, size_t size);
+  int     (*access)(void *data, const char *path, int mode);
+  char   *(*getcwd)(void *data, char *buf, size_t size);
+  int     (*open)(void *data, const char *path, int flags);
+  ssize_t (*read)(void *data, int fd, void *buf, size_t count);
+  off_t   (*lseek)(void *data, int fd, off_t offset, int whence);
+  int     (*close)(void *data, int fd);
+} ExecHelpFsOps;
+
+extern const ExecHelpFsOps exechelp_fs_real;
+extern const ExecHelpFsOps *exechelp_fs;
+
+void exechelp_fs_set_ops(const ExecHelpFsOps *ops);
+char *exechelp_fs_read_file(const char *path, size_t *size);
+char *exechelp_fs_read_file_at(const char *path, off_t offset, size_t *size);
+
+#define exechelp_fs_stat(path, sb)          (exechelp_fs->stat(exechelp_fs->data, (path), (sb)))
+#define exechelp_fs_lstat(path, sb)         (exechelp_fs->lstat(exechelp_fs->data, (path), (sb)))
+#define exechelp_fs_readlink(path, b, s)    (exechelp_fs->readlink(exechelp_fs->data, (path), (b), (s)))
+#define exechelp_fs_access(path, mode)      (exechelp_fs->access(exechelp_fs->data, (path), (mode)))
+#define exechelp_fs_getcwd(buf, size)       (exechelp_fs->getcwd(exechelp_fs->data, (buf), (size)))
+#define exechelp_fs_open(path, flags)       (exechelp_fs->open(exechelp_fs->data, (path), (flags)))
+#define exechelp_fs_read(fd, buf, count)    (exechelp_fs->read(exechelp_fs->data, (fd), (buf), (count)))
+#define exechelp_fs_lseek(fd, off, whence)  (exechelp_fs->lseek(exechelp_fs->data, (fd), (off), (whence)))
+#define exechelp_fs_close(fd)               (exechelp_fs->close(exechelp_fs->data, (fd)))
+
+/* In-memory backend (fsops-memory.c, not part of the library). Paths given
+ * to the constructors must be absolute, and parent directories must exist.
+ * The working directory must be given as a canonical path.
+ * Every operation can be slowed down by an injected latency, to model slow
+ * or networked filesystems.
+ */
+typedef struct _ExecHelpFsMemory ExecHelpFsMemory;
+
+ExecHelpFsMemory *exechelp_fs_memory_new(void);
+void exechelp_fs_memory_free(ExecHelpFsMemory *fs);
+const ExecHelpFsOps *exechelp_fs_memory_get_ops(ExecHelpFsMemory *fs);
+
+int exechelp_fs_memory_add_dir(ExecHelpFsMemory *fs, const char *path, mode_t mode);
+int exechelp_fs_memory_add_file(ExecHelpFsMemory *fs, const char *path, mode_t mode, const char *contents);
+int exechelp_fs_memory_add_symlink(ExecHelpFsMemory *fs, const char *path, const char *target);
+int exechelp_fs_memory_chdir(ExecHelpFsMemory *fs, const char *path);
+void exechelp_fs_memory_set_latency(ExecHelpFsMemory *fs, long latency_ns);
+unsigned long exechelp_fs_memory_get_op_count(ExecHelpFsMemory *fs);
+int exechelp_fs_memory_load(ExecHelpFsMemory *fs, const char *spec_path);
+
+#endif /* __EH_FSOPS_H__ */
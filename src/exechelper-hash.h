@@ -25,6 +25,8 @@
 #ifndef __EH_HASH_H__
 #define __EH_HASH_H__
 
+#include <stddef.h>
+
 #include "list.h"
 
 typedef struct _ExecHelpHashTable ExecHelpHashTable;
@@ -76,6 +78,12 @@ void exechelp_hash_table_iter_steal (ExecHelpHashTableIter *iter);
 ExecHelpHashTable* exechelp_hash_table_ref (ExecHelpHashTable *hash_table);
 void exechelp_hash_table_unref (ExecHelpHashTable *hash_table);
 
+/* Flat images of tables with string keys and values, served read-only
+ */
+void * exechelp_hash_table_serialize (ExecHelpHashTable *hash_table, size_t *size);
+ExecHelpHashTable* exechelp_hash_table_new_from_image (const void * image, size_t size);
+ExecHelpHashTable* exechelp_hash_table_map_image (const char *path);
+
 /* Hash Functions
  */
 int exechelp_str_equal (const void * v1, const void * v2);
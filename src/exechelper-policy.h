@@ -0,0 +1,101 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __EH_POLICY_H__
+#define __EH_POLICY_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "common.h"
+#include "compiled.h"
+
+/* Outcome of an exec decision */
+typedef enum _ExecHelpVerdict {
+  EXECHELP_VERDICT_DENY = 0,      /* invalid request, fail with EACCES */
+  EXECHELP_VERDICT_DELEGATE = 1,  /* let the sandbox helper run it */
+  EXECHELP_VERDICT_ALLOW = 2      /* run it in the current sandbox */
+} ExecHelpVerdict;
+
+const char *exechelp_verdict_to_string(ExecHelpVerdict verdict);
+
+/* An indexed policy list. Lines are stored in a set, along with the distinct
+ * line lengths, so that the prefix match used for managed files only costs
+ * one lookup per distinct length instead of one comparison per line.
+ * When the policy has a compiled version of the list file, the list uses it
+ * rather than indexing the file itself.
+ */
+typedef struct _ExecHelpPolicyList {
+  const char                  *path;
+  char                        *contents;   /* list file with lines NUL-terminated */
+  ExecHelpHashTable           *lines;      /* set of lines, keys point to contents */
+  size_t                      *lengths;    /* distinct line lengths, ascending */
+  size_t                       n_lengths;
+  const ExecHelpCompiledList  *compiled;   /* if set, the above only index the lines
+                                              appended after the compiled ones */
+  struct _ExecHelpPolicy      *policy;
+  int                          compiled_index;
+  struct timespec              mtime;
+  off_t                        size;
+  ino_t                        ino;
+  int                          loaded;
+} ExecHelpPolicyList;
+
+typedef struct _ExecHelpPolicy {
+  ExecHelpExecutionPolicy pol;
+  ExecHelpPolicyList      helper_bins;
+  ExecHelpPolicyList      managed_bins;
+  ExecHelpPolicyList      managed_files;
+  const char             *compiled_path;
+  const char             *compiled_profile;  /* if compiled_path is a snapshot */
+  ExecHelpCompiledPolicy  compiled;
+} ExecHelpPolicy;
+
+ExecHelpPolicy *exechelp_policy_new(const char *helper_bins_path,
+                                    const char *managed_bins_path,
+                                    const char *managed_files_path);
+ExecHelpPolicy *exechelp_policy_get_default(void);
+void exechelp_policy_set_compiled(ExecHelpPolicy *policy, const char *compiled_path);
+void exechelp_policy_set_snapshot(ExecHelpPolicy *policy, const char *snapshot_path, const char *profile);
+void exechelp_policy_free(ExecHelpPolicy *policy);
+
+int exechelp_policy_list_refresh(ExecHelpPolicyList *list);
+int exechelp_policy_list_contains(ExecHelpPolicyList *list, const char *line);
+int exechelp_policy_list_has_prefix_of(ExecHelpPolicyList *list, char *path);
+
+int exechelp_policy_is_helper(ExecHelpPolicy *policy, const char *target);
+int exechelp_policy_is_managed_app(ExecHelpPolicy *policy, const char *target);
+int exechelp_policy_is_managed_file(ExecHelpPolicy *policy, char *real);
+ExecHelpVerdict exechelp_policy_decide(ExecHelpPolicy *policy, const char *target, char *const argv[]);
+
+/* An execution to decide on with exechelp_check_batch */
+typedef struct _ExecHelpCheckRequest {
+  const char   *cwd;     /* directory relative arguments are resolved against,
+                            or NULL for the current directory */
+  const char   *target;  /* as passed to exechelp_policy_decide */
+  char *const  *argv;
+  const char   *home;    /* HOME of the app, which '~/' arguments are expanded
+                            against, empty if it has none, or NULL for the
+                            HOME of the caller */
+} ExecHelpCheckRequest;
+
+int exechelp_check_batch(ExecHelpPolicy *policy, const ExecHelpCheckRequest *requests,
+                         size_t n_requests, ExecHelpVerdict *verdicts);
+
+#endif /* __EH_POLICY_H__ */
@@ -22,5 +22,13 @@
 
 char *exechelp_coreutils_areadlink_with_size(char const *file, size_t size);
 char *exechelp_coreutils_realpath (const char *fname);
+char *exechelp_coreutils_realpath_at (const char *dir, const char *fname);
+char *exechelp_coreutils_canonicalize_existing (const char *fname);
+
+/* Tells whether exechelp_coreutils_realpath failed because the name goes over
+ * the limits set in common.h, in which case it must be treated as managed.
+ * Arguments that exechelp_arg_exceeds_len_limit rejects are not paths, and
+ * must not be passed to the canonicalizer in the first place. */
+#define EXECHELP_REALPATH_OVER_LIMITS(err) ((err) == ELOOP || (err) == ENAMETOOLONG)
 
 #endif
@@ -0,0 +1,44 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __EH_SAMPLE_H__
+#define __EH_SAMPLE_H__
+
+/* Call-site sampling of exec calls. When EXECHELP_SAMPLE is set to N, one in
+ * N interposed exec calls records a backtrace of the code that made it.
+ * Samples are counted in memory by target and call site, and written to
+ * EXECHELP_SAMPLE_LOG (a file, or "stderr" by default) when the process exits
+ * or replaces itself with an allowed exec.
+ *
+ * Calls are sampled at random with a probability of 1/N, so that forked
+ * children that exec once are sampled as often as long-lived processes. As
+ * they exec or _exit right away, their samples are written as soon as they
+ * are taken, and the counts inherited from their parent are dropped.
+ *
+ * One line is written per call site, with frames given as offsets in their
+ * object, so that the lines of different processes can be added up by
+ * exechelper-hotspots:
+ *
+ *   samples\tperiod\ttarget\tobject(symbol+0xoff) object+0xoff ...\n
+ */
+#define EXECHELP_SAMPLE_DEPTH  8   /* frames recorded per sample */
+
+void exechelp_sample_exec(const char *target, const void *caller);
+void exechelp_sample_flush(void);
+
+#endif /* __EH_SAMPLE_H__ */
@@ -0,0 +1,67 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __EH_TRACE_H__
+#define __EH_TRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "policy.h"
+
+/* Exec traces are a sequence of self-delimited records, so that processes
+ * can append to the same trace concurrently with one write each:
+ *
+ *   uint32 magic, uint32 payload length,
+ *   uint8 verdict, uint8 reserved, uint16 argc, uint16 nenv, uint16 reserved,
+ *   cwd\0 target\0 argv[0]\0 ... argv[argc-1]\0 env[0]\0 ... env[nenv-1]\0
+ *
+ * Integers are in host byte order. Environment entries are NAME=value pairs
+ * for the variables the decision depends on.
+ */
+#define EXECHELP_TRACE_MAGIC        0x31524845  /* "EHR1" */
+#define EXECHELP_TRACE_HEADER_SIZE  16
+#define EXECHELP_TRACE_ENV          { "HOME", "PATH", NULL }
+
+typedef struct _ExecHelpTraceRecord {
+  ExecHelpVerdict  verdict;
+  const char      *cwd;
+  const char      *target;
+  int              argc;
+  char           **argv;  /* NULL-terminated */
+  int              nenv;
+  char           **env;   /* NULL-terminated */
+} ExecHelpTraceRecord;
+
+typedef struct _ExecHelpTraceReader {
+  const char  *data;
+  size_t       size;
+  size_t       offset;
+  char       **vec;
+  size_t       vec_len;
+} ExecHelpTraceReader;
+
+int exechelp_trace_open(const char *path);
+int exechelp_trace_write(int fd, const char *target, char *const argv[], ExecHelpVerdict verdict);
+
+int exechelp_trace_reader_open(ExecHelpTraceReader *reader, const char *path);
+int exechelp_trace_reader_next(ExecHelpTraceReader *reader, ExecHelpTraceRecord *record);
+void exechelp_trace_reader_rewind(ExecHelpTraceReader *reader);
+void exechelp_trace_reader_close(ExecHelpTraceReader *reader);
+
+#endif /* __EH_TRACE_H__ */
@@ -0,0 +1,76 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __EH_TRACK_H__
+#define __EH_TRACK_H__
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* Tracker of the files named by managed-files.list, used by exechelper-track.
+ * The directories that contain managed entries, and their ancestors, are
+ * watched with inotify. When an entry or one of its ancestors is renamed
+ * or moved within the watched directories, the new path is added to the
+ * list. New lines are appended to the published list in place, and recorded
+ * in the compiled policy if one is set, so that the cost of publishing them
+ * does not grow with the size of the list. The list is only rewritten and
+ * renamed over the published one when lines are removed.
+ *
+ * The tracker never makes the policy weaker on its own. The old path of a
+ * moved entry stays in the list, and so does a deleted entry: editors save
+ * by renaming a file to a backup and writing a new one, and a file may be
+ * deleted and created again. Such entries are only marked as gone.
+ * exechelp_tracker_rescan() removes those that still do not exist.
+ *
+ * Moves to a directory that is not watched cannot be followed, as inotify
+ * only reports where a file went when its new directory is watched. They
+ * are reported as lost, and a rescan is needed for those entries.
+ *
+ * The list may be edited while it is tracked. Changes made by someone else
+ * since the tracker last read or published it are merged before the tracker
+ * publishes it again, and when events are processed.
+ */
+typedef struct _ExecHelpTracker ExecHelpTracker;
+
+typedef struct _ExecHelpTrackStats {
+  size_t  entries;     /* entries of the list */
+  size_t  watches;     /* directories watched */
+  size_t  unwatched;   /* directories that could not be watched */
+  size_t  events;      /* inotify events read */
+  size_t  renamed;     /* entries added at the new path of a moved entry */
+  size_t  gone;        /* entries deleted or moved away, kept until a rescan */
+  size_t  pruned;      /* gone entries removed by rescans */
+  size_t  lost;        /* moves that could not be followed */
+  size_t  overflows;   /* times the kernel dropped events */
+  size_t  merges;      /* times changes made to the list by someone else were merged */
+  size_t  rewrites;    /* times the list was rewritten */
+  long    rewrite_ns;  /* time spent rewriting the list */
+  size_t  appends;     /* times new lines were appended to the list */
+  long    append_ns;   /* time spent appending to the list */
+  size_t  patched;     /* appends recorded in the compiled policy */
+} ExecHelpTrackStats;
+
+ExecHelpTracker *exechelp_tracker_new(const char *list_path, FILE *log);
+int exechelp_tracker_fd(ExecHelpTracker *tracker);
+int exechelp_tracker_set_compiled(ExecHelpTracker *tracker, const char *compiled_path);
+int exechelp_tracker_process(ExecHelpTracker *tracker);
+int exechelp_tracker_rescan(ExecHelpTracker *tracker);
+const ExecHelpTrackStats *exechelp_tracker_stats(ExecHelpTracker *tracker);
+void exechelp_tracker_free(ExecHelpTracker *tracker);
+
+#endif /* __EH_TRACK_H__ */
@@ -16,6 +16,9 @@
     along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#ifndef __EH_COMMON_H__
+#define __EH_COMMON_H__
+
 #include <stdio.h>
 #include "hash.h"
 #include "slist.h"
@@ -31,31 +34,76 @@
 #define DEBUG2(fmt, ...) \
     do { if (DEBUGLVL>1) fprintf(stderr, fmt, __VA_ARGS__); } while (0)
 
+/* The library is built with hidden visibility, only the interposed exec
+ * functions are exported */
+#define EXECHELP_EXPORT __attribute__((visibility("default")))
+
 /* Constants */
 #define EXECHELP_NULL_BINARY_PATH         "/dev/null"
 #define EXECHELP_MONITORED_EXEC_PATH      "/firejail/denied/"
 
-#define EXECHELP_HELPER_BINS_PATH         "/etc/firejail/self/helper-bins.list"
-#define EXECHELP_MANAGED_BINS_PATH        "/etc/firejail/self/managed-bins.list"
-#define EXECHELP_MANAGED_FILES_PATH       "/etc/firejail/self/managed-files.list"
+/* Tests and benchmarks build against the fixtures in data-test/ instead */
+#ifndef EXECHELP_POLICY_DIR
+#define EXECHELP_POLICY_DIR               "/etc/firejail/self/"
+#endif
+
+#define EXECHELP_HELPER_BINS_PATH         EXECHELP_POLICY_DIR "helper-bins.list"
+#define EXECHELP_MANAGED_BINS_PATH        EXECHELP_POLICY_DIR "managed-bins.list"
+#define EXECHELP_MANAGED_FILES_PATH       EXECHELP_POLICY_DIR "managed-files.list"
+/* Written by exechelper-compile, see compiled.h */
+#define EXECHELP_COMPILED_POLICY_PATH     EXECHELP_POLICY_DIR "policy.ehc"
 #define EXECHELP_FILE_SEPARATOR           "\n"
 #define EXECHELP_FILE_SEPARATOR_CHR       '\n'
 #define EXECHELP_LIST_SEPARATOR           ":"
 #define EXECHELP_LIST_SEPARATOR_LEN       1
 
+/* Limits on the work done for one decision, since argv is controlled by the
+ * sandboxed app. Executions that exceed them are delegated to the sandbox
+ * helper rather than checked. With these, an argument costs at most
+ * EXECHELP_MAX_PATH_COMPONENTS lstat calls per canonicalization pass.
+ * Arguments of EXECHELP_MAX_ARG_LEN bytes or more are the exception: the
+ * kernel refuses paths of PATH_MAX bytes or more, so they cannot name a
+ * managed file and are not checked at all.
+ */
+#define EXECHELP_MAX_ARGS                 1024
+#define EXECHELP_MAX_ARG_LEN              4096
+#define EXECHELP_MAX_SYMLINKS             40
+#define EXECHELP_MAX_PATH_COMPONENTS      256
+
 #define EXECHELP_ENV_ASSOCIATIONS         "FIREJAIL_ASSOCIATIONS"
 #define EXECHELP_ENV_SANDBOX_MANAGED      "FIREJAIL_SANDBOX_MANAGED"
 #define EXECHELP_ENV_SANDBOX_FILES        "FIREJAIL_SANDBOX_FILES"
 
+/* Decision engine to enforce: "legacy" (default) or "engine" */
+#define EXECHELP_ENV_ENGINE               "EXECHELP_ENGINE"
+/* Runs both decision engines and logs their verdicts to a file or "stderr" */
+#define EXECHELP_ENV_SHADOW               "EXECHELP_SHADOW"
+/* Appends every exec decision to an exec trace file, see trace.h */
+#define EXECHELP_ENV_RECORD               "EXECHELP_RECORD"
+/* Window in ms during which delegations of a binary are coalesced into one,
+ * and the spool directory holding the batches, see coalesce.h */
+#define EXECHELP_ENV_COALESCE             "EXECHELP_COALESCE"
+#define EXECHELP_ENV_COALESCE_DIR         "EXECHELP_COALESCE_DIR"
+/* Socket of the delegation daemon, which returns completion handles for the
+ * processes it starts, see delegate.h */
+#define EXECHELP_ENV_DELEGATE_SOCKET      "EXECHELP_DELEGATE_SOCKET"
+/* Samples the call sites of one in every N exec calls, and the file they are
+ * written to, or "stderr", see sample.h */
+#define EXECHELP_ENV_SAMPLE               "EXECHELP_SAMPLE"
+#define EXECHELP_ENV_SAMPLE_LOG           "EXECHELP_SAMPLE_LOG"
+
 extern char **environ;
 
 /* General utilities */
 char *exechelp_resolve_path(const char *target);
 char *exechelp_get_self_name();
+char *exechelp_fd_target(int fd);
 char *exechelp_read_list_from_file(const char *file_path);
 int exechelp_str_has_prefix(const char *str, const char *prefix);
 int exechelp_str_has_prefix_on_sep(const char *str, const char *prefix, const char sep);
 int exechelp_file_list_contains_path(const char *managed, const char *real);
+int exechelp_argv_exceeds_limits(char *const argv[]);
+int exechelp_arg_exceeds_len_limit(const char *arg);
 
 /* Execution policy */
 typedef enum _ExecHelpExecutionPolicy {
@@ -67,6 +115,10 @@ typedef enum _ExecHelpExecutionPolicy {
 } ExecHelpExecutionPolicy;
 #define EXECHELP_DEFAULT_POLICY           HELPERS | UNSPECIFIED
 
+int exechelp_filter_forbidden_exec(const char *target, char *const argv[], char *const envp[],
+                                   char **allowed_target, char **allowed_argv[],
+                                   char **forbidden_target, char **forbidden_argv[]);
+
 /* Binary association structure */
 typedef struct _ExecHelpBinaryAssociations {
   ExecHelpSList     *assoc;
@@ -76,8 +128,12 @@ typedef struct _ExecHelpBinaryAssociations {
 ExecHelpBinaryAssociations *exechelp_get_binary_associations();
 ExecHelpSList *exechelp_get_associations_for_main_binary(ExecHelpBinaryAssociations *assoc, const char *mainkey);
 int exechelp_is_associated_helper(const char *caller, const char *callee);
+/* Returned instead of an allocation for binaries without associations */
+extern const char exechelp_no_associations[];
 char *exechelp_extract_associations_for_binary(const char *receiving_binary);
 
 /* Memory functions */
 void *exechelp_malloc0(size_t size);
 void *exechelp_memdup (const void *mem, unsigned int byte_size);
+
+#endif /* __EH_COMMON_H__ */
@@ -0,0 +1,701 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* In-memory filesystem backend for tests, benchmarks and tools. It models
+ * directories, regular files and symlinks with owner permission bits (the
+ * caller is considered to own every node), and resolves paths the way the
+ * kernel does: symlinks are followed in every component but the last one of
+ * lstat and readlink, at most EXECHELP_FS_MEMORY_MAX_SYMLINKS times.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "fsops.h"
+
+#define EXECHELP_FS_MEMORY_MAX_SYMLINKS 40
+#define EXECHELP_FS_MEMORY_MAX_FDS      64
+#define EXECHELP_FS_MEMORY_FD_BASE      (1 << 20)
+
+typedef struct _ExecHelpFsNode ExecHelpFsNode;
+
+struct _ExecHelpFsNode {
+  mode_t             mode;
+  ino_t              ino;
+  struct timespec    mtime;
+  char              *contents;  /* file contents or symlink target */
+  size_t             size;
+  ExecHelpFsNode    *parent;
+  ExecHelpHashTable *children;  /* directories only */
+};
+
+typedef struct _ExecHelpFsMemoryFd {
+  ExecHelpFsNode *node;
+  size_t          offset;
+} ExecHelpFsMemoryFd;
+
+struct _ExecHelpFsMemory {
+  ExecHelpFsOps       ops;
+  ExecHelpFsNode     *root;
+  char               *cwd;
+  ino_t               next_ino;
+  long                latency_ns;
+  unsigned long       op_count;
+  ExecHelpFsMemoryFd  fds[EXECHELP_FS_MEMORY_MAX_FDS];
+};
+
+static void exechelp_fs_node_free(void *data)
+{
+  ExecHelpFsNode *node = data;
+
+  if (node->children)
+    exechelp_hash_table_destroy(node->children);
+  free(node->contents);
+  free(node);
+}
+
+static ExecHelpFsNode *exechelp_fs_node_new(ExecHelpFsMemory *fs, mode_t mode, const char *contents)
+{
+  ExecHelpFsNode *node = exechelp_malloc0(sizeof(ExecHelpFsNode));
+  if (!node)
+    return NULL;
+
+  node->mode = mode;
+  node->ino = fs->next_ino++;
+  clock_gettime(CLOCK_REALTIME, &node->mtime);
+
+  if (S_ISDIR(mode))
+    node->children = exechelp_hash_table_new_full(exechelp_str_hash, exechelp_str_equal, free, exechelp_fs_node_free);
+  else if (contents)
+  {
+    node->contents = strdup(contents);
+    node->size = strlen(contents);
+  }
+
+  return node;
+}
+
+/* Models the cost of a real filesystem operation */
+static void exechelp_fs_memory_op(ExecHelpFsMemory *fs)
+{
+  struct timespec start, now;
+
+  fs->op_count++;
+  if (fs->latency_ns <= 0)
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  do
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  while ((now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec) < fs->latency_ns);
+}
+
+/**
+ * @fn exechelp_fs_memory_walk
+ * @brief Finds the node a path points to
+ *
+ * @param fs: the filesystem
+ * @param path: an absolute or relative path
+ * @param follow_last: whether to follow a symlink in the last component
+ * @param check_perms: whether directories must be searchable
+ * @param parent: if not NULL, set to the directory containing the last
+ * component, even if that component does not exist
+ * @param last: if not NULL, set to a malloc'd copy of the last component
+ * @return the node, or NULL with errno set
+ */
+static ExecHelpFsNode *exechelp_fs_memory_walk(ExecHelpFsMemory *fs, const char *path, int follow_last,
+                                               int check_perms, ExecHelpFsNode **parent, char **last)
+{
+  ExecHelpFsNode *dir, *node = NULL;
+  char *buf, *component, *next;
+  int n_symlinks = 0;
+
+  if (!path || path[0] == '\0')
+  {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  /* Work on absolute paths so '..' can be followed through parents */
+  if (path[0] == '/')
+    buf = strdup(path);
+  else if (asprintf(&buf, "%s/%s", fs->cwd, path) < 0)
+    buf = NULL;
+  if (!buf)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  dir = fs->root;
+  component = buf;
+
+  for (;;)
+  {
+    while (*component == '/')
+      ++component;
+
+    if (*component == '\0')
+    {
+      /* Trailing slash or root: the directory itself is the target */
+      node = dir;
+      if (parent)
+        *parent = dir->parent ? dir->parent : dir;
+      if (last)
+        *last = strdup(".");
+      break;
+    }
+
+    next = strchr(component, '/');
+    if (next)
+      *next++ = '\0';
+    int is_last = !next || next[strspn(next, "/")] == '\0';
+    /* Like the kernel, a trailing slash requires a directory, following a
+     * symlink in the last component to find it */
+    int trailing_slash = is_last && next;
+
+    if (check_perms && !(dir->mode & S_IXUSR))
+    {
+      errno = EACCES;
+      node = NULL;
+      break;
+    }
+
+    if (strcmp(component, ".") == 0)
+      node = dir;
+    else if (strcmp(component, "..") == 0)
+      node = dir->parent ? dir->parent : dir;
+    else
+      node = exechelp_hash_table_lookup(dir->children, component);
+
+    if (is_last)
+    {
+      if (parent)
+        *parent = dir;
+      if (last)
+        *last = strdup(component);
+    }
+
+    if (!node)
+    {
+      errno = ENOENT;
+      break;
+    }
+
+    if (S_ISLNK(node->mode) && (!is_last || follow_last || trailing_slash))
+    {
+      if (++n_symlinks > EXECHELP_FS_MEMORY_MAX_SYMLINKS)
+      {
+        errno = ELOOP;
+        node = NULL;
+        break;
+      }
+
+      /* Splice the target in front of the rest of the path */
+      char *spliced;
+      if ((next ? asprintf(&spliced, "%s/%s", node->contents, next)
+                : asprintf(&spliced, "%s", node->contents)) < 0)
+      {
+        errno = ENOMEM;
+        node = NULL;
+        break;
+      }
+      free(buf);
+      buf = component = spliced;
+      /* Relative targets are relative to the symlink's directory */
+      if (buf[0] == '/')
+        dir = fs->root;
+
+      if (last)
+      {
+        free(*last);
+        *last = NULL;
+      }
+      continue;
+    }
+
+    if (is_last && !(trailing_slash && !S_ISDIR(node->mode)))
+      break;
+
+    if (!S_ISDIR(node->mode))
+    {
+      errno = ENOTDIR;
+      node = NULL;
+      break;
+    }
+
+    dir = node;
+    component = next;
+  }
+
+  free(buf);
+  return node;
+}
+
+static void exechelp_fs_memory_fill_stat(const ExecHelpFsNode *node, struct stat *sb)
+{
+  memset(sb, 0, sizeof(struct stat));
+  sb->st_dev = 1;
+  sb->st_ino = node->ino;
+  sb->st_mode = node->mode;
+  sb->st_nlink = 1;
+  sb->st_uid = getuid();
+  sb->st_gid = getgid();
+  sb->st_size = node->size;
+  sb->st_mtim = node->mtime;
+  sb->st_ctim = node->mtime;
+  sb->st_atim = node->mtime;
+}
+
+static int exechelp_fs_memory_stat(void *data, const char *path, struct stat *sb)
+{
+  ExecHelpFsMemory *fs = data;
+  exechelp_fs_memory_op(fs);
+
+  ExecHelpFsNode *node = exechelp_fs_memory_walk(fs, path, 1, 1, NULL, NULL);
+  if (!node)
+    return -1;
+
+  exechelp_fs_memory_fill_stat(node, sb);
+  return 0;
+}
+
+static int exechelp_fs_memory_lstat(void *data, const char *path, struct stat *sb)
+{
+  ExecHelpFsMemory *fs = data;
+  exechelp_fs_memory_op(fs);
+
+  ExecHelpFsNode *node = exechelp_fs_memory_walk(fs, path, 0, 1, NULL, NULL);
+  if (!node)
+    return -1;
+
+  exechelp_fs_memory_fill_stat(node, sb);
+  return 0;
+}
+
+static ssize_t exechelp_fs_memory_readlink(void *data, const char *path, char *buf, size_t size)
+{
+  ExecHelpFsMemory *fs = data;
+  exechelp_fs_memory_op(fs);
+
+  ExecHelpFsNode *node = exechelp_fs_memory_walk(fs, path, 0, 1, NULL, NULL);
+  if (!node)
+    return -1;
+
+  if (!S_ISLNK(node->mode))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  size_t len = node->size < size ? node->size : size;
+  memcpy(buf, node->contents, len);
+  return len;
+}
+
+static int exechelp_fs_memory_access(void *data, const char *path, int mode)
+{
+  ExecHelpFsMemory *fs = data;
+  exechelp_fs_memory_op(fs);
+
+  ExecHelpFsNode *node = exechelp_fs_memory_walk(fs, path, 1, 1, NULL, NULL);
+  if (!node)
+    return -1;
+
+  if (((mode & R_OK) && !(node->mode & S_IRUSR)) ||
+      ((mode & W_OK) && !(node->mode & S_IWUSR)) ||
+      ((mode & X_OK) && !(node->mode & S_IXUSR)))
+  {
+    errno = EACCES;
+    return -1;
+  }
+
+  return 0;
+}
+
+static char *exechelp_fs_memory_getcwd(void *data, char *buf, size_t size)
+{
+  ExecHelpFsMemory *fs = data;
+  size_t len = strlen(fs->cwd) + 1;
+
+  exechelp_fs_memory_op(fs);
+
+  if (!buf)
+    return strdup(fs->cwd);
+
+  if (size < len)
+  {
+    errno = ERANGE;
+    return NULL;
+  }
+
+  return memcpy(buf, fs->cwd, len);
+}
+
+static int exechelp_fs_memory_open(void *data, const char *path, int flags)
+{
+  ExecHelpFsMemory *fs = data;
+  int fd;
+
+  exechelp_fs_memory_op(fs);
+
+  if ((flags & O_ACCMODE) != O_RDONLY)
+  {
+    errno = EROFS;
+    return -1;
+  }
+
+  ExecHelpFsNode *node = exechelp_fs_memory_walk(fs, path, 1, 1, NULL, NULL);
+  if (!node)
+    return -1;
+
+  if (!(node->mode & S_IRUSR))
+  {
+    errno = EACCES;
+    return -1;
+  }
+
+  if (S_ISDIR(node->mode))
+  {
+    errno = EISDIR;
+    return -1;
+  }
+
+  for (fd = 0; fd < EXECHELP_FS_MEMORY_MAX_FDS; ++fd)
+  {
+    if (!fs->fds[fd].node)
+    {
+      fs->fds[fd].node = node;
+      fs->fds[fd].offset = 0;
+      return EXECHELP_FS_MEMORY_FD_BASE + fd;
+    }
+  }
+
+  errno = EMFILE;
+  return -1;
+}
+
+static ExecHelpFsMemoryFd *exechelp_fs_memory_get_fd(ExecHelpFsMemory *fs, int fd)
+{
+  fd -= EXECHELP_FS_MEMORY_FD_BASE;
+  if (fd < 0 || fd >= EXECHELP_FS_MEMORY_MAX_FDS || !fs->fds[fd].node)
+  {
+    errno = EBADF;
+    return NULL;
+  }
+
+  return &fs->fds[fd];
+}
+
+static ssize_t exechelp_fs_memory_read(void *data, int fd, void *buf, size_t count)
+{
+  ExecHelpFsMemory *fs = data;
+  exechelp_fs_memory_op(fs);
+
+  ExecHelpFsMemoryFd *file = exechelp_fs_memory_get_fd(fs, fd);
+  if (!file)
+    return -1;
+
+  size_t left = file->node->size - file->offset;
+  size_t len = count < left ? count : left;
+  memcpy(buf, file->node->contents + file->offset, len);
+  file->offset += len;
+
+  return len;
+}
+
+static off_t exechelp_fs_memory_lseek(void *data, int fd, off_t offset, int whence)
+{
+  ExecHelpFsMemory *fs = data;
+  exechelp_fs_memory_op(fs);
+
+  ExecHelpFsMemoryFd *file = exechelp_fs_memory_get_fd(fs, fd);
+  if (!file)
+    return -1;
+
+  if (whence == SEEK_CUR)
+    offset += file->offset;
+  else if (whence == SEEK_END)
+    offset += file->node->size;
+  else if (whence != SEEK_SET)
+    offset = -1;
+
+  if (offset < 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* Reads past the end of the file return nothing */
+  file->offset = (size_t) offset < file->node->size ? (size_t) offset : file->node->size;
+  return offset;
+}
+
+static int exechelp_fs_memory_close(void *data, int fd)
+{
+  ExecHelpFsMemory *fs = data;
+  exechelp_fs_memory_op(fs);
+
+  ExecHelpFsMemoryFd *file = exechelp_fs_memory_get_fd(fs, fd);
+  if (!file)
+    return -1;
+
+  file->node = NULL;
+  return 0;
+}
+
+ExecHelpFsMemory *exechelp_fs_memory_new(void)
+{
+  ExecHelpFsMemory *fs = exechelp_malloc0(sizeof(ExecHelpFsMemory));
+  if (!fs)
+    return NULL;
+
+  fs->next_ino = 2;
+  fs->root = exechelp_fs_node_new(fs, S_IFDIR | 0755, NULL);
+  fs->cwd = strdup("/");
+  if (!fs->root || !fs->cwd)
+  {
+    exechelp_fs_memory_free(fs);
+    return NULL;
+  }
+
+  fs->ops.data = fs;
+  fs->ops.stat = exechelp_fs_memory_stat;
+  fs->ops.lstat = exechelp_fs_memory_lstat;
+  fs->ops.readlink = exechelp_fs_memory_readlink;
+  fs->ops.access = exechelp_fs_memory_access;
+  fs->ops.getcwd = exechelp_fs_memory_getcwd;
+  fs->ops.open = exechelp_fs_memory_open;
+  fs->ops.read = exechelp_fs_memory_read;
+  fs->ops.lseek = exechelp_fs_memory_lseek;
+  fs->ops.close = exechelp_fs_memory_close;
+
+  return fs;
+}
+
+void exechelp_fs_memory_free(ExecHelpFsMemory *fs)
+{
+  if (!fs)
+    return;
+
+  if (exechelp_fs == &fs->ops)
+    exechelp_fs_set_ops(NULL);
+
+  if (fs->root)
+    exechelp_fs_node_free(fs->root);
+  free(fs->cwd);
+  free(fs);
+}
+
+const ExecHelpFsOps *exechelp_fs_memory_get_ops(ExecHelpFsMemory *fs)
+{
+  return fs ? &fs->ops : NULL;
+}
+
+static int exechelp_fs_memory_add(ExecHelpFsMemory *fs, const char *path, mode_t mode, const char *contents)
+{
+  ExecHelpFsNode *parent = NULL, *node;
+  char *last = NULL;
+
+  if (!fs || !path || path[0] != '/')
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* Creating nodes must not depend on permissions, nor count as an op */
+  node = exechelp_fs_memory_walk(fs, path, 0, 0, &parent, &last);
+  if (node || !parent || !last || strcmp(last, ".") == 0 || strcmp(last, "..") == 0)
+  {
+    free(last);
+    errno = node ? EEXIST : (parent ? EINVAL : ENOENT);
+    return -1;
+  }
+
+  if (!S_ISDIR(parent->mode))
+  {
+    free(last);
+    errno = ENOTDIR;
+    return -1;
+  }
+
+  node = exechelp_fs_node_new(fs, mode, contents);
+  if (!node)
+  {
+    free(last);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  node->parent = parent;
+  exechelp_hash_table_insert(parent->children, last, node);
+  parent->mtime = node->mtime;
+  return 0;
+}
+
+int exechelp_fs_memory_add_dir(ExecHelpFsMemory *fs, const char *path, mode_t mode)
+{
+  return exechelp_fs_memory_add(fs, path, S_IFDIR | (mode & 07777), NULL);
+}
+
+int exechelp_fs_memory_add_file(ExecHelpFsMemory *fs, const char *path, mode_t mode, const char *contents)
+{
+  return exechelp_fs_memory_add(fs, path, S_IFREG | (mode & 07777), contents ? contents : "");
+}
+
+int exechelp_fs_memory_add_symlink(ExecHelpFsMemory *fs, const char *path, const char *target)
+{
+  if (!target || target[0] == '\0')
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return exechelp_fs_memory_add(fs, path, S_IFLNK | 0777, target);
+}
+
+int exechelp_fs_memory_chdir(ExecHelpFsMemory *fs, const char *path)
+{
+  ExecHelpFsNode *node;
+
+  if (!fs || !path || path[0] != '/')
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  node = exechelp_fs_memory_walk(fs, path, 1, 1, NULL, NULL);
+  if (!node)
+    return -1;
+
+  if (!S_ISDIR(node->mode))
+  {
+    errno = ENOTDIR;
+    return -1;
+  }
+
+  char *cwd = strdup(path);
+  if (!cwd)
+    return -1;
+
+  free(fs->cwd);
+  fs->cwd = cwd;
+  return 0;
+}
+
+void exechelp_fs_memory_set_latency(ExecHelpFsMemory *fs, long latency_ns)
+{
+  if (fs)
+    fs->latency_ns = latency_ns;
+}
+
+unsigned long exechelp_fs_memory_get_op_count(ExecHelpFsMemory *fs)
+{
+  return fs ? fs->op_count : 0;
+}
+
+/**
+ * @fn exechelp_fs_memory_load
+ * @brief Populates a filesystem from a fixture specification, made of one
+ * entry per line. Blank lines and lines starting with '#' are ignored.
+ *
+ *   d <path> [octal mode]
+ *   f <path> [octal mode] [contents, '\n' escapes allowed]
+ *   l <path> <target>
+ *
+ * @param fs: the filesystem to populate
+ * @param spec_path: the specification file, read from the real filesystem
+ * @return 0 on success, or the number of the first invalid line
+ */
+int exechelp_fs_memory_load(ExecHelpFsMemory *fs, const char *spec_path)
+{
+  char line[8192];
+  int lineno = 0;
+  FILE *f = fopen(spec_path, "r");
+
+  if (!f)
+    return -1;
+
+  while (fgets(line, sizeof(line), f))
+  {
+    char type, *path, *arg, *rest = NULL, *save = NULL;
+    int ret = 0;
+
+    ++lineno;
+    line[strcspn(line, "\n")] = '\0';
+    if (line[0] == '\0' || line[0] == '#')
+      continue;
+
+    type = line[0];
+    path = strtok_r(line + 1, " \t", &save);
+    arg = strtok_r(NULL, " \t", &save);
+    if (arg)
+      rest = save;
+
+    if (!path)
+      ret = -1;
+    else if (type == 'd')
+      ret = exechelp_fs_memory_add_dir(fs, path, arg ? strtol(arg, NULL, 8) : 0755);
+    else if (type == 'l')
+      ret = arg ? exechelp_fs_memory_add_symlink(fs, path, arg) : -1;
+    else if (type == 'f')
+    {
+      char *contents = NULL, *in, *out;
+
+      if (rest && *rest)
+      {
+        contents = strdup(rest);
+        for (in = out = contents; *in; ++in, ++out)
+        {
+          if (in[0] == '\\' && in[1] == 'n')
+          {
+            *out = '\n';
+            ++in;
+          }
+          else
+            *out = *in;
+        }
+        *out = '\0';
+      }
+
+      ret = exechelp_fs_memory_add_file(fs, path, arg ? strtol(arg, NULL, 8) : 0644, contents);
+      free(contents);
+    }
+    else
+      ret = -1;
+
+    if (ret)
+    {
+      fclose(f);
+      return lineno;
+    }
+  }
+
+  fclose(f);
+  return 0;
+}
@@ -0,0 +1,181 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "fsops.h"
+
+static int exechelp_fs_real_stat(void *data, const char *path, struct stat *sb)
+{
+  return stat(path, sb);
+}
+
+static int exechelp_fs_real_lstat(void *data, const char *path, struct stat *sb)
+{
+  return lstat(path, sb);
+}
+
+static ssize_t exechelp_fs_real_readlink(void *data, const char *path, char *buf, size_t size)
+{
+  return readlink(path, buf, size);
+}
+
+static int exechelp_fs_real_access(void *data, const char *path, int mode)
+{
+  return access(path, mode);
+}
+
+static char *exechelp_fs_real_getcwd(void *data, char *buf, size_t size)
+{
+  return getcwd(buf, size);
+}
+
+static int exechelp_fs_real_open(void *data, const char *path, int flags)
+{
+  return open(path, flags | O_CLOEXEC);
+}
+
+static ssize_t exechelp_fs_real_read(void *data, int fd, void *buf, size_t count)
+{
+  return read(fd, buf, count);
+}
+
+static off_t exechelp_fs_real_lseek(void *data, int fd, off_t offset, int whence)
+{
+  return lseek(fd, offset, whence);
+}
+
+static int exechelp_fs_real_close(void *data, int fd)
+{
+  return close(fd);
+}
+
+const ExecHelpFsOps exechelp_fs_real = {
+  NULL,
+  exechelp_fs_real_stat,
+  exechelp_fs_real_lstat,
+  exechelp_fs_real_readlink,
+  exechelp_fs_real_access,
+  exechelp_fs_real_getcwd,
+  exechelp_fs_real_open,
+  exechelp_fs_real_read,
+  exechelp_fs_real_lseek,
+  exechelp_fs_real_close,
+};
+
+const ExecHelpFsOps *exechelp_fs = &exechelp_fs_real;
+
+/**
+ * @fn exechelp_fs_set_ops
+ * @brief Changes the filesystem backend used by the decision pipeline
+ *
+ * @param ops: the backend to use, or NULL for the real filesystem
+ */
+void exechelp_fs_set_ops(const ExecHelpFsOps *ops)
+{
+  exechelp_fs = ops ? ops : &exechelp_fs_real;
+}
+
+/**
+ * @fn exechelp_fs_read_file
+ * @brief Reads a whole file through the current backend
+ *
+ * @param path: the file to read
+ * @param size: if not NULL, set to the number of bytes read
+ * @return a malloc'd NUL-terminated copy of the file, or NULL on error
+ */
+char *exechelp_fs_read_file(const char *path, size_t *size)
+{
+  return exechelp_fs_read_file_at(path, 0, size);
+}
+
+/**
+ * @fn exechelp_fs_read_file_at
+ * @brief Reads the end of a file through the current backend
+ *
+ * @param path: the file to read
+ * @param offset: where to start reading
+ * @param size: if not NULL, set to the number of bytes read
+ * @return a malloc'd NUL-terminated copy of the file from offset, or NULL
+ * on error
+ */
+char *exechelp_fs_read_file_at(const char *path, off_t offset, size_t *size)
+{
+  struct stat sb;
+  size_t len = 0, alloc;
+  char *contents;
+  int fd;
+
+  if ((fd = exechelp_fs_open(path, O_RDONLY)) < 0)
+    return NULL;
+
+  if (offset && exechelp_fs_lseek(fd, offset, SEEK_SET) != offset)
+  {
+    exechelp_fs_close(fd);
+    return NULL;
+  }
+
+  /* The size is a hint, files may change while being read. Leave room to
+   * read the end of file without growing the buffer. */
+  alloc = (exechelp_fs_stat(path, &sb) == 0 && sb.st_size > offset) ? sb.st_size - offset + 2 : 4096;
+  contents = malloc(alloc);
+
+  while (contents)
+  {
+    ssize_t r = exechelp_fs_read(fd, contents + len, alloc - len - 1);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+    {
+      if (r < 0)
+      {
+        free(contents);
+        contents = NULL;
+      }
+      break;
+    }
+
+    len += r;
+    if (len + 1 == alloc)
+    {
+      char *grown = realloc(contents, alloc * 2);
+      if (!grown)
+        free(contents);
+      contents = grown;
+      alloc *= 2;
+    }
+  }
+
+  exechelp_fs_close(fd);
+
+  if (contents)
+  {
+    contents[len] = '\0';
+    if (size)
+      *size = len;
+  }
+
+  return contents;
+}
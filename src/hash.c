@@ -27,10 +27,15 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>  /* memset */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "hash.h"
 #include "common.h"
@@ -215,8 +220,42 @@ struct _ExecHelpHashTable
 #endif
   ExecHelpDestroyNotify   key_destroy_func;
   ExecHelpDestroyNotify   value_destroy_func;
+
+  /* Read-only tables served from a flat image, see
+   * exechelp_hash_table_new_from_image(). Their size is 0 so that the code
+   * walking the arrays above sees an empty table. */
+  const unsigned char    *image;
+  size_t                  image_size;
+  int                     image_mapped;
 };
 
+/* Flat images of tables with string keys and values. Strings are referred
+ * to by their offset from the start of the image, so that images can be
+ * mapped at any address and shared between processes. Buckets are laid out
+ * and probed like the hashes of a table, with 0 offsets for %NULL values.
+ */
+#define EH_IMAGE_MAGIC    "EHT1"
+#define EH_IMAGE_VERSION  1
+
+typedef struct
+{
+  char      magic[4];
+  uint32_t  version;
+  uint32_t  size;         /* of the whole image */
+  uint32_t  shift;        /* 1 << shift buckets */
+  uint32_t  nnodes;
+  uint32_t  buckets_off;
+  uint32_t  strings_off;
+  uint32_t  reserved;
+} EHImageHeader;
+
+typedef struct
+{
+  uint32_t  hash;
+  uint32_t  key;
+  uint32_t  value;
+} EHImageBucket;
+
 typedef struct
 {
   ExecHelpHashTable  *hash_table;
@@ -399,6 +438,62 @@ exechelp_hash_table_lookup_node (ExecHelpHashTable    *hash_table,
   return node_index;
 }
 
+/*
+ * exechelp_hash_table_image_lookup:
+ * @hash_table: a #ExecHelpHashTable served from an image
+ * @key: the string to lookup
+ *
+ * Performs a lookup in the image of a table, probing buckets in the same
+ * order as exechelp_hash_table_lookup_node(). Offsets are checked as they
+ * are read, so a corrupt image can only cause misses.
+ *
+ * Returns: the bucket of @key, or %NULL if it is not in the image
+ */
+static const EHImageBucket *
+exechelp_hash_table_image_lookup (ExecHelpHashTable *hash_table,
+                           const void *       key)
+{
+  const EHImageHeader *header = (const EHImageHeader *) hash_table->image;
+  const EHImageBucket *buckets = (const EHImageBucket *) (hash_table->image + header->buckets_off);
+  unsigned int mask = (1U << header->shift) - 1;
+  unsigned int hash_value, node_index, step;
+
+  if (!key)
+    return NULL;
+
+  hash_value = exechelp_str_hash (key);
+  if (!HASH_IS_REAL (hash_value))
+    hash_value = 2;
+
+  node_index = hash_value % prime_mod[header->shift];
+  for (step = 0; step <= mask && !HASH_IS_UNUSED (buckets[node_index].hash); )
+    {
+      const EHImageBucket *bucket = &buckets[node_index];
+
+      if (bucket->hash == hash_value &&
+          bucket->key >= header->strings_off && bucket->key < hash_table->image_size &&
+          strcmp ((const char *) hash_table->image + bucket->key, key) == 0)
+        return bucket;
+
+      step++;
+      node_index = (node_index + step) & mask;
+    }
+
+  return NULL;
+}
+
+static void *
+exechelp_hash_table_image_string (ExecHelpHashTable *hash_table,
+                           uint32_t           offset)
+{
+  const EHImageHeader *header = (const EHImageHeader *) hash_table->image;
+
+  if (offset < header->strings_off || offset >= hash_table->image_size)
+    return NULL;
+
+  return (void *) (hash_table->image + offset);
+}
+
 /*
  * exechelp_hash_table_remove_node:
  * @hash_table: our #ExecHelpHashTable
@@ -521,7 +616,7 @@ exechelp_hash_table_remove_all_nodes (ExecHelpHashTable *hash_table,
           old_keys[i] = NULL;
           old_values[i] = NULL;
 
-          if (hash_table->key_destroy_func == NULL)
+          if (hash_table->key_destroy_func != NULL)
             hash_table->key_destroy_func (key);
 
           if (hash_table->value_destroy_func != NULL)
@@ -703,6 +798,9 @@ exechelp_hash_table_new_full (ExecHelpHashFunc      hash_func,
   hash_table->keys               = exechelp_malloc0 (sizeof (void *) * hash_table->size);
   hash_table->values             = hash_table->keys;
   hash_table->hashes             = exechelp_malloc0 (sizeof (unsigned int) * hash_table->size);
+  hash_table->image              = NULL;
+  hash_table->image_size         = 0;
+  hash_table->image_mapped       = 0;
 
   return hash_table;
 }
@@ -1067,7 +1165,10 @@ exechelp_hash_table_unref (ExecHelpHashTable *hash_table)
 
   if (__sync_sub_and_fetch(&hash_table->ref_count, 1) == 0)
     {
-      exechelp_hash_table_remove_all_nodes (hash_table, 1, 1);
+      if (hash_table->image_mapped)
+        munmap ((void *) hash_table->image, hash_table->image_size);
+      if (!hash_table->image)
+        exechelp_hash_table_remove_all_nodes (hash_table, 1, 1);
       if (hash_table->keys != hash_table->values)
         free (hash_table->values);
       free (hash_table->keys);
@@ -1119,6 +1220,12 @@ exechelp_hash_table_lookup (ExecHelpHashTable    *hash_table,
   if(!hash_table)
     return NULL;
 
+  if (hash_table->image)
+    {
+      const EHImageBucket *bucket = exechelp_hash_table_image_lookup (hash_table, key);
+      return bucket ? exechelp_hash_table_image_string (hash_table, bucket->value) : NULL;
+    }
+
   node_index = exechelp_hash_table_lookup_node (hash_table, key, &node_hash);
 
   return HASH_IS_REAL (hash_table->hashes[node_index])
@@ -1156,6 +1263,19 @@ exechelp_hash_table_lookup_extended (ExecHelpHashTable    *hash_table,
   if(!hash_table)
     return 0;
 
+  if (hash_table->image)
+    {
+      const EHImageBucket *bucket = exechelp_hash_table_image_lookup (hash_table, lookup_key);
+
+      if (!bucket)
+        return 0;
+      if (oriexechelp_key)
+        *oriexechelp_key = exechelp_hash_table_image_string (hash_table, bucket->key);
+      if (value)
+        *value = exechelp_hash_table_image_string (hash_table, bucket->value);
+      return 1;
+    }
+
   node_index = exechelp_hash_table_lookup_node (hash_table, lookup_key, &node_hash);
 
   if (!HASH_IS_REAL (hash_table->hashes[node_index]))
@@ -1197,7 +1317,7 @@ exechelp_hash_table_insert_internal (ExecHelpHashTable *hash_table,
   unsigned int key_hash;
   unsigned int node_index;
 
-  if(!hash_table)
+  if(!hash_table || hash_table->image)
     return 0;
 
   node_index = exechelp_hash_table_lookup_node (hash_table, key, &key_hash);
@@ -1299,6 +1419,9 @@ exechelp_hash_table_contains (ExecHelpHashTable    *hash_table,
   if(!hash_table)
     return 0;
 
+  if (hash_table->image)
+    return exechelp_hash_table_image_lookup (hash_table, key) != NULL;
+
   node_index = exechelp_hash_table_lookup_node (hash_table, key, &node_hash);
 
   return HASH_IS_REAL (hash_table->hashes[node_index]);
@@ -1325,7 +1448,7 @@ exechelp_hash_table_remove_internal (ExecHelpHashTable    *hash_table,
   unsigned int node_index;
   unsigned int node_hash;
 
-  if(!hash_table)
+  if(!hash_table || hash_table->image)
     return 0;
 
   node_index = exechelp_hash_table_lookup_node (hash_table, key, &node_hash);
@@ -1397,7 +1520,7 @@ exechelp_hash_table_steal (ExecHelpHashTable    *hash_table,
 void
 exechelp_hash_table_remove_all (ExecHelpHashTable *hash_table)
 {
-  if(!hash_table)
+  if(!hash_table || hash_table->image)
     return;
 
 #ifndef EH_DISABLE_ASSERT
@@ -1421,7 +1544,7 @@ exechelp_hash_table_remove_all (ExecHelpHashTable *hash_table)
 void
 exechelp_hash_table_steal_all (ExecHelpHashTable *hash_table)
 {
-  if(!hash_table)
+  if(!hash_table || hash_table->image)
     return;
 
 #ifndef EH_DISABLE_ASSERT
@@ -1462,6 +1585,9 @@ exechelp_hash_table_foreach_remove_or_steal (ExecHelpHashTable *hash_table,
   int version = hash_table->version;
 #endif
 
+  if (hash_table->image)
+    return 0;
+
   for (i = 0; i < hash_table->size; i++)
     {
       unsigned int node_hash = hash_table->hashes[i];
@@ -1575,6 +1701,18 @@ exechelp_hash_table_foreach (ExecHelpHashTable *hash_table,
   if(!hash_table || !func)
     return;
 
+  if (hash_table->image)
+    {
+      const EHImageHeader *header = (const EHImageHeader *) hash_table->image;
+      const EHImageBucket *buckets = (const EHImageBucket *) (hash_table->image + header->buckets_off);
+
+      for (i = 0; i < 1 << header->shift; i++)
+        if (HASH_IS_REAL (buckets[i].hash))
+          (* func) (exechelp_hash_table_image_string (hash_table, buckets[i].key),
+                    exechelp_hash_table_image_string (hash_table, buckets[i].value), user_data);
+      return;
+    }
+
 #ifndef EH_DISABLE_ASSERT
   version = hash_table->version;
 #endif
@@ -1803,6 +1941,224 @@ exechelp_hash_table_get_values (ExecHelpHashTable *hash_table)
   return retval;
 }
 
+/* Flat images.
+ */
+
+/**
+ * exechelp_hash_table_serialize:
+ * @hash_table: a #ExecHelpHashTable created with exechelp_str_hash() and
+ *     exechelp_str_equal(), whose keys and non-%NULL values are strings
+ * @size: return location for the size of the image
+ *
+ * Serializes @hash_table into a flat image that holds its strings and
+ * refers to them by offset. The image can be written to a file, and later
+ * served as a read-only table without being deserialized, by mapping it with
+ * exechelp_hash_table_map_image() or passing it to
+ * exechelp_hash_table_new_from_image(). Values that are the key they are
+ * associated with are stored once.
+ *
+ * Returns: a newly-allocated image, or %NULL with errno set if the table
+ *     cannot be serialized
+ */
+void *
+exechelp_hash_table_serialize (ExecHelpHashTable *hash_table,
+                        size_t            *size)
+{
+  EHImageHeader *header;
+  EHImageBucket *buckets;
+  unsigned char *image;
+  size_t strings_size = 0, total, offset;
+  unsigned int mask;
+  int i, shift;
+
+  if (!hash_table || !size || hash_table->image ||
+      hash_table->hash_func != exechelp_str_hash || hash_table->key_equal_func != exechelp_str_equal)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  for (i = 0; i < hash_table->size; i++)
+    {
+      if (!HASH_IS_REAL (hash_table->hashes[i]))
+        continue;
+      strings_size += strlen (hash_table->keys[i]) + 1;
+      if (hash_table->values[i] && hash_table->values[i] != hash_table->keys[i])
+        strings_size += strlen (hash_table->values[i]) + 1;
+    }
+
+  /* At most half full, so that probes stay short */
+  shift = exechelp_hash_table_find_closest_shift (hash_table->nnodes * 2);
+  shift = (shift > HASH_TABLE_MIN_SHIFT) ? shift : HASH_TABLE_MIN_SHIFT;
+  mask = (1U << shift) - 1;
+
+  offset = sizeof (EHImageHeader) + ((size_t) 1 << shift) * sizeof (EHImageBucket);
+  total = offset + strings_size;
+  if (shift > 30 || total > UINT32_MAX)
+    {
+      errno = EFBIG;
+      return NULL;
+    }
+
+  if (!(image = exechelp_malloc0 (total)))
+    return NULL;
+
+  header = (EHImageHeader *) image;
+  memcpy (header->magic, EH_IMAGE_MAGIC, sizeof (header->magic));
+  header->version = EH_IMAGE_VERSION;
+  header->size = total;
+  header->shift = shift;
+  header->nnodes = hash_table->nnodes;
+  header->buckets_off = sizeof (EHImageHeader);
+  header->strings_off = offset;
+  buckets = (EHImageBucket *) (image + header->buckets_off);
+
+  for (i = 0; i < hash_table->size; i++)
+    {
+      unsigned int node_hash = hash_table->hashes[i];
+      unsigned int node_index, step = 0;
+      size_t len;
+
+      if (!HASH_IS_REAL (node_hash))
+        continue;
+
+      node_index = node_hash % prime_mod[shift];
+      while (!HASH_IS_UNUSED (buckets[node_index].hash))
+        {
+          step++;
+          node_index = (node_index + step) & mask;
+        }
+
+      buckets[node_index].hash = node_hash;
+      buckets[node_index].key = offset;
+      len = strlen (hash_table->keys[i]) + 1;
+      memcpy (image + offset, hash_table->keys[i], len);
+      offset += len;
+
+      if (hash_table->values[i] == hash_table->keys[i])
+        buckets[node_index].value = buckets[node_index].key;
+      else if (hash_table->values[i])
+        {
+          buckets[node_index].value = offset;
+          len = strlen (hash_table->values[i]) + 1;
+          memcpy (image + offset, hash_table->values[i], len);
+          offset += len;
+        }
+    }
+
+  *size = total;
+  return image;
+}
+
+/**
+ * exechelp_hash_table_new_from_image:
+ * @image: an image made by exechelp_hash_table_serialize(), aligned on 4 bytes
+ * @size: the size of @image
+ *
+ * Creates a read-only #ExecHelpHashTable served from @image, which must
+ * remain valid and unchanged for the lifetime of the table. Lookups read
+ * @image directly. exechelp_hash_table_lookup(),
+ * exechelp_hash_table_lookup_extended(), exechelp_hash_table_contains(),
+ * exechelp_hash_table_size() and exechelp_hash_table_foreach() work as on
+ * any table; functions that modify the table fail, and the other ones see an
+ * empty table. Keys and values returned by the table point into @image.
+ *
+ * The header of @image is validated, and offsets are checked as they are
+ * used, so a corrupt image does not lead to reads outside of it.
+ *
+ * Returns: a new #ExecHelpHashTable, or %NULL with errno set if @image is
+ *     not a valid image
+ */
+ExecHelpHashTable *
+exechelp_hash_table_new_from_image (const void *image,
+                             size_t      size)
+{
+  const EHImageHeader *header = image;
+  ExecHelpHashTable *hash_table;
+
+  if (!image || ((uintptr_t) image & 3) || size < sizeof (EHImageHeader) ||
+      memcmp (header->magic, EH_IMAGE_MAGIC, sizeof (header->magic)) ||
+      header->version != EH_IMAGE_VERSION || header->size != size ||
+      header->shift < HASH_TABLE_MIN_SHIFT || header->shift > 30 ||
+      header->nnodes >= 1U << header->shift ||
+      header->buckets_off != sizeof (EHImageHeader) ||
+      header->strings_off != header->buckets_off + ((size_t) 1 << header->shift) * sizeof (EHImageBucket) ||
+      header->strings_off > size ||
+      (size > header->strings_off && ((const char *) image)[size - 1] != '\0'))
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  if (!(hash_table = exechelp_hash_table_new (exechelp_str_hash, exechelp_str_equal)))
+    return NULL;
+
+  /* The arrays of a regular table are left empty */
+  free (hash_table->keys);
+  free (hash_table->hashes);
+  hash_table->keys = hash_table->values = NULL;
+  hash_table->hashes = NULL;
+  hash_table->size = 0;
+  hash_table->nnodes = header->nnodes;
+  hash_table->noccupied = header->nnodes;
+  hash_table->image = image;
+  hash_table->image_size = size;
+
+  return hash_table;
+}
+
+/**
+ * exechelp_hash_table_map_image:
+ * @path: a file holding an image made by exechelp_hash_table_serialize()
+ *
+ * Maps the image at @path read-only and serves it as a table, see
+ * exechelp_hash_table_new_from_image(). The mapping is shared with other
+ * processes mapping the same file, and released with the table.
+ *
+ * Returns: a new #ExecHelpHashTable, or %NULL with errno set
+ */
+ExecHelpHashTable *
+exechelp_hash_table_map_image (const char *path)
+{
+  ExecHelpHashTable *hash_table;
+  struct stat sb;
+  void *image;
+  int fd, saved_errno;
+
+  if ((fd = open (path, O_RDONLY | O_CLOEXEC)) < 0)
+    return NULL;
+
+  if (fstat (fd, &sb))
+    {
+      saved_errno = errno;
+      close (fd);
+      errno = saved_errno;
+      return NULL;
+    }
+  if (sb.st_size < (off_t) sizeof (EHImageHeader) || sb.st_size > UINT32_MAX)
+    {
+      close (fd);
+      errno = EINVAL;
+      return NULL;
+    }
+
+  image = mmap (NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (image == MAP_FAILED)
+    return NULL;
+
+  if (!(hash_table = exechelp_hash_table_new_from_image (image, sb.st_size)))
+    {
+      saved_errno = errno;
+      munmap (image, sb.st_size);
+      errno = saved_errno;
+      return NULL;
+    }
+  hash_table->image_mapped = 1;
+
+  return hash_table;
+}
+
 /* Hash functions.
  */
 
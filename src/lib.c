@@ -23,6 +23,8 @@
 #include <dlfcn.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -33,8 +35,15 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "coalesce.h"
 #include "common.h"
+#include "delegate.h"
+#include "env.h"
+#include "fsops.h"
+#include "policy.h"
 #include "realpath.h"
+#include "sample.h"
+#include "trace.h"
 
 /**
  * @fn exechelp_is_associated_helper_client
@@ -115,8 +124,26 @@ static ExecHelpExecutionPolicy *exechelp_targets_sandbox_managed_file(const char
     return 0;
   }
 
+  /* Without any managed file, there is no need to canonicalize arguments */
+  if (managed[0] == '\0')
+  {
+    DEBUG2("DEBUG: No sandbox-managed files to check arguments against before executing '%s'\n", target);
+    return 0;
+  }
+
   ExecHelpExecutionPolicy *ret = NULL;
   int len = 0, some_forbidden = 0;
+
+  /* Too many arguments to check, so delegate as if the first was managed */
+  if (exechelp_argv_exceeds_limits(argv))
+  {
+    DEBUG2("DEBUG: Too many parameters to check for '%s'\n", target);
+    ret = exechelp_malloc0(sizeof(ExecHelpExecutionPolicy) * 3);
+    ret[0] = HELPERS;
+    ret[1] = SANDBOX_MANAGED;
+    return ret;
+  }
+
   for(;argv[len];++len);
   ret = exechelp_malloc0(sizeof(ExecHelpExecutionPolicy) * (len+1));
   ret[0] = HELPERS; /* Just to make the array nicer to loop through, mark executable as a helper */
@@ -125,14 +152,30 @@ static ExecHelpExecutionPolicy *exechelp_targets_sandbox_managed_file(const char
   for(len=1;argv[len];++len)
   {
     const char *arg = argv[len];
-    char *real = exechelp_coreutils_realpath(arg);
     DEBUG2("DEBUG: checking if argument %d ('%s') is to be managed by the sandbox\n", len, arg);
 
+    if (exechelp_arg_exceeds_len_limit(arg))
+    {
+      DEBUG2("DEBUG: \t\t'%.64s...' is too long to be a file\n", arg);
+      ret[len] = UNSPECIFIED;
+      continue;
+    }
+
+    char *real = exechelp_coreutils_realpath(arg);
+
+    if (!real && EXECHELP_REALPATH_OVER_LIMITS(errno))
+    {
+      DEBUG2("DEBUG: \t\t'%s' is too costly to canonicalize, delegating\n", arg);
+      ret[len] = SANDBOX_MANAGED;
+      some_forbidden = 1;
+      continue;
+    }
+
     short is_file = strchr(arg, '/') != NULL;
     if(!is_file)
     {
       struct stat sb;
-      if(stat(real, &sb) == 0)
+      if(exechelp_fs_stat(real, &sb) == 0)
         is_file = 1;
       else
         is_file = (errno == EACCES || errno == ELOOP || errno == EOVERFLOW) ? 1:0;
@@ -155,7 +198,7 @@ static ExecHelpExecutionPolicy *exechelp_targets_sandbox_managed_file(const char
       ret[len] = UNSPECIFIED;
     }
 
-    ++arg;
+    free(real);
   }
 
   DEBUG2("%s", "Found forbidden files in arguments?");
@@ -163,9 +206,24 @@ static ExecHelpExecutionPolicy *exechelp_targets_sandbox_managed_file(const char
   return ret;
 }
 
-static int exechelp_filter_forbidden_exec(const char *target, char *const argv[], char *const envp[],
-                                          char **allowed_target, char **allowed_argv[],
-                                          char **forbidden_target, char **forbidden_argv[])
+/**
+ * @fn exechelp_filter_forbidden_exec
+ * @brief Decides whether an execution can proceed within the sandbox or must
+ * be delegated to the sandbox helper. This is the whole decision pipeline run
+ * by the interposed exec functions, exposed so it can be exercised by tests.
+ *
+ * @param target: the full path of the binary to be executed
+ * @param argv: the list of arguments forwarded to execve
+ * @param envp: the environment forwarded to execve
+ * @param allowed_target: set to a malloc'd copy of target if allowed
+ * @param allowed_argv: set to a malloc'd copy of argv if allowed
+ * @param forbidden_target: set to a malloc'd copy of target if delegated
+ * @param forbidden_argv: set to a malloc'd copy of argv if delegated
+ * @return 1 if the execution is allowed, 0 if it must be delegated
+ */
+int exechelp_filter_forbidden_exec(const char *target, char *const argv[], char *const envp[],
+                                   char **allowed_target, char **allowed_argv[],
+                                   char **forbidden_target, char **forbidden_argv[])
 {
   if(!target || !argv)
     return 0;
@@ -188,14 +246,15 @@ static int exechelp_filter_forbidden_exec(const char *target, char *const argv[]
     DEBUG2("DEBUG: Child process can partly or completely execute '%s', now checking parameters...\n", target);
 
     ExecHelpExecutionPolicy *decisions = exechelp_targets_sandbox_managed_file(target, argv);
-    ExecHelpExecutionPolicy *iter = decisions + 1;
+    ExecHelpExecutionPolicy *iter = decisions ? decisions + 1 : NULL;
     int i = 1, have_forbidden = 0;
-    while (*iter)
+    while (iter && *iter)
     {
       have_forbidden |= !(*iter & (HELPERS | UNSPECIFIED));
       ++iter;
       ++i;
     }
+    free(decisions);
 
     /* Don't do anything fancy yet for mixed forbidden-allowed executions, just
      * delegate to the sandbox but let it know to expect a mixed setup, we can
@@ -206,8 +265,8 @@ static int exechelp_filter_forbidden_exec(const char *target, char *const argv[]
 
     DEBUG2("DEBUG: Child process is allowed to execute '%s' and to access all of its parameters, proceeding\n", target);
     *allowed_target = strdup(target);
-    *allowed_argv = arg_len? malloc(sizeof(char *) * arg_len) : NULL;
-    *allowed_argv = memcpy(*allowed_argv, argv, sizeof(char *) * (arg_len+1));
+    *allowed_argv = malloc(sizeof(char *) * arg_len);
+    *allowed_argv = memcpy(*allowed_argv, argv, sizeof(char *) * arg_len);
 
     return 1;
   }
@@ -216,96 +275,414 @@ static int exechelp_filter_forbidden_exec(const char *target, char *const argv[]
   {
     DEBUG2("DEBUG: Child process is not allowed to execute '%s', or some parameters are are not allowed; delegating the whole execution\n", target);
     *forbidden_target = strdup(target);
-    *forbidden_argv = arg_len? malloc(sizeof(char *) * (arg_len+1)) : NULL;
-    *forbidden_argv = memcpy(*forbidden_argv, argv, sizeof(char *) * (arg_len+1));
+    *forbidden_argv = malloc(sizeof(char *) * arg_len);
+    *forbidden_argv = memcpy(*forbidden_argv, argv, sizeof(char *) * arg_len);
 
     return 0;
   }
 }
 
-/* int execl(const char *path, const char *arg, ...) will call execve */
-/* int execle(const char *path, const char *arg, ...) will call execve */
-/* int execlp(const char *file, const char *arg, ...) will call execvp */
-/* int execv(const char *path, char *const argv[]) will call execve */
-/* int execvp(const char *file, char *const argv[]) will call execvpe */
-
-int execve(const char *path, char *const argv[], char *const envp[])
+/**
+ * @fn exechelp_legacy_decide
+ * @brief Runs the legacy decision pipeline and turns its output into a
+ * verdict
+ */
+static ExecHelpVerdict exechelp_legacy_decide(const char *target, char *const argv[], char *const envp[])
 {
-  typeof(execve) *original_execve = dlsym(RTLD_NEXT, "execve");
-  DEBUG("Child process is attempting to execute (execve) binary '%s'\n", path);
-
   char *allowed_exec = NULL, *forbidden_exec = NULL;
   char **allowed_argv = NULL, **forbidden_argv = NULL;
-  int ret_value = 0;
+  ExecHelpVerdict verdict;
+
+  if (exechelp_filter_forbidden_exec(target, argv, envp,
+                                     &allowed_exec, &allowed_argv,
+                                     &forbidden_exec, &forbidden_argv))
+    verdict = EXECHELP_VERDICT_ALLOW;
+  else if (forbidden_exec)
+    verdict = EXECHELP_VERDICT_DELEGATE;
+  else
+    verdict = EXECHELP_VERDICT_DENY;
+
+  free(allowed_exec);
+  free(forbidden_exec);
+  free(allowed_argv);
+  free(forbidden_argv);
 
-  exechelp_filter_forbidden_exec(path, argv, envp,
-                                 &allowed_exec, &allowed_argv,
-                                 &forbidden_exec, &forbidden_argv);
+  return verdict;
+}
 
-  /* First getting rid of the denied process/files because we know we will return from
-   * this call.
-   */
-  if (forbidden_exec)
+/**
+ * @fn exechelp_use_engine
+ * @brief Tells whether the indexed decision engine should be enforced rather
+ * than the legacy pipeline, which remains the default while they are being
+ * compared in shadow mode
+ */
+static int exechelp_use_engine(void)
+{
+  static int use_engine = -1;
+
+  if (use_engine == -1)
   {
-    if (!allowed_exec)
-      DEBUG("Child process delegating the execution of '%s' to the sandbox\n", path); 
+    const char *engine = getenv(EXECHELP_ENV_ENGINE);
+    use_engine = (engine && strcmp(engine, "engine") == 0);
+  }
+
+  return use_engine;
+}
+
+/**
+ * @fn exechelp_shadow_log_fd
+ * @brief Returns the file descriptor shadow mode logs to, or -1 if shadow
+ * mode is disabled
+ */
+static int exechelp_shadow_log_fd(void)
+{
+  static int fd = -2;
+
+  if (fd == -2)
+  {
+    const char *dest = getenv(EXECHELP_ENV_SHADOW);
+
+    if (!dest || dest[0] == '\0')
+      fd = -1;
+    else if (strcmp(dest, "stderr") == 0)
+      fd = STDERR_FILENO;
     else
-      DEBUG("Child process must delegate the execution of some parameters of '%s' to the sandbox\n", path); 
-
-    /* Here we execute a fake execve to a specific path, so the sandbox gets notified.
-     * We do this rather than deny the system call with a built-in security mechanism
-     * because a seccomp + ptrace combination would require that we compile a new
-     * execve seccomp policy every time we want to deny a system call, and that we then
-     * refind and recompile the original seccomp policy, and reload it. This would be
-     * too costly, and ptrace itself cannot prevent the execve call from happening so
-     * we rely on the sandboxed process to self-censor instead. Disobeying processes
-     * could be detected by duplicating the checking logic in the trusted daemon that
-     * monitors the execve calls of the sandboxed process.
-     */
-    size_t altered_len = strlen(EXECHELP_MONITORED_EXEC_PATH) + (forbidden_exec? strlen(forbidden_exec):0) + 1;
-    char *altered_path = malloc(sizeof(char) * altered_len);
-    snprintf(altered_path, altered_len, "%s%s", EXECHELP_MONITORED_EXEC_PATH, (forbidden_exec? forbidden_exec:""));
+      fd = open(dest, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  }
 
-    int ret = (*original_execve)(altered_path, forbidden_argv, envp);
-    free(altered_path);
+  return fd;
+}
 
-    /* Ideally the sandbox is configured to return EACCES for such paths, but the
-     * normal error to be had is ENOENT without a compatible sandbox. We force the
-     * error to EACCES for that reason.
-     */
-    DEBUG("Child process's system call successfully hijacked for sandbox to take over (returned %d)\n", ret);
+static long exechelp_elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+  return (end->tv_sec - start->tv_sec) * 1000000000L + (end->tv_nsec - start->tv_nsec);
+}
+
+/**
+ * @fn exechelp_record_fd
+ * @brief Returns the file descriptor of the exec trace being recorded, or -1
+ * if recording is disabled
+ */
+static int exechelp_record_fd(void)
+{
+  static int fd = -2;
+
+  if (fd == -2)
+    fd = exechelp_trace_open(getenv(EXECHELP_ENV_RECORD));
+
+  return fd;
+}
+
+/**
+ * @fn exechelp_compute_verdict
+ * @brief Decides the fate of an execution with the enforced decision engine.
+ * In shadow mode, both the legacy pipeline and the indexed engine are run,
+ * their verdicts and timings are logged, and the enforced one is returned.
+ * The order in which they run alternates so neither always gets warm caches.
+ *
+ * @param target: the full path of the binary to be executed
+ * @param argv: the list of arguments forwarded to execve
+ * @param envp: the environment forwarded to execve
+ * @return the verdict of the enforced decision engine
+ */
+static ExecHelpVerdict exechelp_compute_verdict(const char *target, char *const argv[], char *const envp[])
+{
+  static unsigned long decisions = 0;
+  int use_engine = exechelp_use_engine();
+  int shadow_fd = exechelp_shadow_log_fd();
+
+  if (shadow_fd < 0)
+  {
+    if (use_engine)
+      return exechelp_policy_decide(exechelp_policy_get_default(), target, argv);
+    else
+      return exechelp_legacy_decide(target, argv, envp);
   }
 
-  /* Then executing the allowed process with the allowed parameters. We might not return.
+  ExecHelpVerdict legacy, engine = EXECHELP_VERDICT_DENY;
+  struct timespec legacy_start, legacy_end, engine_start, engine_end;
+  int engine_first = decisions++ % 2;
+
+  if (engine_first)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &engine_start);
+    engine = exechelp_policy_decide(exechelp_policy_get_default(), target, argv);
+    clock_gettime(CLOCK_MONOTONIC, &engine_end);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &legacy_start);
+  legacy = exechelp_legacy_decide(target, argv, envp);
+  clock_gettime(CLOCK_MONOTONIC, &legacy_end);
+
+  if (!engine_first)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &engine_start);
+    engine = exechelp_policy_decide(exechelp_policy_get_default(), target, argv);
+    clock_gettime(CLOCK_MONOTONIC, &engine_end);
+  }
+
+  int argc = 0;
+  while (argv && argv[argc])
+    ++argc;
+
+  dprintf(shadow_fd, "ExecHelper shadow: %s pid=%d enforced=%s legacy=%s legacy_ns=%ld engine=%s engine_ns=%ld argc=%d target='%s'\n",
+          (legacy == engine ? "match" : "MISMATCH"), getpid(),
+          (use_engine ? "engine" : "legacy"),
+          exechelp_verdict_to_string(legacy), exechelp_elapsed_ns(&legacy_start, &legacy_end),
+          exechelp_verdict_to_string(engine), exechelp_elapsed_ns(&engine_start, &engine_end),
+          argc, (target ? target : "(null)"));
+
+  if (legacy != engine)
+  {
+    int i;
+    for (i = 0; i < argc; ++i)
+      dprintf(shadow_fd, "ExecHelper shadow:   argv[%d]='%s'\n", i, argv[i]);
+  }
+
+  return use_engine ? engine : legacy;
+}
+
+/**
+ * @fn exechelp_decide
+ * @brief Decides the fate of an execution, and appends the decision to the
+ * exec trace if one is being recorded
+ */
+static ExecHelpVerdict exechelp_decide(const char *target, char *const argv[], char *const envp[])
+{
+  ExecHelpVerdict verdict = exechelp_compute_verdict(target, argv, envp);
+  int record_fd = exechelp_record_fd();
+
+  if (record_fd >= 0 && exechelp_trace_write(record_fd, target, argv, verdict) != 0)
+    DEBUG("ExecHelper: could not record the execution of '%s' (%s)\n", target, strerror(errno));
+
+  return verdict;
+}
+
+/**
+ * @fn exechelp_delegate_exec
+ * @brief Notifies the sandbox that an execution must be delegated to it
+ *
+ * @param target: the full path of the binary to be executed
+ * @param argv: the list of arguments forwarded to execve
+ * @param envp: the environment forwarded to execve
+ */
+static void exechelp_delegate_exec(const char *target, char *const argv[], char *const envp[])
+{
+  typeof(execve) *original_execve = dlsym(RTLD_NEXT, "execve");
+  DEBUG("Child process delegating the execution of '%s' to the sandbox\n", target);
+
+  /* Here we execute a fake execve to a specific path, so the sandbox gets notified.
+   * We do this rather than deny the system call with a built-in security mechanism
+   * because a seccomp + ptrace combination would require that we compile a new
+   * execve seccomp policy every time we want to deny a system call, and that we then
+   * refind and recompile the original seccomp policy, and reload it. This would be
+   * too costly, and ptrace itself cannot prevent the execve call from happening so
+   * we rely on the sandboxed process to self-censor instead. Disobeying processes
+   * could be detected by duplicating the checking logic in the trusted daemon that
+   * monitors the execve calls of the sandboxed process.
+   */
+  size_t altered_len = strlen(EXECHELP_MONITORED_EXEC_PATH) + strlen(target) + 1;
+  char *altered_path = malloc(sizeof(char) * altered_len);
+  if (!altered_path)
+    return;
+  snprintf(altered_path, altered_len, "%s%s", EXECHELP_MONITORED_EXEC_PATH, target);
+
+  int ret = (*original_execve)(altered_path, argv, envp);
+  free(altered_path);
+
+  /* Ideally the sandbox is configured to return EACCES for such paths, but the
+   * normal error to be had is ENOENT without a compatible sandbox. We force the
+   * error to EACCES for that reason.
    */
-  if (allowed_exec)
+  DEBUG("Child process's system call successfully hijacked for sandbox to take over (returned %d)\n", ret);
+}
+
+/**
+ * @fn exechelp_coalesce_window
+ * @brief Returns the window in ms during which delegations of a binary are
+ * coalesced, or 0 if they are delegated one by one
+ */
+static long exechelp_coalesce_window(void)
+{
+  static long window = -1;
+
+  if (window == -1)
   {
-    DEBUG("%s", "Child process is allowed to proceed by the sandbox\n");
-    ret_value = (*original_execve)(allowed_exec, allowed_argv, envp);
+    const char *value = getenv(EXECHELP_ENV_COALESCE);
+    window = value ? strtol(value, NULL, 10) : 0;
+    if (window < 0)
+      window = 0;
   }
-  else
+
+  return window;
+}
+
+/* Completion handle of the last execution the thread delegated, until it is
+ * claimed with exechelp_last_delegation_fd(), see delegate.h */
+static __thread int exechelp_delegation_fd = -1;
+
+static void exechelp_set_delegation_fd(int fd)
+{
+  if (exechelp_delegation_fd >= 0)
+    close(exechelp_delegation_fd);
+  exechelp_delegation_fd = fd;
+}
+
+/**
+ * @fn exechelp_last_delegation_fd
+ * @brief Hands over the completion handle of the last execution that the
+ * calling thread delegated, which becomes readable when the delegated process
+ * exits. Each handle is returned once; unclaimed handles are closed by the
+ * next delegation.
+ *
+ * @return a file descriptor to be closed by the caller, or -1 if the last
+ * delegation did not go through a delegation daemon or was already claimed
+ */
+EXECHELP_EXPORT int exechelp_last_delegation_fd(void)
+{
+  int fd = exechelp_delegation_fd;
+
+  exechelp_delegation_fd = -1;
+  return fd;
+}
+
+/**
+ * @fn exechelp_delegate
+ * @brief Delegates an execution to the sandbox, coalescing it with the other
+ * delegations of its target when a coalescing window is set (see coalesce.h),
+ * and through the delegation daemon when there is one (see delegate.h)
+ *
+ * @param target: the full path of the binary to be executed
+ * @param argv: the list of arguments forwarded to execve
+ * @param envp: the environment forwarded to execve
+ */
+static void exechelp_delegate(const char *target, char *const argv[], char *const envp[])
+{
+  long window = exechelp_coalesce_window();
+  const char *socket_path = getenv(EXECHELP_ENV_DELEGATE_SOCKET);
+  char **batch_argv = NULL;
+
+  exechelp_set_delegation_fd(-1);
+
+  if (window > 0)
   {
-    errno = EACCES;
-    ret_value = -1;
+    const char *dir = getenv(EXECHELP_ENV_COALESCE_DIR);
+    char *default_dir = dir ? NULL : exechelp_coalesce_default_dir();
+    int ret = exechelp_coalesce_delegation(dir ? dir : default_dir, window, target, argv, &batch_argv);
+
+    free(default_dir);
+    if (ret == 1)
+    {
+      DEBUG("Child process joined a batch of delegations of '%s'\n", target);
+      return;
+    }
+    if (ret < 0)
+      DEBUG("Child process could not coalesce the delegation of '%s' (%s)\n", target, strerror(errno));
   }
 
-  free(allowed_exec);
-  free(forbidden_exec);
+  if (socket_path)
+  {
+    int fd = exechelp_delegate_request(socket_path, NULL, NULL, target, batch_argv ? batch_argv : argv, NULL);
+    if (fd >= 0)
+    {
+      DEBUG("Child process delegated the execution of '%s' to the daemon at '%s'\n", target, socket_path);
+      exechelp_set_delegation_fd(fd);
+      free(batch_argv);
+      return;
+    }
+    DEBUG("Child process could not delegate '%s' to the daemon at '%s' (%s)\n", target, socket_path, strerror(errno));
+  }
 
-  if (allowed_argv)
-    free(allowed_argv);
+  exechelp_delegate_exec(target, batch_argv ? batch_argv : argv, envp);
+  free(batch_argv);
+}
 
-  if (forbidden_argv)
-    free(forbidden_argv);
+/**
+ * @fn exechelp_child_envp
+ * @brief Builds the environment of an allowed child, which keeps ExecHelper
+ * preloaded and gets the binary associations of its own binary. The
+ * associations are compiled into the library, so those of the last target
+ * are kept for the next exec, which is most often of the same binary.
+ *
+ * @param target: the full path of the binary to be executed
+ * @param envp: the environment forwarded to exec
+ * @return a vector to be freed with free(), or NULL with errno set on error
+ */
+static char **exechelp_child_envp(const char *target, char *const envp[])
+{
+  static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  static char *last_target = NULL, *last_associations = NULL;
+  char **child_envp;
 
-  return ret_value;
+  pthread_mutex_lock(&lock);
+
+  if (!last_target || strcmp(last_target, target) != 0)
+  {
+    /* The associations are exechelp_no_associations rather than an
+     * allocation when the binary is not in the index, but they are an empty
+     * allocation when it is in the index with no other binary */
+    char *associations = exechelp_extract_associations_for_binary(target);
+    char *target_copy = strdup(target);
+
+    if (last_associations != exechelp_no_associations)
+      free(last_associations);
+    if (!target_copy && associations != exechelp_no_associations)
+      free(associations);
+    free(last_target);
+    last_target = target_copy;
+    last_associations = target_copy ? associations : NULL;
+  }
+
+  child_envp = exechelp_env_build(envp, exechelp_env_preload_path(),
+                                  (last_associations && last_associations[0]) ? last_associations : NULL);
+
+  pthread_mutex_unlock(&lock);
+  return child_envp;
 }
 
-int execvpe(const char *file, char *const argv[], char *const envp[])
+EXECHELP_EXPORT int execve(const char *path, char *const argv[], char *const envp[])
+{
+  typeof(execve) *original_execve = dlsym(RTLD_NEXT, "execve");
+  DEBUG("Child process is attempting to execute (execve) binary '%s'\n", path);
+  exechelp_sample_exec(path, __builtin_return_address(0));
+
+  ExecHelpVerdict verdict = exechelp_decide(path, argv, envp);
+
+  /* First getting rid of the denied process/files because we know we will return from
+   * this call.
+   */
+  if (verdict == EXECHELP_VERDICT_DELEGATE)
+    exechelp_delegate(path, argv, envp);
+
+  /* Then executing the allowed process. We might not return.
+   */
+  if (verdict == EXECHELP_VERDICT_ALLOW)
+  {
+    DEBUG("%s", "Child process is allowed to proceed by the sandbox\n");
+
+    char **child_envp = exechelp_child_envp(path, envp);
+    if (!child_envp)
+      return -1;
+
+    exechelp_sample_flush();
+    int ret_value = (*original_execve)(path, argv, child_envp);
+    int saved_errno = errno;
+    free(child_envp);
+    errno = saved_errno;
+    return ret_value;
+  }
+
+  errno = EACCES;
+  return -1;
+}
+
+EXECHELP_EXPORT int execvpe(const char *file, char *const argv[], char *const envp[])
 {
   typeof(execvpe) *original_execvpe = dlsym(RTLD_NEXT, "execvpe");
   DEBUG("Child process is attempting to execute (execvpe) binary name '%s'\n", file);
 
+  exechelp_sample_exec(file, __builtin_return_address(0));
+
   char *path = exechelp_resolve_path(file);
   if (!path)
   {
@@ -314,184 +691,211 @@ int execvpe(const char *file, char *const argv[], char *const envp[])
     return -1;
   }
 
-  char *allowed_exec = NULL, *forbidden_exec = NULL;
-  char **allowed_argv = NULL, **forbidden_argv = NULL;
-  int ret_value = 0;
-
-  exechelp_filter_forbidden_exec(path, argv, envp,
-                                 &allowed_exec, &allowed_argv,
-                                 &forbidden_exec, &forbidden_argv);
+  ExecHelpVerdict verdict = exechelp_decide(path, argv, envp);
+  int ret_value = -1;
 
   /* First getting rid of the denied process/files because we know we will return from
    * this call.
    */
-  if (forbidden_exec)
-  {
-    if (!allowed_exec)
-      DEBUG("Child process delegating the execution of '%s' to the sandbox\n", path); 
-    else
-      DEBUG("Child process must delegate the execution of some parameters of '%s' to the sandbox\n", path); 
-
-    /* Here we execute a fake execvpe to a specific path, so the sandbox gets notified.
-     * We do this rather than deny the system call with a built-in security mechanism
-     * because a seccomp + ptrace combination would require that we compile a new
-     * execvpe seccomp policy every time we want to deny a system call, and that we then
-     * refind and recompile the original seccomp policy, and reload it. This would be
-     * too costly, and ptrace itself cannot prevent the execvpe call from happening so
-     * we rely on the sandboxed process to self-censor instead. Disobeying processes
-     * could be detected by duplicating the checking logic in the trusted daemon that
-     * monitors the execvpe calls of the sandboxed process.
-     */
-    size_t altered_len = strlen(EXECHELP_MONITORED_EXEC_PATH) + (forbidden_exec? strlen(forbidden_exec):0) + 1;
-    char *altered_path = malloc(sizeof(char) * altered_len);
-    snprintf(altered_path, altered_len, "%s%s", EXECHELP_MONITORED_EXEC_PATH, (forbidden_exec? forbidden_exec:""));
-
-    int ret = (*original_execvpe)(altered_path, forbidden_argv, envp);
-    free(altered_path);
-
-    /* Ideally the sandbox is configured to return EACCES for such paths, but the
-     * normal error to be had is ENOENT without a compatible sandbox. We force the
-     * error to EACCES for that reason.
-     */
-    DEBUG("Child process's system call successfully hijacked for sandbox to take over (returned %d)\n", ret);
-  }
+  if (verdict == EXECHELP_VERDICT_DELEGATE)
+    exechelp_delegate(path, argv, envp);
 
-  /* Then executing the allowed process with the allowed parameters. We might not return.
+  /* Then executing the allowed process. We might not return.
    */
-  if (allowed_exec)
+  if (verdict == EXECHELP_VERDICT_ALLOW)
   {
     DEBUG("%s", "Child process is allowed to proceed by the sandbox\n");
-    
-    /* We still execute with 'file' in the rare situation where path returns a ENOEXEC 
+
+    /* We still execute with 'file' in the rare situation where path returns a ENOEXEC
      * file that also fails running in a shell, in which case execvpe would try another
      * entry in the path. We should improve exechelp_resolve_path to better determine
-     * the executability of a path rather than merely checking for permission. However
-     * we want to use allowed_exec if it has been modified compared to the original
-     * path given to the filter function.
+     * the executability of a path rather than merely checking for permission.
      */
-    if (strcmp(path, allowed_exec) == 0)
-      ret_value = (*original_execvpe)(file, allowed_argv, envp);
-    else
-      ret_value = (*original_execvpe)(allowed_exec, allowed_argv, envp);
+    char **child_envp = exechelp_child_envp(path, envp);
+    exechelp_sample_flush();
+    if (child_envp)
+      ret_value = (*original_execvpe)(file, argv, child_envp);
+    int saved_errno = errno;
+    free(child_envp);
+    errno = saved_errno;
   }
   else
-  {
     errno = EACCES;
-    ret_value = -1;
-  }
-
-  free(allowed_exec);
-  free(forbidden_exec);
-
-  if (allowed_argv)
-    free(allowed_argv);
-
-  if (forbidden_argv)
-    free(forbidden_argv);
 
+  int saved_errno = errno;
   free(path);
+  errno = saved_errno;
   return ret_value;
 }
 
-int fexecve(int fd, char *const argv[], char *const envp[])
+EXECHELP_EXPORT int fexecve(int fd, char *const argv[], char *const envp[])
 {
-  if(fd<0)
-  {
-    errno = EINVAL;
-    return -1;
-  }
-
-  size_t len = strlen("/proc/self/fd/") + 48;
-  char *fdpath = malloc(sizeof(char) * len);
-  snprintf(fdpath, len, "/proc/self/fd/%d", fd);
-
-  char *path = exechelp_coreutils_areadlink_with_size(fdpath, 2048);
-  free(fdpath);
+  char *path = exechelp_fd_target(fd);
   if(!path)
   {
     errno = EINVAL;
     return -1;
   }
 
-  typeof(execve) *original_execve = dlsym(RTLD_NEXT, "execve");
   typeof(fexecve) *original_fexecve = dlsym(RTLD_NEXT, "fexecve");
   DEBUG("Child process is attempting to execute (fexecve) file descriptor '%s' (%d)\n", path, fd);
+  exechelp_sample_exec(path, __builtin_return_address(0));
 
-  char *allowed_exec = NULL, *forbidden_exec = NULL;
-  char **allowed_argv = NULL, **forbidden_argv = NULL;
-  int ret_value = 0;
-
-  exechelp_filter_forbidden_exec(path, argv, envp,
-                                 &allowed_exec, &allowed_argv,
-                                 &forbidden_exec, &forbidden_argv);
+  ExecHelpVerdict verdict = exechelp_decide(path, argv, envp);
+  int ret_value = -1;
 
   /* First getting rid of the denied process/files because we know we will return from
    * this call.
    */
-  if (forbidden_exec)
-  {
-    if (!allowed_exec)
-      DEBUG("Child process delegating the execution of '%s' to the sandbox\n", path); 
-    else
-      DEBUG("Child process must delegate the execution of some parameters of '%s' to the sandbox\n", path); 
-
-    /* Here we execute a fake execve to a specific path, so the sandbox gets notified.
-     * We do this rather than deny the system call with a built-in security mechanism
-     * because a seccomp + ptrace combination would require that we compile a new
-     * execve seccomp policy every time we want to deny a system call, and that we then
-     * refind and recompile the original seccomp policy, and reload it. This would be
-     * too costly, and ptrace itself cannot prevent the execve call from happening so
-     * we rely on the sandboxed process to self-censor instead. Disobeying processes
-     * could be detected by duplicating the checking logic in the trusted daemon that
-     * monitors the execve calls of the sandboxed process.
-     */
-    size_t altered_len = strlen(EXECHELP_MONITORED_EXEC_PATH) + (forbidden_exec? strlen(forbidden_exec):0) + 1;
-    char *altered_path = malloc(sizeof(char) * altered_len);
-    snprintf(altered_path, altered_len, "%s%s", EXECHELP_MONITORED_EXEC_PATH, (forbidden_exec? forbidden_exec:""));
-
-    int ret = (*original_execve)(altered_path, forbidden_argv, envp);
-    free(altered_path);
+  if (verdict == EXECHELP_VERDICT_DELEGATE)
+    exechelp_delegate(path, argv, envp);
 
-    /* Ideally the sandbox is configured to return EACCES for such paths, but the
-     * normal error to be had is ENOENT without a compatible sandbox. We force the
-     * error to EACCES for that reason.
-     */
-    DEBUG("Child process's system call successfully hijacked for sandbox to take over (returned %d)\n", ret);
-  }
-
-  /* Then executing the allowed process with the allowed parameters. We might not return.
+  /* Then executing the allowed process. We might not return.
    */
-  if (allowed_exec)
+  if (verdict == EXECHELP_VERDICT_ALLOW)
   {
     DEBUG("%s", "Child process is allowed to proceed by the sandbox\n");
-        
-    /* We still execute with 'file' in the rare situation where the file descriptor has
-     * changed since we read the fd info, because we care most about semantic equivalence
-     * with unpreloaded programs. However we want to use allowed_exec if it has been
-     * modified compared to the original path given to the filter function.
+
+    /* We still execute the file descriptor rather than the path, for semantic
+     * equivalence with unpreloaded programs in the rare situation where the file
+     * descriptor has changed since we read the fd info.
      */
-    if (strcmp(path, allowed_exec) == 0)
-      ret_value = (*original_fexecve)(fd, allowed_argv, envp);
-    else
-      ret_value = (*original_execve)(allowed_exec, allowed_argv, envp);
+    char **child_envp = exechelp_child_envp(path, envp);
+    exechelp_sample_flush();
+    if (child_envp)
+      ret_value = (*original_fexecve)(fd, argv, child_envp);
+    int saved_errno = errno;
+    free(child_envp);
+    errno = saved_errno;
   }
   else
-  {
     errno = EACCES;
-    ret_value = -1;
+
+  int saved_errno = errno;
+  free(path);
+  errno = saved_errno;
+  return ret_value;
+}
+
+/* glibc implements the exec variants below with calls to its internal execve,
+ * which the dynamic linker does not let us interpose. They are wrapped here so
+ * that they go through the same decision as execve and execvpe. The variadic
+ * arguments of the execl family are gathered into an argv on the stack, like
+ * glibc does, so that wrapping them does not cost an allocation.
+ */
+
+/**
+ * @fn exechelp_count_va_args
+ * @brief Counts the arguments of an execl-style call, up to the NULL that
+ * terminates them
+ *
+ * @param arg: the first argument, i.e. argv[0]
+ * @param ap: the remaining arguments, left untouched
+ * @return the number of arguments, or -1 if there are too many to exec
+ */
+static int exechelp_count_va_args(const char *arg, va_list ap)
+{
+  va_list count;
+  int argc = 0;
+
+  if (!arg)
+    return 0;
+
+  va_copy(count, ap);
+  for (argc = 1; va_arg(count, char *); ++argc)
+  {
+    if (argc == INT_MAX - 1)
+    {
+      argc = -1;
+      break;
+    }
   }
+  va_end(count);
 
-  free(allowed_exec);
-  free(forbidden_exec);
+  return argc;
+}
 
-  if (allowed_argv)
-    free(allowed_argv);
+#define EXECHELP_COLLECT_VA_ARGS(argv, argc, arg, ap) \
+  do { \
+    int _i; \
+    (argv)[0] = (char *) (arg); \
+    for (_i = 1; _i <= (argc); ++_i) \
+      (argv)[_i] = va_arg((ap), char *); \
+  } while (0)
 
-  if (forbidden_argv)
-    free(forbidden_argv);
+EXECHELP_EXPORT int execv(const char *path, char *const argv[])
+{
+  DEBUG("Child process is attempting to execute (execv) binary '%s'\n", path);
+  return execve(path, argv, environ);
+}
 
-  free(path);
-  return ret_value;
+EXECHELP_EXPORT int execvp(const char *file, char *const argv[])
+{
+  DEBUG("Child process is attempting to execute (execvp) binary name '%s'\n", file);
+  return execvpe(file, argv, environ);
+}
+
+EXECHELP_EXPORT int execl(const char *path, const char *arg, ...)
+{
+  va_list ap;
+
+  va_start(ap, arg);
+  int argc = exechelp_count_va_args(arg, ap);
+  if (argc < 0)
+  {
+    va_end(ap);
+    errno = E2BIG;
+    return -1;
+  }
+
+  char *argv[argc + 1];
+  EXECHELP_COLLECT_VA_ARGS(argv, argc, arg, ap);
+  va_end(ap);
+
+  DEBUG("Child process is attempting to execute (execl) binary '%s'\n", path);
+  return execve(path, argv, environ);
 }
 
+EXECHELP_EXPORT int execle(const char *path, const char *arg, ...)
+{
+  va_list ap;
+
+  va_start(ap, arg);
+  int argc = exechelp_count_va_args(arg, ap);
+  if (argc < 0)
+  {
+    va_end(ap);
+    errno = E2BIG;
+    return -1;
+  }
+
+  /* The environment follows the NULL that terminates the arguments */
+  char *argv[argc + 1];
+  EXECHELP_COLLECT_VA_ARGS(argv, argc, arg, ap);
+  char *const *envp = va_arg(ap, char *const *);
+  va_end(ap);
+
+  DEBUG("Child process is attempting to execute (execle) binary '%s'\n", path);
+  return execve(path, argv, envp);
+}
 
+EXECHELP_EXPORT int execlp(const char *file, const char *arg, ...)
+{
+  va_list ap;
+
+  va_start(ap, arg);
+  int argc = exechelp_count_va_args(arg, ap);
+  if (argc < 0)
+  {
+    va_end(ap);
+    errno = E2BIG;
+    return -1;
+  }
+
+  char *argv[argc + 1];
+  EXECHELP_COLLECT_VA_ARGS(argv, argc, arg, ap);
+  va_end(ap);
+
+  DEBUG("Child process is attempting to execute (execlp) binary name '%s'\n", file);
+  return execvpe(file, argv, environ);
+}
@@ -172,9 +172,10 @@ exechelp_list_alloc (void)
 void
 exechelp_list_free (ExecHelpList *list)
 {
-  if (list) {
-    exechelp_list_free (list->next); 
+  while (list) {
+    ExecHelpList *next = list->next;
     free (list);
+    list = next;
   }
 }
 
@@ -1113,6 +1114,17 @@ exechelp_list_insert_sorted_with_data (ExecHelpList            *list,
   return exechelp_list_insert_sorted_real (list, data, (ExecHelpFunc) func, user_data);
 }
 
+/* Sorting is a bottom-up merge sort of the natural runs of the list. Runs
+ * are taken from the head of the list, strictly descending ones being
+ * reversed in place, and pushed on a stack where pending[k] holds the merge
+ * of 2^k runs, like the carries of a binary counter. Sorted or nearly sorted
+ * lists thus cost a single pass, and no level of the sort walks the list to
+ * find its middle. Prev pointers are set while the nodes are being linked,
+ * as walking the sorted list again would mostly miss the cache.
+ */
+#define EXECHELP_LIST_SORT_MAX_PENDING 64
+#define EXECHELP_LIST_SORT_MIN_RUN     8
+
 static ExecHelpList *
 exechelp_list_sort_merge (ExecHelpList     *l1, 
                    ExecHelpList     *l2,
@@ -1149,34 +1161,103 @@ exechelp_list_sort_merge (ExecHelpList     *l1,
   return list.next;
 }
 
+static ExecHelpList *
+exechelp_list_sort_take_run (ExecHelpList    *list,
+                      ExecHelpList   **rest,
+                      ExecHelpFunc     compare_func,
+                      void *  user_data)
+{
+  ExecHelpCompareDataFunc cmp = (ExecHelpCompareDataFunc) compare_func;
+  ExecHelpList *run = list, *last = list, *next = list->next, *node, *prev;
+  int length = 1;
+
+  /* Only strictly descending runs are reversed, so the sort stays stable */
+  if (next && cmp (list->data, next->data, user_data) > 0)
+    {
+      list->next = NULL;
+      while (next && cmp (run->data, next->data, user_data) > 0)
+        {
+          node = next;
+          next = node->next;
+          node->next = run;
+          run = node;
+          length++;
+        }
+    }
+  else
+    {
+      while (next && cmp (last->data, next->data, user_data) <= 0)
+        {
+          last = next;
+          next = next->next;
+          length++;
+        }
+      last->next = NULL;
+    }
+
+  /* Short runs are extended by insertion, which is cheaper than merging
+   * many tiny runs while the nodes are still in the cache */
+  for (; next && length < EXECHELP_LIST_SORT_MIN_RUN; ++length)
+    {
+      ExecHelpList **link = &run;
+
+      node = next;
+      next = node->next;
+      if (cmp (last->data, node->data, user_data) <= 0)
+        link = &last->next;
+      else
+        while (cmp ((*link)->data, node->data, user_data) <= 0)
+          link = &(*link)->next;
+
+      node->next = *link;
+      *link = node;
+      if (!node->next)
+        last = node;
+    }
+
+  /* The run is still in the cache, unlike the sorted list will be */
+  for (node = run, prev = NULL; node; prev = node, node = node->next)
+    node->prev = prev;
+
+  *rest = next;
+  return run;
+}
+
 static ExecHelpList * 
 exechelp_list_sort_real (ExecHelpList    *list,
                   ExecHelpFunc     compare_func,
                   void *  user_data)
 {
-  ExecHelpList *l1, *l2;
-  
+  ExecHelpList *pending[EXECHELP_LIST_SORT_MAX_PENDING] = { NULL };
+  ExecHelpList *run;
+  int k, top = 0;
+
   if (!list) 
     return NULL;
   if (!list->next) 
     return list;
 
-  l1 = list; 
-  l2 = list->next;
-
-  while ((l2 = l2->next) != NULL)
+  while (list)
     {
-      if ((l2 = l2->next) == NULL) 
-        break;
-      l1 = l1->next;
+      run = exechelp_list_sort_take_run (list, &list, compare_func, user_data);
+
+      /* Earlier runs go first when merging, for stability */
+      for (k = 0; k < EXECHELP_LIST_SORT_MAX_PENDING - 1 && pending[k]; ++k)
+        {
+          run = exechelp_list_sort_merge (pending[k], run, compare_func, user_data);
+          pending[k] = NULL;
+        }
+      pending[k] = pending[k] ? exechelp_list_sort_merge (pending[k], run, compare_func, user_data) : run;
+      if (k >= top)
+        top = k + 1;
     }
-  l2 = l1->next; 
-  l1->next = NULL; 
 
-  return exechelp_list_sort_merge (exechelp_list_sort_real (list, compare_func, user_data),
-                            exechelp_list_sort_real (l2, compare_func, user_data),
-                            compare_func,
-                            user_data);
+  for (run = NULL, k = 0; k < top; ++k)
+    if (pending[k])
+      run = run ? exechelp_list_sort_merge (pending[k], run, compare_func, user_data) : pending[k];
+  run->prev = NULL;
+
+  return run;
 }
 
 /**
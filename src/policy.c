@@ -0,0 +1,720 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "fsops.h"
+#include "policy.h"
+#include "realpath.h"
+
+/* Indexed decision engine. It makes the same decisions as the legacy
+ * pipeline in lib.c (exechelp_filter_forbidden_exec), with two deliberate
+ * differences that cannot change a verdict:
+ *  - binary lists are matched line by line, whereas the legacy code matches
+ *    any substring of the list file; and binary lists are only read when the
+ *    execution policy lets them change the outcome
+ *  - argument checking stops at the first managed file
+ * Policy files are considered changed when their mtime (to the nanosecond),
+ * size or inode change, rather than only when their mtime in seconds grows.
+ * Lists whose file has been compiled by exechelper-compile since it last
+ * changed are looked up in the mapped compiled policy instead, and so are
+ * lists whose file was only appended to since; the appended lines are then
+ * indexed from the file.
+ */
+
+const char *exechelp_verdict_to_string(ExecHelpVerdict verdict)
+{
+  switch (verdict)
+  {
+    case EXECHELP_VERDICT_ALLOW:
+      return "allow";
+    case EXECHELP_VERDICT_DELEGATE:
+      return "delegate";
+    case EXECHELP_VERDICT_DENY:
+    default:
+      return "deny";
+  }
+}
+
+static int exechelp_policy_compare_lengths(const void *a, const void *b)
+{
+  size_t la = *(const size_t *) a;
+  size_t lb = *(const size_t *) b;
+
+  return (la > lb) - (la < lb);
+}
+
+static void exechelp_policy_list_clear(ExecHelpPolicyList *list)
+{
+  if (list->lines)
+    exechelp_hash_table_destroy(list->lines);
+  free(list->contents);
+  free(list->lengths);
+
+  list->lines = NULL;
+  list->contents = NULL;
+  list->lengths = NULL;
+  list->n_lengths = 0;
+  list->compiled = NULL;
+  list->loaded = 0;
+}
+
+/**
+ * @fn exechelp_policy_reopen_compiled
+ * @brief Maps the current version of the compiled policy in place of the
+ * previous one.
+ *
+ * @param policy: the policy whose compiled policy changed
+ * @return 1 if a compiled policy is mapped, 0 otherwise
+ */
+static int exechelp_policy_reopen_compiled(ExecHelpPolicy *policy)
+{
+  ExecHelpPolicyList *lists[] = { &policy->helper_bins, &policy->managed_bins, &policy->managed_files };
+  ExecHelpCompiledPolicy compiled;
+  size_t i;
+
+  if ((policy->compiled_profile ?
+       exechelp_snapshot_open(&compiled, policy->compiled_path, policy->compiled_profile) :
+       exechelp_compiled_open(&compiled, policy->compiled_path)) != 0)
+    memset(&compiled, 0, sizeof(compiled));
+
+  /* Lists compiled from the same version of their file follow the new
+   * compiled policy, others are reloaded on their next refresh */
+  for (i = 0; i < sizeof(lists) / sizeof(lists[0]); ++i)
+  {
+    ExecHelpPolicyList *list = lists[i];
+    struct stat sb;
+
+    if (!list->compiled)
+      continue;
+
+    sb.st_mtim = list->mtime;
+    sb.st_size = list->size;
+    sb.st_ino = list->ino;
+    if (compiled.data && exechelp_compiled_source_matches(&compiled.lists[list->compiled_index], &sb))
+      list->compiled = &policy->compiled.lists[list->compiled_index];
+    else
+      exechelp_policy_list_clear(list);
+  }
+
+  exechelp_compiled_close(&policy->compiled);
+  policy->compiled = compiled;
+
+  return policy->compiled.data != NULL;
+}
+
+/**
+ * @fn exechelp_policy_list_index
+ * @brief Indexes the lines of a list file into a cleared list
+ *
+ * Lines are split like the legacy matcher in exechelp_file_list_contains_path
+ * splits them: a trailing newline does not make an empty line, but a blank
+ * line anywhere else does (and matches every path as a prefix).
+ *
+ * @param list: the list to index the lines into
+ * @param contents: a malloc'd buffer, owned by the list on success and freed
+ * on failure
+ * @param first: the first line to index, in contents
+ * @return 1 if the lines were indexed, 0 otherwise
+ */
+static int exechelp_policy_list_index(ExecHelpPolicyList *list, char *contents, char *first)
+{
+  size_t n_lines = 0, i;
+  char *line;
+  for (line = first; *line; ++line)
+    n_lines += (*line == EXECHELP_FILE_SEPARATOR_CHR);
+  n_lines++;
+
+  size_t *lengths = malloc(sizeof(size_t) * n_lines);
+  ExecHelpHashTable *lines = exechelp_hash_table_new(exechelp_str_hash, exechelp_str_equal);
+  if (!lengths || !lines)
+  {
+    free(lengths);
+    free(contents);
+    if (lines)
+      exechelp_hash_table_destroy(lines);
+    return 0;
+  }
+
+  n_lines = 0;
+  line = first;
+  while (*line)
+  {
+    char *sep = strchr(line, EXECHELP_FILE_SEPARATOR_CHR);
+    if (sep)
+      *sep = '\0';
+
+    exechelp_hash_table_add(lines, line);
+    lengths[n_lines++] = sep ? (size_t)(sep - line) : strlen(line);
+
+    if (!sep)
+      break;
+    line = sep + 1;
+  }
+
+  /* Only keep distinct lengths */
+  qsort(lengths, n_lines, sizeof(size_t), exechelp_policy_compare_lengths);
+  size_t n_lengths = 0;
+  for (i = 0; i < n_lines; ++i)
+    if (n_lengths == 0 || lengths[n_lengths - 1] != lengths[i])
+      lengths[n_lengths++] = lengths[i];
+
+  list->contents = contents;
+  list->lines = lines;
+  list->lengths = lengths;
+  list->n_lengths = n_lengths;
+
+  DEBUG2("DEBUG: indexed %u distinct lines of %zu distinct lengths from '%s'\n",
+         exechelp_hash_table_size(lines), n_lengths, list->path);
+  return 1;
+}
+
+/**
+ * @fn exechelp_policy_list_use_compiled
+ * @brief Switches a list to its compiled version, if the compiled policy was
+ * built from the current version of the list file
+ *
+ * @param list: the list to switch
+ * @param sb: the stat information of the list file
+ * @return 1 if the list now uses its compiled version, 0 otherwise
+ */
+static int exechelp_policy_list_use_compiled(ExecHelpPolicyList *list, const struct stat *sb)
+{
+  ExecHelpPolicy *policy = list->policy;
+  struct stat csb;
+
+  if (!policy || !policy->compiled_path || exechelp_fs_stat(policy->compiled_path, &csb) != 0)
+    return 0;
+
+  if ((!policy->compiled.data ||
+       policy->compiled.ino != csb.st_ino ||
+       policy->compiled.mtime.tv_sec != csb.st_mtim.tv_sec ||
+       policy->compiled.mtime.tv_nsec != csb.st_mtim.tv_nsec) &&
+      !exechelp_policy_reopen_compiled(policy))
+    return 0;
+
+  const ExecHelpCompiledList *compiled = &policy->compiled.lists[list->compiled_index];
+  if (!exechelp_compiled_source_matches(compiled, sb))
+    return 0;
+
+  /* Lines appended after the compiled ones, which must start a new line */
+  int64_t indexed = compiled->source->indexed_size;
+  ExecHelpPolicyList tail;
+  memset(&tail, 0, sizeof(tail));
+  if (indexed < 0 || indexed > sb->st_size)
+    return 0;
+  if (indexed < sb->st_size)
+  {
+    char *contents = exechelp_fs_read_file_at(list->path, indexed ? indexed - 1 : 0, NULL);
+    if (!contents || (indexed && contents[0] != EXECHELP_FILE_SEPARATOR_CHR))
+    {
+      free(contents);
+      return 0;
+    }
+    if (!exechelp_policy_list_index(&tail, contents, indexed ? contents + 1 : contents))
+      return 0;
+  }
+
+  exechelp_policy_list_clear(list);
+  list->contents = tail.contents;
+  list->lines = tail.lines;
+  list->lengths = tail.lengths;
+  list->n_lengths = tail.n_lengths;
+  list->compiled = compiled;
+  list->mtime = sb->st_mtim;
+  list->size = sb->st_size;
+  list->ino = sb->st_ino;
+  list->loaded = 1;
+
+  DEBUG2("DEBUG: using the compiled index of '%s' (%u lines, %lld bytes appended)\n", list->path,
+         compiled->n_entries, (long long) (sb->st_size - indexed));
+  return 1;
+}
+
+/**
+ * @fn exechelp_policy_list_load
+ * @brief (Re)builds the index of a policy list from its file
+ *
+ * @param list: the list to load, whose previous index is kept on failure
+ * @param sb: the stat information of the list file, recorded on success
+ * @return 1 if the list was loaded, 0 otherwise
+ */
+static int exechelp_policy_list_load(ExecHelpPolicyList *list, const struct stat *sb)
+{
+  ExecHelpPolicyList loaded;
+
+  char *contents = exechelp_fs_read_file(list->path, NULL);
+  if (!contents)
+    return 0;
+
+  memset(&loaded, 0, sizeof(loaded));
+  if (!exechelp_policy_list_index(&loaded, contents, contents))
+    return 0;
+
+  exechelp_policy_list_clear(list);
+  list->contents = loaded.contents;
+  list->lines = loaded.lines;
+  list->lengths = loaded.lengths;
+  list->n_lengths = loaded.n_lengths;
+  list->mtime = sb->st_mtim;
+  list->size = sb->st_size;
+  list->ino = sb->st_ino;
+  list->loaded = 1;
+
+  return 1;
+}
+
+/**
+ * @fn exechelp_policy_list_refresh
+ * @brief Makes sure a policy list reflects the current content of its file.
+ * If the file cannot be read anymore, the last known content is kept, like
+ * exechelp_read_list_from_file does.
+ *
+ * @param list: the list to refresh
+ * @return 1 if the list has an index, 0 if it was never loaded
+ */
+int exechelp_policy_list_refresh(ExecHelpPolicyList *list)
+{
+  struct stat sb;
+
+  if (!list || !list->path)
+    return 0;
+
+  if (exechelp_fs_stat(list->path, &sb) != 0)
+    return list->loaded;
+
+  if (list->loaded &&
+      list->mtime.tv_sec == sb.st_mtim.tv_sec &&
+      list->mtime.tv_nsec == sb.st_mtim.tv_nsec &&
+      list->size == sb.st_size &&
+      list->ino == sb.st_ino)
+    return 1;
+
+  if (!exechelp_policy_list_use_compiled(list, &sb))
+    exechelp_policy_list_load(list, &sb);
+  return list->loaded;
+}
+
+/**
+ * @fn exechelp_policy_list_contains
+ * @brief Tells whether a policy list contains a line
+ *
+ * @param list: an already refreshed list
+ * @param line: the line to look for
+ * @return 1 if the exact line is in the list, 0 otherwise
+ */
+int exechelp_policy_list_contains(ExecHelpPolicyList *list, const char *line)
+{
+  if (!list || !list->loaded || !line)
+    return 0;
+
+  if (list->compiled && exechelp_compiled_list_contains(list->compiled, line))
+    return 1;
+
+  return list->lines && exechelp_hash_table_contains(list->lines, line);
+}
+
+/**
+ * @fn exechelp_policy_list_has_prefix_of
+ * @brief Tells whether a line of a policy list is a prefix of a path, with
+ * the same semantics as exechelp_file_list_contains_path
+ *
+ * @param list: an already refreshed list
+ * @param path: the path to match, which is temporarily truncated in place
+ * to look up each candidate prefix without copying it
+ * @return 1 if a line of the list is a prefix of path, 0 otherwise
+ */
+int exechelp_policy_list_has_prefix_of(ExecHelpPolicyList *list, char *path)
+{
+  size_t len, i;
+  int found = 0;
+
+  if (!list || !list->loaded || !path)
+    return 0;
+
+  if (list->compiled && exechelp_compiled_list_has_prefix_of(list->compiled, path))
+    return 1;
+
+  len = strlen(path);
+  for (i = 0; i < list->n_lengths && list->lengths[i] <= len && !found; ++i)
+  {
+    char saved = path[list->lengths[i]];
+    path[list->lengths[i]] = '\0';
+    found = exechelp_hash_table_contains(list->lines, path);
+    path[list->lengths[i]] = saved;
+  }
+
+  return found;
+}
+
+/* Tells whether a refreshed list has no line at all */
+static int exechelp_policy_list_is_empty(ExecHelpPolicyList *list)
+{
+  return list->n_lengths == 0 && (!list->compiled || list->compiled->n_lengths == 0);
+}
+
+static void exechelp_policy_list_init(ExecHelpPolicyList *list, const char *path,
+                                      ExecHelpPolicy *policy, int compiled_index)
+{
+  memset(list, 0, sizeof(ExecHelpPolicyList));
+  list->path = path;
+  list->policy = policy;
+  list->compiled_index = compiled_index;
+}
+
+ExecHelpPolicy *exechelp_policy_new(const char *helper_bins_path,
+                                    const char *managed_bins_path,
+                                    const char *managed_files_path)
+{
+  ExecHelpPolicy *policy = malloc(sizeof(ExecHelpPolicy));
+  if (!policy)
+    return NULL;
+
+  policy->pol = EXECHELP_DEFAULT_POLICY;
+  policy->compiled_path = NULL;
+  policy->compiled_profile = NULL;
+  memset(&policy->compiled, 0, sizeof(policy->compiled));
+  exechelp_policy_list_init(&policy->helper_bins, helper_bins_path, policy, EXECHELP_COMPILED_HELPER_BINS);
+  exechelp_policy_list_init(&policy->managed_bins, managed_bins_path, policy, EXECHELP_COMPILED_MANAGED_BINS);
+  exechelp_policy_list_init(&policy->managed_files, managed_files_path, policy, EXECHELP_COMPILED_MANAGED_FILES);
+
+  return policy;
+}
+
+/* Stops using the compiled policy, lists using it are reloaded on their next
+ * refresh */
+static void exechelp_policy_drop_compiled(ExecHelpPolicy *policy)
+{
+  if (!policy->compiled.data)
+    return;
+
+  if (policy->helper_bins.compiled)
+    exechelp_policy_list_clear(&policy->helper_bins);
+  if (policy->managed_bins.compiled)
+    exechelp_policy_list_clear(&policy->managed_bins);
+  if (policy->managed_files.compiled)
+    exechelp_policy_list_clear(&policy->managed_files);
+  exechelp_compiled_close(&policy->compiled);
+}
+
+/**
+ * @fn exechelp_policy_set_compiled
+ * @brief Sets the compiled policy to look up lists in when it is up to date
+ * with their files.
+ *
+ * @param policy: the policy
+ * @param compiled_path: the compiled policy written by exechelper-compile,
+ * or NULL to always index the list files
+ */
+void exechelp_policy_set_compiled(ExecHelpPolicy *policy, const char *compiled_path)
+{
+  if (!policy)
+    return;
+
+  exechelp_policy_drop_compiled(policy);
+  policy->compiled_path = compiled_path;
+  policy->compiled_profile = NULL;
+}
+
+/**
+ * @fn exechelp_policy_set_snapshot
+ * @brief Sets the multi-profile snapshot to look up lists in when it is up to
+ * date with their files, like exechelp_policy_set_compiled. The lists of the
+ * policy must be those the profile was compiled from.
+ *
+ * @param policy: the policy
+ * @param snapshot_path: the snapshot written by exechelper-compile -m
+ * @param profile: the name of the profile of the policy in the snapshot
+ */
+void exechelp_policy_set_snapshot(ExecHelpPolicy *policy, const char *snapshot_path, const char *profile)
+{
+  if (!policy)
+    return;
+
+  exechelp_policy_drop_compiled(policy);
+  policy->compiled_path = profile ? snapshot_path : NULL;
+  policy->compiled_profile = profile;
+}
+
+ExecHelpPolicy *exechelp_policy_get_default(void)
+{
+  static ExecHelpPolicy *policy = NULL;
+
+  if (!policy)
+  {
+    policy = exechelp_policy_new(EXECHELP_HELPER_BINS_PATH,
+                                 EXECHELP_MANAGED_BINS_PATH,
+                                 EXECHELP_MANAGED_FILES_PATH);
+    exechelp_policy_set_compiled(policy, EXECHELP_COMPILED_POLICY_PATH);
+  }
+
+  return policy;
+}
+
+void exechelp_policy_free(ExecHelpPolicy *policy)
+{
+  if (!policy)
+    return;
+
+  exechelp_policy_list_clear(&policy->helper_bins);
+  exechelp_policy_list_clear(&policy->managed_bins);
+  exechelp_policy_list_clear(&policy->managed_files);
+  exechelp_compiled_close(&policy->compiled);
+  free(policy);
+}
+
+int exechelp_policy_is_helper(ExecHelpPolicy *policy, const char *target)
+{
+  if (!policy || !exechelp_policy_list_refresh(&policy->helper_bins))
+    return 0;
+
+  return exechelp_policy_list_contains(&policy->helper_bins, target);
+}
+
+int exechelp_policy_is_managed_app(ExecHelpPolicy *policy, const char *target)
+{
+  if (!policy || !exechelp_policy_list_refresh(&policy->managed_bins))
+    return 0;
+
+  return exechelp_policy_list_contains(&policy->managed_bins, target);
+}
+
+int exechelp_policy_is_managed_file(ExecHelpPolicy *policy, char *real)
+{
+  if (!policy || !exechelp_policy_list_refresh(&policy->managed_files))
+    return 0;
+
+  return exechelp_policy_list_has_prefix_of(&policy->managed_files, real);
+}
+
+/* State shared by the decisions of a batch, see exechelp_check_batch */
+typedef struct _ExecHelpCheckContext {
+  const char        *cwd;           /* directory of the current request, or NULL */
+  const char        *home;          /* HOME of the current request, or NULL */
+  char              *real_cwd;      /* canonical cwd, once resolved */
+  int                cwd_resolved;
+  ExecHelpHashTable *cache;         /* argument -> managed + 1 */
+} ExecHelpCheckContext;
+
+/* Lists of a batch are refreshed once by exechelp_check_batch */
+static int exechelp_policy_list_ready(ExecHelpPolicyList *list, ExecHelpCheckContext *ctx)
+{
+  return ctx ? list->loaded : exechelp_policy_list_refresh(list);
+}
+
+/**
+ * @fn exechelp_policy_arg_is_managed
+ * @brief Canonicalizes an argument and tells whether it is a managed file.
+ * Within a batch, relative arguments are resolved against the directory of
+ * their request and '~/' arguments against its HOME, and the outcome is
+ * cached for later requests.
+ *
+ * @param policy: the policy to enforce
+ * @param arg: the argument
+ * @param ctx: the state of the current batch, or NULL
+ * @return 1 if the argument is a managed file or cannot be canonicalized
+ * because it goes over the canonicalizer's limits, 0 otherwise, including
+ * for arguments too long to be a path
+ */
+static int exechelp_policy_arg_is_managed(ExecHelpPolicy *policy, const char *arg, ExecHelpCheckContext *ctx)
+{
+  const char *dir = NULL;
+  char *key = NULL, *real;
+  int managed;
+
+  if (exechelp_arg_exceeds_len_limit(arg))
+    return 0;
+
+  /* Resolved against the request's HOME like the canonicalizer expands them
+   * against $HOME, and cached like relative arguments */
+  if (ctx && ctx->home && arg[0] == '~' && arg[1] == '/')
+  {
+    /* Like the canonicalizer without $HOME */
+    if (!ctx->home[0])
+      return 0;
+
+    dir = ctx->home;
+    arg += 2;
+    while (*arg == '/')
+      arg++;
+    if (!*arg)
+      arg = ".";
+  }
+  else if (ctx && ctx->cwd && arg[0] && arg[0] != '/' && arg[0] != '~')
+  {
+    if (!ctx->cwd_resolved)
+    {
+      ctx->real_cwd = exechelp_coreutils_canonicalize_existing(ctx->cwd);
+      ctx->cwd_resolved = 1;
+    }
+
+    /* Like in a process whose working directory is gone */
+    if (!ctx->real_cwd)
+      return 0;
+    dir = ctx->real_cwd;
+  }
+
+  /* Relative arguments are not joined to their directory, as the joined
+   * path would count more components against the canonicalizer's limits,
+   * so they are cached under their directory's length, directory and name */
+  if (ctx && ctx->cache && (dir || arg[0] == '/'))
+  {
+    if (dir ? asprintf(&key, "%zu:%s/%s", strlen(dir), dir, arg) < 0 : !(key = strdup(arg)))
+      key = NULL;
+
+    void *cached = key ? exechelp_hash_table_lookup(ctx->cache, key) : NULL;
+    if (cached)
+    {
+      free(key);
+      return (int) (intptr_t) cached - 1;
+    }
+  }
+
+  real = exechelp_coreutils_realpath_at(dir, arg);
+  managed = real ? exechelp_policy_list_has_prefix_of(&policy->managed_files, real)
+                 : EXECHELP_REALPATH_OVER_LIMITS(errno);
+  free(real);
+
+  if (key)
+    exechelp_hash_table_insert(ctx->cache, key, (void *) (intptr_t) (managed + 1));
+
+  return managed;
+}
+
+static ExecHelpVerdict exechelp_policy_decide_internal(ExecHelpPolicy *policy, const char *target,
+                                                       char *const argv[], ExecHelpCheckContext *ctx)
+{
+  int i;
+
+  if (!policy || !target || !argv)
+    return EXECHELP_VERDICT_DENY;
+
+  /* Same precedence as the legacy pipeline, except that lists which cannot
+   * change the outcome are not consulted. */
+  if (!(policy->pol & UNSPECIFIED) &&
+      !((policy->pol & HELPERS) && exechelp_policy_list_ready(&policy->helper_bins, ctx) &&
+        exechelp_policy_list_contains(&policy->helper_bins, target)) &&
+      !((policy->pol & SANDBOX_MANAGED) && exechelp_policy_list_ready(&policy->managed_bins, ctx) &&
+        exechelp_policy_list_contains(&policy->managed_bins, target)))
+  {
+    DEBUG2("DEBUG: engine delegates the execution of '%s' because of its binary\n", target);
+    return EXECHELP_VERDICT_DELEGATE;
+  }
+
+  if (!argv[0] || !argv[1])
+    return EXECHELP_VERDICT_ALLOW;
+
+  /* Without any managed file, there is no need to canonicalize arguments */
+  if (!exechelp_policy_list_ready(&policy->managed_files, ctx) || exechelp_policy_list_is_empty(&policy->managed_files))
+    return EXECHELP_VERDICT_ALLOW;
+
+  if (exechelp_argv_exceeds_limits(argv))
+  {
+    DEBUG2("DEBUG: engine delegates the execution of '%s' because it has too many arguments\n", target);
+    return EXECHELP_VERDICT_DELEGATE;
+  }
+
+  for (i = 1; argv[i]; ++i)
+  {
+    if (exechelp_policy_arg_is_managed(policy, argv[i], ctx))
+    {
+      DEBUG2("DEBUG: engine delegates the execution of '%s' because of argument %d ('%s')\n", target, i, argv[i]);
+      return EXECHELP_VERDICT_DELEGATE;
+    }
+  }
+
+  return EXECHELP_VERDICT_ALLOW;
+}
+
+/**
+ * @fn exechelp_policy_decide
+ * @brief Decides whether an execution can proceed within the sandbox or must
+ * be delegated to the sandbox helper
+ *
+ * @param policy: the policy to enforce
+ * @param target: the full path of the binary to be executed
+ * @param argv: the list of arguments forwarded to execve
+ * @return the verdict for this execution
+ */
+ExecHelpVerdict exechelp_policy_decide(ExecHelpPolicy *policy, const char *target, char *const argv[])
+{
+  return exechelp_policy_decide_internal(policy, target, argv, NULL);
+}
+
+/**
+ * @fn exechelp_check_batch
+ * @brief Decides on many executions at once, e.g. for a daemon re-checking
+ * the executions it is asked to perform. Verdicts are those that
+ * exechelp_policy_decide would return for each request from its directory
+ * and with its HOME, but the policy lists are only refreshed once for the
+ * whole batch, the process's working directory and environment are left
+ * untouched, and arguments that occur in several requests are only
+ * canonicalized once.
+ *
+ * Requests are not decided atomically with respect to changes to the
+ * filesystem or to the policy. A policy must not be used by several threads
+ * at once.
+ *
+ * @param policy: the policy to enforce
+ * @param requests: the executions to decide on
+ * @param n_requests: the number of requests
+ * @param verdicts: filled in with the verdict of each request
+ * @return 0 on success, -1 if the arguments are invalid
+ */
+int exechelp_check_batch(ExecHelpPolicy *policy, const ExecHelpCheckRequest *requests,
+                         size_t n_requests, ExecHelpVerdict *verdicts)
+{
+  ExecHelpCheckContext ctx = { NULL, NULL, NULL, 0, NULL };
+  size_t i;
+
+  if (!policy || (n_requests && (!requests || !verdicts)))
+    return -1;
+
+  exechelp_policy_list_refresh(&policy->helper_bins);
+  exechelp_policy_list_refresh(&policy->managed_bins);
+  exechelp_policy_list_refresh(&policy->managed_files);
+
+  if (n_requests > 1 && !exechelp_policy_list_is_empty(&policy->managed_files))
+    ctx.cache = exechelp_hash_table_new_full(exechelp_str_hash, exechelp_str_equal, free, NULL);
+
+  for (i = 0; i < n_requests; ++i)
+  {
+    ctx.cwd = requests[i].cwd;
+    ctx.home = requests[i].home;
+    verdicts[i] = exechelp_policy_decide_internal(policy, requests[i].target, requests[i].argv, &ctx);
+    free(ctx.real_cwd);
+    ctx.real_cwd = NULL;
+    ctx.cwd_resolved = 0;
+  }
+
+  if (ctx.cache)
+    exechelp_hash_table_destroy(ctx.cache);
+
+  return 0;
+}
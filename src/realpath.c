@@ -18,6 +18,7 @@
  */
 
 #include "common.h"
+#include "fsops.h"
 #include "realpath.h"
 #include <errno.h>
 #include <stdio.h>
@@ -54,11 +55,14 @@ enum _exechelp_canonicalize_mode_t
     CAN_MISSING = 2,
 
     /* Don't expand symlinks.  */
-    CAN_NOLINKS = 4
+    CAN_NOLINKS = 4,
+
+    /* Don't expand a leading '~/' to $HOME.  */
+    CAN_NOHOME = 8
   };
 typedef enum _exechelp_canonicalize_mode_t _exechelp_canonicalize_mode_t;
 
-static char *_exechelp_canonicalize_filename_mode (const char *, _exechelp_canonicalize_mode_t);
+static char *_exechelp_canonicalize_filename_mode (const char *, const char *, _exechelp_canonicalize_mode_t);
 
 char *exechelp_coreutils_areadlink_with_size (char const *file, size_t size)
 {
@@ -83,7 +87,7 @@ char *exechelp_coreutils_areadlink_with_size (char const *file, size_t size)
 
     if (buffer == NULL)
       return NULL;
-    r = readlink (file, buffer, buf_size);
+    r = exechelp_fs_readlink (file, buffer, buf_size);
     link_length = r;
 
     /* On AIX 5L v5.3 and HP-UX 11i v2 04/09, readlink returns -1
@@ -146,13 +150,15 @@ static int _exechelp_seen_triple (ExecHelpHashTable **h, char const *filename, s
 }
 
 /* Return the canonical absolute name of file NAME, while treating
- * missing elements according to CAN_MODE.  A canonical name
+ * missing elements according to CAN_MODE.  A relative NAME is resolved
+ * against DIR, which must be canonical, or against the working directory
+ * if DIR is NULL.  A canonical name
  * does not contain any ".", ".." components nor any repeated file name
  * separators ('/') or, depending on other CAN_MODE flags, symlinks.
  * Whether components must exist or not depends on canonicalize mode.
  * The result is malloc'd.
  */
-static char *_exechelp_canonicalize_filename_mode (const char *name, _exechelp_canonicalize_mode_t can_mode)
+static char *_exechelp_canonicalize_filename_mode (const char *dir, const char *name, _exechelp_canonicalize_mode_t can_mode)
 {
   char *rname, *dest, *extra_buf = NULL;
   char const *start;
@@ -163,6 +169,8 @@ static char *_exechelp_canonicalize_filename_mode (const char *name, _exechelp_c
   int saved_errno;
   int can_flags = can_mode & ~CAN_MODE_MASK;
   int logical = can_flags & CAN_NOLINKS;
+  int nohome = can_flags & CAN_NOHOME;
+  int n_symlinks = 0, n_components = 0;
 
   can_mode &= CAN_MODE_MASK;
 
@@ -184,9 +192,15 @@ static char *_exechelp_canonicalize_filename_mode (const char *name, _exechelp_c
     return NULL;
   }
 
+  if (strnlen (name, EXECHELP_MAX_ARG_LEN) == EXECHELP_MAX_ARG_LEN)
+  {
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+
   if (!IS_ABSOLUTE_FILE_NAME (name))
   {
-    if(name[0] == '~')
+    if(name[0] == '~' && !nohome)
     {
       if (!ISSLASH(name[1]))
       {
@@ -217,7 +231,7 @@ static char *_exechelp_canonicalize_filename_mode (const char *name, _exechelp_c
     }
     else
     {
-      rname = getcwd (NULL, 0);
+      rname = dir ? strdup (dir) : exechelp_fs_getcwd (NULL, 0);
       if (!rname)
         return NULL;
       dest = strchr (rname, '\0');
@@ -291,6 +305,14 @@ static char *_exechelp_canonicalize_filename_mode (const char *name, _exechelp_c
       dest += end - start;
       *dest = '\0';
 
+      /* Bound the work an attacker-controlled name can cause, whatever
+       * the canonicalization mode */
+      if (++n_components > EXECHELP_MAX_PATH_COMPONENTS)
+      {
+        saved_errno = ENAMETOOLONG;
+        goto error;
+      }
+
       if (logical && (can_mode == CAN_MISSING))
       {
         /* Avoid the stat in this case as it's inconsequential.
@@ -299,7 +321,7 @@ static char *_exechelp_canonicalize_filename_mode (const char *name, _exechelp_c
          */
         st.st_mode = 0;
       }
-      else if ((logical ? stat (rname, &st) : lstat (rname, &st)) != 0)
+      else if ((logical ? exechelp_fs_stat (rname, &st) : exechelp_fs_lstat (rname, &st)) != 0)
       {
         saved_errno = errno;
         if (can_mode == CAN_EXISTING)
@@ -318,6 +340,12 @@ static char *_exechelp_canonicalize_filename_mode (const char *name, _exechelp_c
         char *buf;
         size_t n, len;
 
+        if (++n_symlinks > EXECHELP_MAX_SYMLINKS)
+        {
+          saved_errno = ELOOP;
+          goto error;
+        }
+
         /* Detect loops.  We cannot use the cycle-check module here,
          * since it's actually possible to encounter the same symlink
          * more than once in a given traversal.  However, encountering
@@ -405,13 +433,22 @@ static char *_exechelp_canonicalize_filename_mode (const char *name, _exechelp_c
 }
 
 char *exechelp_coreutils_realpath (const char *fname)
+{
+  return exechelp_coreutils_realpath_at (NULL, fname);
+}
+
+/* Same as exechelp_coreutils_realpath, with relative names resolved against
+ * the canonical directory DIR rather than the working directory. Unlike
+ * joining DIR and FNAME, this does not count the components of DIR towards
+ * the limits of FNAME. */
+char *exechelp_coreutils_realpath_at (const char *dir, const char *fname)
 {
   int can_mode = CAN_MISSING;
-  char *can_fname = _exechelp_canonicalize_filename_mode (fname, can_mode);
+  char *can_fname = _exechelp_canonicalize_filename_mode (dir, fname, can_mode);
   if (can_fname)  /* canonicalize again to resolve symlinks.  */
   {
     can_mode &= ~CAN_NOLINKS;
-    char *can_fname2 = _exechelp_canonicalize_filename_mode (can_fname, can_mode);
+    char *can_fname2 = _exechelp_canonicalize_filename_mode (NULL, can_fname, can_mode);
     free (can_fname);
     can_fname = can_fname2;
   }
@@ -422,3 +459,8 @@ char *exechelp_coreutils_realpath (const char *fname)
   return can_fname;
 }
 
+/* Same as realpath(3): every component must exist, and '~' is not expanded */
+char *exechelp_coreutils_canonicalize_existing (const char *fname)
+{
+  return _exechelp_canonicalize_filename_mode (NULL, fname, CAN_EXISTING | CAN_NOHOME);
+}
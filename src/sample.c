@@ -0,0 +1,337 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/auxv.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "hash.h"
+#include "sample.h"
+
+/* Backtraces start in the sampler, so they hold a few more frames than are
+ * recorded */
+#define EXECHELP_SAMPLE_MAX_FRAMES  (EXECHELP_SAMPLE_DEPTH + 8)
+
+typedef struct _ExecHelpSample {
+  unsigned int  hash;
+  unsigned int  n_frames;
+  size_t        count;
+  void         *frames[EXECHELP_SAMPLE_DEPTH];
+  char          target[];
+} ExecHelpSample;
+
+static pthread_mutex_t sample_lock = PTHREAD_MUTEX_INITIALIZER;
+static long sample_period = -1;
+static uint64_t sample_state = 0;
+static int sample_fd = -1;
+static int sample_forked = 0;
+static void *sample_self_base = NULL;
+static ExecHelpHashTable *sample_sites = NULL;
+
+static unsigned int exechelp_sample_hash(const void *v)
+{
+  return ((const ExecHelpSample *) v)->hash;
+}
+
+static int exechelp_sample_equal(const void *v1, const void *v2)
+{
+  const ExecHelpSample *a = v1, *b = v2;
+
+  return a->hash == b->hash && a->n_frames == b->n_frames &&
+         memcmp(a->frames, b->frames, sizeof(void *) * a->n_frames) == 0 &&
+         strcmp(a->target, b->target) == 0;
+}
+
+/* Seeds the generator that picks the calls to sample. Calls are picked at
+ * random rather than counted, as most processes that exec are forked
+ * children that exec once, and would otherwise all pick their first call. */
+static void exechelp_sample_seed(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  sample_state = ((uint64_t) getpid() << 32) ^ (uint64_t) ts.tv_nsec ^ ((uint64_t) ts.tv_sec << 20);
+  if (!sample_state)
+    sample_state = 1;
+}
+
+/* xorshift64* */
+static uint64_t exechelp_sample_random(void)
+{
+  sample_state ^= sample_state >> 12;
+  sample_state ^= sample_state << 25;
+  sample_state ^= sample_state >> 27;
+  return sample_state * 0x2545f4914f6cdd1dULL;
+}
+
+static void exechelp_sample_prepare_fork(void)
+{
+  pthread_mutex_lock(&sample_lock);
+}
+
+static void exechelp_sample_parent_fork(void)
+{
+  pthread_mutex_unlock(&sample_lock);
+}
+
+/* The counts inherited by a forked child are the parent's, which writes
+ * them. Children mostly exec or _exit soon, so they write their own samples
+ * as soon as they are taken. */
+static void exechelp_sample_child_fork(void)
+{
+  exechelp_hash_table_remove_all(sample_sites);
+  sample_forked = 1;
+  exechelp_sample_seed();
+  pthread_mutex_unlock(&sample_lock);
+}
+
+/**
+ * @fn exechelp_sample_init
+ * @brief Reads the sampling settings, and prepares the sampler if sampling is
+ * enabled. Called with sample_lock held.
+ */
+static void exechelp_sample_init(void)
+{
+  const char *value = getenv(EXECHELP_ENV_SAMPLE);
+  const char *dest = getenv(EXECHELP_ENV_SAMPLE_LOG);
+  Dl_info self, program;
+
+  sample_period = value ? strtol(value, NULL, 10) : 0;
+  if (sample_period <= 0)
+  {
+    sample_period = 0;
+    return;
+  }
+
+  if (!dest || dest[0] == '\0' || strcmp(dest, "stderr") == 0)
+    sample_fd = STDERR_FILENO;
+  else
+    sample_fd = open(dest, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+
+  sample_sites = exechelp_hash_table_new_full(exechelp_sample_hash, exechelp_sample_equal, free, NULL);
+  if (sample_fd < 0 || !sample_sites)
+  {
+    sample_period = 0;
+    return;
+  }
+
+  /* Frames of the library are not call sites, unless the library is linked
+   * into the program itself */
+  if (dladdr((void *) exechelp_sample_init, &self) &&
+      !(dladdr((void *) getauxval(AT_PHDR), &program) && program.dli_fbase == self.dli_fbase))
+    sample_self_base = self.dli_fbase;
+
+  /* backtrace() loads the unwinder on its first call, which is better done
+   * now than in the middle of an exec */
+  void *frame;
+  backtrace(&frame, 1);
+
+  exechelp_sample_seed();
+  pthread_atfork(exechelp_sample_prepare_fork, exechelp_sample_parent_fork, exechelp_sample_child_fork);
+  atexit(exechelp_sample_flush);
+}
+
+/* The sampler is set up when the library is loaded, so that it is ready
+ * before the app forks any child */
+__attribute__((constructor))
+static void exechelp_sample_load(void)
+{
+  pthread_mutex_lock(&sample_lock);
+  if (sample_period < 0)
+    exechelp_sample_init();
+  pthread_mutex_unlock(&sample_lock);
+}
+
+/* Writes a frame as an offset in its object, which does not vary with the
+ * address the object is loaded at */
+static void exechelp_sample_print_frame(FILE *out, void *frame)
+{
+  Dl_info info;
+  const char *name;
+
+  if (!dladdr(frame, &info) || !info.dli_fname)
+  {
+    fprintf(out, "%p", frame);
+    return;
+  }
+
+  name = info.dli_fname[0] ? info.dli_fname : "[program]";
+  if (info.dli_sname && info.dli_saddr)
+    fprintf(out, "%s(%s+0x%lx)", name, info.dli_sname,
+            (unsigned long) ((char *) frame - (char *) info.dli_saddr));
+  else
+    fprintf(out, "%s+0x%lx", name, (unsigned long) ((char *) frame - (char *) info.dli_fbase));
+}
+
+/**
+ * @fn exechelp_sample_write
+ * @brief Writes the samples counted so far in one write(), and forgets them.
+ * Called with sample_lock held.
+ */
+static void exechelp_sample_write(void)
+{
+  ExecHelpHashTableIter iter;
+  ExecHelpSample *sample;
+  char *buf = NULL, *c;
+  size_t size = 0;
+  unsigned int i;
+
+  if (!sample_sites || exechelp_hash_table_size(sample_sites) == 0)
+    return;
+
+  FILE *out = open_memstream(&buf, &size);
+  if (!out)
+    return;
+
+  exechelp_hash_table_iter_init(&iter, sample_sites);
+  while (exechelp_hash_table_iter_next(&iter, (void **) &sample, NULL))
+  {
+    /* Fields are separated by tabs and lines by newlines */
+    for (c = sample->target; *c; ++c)
+      if (*c == '\t' || *c == '\n')
+        *c = '?';
+
+    fprintf(out, "%zu\t%ld\t%s\t", sample->count, sample_period, sample->target);
+    for (i = 0; i < sample->n_frames; ++i)
+    {
+      if (i)
+        fputc(' ', out);
+      exechelp_sample_print_frame(out, sample->frames[i]);
+    }
+    fputc('\n', out);
+  }
+
+  if (fclose(out) == 0)
+  {
+    size_t done = 0;
+    while (done < size)
+    {
+      ssize_t written = write(sample_fd, buf + done, size - done);
+      if (written < 0 && errno == EINTR)
+        continue;
+      if (written <= 0)
+        break;
+      done += written;
+    }
+  }
+  free(buf);
+
+  exechelp_hash_table_remove_all(sample_sites);
+}
+
+/**
+ * @fn exechelp_sample_exec
+ * @brief Counts an interposed exec call, and records where it was made from
+ * if it is the one in EXECHELP_SAMPLE to be sampled
+ *
+ * @param target: the binary being executed, as passed by the app, which may
+ * be NULL
+ * @param caller: the return address of the exported exec function, where the
+ * call site starts
+ */
+__attribute__((noinline))
+void exechelp_sample_exec(const char *target, const void *caller)
+{
+  void *frames[EXECHELP_SAMPLE_MAX_FRAMES];
+  int n, first = 1, saved_errno = errno;
+
+  if (sample_period == 0)
+    return;
+
+  pthread_mutex_lock(&sample_lock);
+
+  if (sample_period < 0)
+    exechelp_sample_init();
+  if (sample_period == 0 || exechelp_sample_random() % sample_period != 0)
+    goto out;
+
+  n = backtrace(frames, EXECHELP_SAMPLE_MAX_FRAMES);
+  while (first < n && frames[first] != caller)
+    first++;
+  if (first == n)
+    first = 1;
+
+  if (sample_self_base)
+  {
+    Dl_info info;
+    while (first < n && dladdr(frames[first], &info) && info.dli_fbase == sample_self_base)
+      first++;
+  }
+
+  /* The exec call fails later on, but its call site is still worth knowing */
+  if (!target)
+    target = "(null)";
+
+  size_t target_len = strlen(target) + 1;
+  ExecHelpSample *sample = malloc(sizeof(ExecHelpSample) + target_len), *site;
+  if (!sample)
+    goto out;
+
+  sample->count = 1;
+  sample->n_frames = n - first < EXECHELP_SAMPLE_DEPTH ? n - first : EXECHELP_SAMPLE_DEPTH;
+  memcpy(sample->frames, frames + first, sizeof(void *) * sample->n_frames);
+  memcpy(sample->target, target, target_len);
+  sample->hash = exechelp_str_hash(target);
+  for (n = 0; n < (int) sample->n_frames; ++n)
+    sample->hash = sample->hash * 31 + (unsigned int) ((uintptr_t) sample->frames[n] >> 2);
+
+  site = exechelp_hash_table_lookup(sample_sites, sample);
+  if (site)
+  {
+    site->count++;
+    free(sample);
+  }
+  else
+    exechelp_hash_table_add(sample_sites, sample);
+
+  if (sample_forked)
+    exechelp_sample_write();
+
+out:
+  pthread_mutex_unlock(&sample_lock);
+  errno = saved_errno;
+}
+
+/**
+ * @fn exechelp_sample_flush
+ * @brief Writes the samples counted so far, before the process exits or
+ * replaces itself
+ */
+void exechelp_sample_flush(void)
+{
+  if (sample_period <= 0)
+    return;
+
+  int saved_errno = errno;
+  pthread_mutex_lock(&sample_lock);
+  exechelp_sample_write();
+  pthread_mutex_unlock(&sample_lock);
+  errno = saved_errno;
+}
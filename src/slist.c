@@ -35,9 +35,10 @@ exechelp_slist_alloc (void)
 void
 exechelp_slist_free (ExecHelpSList *list)
 {
-  if (list) {
-    exechelp_slist_free (list->next);
+  while (list) {
+    ExecHelpSList *next = list->next;
     free (list);
+    list = next;
   }
 }
 
@@ -532,6 +533,10 @@ exechelp_slist_insert_sorted_with_data (ExecHelpSList *list,
   return exechelp_slist_insert_sorted_real (list, data, (ExecHelpFunc) func, user_data);
 }
 
+/* Bottom-up merge sort of the natural runs of the list, see list.c */
+#define EXECHELP_SLIST_SORT_MAX_PENDING 64
+#define EXECHELP_SLIST_SORT_MIN_RUN     8
+
 static ExecHelpSList *
 exechelp_slist_sort_merge (ExecHelpSList *l1,
                     ExecHelpSList *l2,
@@ -563,35 +568,100 @@ exechelp_slist_sort_merge (ExecHelpSList *l1,
   return list.next;
 }
 
+static ExecHelpSList *
+exechelp_slist_sort_take_run (ExecHelpSList *list,
+                       ExecHelpSList **rest,
+                       ExecHelpFunc compare_func,
+                       void * user_data)
+{
+  ExecHelpCompareDataFunc cmp = (ExecHelpCompareDataFunc) compare_func;
+  ExecHelpSList *run = list, *last = list, *next = list->next;
+  int length = 1;
+
+  /* Only strictly descending runs are reversed, so the sort stays stable */
+  if (next && cmp (list->data, next->data, user_data) > 0)
+    {
+      list->next = NULL;
+      while (next && cmp (run->data, next->data, user_data) > 0)
+        {
+          ExecHelpSList *node = next;
+
+          next = node->next;
+          node->next = run;
+          run = node;
+          length++;
+        }
+    }
+  else
+    {
+      while (next && cmp (last->data, next->data, user_data) <= 0)
+        {
+          last = next;
+          next = next->next;
+          length++;
+        }
+      last->next = NULL;
+    }
+
+  /* Short runs are extended by insertion, which is cheaper than merging
+   * many tiny runs while the nodes are still in the cache */
+  for (; next && length < EXECHELP_SLIST_SORT_MIN_RUN; ++length)
+    {
+      ExecHelpSList *node = next, **link = &run;
+
+      next = node->next;
+      if (cmp (last->data, node->data, user_data) <= 0)
+        link = &last->next;
+      else
+        while (cmp ((*link)->data, node->data, user_data) <= 0)
+          link = &(*link)->next;
+
+      node->next = *link;
+      *link = node;
+      if (!node->next)
+        last = node;
+    }
+
+  *rest = next;
+  return run;
+}
+
 static ExecHelpSList *
 exechelp_slist_sort_real (ExecHelpSList *list,
                    ExecHelpFunc compare_func,
                    void * user_data)
 {
-  ExecHelpSList *l1, *l2;
+  ExecHelpSList *pending[EXECHELP_SLIST_SORT_MAX_PENDING] = { NULL };
+  ExecHelpSList *run;
+  int k, top = 0;
 
   if (!list)
     return NULL;
   if (!list->next)
     return list;
 
-  l1 = list;
-  l2 = list->next;
-
-  while ((l2 = l2->next) != NULL)
+  while (list)
     {
-      if ((l2 = l2->next) == NULL)
-        break;
-      l1=l1->next;
+      run = exechelp_slist_sort_take_run (list, &list, compare_func, user_data);
+
+      /* Earlier runs go first when merging, for stability */
+      for (k = 0; k < EXECHELP_SLIST_SORT_MAX_PENDING - 1 && pending[k]; ++k)
+        {
+          run = exechelp_slist_sort_merge (pending[k], run, compare_func, user_data);
+          pending[k] = NULL;
+        }
+      pending[k] = pending[k] ? exechelp_slist_sort_merge (pending[k], run, compare_func, user_data) : run;
+      if (k >= top)
+        top = k + 1;
     }
-  l2 = l1->next;
-  l1->next = NULL;
 
-  return exechelp_slist_sort_merge (exechelp_slist_sort_real (list, compare_func, user_data),
-                             exechelp_slist_sort_real (l2, compare_func, user_data),
-                             compare_func,
-                             user_data);
+  for (run = NULL, k = 0; k < top; ++k)
+    if (pending[k])
+      run = run ? exechelp_slist_sort_merge (pending[k], run, compare_func, user_data) : pending[k];
+
+  return run;
 }
+
 ExecHelpSList *
 exechelp_slist_sort (ExecHelpSList *list,
               ExecHelpCompareFunc compare_func)
@@ -0,0 +1,261 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "trace.h"
+
+#ifndef PATH_MAX
+# define PATH_MAX 8192
+#endif
+
+static const char *exechelp_trace_env[] = EXECHELP_TRACE_ENV;
+
+/**
+ * @fn exechelp_trace_open
+ * @brief Opens an exec trace for appending records
+ *
+ * @param path: the path of the trace, created if needed
+ * @return a file descriptor, or -1 on error
+ */
+int exechelp_trace_open(const char *path)
+{
+  if (!path || path[0] == '\0')
+    return -1;
+
+  return open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+}
+
+/**
+ * @fn exechelp_trace_write
+ * @brief Appends the record of an exec decision to a trace, along with the
+ * current working directory and the environment variables it depends on
+ *
+ * @param fd: a trace opened with exechelp_trace_open
+ * @param target: the full path of the binary to be executed
+ * @param argv: the list of arguments forwarded to execve
+ * @param verdict: the verdict that was enforced
+ * @return 0 on success, -1 on error
+ */
+int exechelp_trace_write(int fd, const char *target, char *const argv[], ExecHelpVerdict verdict)
+{
+  char cwd[PATH_MAX];
+  const char *env[sizeof(exechelp_trace_env) / sizeof(exechelp_trace_env[0])];
+  size_t payload = EXECHELP_TRACE_HEADER_SIZE - 2 * sizeof(uint32_t);
+  int argc = 0, nenv = 0, i;
+
+  if (fd < 0 || !target)
+    return -1;
+
+  if (!getcwd(cwd, sizeof(cwd)))
+    cwd[0] = '\0';
+
+  payload += strlen(cwd) + 1 + strlen(target) + 1;
+  for (argc = 0; argv && argv[argc] && argc < UINT16_MAX; ++argc)
+    payload += strlen(argv[argc]) + 1;
+
+  for (i = 0; exechelp_trace_env[i]; ++i)
+  {
+    const char *value = getenv(exechelp_trace_env[i]);
+    if (value)
+    {
+      /* Point to the NAME=value string owned by environ */
+      env[nenv++] = value - strlen(exechelp_trace_env[i]) - 1;
+      payload += strlen(env[nenv - 1]) + 1;
+    }
+  }
+
+  if (payload > UINT32_MAX)
+    return -1;
+
+  char *record = malloc(2 * sizeof(uint32_t) + payload);
+  if (!record)
+    return -1;
+
+  uint32_t magic = EXECHELP_TRACE_MAGIC, len = payload;
+  uint16_t argc16 = argc, nenv16 = nenv, reserved = 0;
+  char *p = record;
+
+  memcpy(p, &magic, sizeof(magic));       p += sizeof(magic);
+  memcpy(p, &len, sizeof(len));           p += sizeof(len);
+  *p++ = (char) verdict;
+  *p++ = 0;
+  memcpy(p, &argc16, sizeof(argc16));     p += sizeof(argc16);
+  memcpy(p, &nenv16, sizeof(nenv16));     p += sizeof(nenv16);
+  memcpy(p, &reserved, sizeof(reserved)); p += sizeof(reserved);
+
+  p = stpcpy(p, cwd) + 1;
+  p = stpcpy(p, target) + 1;
+  for (i = 0; i < argc; ++i)
+    p = stpcpy(p, argv[i]) + 1;
+  for (i = 0; i < nenv; ++i)
+    p = stpcpy(p, env[i]) + 1;
+
+  ssize_t size = p - record;
+  ssize_t written = write(fd, record, size);
+  free(record);
+
+  return written == size ? 0 : -1;
+}
+
+/**
+ * @fn exechelp_trace_reader_open
+ * @brief Maps an exec trace for reading
+ *
+ * @param reader: the reader to initialise
+ * @param path: the path of the trace
+ * @return 0 on success, -1 on error
+ */
+int exechelp_trace_reader_open(ExecHelpTraceReader *reader, const char *path)
+{
+  struct stat sb;
+  int fd;
+
+  memset(reader, 0, sizeof(ExecHelpTraceReader));
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  if (fstat(fd, &sb) != 0)
+  {
+    close(fd);
+    return -1;
+  }
+
+  if (sb.st_size > 0)
+  {
+    void *data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+      close(fd);
+      return -1;
+    }
+    reader->data = data;
+    reader->size = sb.st_size;
+  }
+
+  close(fd);
+  return 0;
+}
+
+/* Returns the string at *offset if it is NUL-terminated before end, and
+ * moves *offset past it */
+static const char *exechelp_trace_next_string(const char *data, size_t *offset, size_t end)
+{
+  const char *str = data + *offset;
+  const char *nul = memchr(str, '\0', end - *offset);
+
+  if (!nul)
+    return NULL;
+
+  *offset += nul - str + 1;
+  return str;
+}
+
+/**
+ * @fn exechelp_trace_reader_next
+ * @brief Reads the next record of a trace. The strings of the record point
+ * into the trace and its vectors into the reader, so they remain valid until
+ * the next call.
+ *
+ * @param reader: an opened reader
+ * @param record: the record to fill
+ * @return 1 if a record was read, 0 at the end of the trace, -1 if the
+ * trace is corrupted
+ */
+int exechelp_trace_reader_next(ExecHelpTraceReader *reader, ExecHelpTraceRecord *record)
+{
+  uint32_t magic, len;
+  uint16_t argc, nenv;
+  size_t offset = reader->offset, end;
+  int i;
+
+  if (offset == reader->size)
+    return 0;
+  if (reader->size - offset < EXECHELP_TRACE_HEADER_SIZE)
+    return -1;
+
+  memcpy(&magic, reader->data + offset, sizeof(magic));
+  memcpy(&len, reader->data + offset + sizeof(magic), sizeof(len));
+  offset += 2 * sizeof(uint32_t);
+
+  if (magic != EXECHELP_TRACE_MAGIC || len > reader->size - offset)
+    return -1;
+  end = offset + len;
+
+  record->verdict = (ExecHelpVerdict) reader->data[offset];
+  memcpy(&argc, reader->data + offset + 2, sizeof(argc));
+  memcpy(&nenv, reader->data + offset + 4, sizeof(nenv));
+  offset += EXECHELP_TRACE_HEADER_SIZE - 2 * sizeof(uint32_t);
+
+  if (reader->vec_len < (size_t) argc + nenv + 2)
+  {
+    char **vec = realloc(reader->vec, sizeof(char *) * (argc + nenv + 2));
+    if (!vec)
+      return -1;
+    reader->vec = vec;
+    reader->vec_len = argc + nenv + 2;
+  }
+
+  record->argc = argc;
+  record->nenv = nenv;
+  record->argv = reader->vec;
+  record->env = reader->vec + argc + 1;
+
+  if (!(record->cwd = exechelp_trace_next_string(reader->data, &offset, end)) ||
+      !(record->target = exechelp_trace_next_string(reader->data, &offset, end)))
+    return -1;
+
+  for (i = 0; i < argc; ++i)
+    if (!(record->argv[i] = (char *) exechelp_trace_next_string(reader->data, &offset, end)))
+      return -1;
+  record->argv[argc] = NULL;
+
+  for (i = 0; i < nenv; ++i)
+    if (!(record->env[i] = (char *) exechelp_trace_next_string(reader->data, &offset, end)))
+      return -1;
+  record->env[nenv] = NULL;
+
+  reader->offset = end;
+  return 1;
+}
+
+void exechelp_trace_reader_rewind(ExecHelpTraceReader *reader)
+{
+  reader->offset = 0;
+}
+
+void exechelp_trace_reader_close(ExecHelpTraceReader *reader)
+{
+  if (reader->data)
+    munmap((void *) reader->data, reader->size);
+  free(reader->vec);
+  memset(reader, 0, sizeof(ExecHelpTraceReader));
+}
@@ -0,0 +1,1043 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Tracker of managed files, used by exechelper-track (see track.h). Entries
+ * are looked up by path when a file event arrives, so that following a file
+ * costs the same whatever the size of the list; only directory events scan
+ * the list and the watches, for the entries and watched directories they
+ * contain. Entries are kept in the order of the list, and the new paths of
+ * moved entries are appended to it. Once all pending events are applied,
+ * the new lines are appended to the published list in place, so publishing
+ * them costs the same whatever the size of the list, and so does updating
+ * the compiled policy (see exechelp_compiled_append_source). The list is
+ * only rewritten next to the published one and renamed over it when lines
+ * are removed, or when it does not end with a newline.
+ *
+ * The list may also be edited by someone else, e.g. by an administrator or
+ * by a tool that rescans the file system. Before publishing, the tracker compares the
+ * list with the version it last read or published, and merges the changes
+ * made since: lines added by others are followed too, and lines they removed
+ * are dropped, while the tracker's own changes are kept.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "compiled.h"
+#include "track.h"
+
+#define TRACK_MASK  (IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+#define TRACK_BUFFER_SIZE  65536
+/* Times a list that keeps changing is merged before giving up publishing */
+#define TRACK_MAX_MERGES   8
+
+typedef struct _TrackWatch {
+  int   wd;
+  char *path;
+} TrackWatch;
+
+typedef struct _TrackMove {
+  uint32_t  cookie;
+  char     *path;
+  int       is_dir;
+} TrackMove;
+
+struct _ExecHelpTracker {
+  char               *list_path;
+  mode_t              list_mode;
+  struct stat         list_sb;    /* the list as last read or published */
+  ExecHelpHashTable  *published;  /* lines of the list as last read or published */
+  size_t              n_published; /* lines after these are not published yet */
+  int                 ends_line;  /* whether the published list ends with a newline */
+  int                 rewrite;    /* whether published lines were removed */
+  char               *compiled_path;
+  FILE               *log;
+  int                 fd;
+  char              **lines;      /* lines of the list, NULL once removed */
+  unsigned char      *gone;       /* whether each line was deleted or moved away */
+  size_t              n_lines;
+  ExecHelpHashTable  *entries;    /* entry path without trailing '/' -> line + 1 */
+  TrackWatch         *watches;
+  size_t              n_watches;
+  ExecHelpHashTable  *by_wd;      /* wd -> watch + 1 */
+  TrackMove          *moves;      /* IN_MOVED_FROM events awaiting their IN_MOVED_TO */
+  size_t              n_moves;
+  ExecHelpTrackStats  stats;
+};
+
+#define TRACK_INDEX(value)   ((size_t) (uintptr_t) (value) - 1)
+#define TRACK_VALUE(index)   ((void *) (uintptr_t) ((index) + 1))
+
+static long track_elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+  return (end->tv_sec - start->tv_sec) * 1000000000L + (end->tv_nsec - start->tv_nsec);
+}
+
+/* Returns the path an entry is tracked under, which has no trailing '/' */
+static char *track_entry_key(const char *line)
+{
+  size_t len = strlen(line);
+
+  while (len > 1 && line[len - 1] == '/')
+    --len;
+
+  return len > 1 ? strndup(line, len) : NULL;
+}
+
+/* Tells whether path is dir or is inside dir */
+static int track_is_under(const char *path, const char *dir, size_t dir_len)
+{
+  return strncmp(path, dir, dir_len) == 0 && (path[dir_len] == '\0' || path[dir_len] == '/');
+}
+
+/* Returns a copy of path with its prefix from replaced with to */
+static char *track_rebase(const char *path, size_t from_len, const char *to)
+{
+  char *rebased = NULL;
+
+  if (asprintf(&rebased, "%s%s", to, path + from_len) < 0)
+    return NULL;
+
+  return rebased;
+}
+
+/* Tells whether two stat results are of the same version of a file */
+static int track_same_version(const struct stat *a, const struct stat *b)
+{
+  return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+         a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static void track_free_lines(char **lines, size_t n_lines)
+{
+  size_t i;
+
+  for (i = 0; i < n_lines; ++i)
+    free(lines[i]);
+  free(lines);
+}
+
+/* Reads the lines of a list, the stat information of the version read, and
+ * whether it ends with a newline */
+static int track_read_lines(const char *path, char ***lines_out, size_t *n_out, struct stat *sb,
+                            int *ends_line)
+{
+  char *contents, *line, *save = NULL, **lines = NULL;
+  size_t capacity = 0, n_lines = 0;
+  FILE *file;
+
+  file = fopen(path, "re");
+  if (!file)
+    return -1;
+
+  if (fstat(fileno(file), sb) != 0)
+  {
+    fclose(file);
+    return -1;
+  }
+
+  contents = malloc(sb->st_size + 1);
+  if (!contents || fread(contents, 1, sb->st_size, file) != (size_t) sb->st_size)
+  {
+    free(contents);
+    fclose(file);
+    return -1;
+  }
+  contents[sb->st_size] = '\0';
+  fclose(file);
+  *ends_line = sb->st_size == 0 || contents[sb->st_size - 1] == EXECHELP_FILE_SEPARATOR_CHR;
+
+  for (line = strtok_r(contents, EXECHELP_FILE_SEPARATOR, &save); line;
+       line = strtok_r(NULL, EXECHELP_FILE_SEPARATOR, &save))
+  {
+    if (n_lines == capacity)
+    {
+      capacity = capacity ? capacity * 2 : 64;
+      char **grown = realloc(lines, sizeof(char *) * capacity);
+      if (!grown)
+        goto fail;
+      lines = grown;
+    }
+
+    if (!(lines[n_lines] = strdup(line)))
+      goto fail;
+    n_lines++;
+  }
+
+  free(contents);
+  *lines_out = lines;
+  *n_out = n_lines;
+  return 0;
+
+  fail:
+  free(contents);
+  track_free_lines(lines, n_lines);
+  return -1;
+}
+
+/* Remembers the lines of the list as they were published */
+static int track_set_published(ExecHelpTracker *tracker, char **lines, size_t n_lines)
+{
+  size_t i;
+
+  exechelp_hash_table_remove_all(tracker->published);
+
+  for (i = 0; i < n_lines; ++i)
+  {
+    char *line;
+
+    if (!lines[i] || exechelp_hash_table_contains(tracker->published, lines[i]))
+      continue;
+    if (!(line = strdup(lines[i])) || !exechelp_hash_table_add(tracker->published, line))
+      return -1;
+  }
+
+  return 0;
+}
+
+static int track_read_list(ExecHelpTracker *tracker)
+{
+  if (track_read_lines(tracker->list_path, &tracker->lines, &tracker->n_lines, &tracker->list_sb,
+                       &tracker->ends_line) != 0)
+    return -1;
+  tracker->list_mode = tracker->list_sb.st_mode & 07777;
+  tracker->n_published = tracker->n_lines;
+
+  tracker->gone = calloc(tracker->n_lines ? tracker->n_lines : 1, 1);
+  if (!tracker->gone)
+    return -1;
+
+  return track_set_published(tracker, tracker->lines, tracker->n_lines);
+}
+
+/* Appends a line to the list, and returns its index or -1 */
+static ssize_t track_add_line(ExecHelpTracker *tracker, char *line)
+{
+  char **lines = realloc(tracker->lines, sizeof(char *) * (tracker->n_lines + 1));
+  if (lines)
+    tracker->lines = lines;
+
+  unsigned char *gone = realloc(tracker->gone, tracker->n_lines + 1);
+  if (gone)
+    tracker->gone = gone;
+
+  if (!lines || !gone)
+    return -1;
+
+  lines[tracker->n_lines] = line;
+  gone[tracker->n_lines] = 0;
+  return tracker->n_lines++;
+}
+
+/* Removes a line from the list, and stops following its entry */
+static void track_drop_line(ExecHelpTracker *tracker, size_t line)
+{
+  char *key = track_entry_key(tracker->lines[line]);
+
+  if (key && exechelp_hash_table_lookup(tracker->entries, key) == TRACK_VALUE(line))
+  {
+    exechelp_hash_table_remove(tracker->entries, key);
+    tracker->stats.entries--;
+  }
+  free(key);
+  free(tracker->lines[line]);
+  tracker->lines[line] = NULL;
+  tracker->gone[line] = 0;
+}
+
+static int track_watch(ExecHelpTracker *tracker, ExecHelpHashTable *by_path, const char *dir)
+{
+  int wd;
+
+  if (exechelp_hash_table_contains(by_path, dir))
+    return 0;
+
+  wd = inotify_add_watch(tracker->fd, dir, TRACK_MASK);
+  if (wd < 0)
+  {
+    if (tracker->log)
+      fprintf(tracker->log, "Cannot watch '%s': %s\n", dir, strerror(errno));
+    tracker->stats.unwatched++;
+    /* Remember it anyway, so that it is not tried again */
+    return exechelp_hash_table_add(by_path, strdup(dir)) ? 0 : -1;
+  }
+
+  /* A directory may already be watched under another path */
+  if (exechelp_hash_table_contains(tracker->by_wd, (void *) (intptr_t) wd))
+    return exechelp_hash_table_add(by_path, strdup(dir)) ? 0 : -1;
+
+  TrackWatch *watches = realloc(tracker->watches, sizeof(TrackWatch) * (tracker->n_watches + 1));
+  if (!watches)
+    return -1;
+  tracker->watches = watches;
+
+  watches[tracker->n_watches].wd = wd;
+  watches[tracker->n_watches].path = strdup(dir);
+  if (!watches[tracker->n_watches].path)
+    return -1;
+
+  exechelp_hash_table_insert(tracker->by_wd, (void *) (intptr_t) wd, TRACK_VALUE(tracker->n_watches));
+  exechelp_hash_table_add(by_path, strdup(dir));
+  tracker->n_watches++;
+
+  return 0;
+}
+
+/* Watches the directory of every entry that is not followed yet and all of
+ * its ancestors */
+static int track_watch_entries(ExecHelpTracker *tracker)
+{
+  ExecHelpHashTable *by_path = exechelp_hash_table_new_full(exechelp_str_hash, exechelp_str_equal, free, NULL);
+  size_t i;
+  int ret = 0;
+
+  if (!by_path)
+    return -1;
+
+  for (i = 0; i < tracker->n_lines && ret == 0; ++i)
+  {
+    char *key = tracker->lines[i] && tracker->lines[i][0] == '/' ? track_entry_key(tracker->lines[i]) : NULL;
+    char *slash;
+
+    if (!key)
+      continue;
+
+    if (exechelp_hash_table_contains(tracker->entries, key))
+    {
+      free(key);
+      continue;
+    }
+    exechelp_hash_table_insert(tracker->entries, key, TRACK_VALUE(i));
+    tracker->stats.entries++;
+
+    char *dir = strdup(key);
+    while (dir && ret == 0 && (slash = strrchr(dir, '/')))
+    {
+      if (slash == dir)
+      {
+        ret = track_watch(tracker, by_path, "/");
+        break;
+      }
+      *slash = '\0';
+      ret = track_watch(tracker, by_path, dir);
+    }
+    if (!dir)
+      ret = -1;
+    free(dir);
+  }
+
+  exechelp_hash_table_destroy(by_path);
+  tracker->stats.watches = tracker->n_watches;
+  return ret;
+}
+
+/**
+ * @fn exechelp_tracker_new
+ * @brief Reads a managed files list and starts watching the directories of
+ * its entries
+ *
+ * @param list_path: the list to keep up to date
+ * @param log: where to report changes and problems, or NULL
+ * @return a new tracker, or NULL on error
+ */
+ExecHelpTracker *exechelp_tracker_new(const char *list_path, FILE *log)
+{
+  ExecHelpTracker *tracker = exechelp_malloc0(sizeof(ExecHelpTracker));
+
+  if (!tracker)
+    return NULL;
+
+  tracker->log = log;
+  tracker->list_path = strdup(list_path);
+  tracker->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  tracker->entries = exechelp_hash_table_new_full(exechelp_str_hash, exechelp_str_equal, free, NULL);
+  tracker->published = exechelp_hash_table_new_full(exechelp_str_hash, exechelp_str_equal, free, NULL);
+  tracker->by_wd = exechelp_hash_table_new(exechelp_direct_hash, exechelp_direct_equal);
+
+  if (!tracker->list_path || tracker->fd < 0 || !tracker->entries || !tracker->published || !tracker->by_wd ||
+      track_read_list(tracker) != 0 || track_watch_entries(tracker) != 0)
+  {
+    int saved = errno;
+    exechelp_tracker_free(tracker);
+    errno = saved;
+    return NULL;
+  }
+
+  return tracker;
+}
+
+/**
+ * @fn exechelp_tracker_fd
+ * @brief Returns the file descriptor to poll for events, which is
+ * non-blocking
+ */
+int exechelp_tracker_fd(ExecHelpTracker *tracker)
+{
+  return tracker->fd;
+}
+
+const ExecHelpTrackStats *exechelp_tracker_stats(ExecHelpTracker *tracker)
+{
+  return &tracker->stats;
+}
+
+/* Marks an entry as gone, and adds its new path if it was moved to one.
+ * The new path of an entry that was already gone is gone too, e.g. when its
+ * directory is moved. Returns 1 if a line was added, 0 if not, or -1. */
+static int track_follow_entry(ExecHelpTracker *tracker, size_t line, const char *to)
+{
+  char *new_line = NULL, *new_key = NULL;
+  int was_gone = tracker->gone[line];
+  ssize_t added;
+
+  tracker->gone[line] = 1;
+
+  if (!to)
+  {
+    if (tracker->log)
+      fprintf(tracker->log, "'%s' is gone, kept until a rescan\n", tracker->lines[line]);
+    tracker->stats.gone++;
+    return 0;
+  }
+
+  /* An entry moved over another one is already managed */
+  if (exechelp_hash_table_contains(tracker->entries, to))
+    return 0;
+
+  size_t len = strlen(tracker->lines[line]);
+  int slash = tracker->lines[line][len - 1] == '/';
+
+  if (asprintf(&new_line, "%s%s", to, slash ? "/" : "") < 0 || !(new_key = strdup(to)))
+  {
+    free(new_line);
+    return -1;
+  }
+
+  if ((added = track_add_line(tracker, new_line)) < 0)
+  {
+    free(new_line);
+    free(new_key);
+    return -1;
+  }
+
+  if (tracker->log)
+    fprintf(tracker->log, "Added '%s', moved from '%s'\n", new_line, tracker->lines[line]);
+
+  tracker->gone[added] = was_gone;
+  exechelp_hash_table_insert(tracker->entries, new_key, TRACK_VALUE(added));
+  tracker->stats.entries++;
+  tracker->stats.renamed++;
+
+  return 1;
+}
+
+/* Applies the move of path to to, or its deletion if to is NULL, to the
+ * entries and watches. Returns the number of lines added, or -1. */
+static int track_apply(ExecHelpTracker *tracker, const char *path, int is_dir, const char *to)
+{
+  void *value = exechelp_hash_table_lookup(tracker->entries, path);
+  size_t path_len = strlen(path), n_lines = tracker->n_lines, i;
+  int changed = 0, ret;
+
+  if (value)
+  {
+    ret = track_follow_entry(tracker, TRACK_INDEX(value), to);
+    if (ret < 0)
+      return -1;
+    changed += ret;
+  }
+
+  if (!is_dir)
+    return changed;
+
+  /* Entries and watched directories inside a moved or deleted directory,
+   * without the lines added for them */
+  for (i = 0; i < n_lines; ++i)
+  {
+    char *key;
+
+    if (!tracker->lines[i] || !track_is_under(tracker->lines[i], path, path_len) ||
+        tracker->lines[i][path_len] != '/' || !tracker->lines[i][path_len + 1] ||
+        !(key = track_entry_key(tracker->lines[i])))
+      continue;
+
+    char *rebased = to ? track_rebase(key, path_len, to) : NULL;
+    if (!to || rebased)
+      ret = track_follow_entry(tracker, i, rebased);
+    else
+      ret = -1;
+    free(rebased);
+    free(key);
+    if (ret < 0)
+      return -1;
+    changed += ret;
+  }
+
+  for (i = 0; to && i < tracker->n_watches; ++i)
+  {
+    if (track_is_under(tracker->watches[i].path, path, path_len))
+    {
+      char *rebased = track_rebase(tracker->watches[i].path, path_len, to);
+      if (!rebased)
+        return -1;
+      free(tracker->watches[i].path);
+      tracker->watches[i].path = rebased;
+    }
+  }
+
+  return changed;
+}
+
+/* Tells whether a moved path is, or contains, an entry */
+static int track_has_entries(ExecHelpTracker *tracker, const char *path, int is_dir)
+{
+  size_t path_len = strlen(path), i;
+
+  if (exechelp_hash_table_contains(tracker->entries, path))
+    return 1;
+
+  for (i = 0; is_dir && i < tracker->n_lines; ++i)
+    if (tracker->lines[i] && track_is_under(tracker->lines[i], path, path_len))
+      return 1;
+
+  return 0;
+}
+
+static int track_handle_event(ExecHelpTracker *tracker, const struct inotify_event *event)
+{
+  void *value = exechelp_hash_table_lookup(tracker->by_wd, (void *) (intptr_t) event->wd);
+  int is_dir = (event->mask & IN_ISDIR) != 0;
+  char *path = NULL;
+  int changed = 0;
+  size_t i;
+
+  tracker->stats.events++;
+
+  if (event->mask & IN_Q_OVERFLOW)
+  {
+    if (tracker->log)
+      fprintf(tracker->log, "Events were dropped by the kernel, a rescan is needed\n");
+    tracker->stats.overflows++;
+    return 0;
+  }
+
+  if (!value || !event->len)
+    return 0;
+
+  TrackWatch *watch = &tracker->watches[TRACK_INDEX(value)];
+  if (asprintf(&path, "%s%s%s", watch->path, strcmp(watch->path, "/") ? "/" : "", event->name) < 0)
+    return -1;
+
+  if (event->mask & IN_MOVED_FROM)
+  {
+    TrackMove *moves = realloc(tracker->moves, sizeof(TrackMove) * (tracker->n_moves + 1));
+    if (!moves)
+    {
+      free(path);
+      return -1;
+    }
+    tracker->moves = moves;
+    moves[tracker->n_moves].cookie = event->cookie;
+    moves[tracker->n_moves].path = path;
+    moves[tracker->n_moves].is_dir = is_dir;
+    tracker->n_moves++;
+    return 0;
+  }
+
+  if (event->mask & IN_MOVED_TO)
+  {
+    for (i = 0; i < tracker->n_moves; ++i)
+    {
+      if (tracker->moves[i].cookie == event->cookie)
+      {
+        TrackMove move = tracker->moves[i];
+
+        tracker->moves[i] = tracker->moves[--tracker->n_moves];
+        changed = track_apply(tracker, move.path, move.is_dir, path);
+        free(move.path);
+        break;
+      }
+    }
+  }
+  else if (event->mask & IN_DELETE)
+    changed = track_apply(tracker, path, is_dir, NULL);
+
+  free(path);
+  return changed;
+}
+
+/* Moves whose IN_MOVED_TO never came went out of the watched directories */
+static void track_drop_moves(ExecHelpTracker *tracker)
+{
+  size_t i;
+
+  for (i = 0; i < tracker->n_moves; ++i)
+  {
+    if (track_has_entries(tracker, tracker->moves[i].path, tracker->moves[i].is_dir))
+    {
+      if (tracker->log)
+        fprintf(tracker->log, "Lost track of '%s', moved out of the watched directories\n",
+                tracker->moves[i].path);
+      tracker->stats.lost++;
+      track_apply(tracker, tracker->moves[i].path, tracker->moves[i].is_dir, NULL);
+    }
+    free(tracker->moves[i].path);
+  }
+
+  tracker->n_moves = 0;
+}
+
+/**
+ * @fn track_merge_list
+ * @brief Merges the changes made to the list by someone else since it was
+ * last read or published. Lines they added are followed too, and lines they
+ * removed are dropped, but lines the tracker added or removed since are kept
+ * as they are.
+ *
+ * @return the number of lines added or removed, or -1 on error
+ */
+static int track_merge_list(ExecHelpTracker *tracker)
+{
+  ExecHelpHashTable *on_disk = NULL, *current = NULL;
+  char **disk = NULL;
+  size_t n_disk = 0, n_lines = tracker->n_lines, i;
+  struct stat sb;
+  int changed = 0, ends_line, ret = -1;
+
+  /* A list deleted by someone else is published again */
+  if (stat(tracker->list_path, &sb) != 0)
+    return errno == ENOENT ? 0 : -1;
+  if (track_same_version(&sb, &tracker->list_sb))
+    return 0;
+
+  if (track_read_lines(tracker->list_path, &disk, &n_disk, &sb, &ends_line) != 0)
+    return -1;
+
+  on_disk = exechelp_hash_table_new(exechelp_str_hash, exechelp_str_equal);
+  current = exechelp_hash_table_new(exechelp_str_hash, exechelp_str_equal);
+  if (!on_disk || !current)
+    goto out;
+
+  for (i = 0; i < n_disk; ++i)
+    exechelp_hash_table_add(on_disk, disk[i]);
+
+  for (i = 0; i < n_lines; ++i)
+  {
+    if (!tracker->lines[i] || !exechelp_hash_table_contains(tracker->published, tracker->lines[i]) ||
+        exechelp_hash_table_contains(on_disk, tracker->lines[i]))
+      continue;
+
+    if (tracker->log)
+      fprintf(tracker->log, "Removed '%s', removed from the list by someone else\n", tracker->lines[i]);
+    track_drop_line(tracker, i);
+    changed++;
+  }
+
+  for (i = 0; i < n_lines; ++i)
+    if (tracker->lines[i])
+      exechelp_hash_table_add(current, tracker->lines[i]);
+
+  for (i = 0; i < n_disk; ++i)
+  {
+    char *line;
+    ssize_t added;
+
+    if (exechelp_hash_table_contains(tracker->published, disk[i]) ||
+        exechelp_hash_table_contains(current, disk[i]))
+      continue;
+
+    if (!(line = strdup(disk[i])) || (added = track_add_line(tracker, line)) < 0)
+    {
+      free(line);
+      goto out;
+    }
+    exechelp_hash_table_add(current, line);
+
+    if (tracker->log)
+      fprintf(tracker->log, "Added '%s', added to the list by someone else\n", tracker->lines[added]);
+    changed++;
+  }
+
+  /* Lines the tracker did not follow yet, including those sharing the entry
+   * of a removed line */
+  if (track_watch_entries(tracker) != 0 || track_set_published(tracker, disk, n_disk) != 0)
+    goto out;
+
+  tracker->list_sb = sb;
+  tracker->list_mode = sb.st_mode & 07777;
+  tracker->ends_line = ends_line;
+  tracker->stats.merges++;
+  ret = changed;
+
+  out:
+  if (on_disk)
+    exechelp_hash_table_destroy(on_disk);
+  if (current)
+    exechelp_hash_table_destroy(current);
+  track_free_lines(disk, n_disk);
+  return ret;
+}
+
+/* Writes the list next to the published one, and renames it over the
+ * published one unless that changed since it was last read or published.
+ * Returns 0 on success, 1 if the published list changed, or -1. */
+static int track_write_list(ExecHelpTracker *tracker)
+{
+  struct timespec start, end;
+  struct stat sb, published;
+  char *tmp = NULL;
+  size_t i;
+  FILE *file;
+  int fd, ret = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (asprintf(&tmp, "%s.XXXXXX", tracker->list_path) < 0)
+    return -1;
+  if ((fd = mkstemp(tmp)) < 0 || !(file = fdopen(fd, "w")))
+  {
+    if (fd >= 0)
+    {
+      close(fd);
+      unlink(tmp);
+    }
+    free(tmp);
+    return -1;
+  }
+
+  for (i = 0; i < tracker->n_lines && ret == 0; ++i)
+    if (tracker->lines[i] && fprintf(file, "%s%s", tracker->lines[i], EXECHELP_FILE_SEPARATOR) < 0)
+      ret = -1;
+
+  if (ret == 0 && (fflush(file) || fchmod(fd, tracker->list_mode) || fsync(fd) || fstat(fd, &sb)))
+    ret = -1;
+  if (fclose(file))
+    ret = -1;
+
+  /* Changes made between this check and the rename are lost. Editors that
+   * rename their copy over the list make that window as short as ours. */
+  if (ret == 0 && stat(tracker->list_path, &published) == 0 &&
+      !track_same_version(&published, &tracker->list_sb))
+    ret = 1;
+  if (ret == 0 && rename(tmp, tracker->list_path))
+    ret = -1;
+  if (ret)
+  {
+    int saved = errno;
+    unlink(tmp);
+    errno = saved;
+  }
+  free(tmp);
+
+  if (ret == 0)
+  {
+    tracker->list_sb = sb;
+    tracker->n_published = tracker->n_lines;
+    tracker->ends_line = 1;
+    tracker->rewrite = 0;
+    if (track_set_published(tracker, tracker->lines, tracker->n_lines) != 0)
+      ret = -1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  tracker->stats.rewrite_ns += track_elapsed_ns(&start, &end);
+  tracker->stats.rewrites += ret == 0;
+
+  return ret;
+}
+
+/* Records the lines appended to the list in the compiled policy, so that it
+ * does not need to be compiled again */
+static void track_update_compiled(ExecHelpTracker *tracker, const struct stat *before)
+{
+  int ret;
+
+  if (!tracker->compiled_path)
+    return;
+
+  ret = exechelp_compiled_append_source(tracker->compiled_path, EXECHELP_COMPILED_MANAGED_FILES,
+                                        before, &tracker->list_sb);
+  if (ret < 0 && tracker->log)
+    fprintf(tracker->log, "Cannot update '%s': %s\n", tracker->compiled_path, strerror(errno));
+  tracker->stats.patched += ret > 0;
+}
+
+/* Appends the lines that are not published yet to the published list.
+ * Returns 0 on success, 1 if the published list changed, or -1. */
+static int track_append_list(ExecHelpTracker *tracker)
+{
+  struct timespec start, end;
+  struct stat before = tracker->list_sb, sb;
+  char *buf = NULL;
+  size_t len = 0, i;
+  FILE *stream;
+  int fd, ret = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (!(stream = open_memstream(&buf, &len)))
+    return -1;
+  for (i = tracker->n_published; i < tracker->n_lines && ret == 0; ++i)
+    if (tracker->lines[i] && !exechelp_hash_table_contains(tracker->published, tracker->lines[i]) &&
+        fprintf(stream, "%s%s", tracker->lines[i], EXECHELP_FILE_SEPARATOR) < 0)
+      ret = -1;
+  if (fclose(stream) || ret)
+  {
+    free(buf);
+    return -1;
+  }
+
+  /* Lines that someone else added too are already published */
+  if (!len)
+  {
+    free(buf);
+    tracker->n_published = tracker->n_lines;
+    return 0;
+  }
+
+  /* A list deleted by someone else is written again */
+  if ((fd = open(tracker->list_path, O_WRONLY | O_APPEND | O_CLOEXEC)) < 0)
+  {
+    free(buf);
+    if (errno != ENOENT)
+      return -1;
+    tracker->rewrite = 1;
+    return 1;
+  }
+
+  if (fstat(fd, &sb))
+    ret = -1;
+  else if (!track_same_version(&sb, &tracker->list_sb))
+    ret = 1;
+  for (i = 0; ret == 0 && i < len; )
+  {
+    ssize_t written = write(fd, buf + i, len - i);
+    if (written < 0 && errno != EINTR)
+      ret = -1;
+    else if (written > 0)
+      i += written;
+  }
+  if (ret == 0 && (fsync(fd) || fstat(fd, &sb)))
+    ret = -1;
+  if (close(fd))
+    ret = -1;
+  free(buf);
+
+  if (ret == 0)
+  {
+    for (i = tracker->n_published; i < tracker->n_lines && ret == 0; ++i)
+    {
+      char *line;
+
+      if (!tracker->lines[i] || exechelp_hash_table_contains(tracker->published, tracker->lines[i]))
+        continue;
+      if (!(line = strdup(tracker->lines[i])) || !exechelp_hash_table_add(tracker->published, line))
+        ret = -1;
+    }
+    tracker->list_sb = sb;
+    tracker->n_published = tracker->n_lines;
+    track_update_compiled(tracker, &before);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  tracker->stats.append_ns += track_elapsed_ns(&start, &end);
+  tracker->stats.appends += ret == 0;
+
+  return ret;
+}
+
+/* Publishes the list, after merging the changes made to it by someone else.
+ * Returns the number of lines merged, or -1 on error. */
+static int track_publish(ExecHelpTracker *tracker)
+{
+  int merged = 0, tries, ret;
+
+  for (tries = 0; tries < TRACK_MAX_MERGES; ++tries)
+  {
+    if ((ret = track_merge_list(tracker)) < 0)
+      return -1;
+    merged += ret;
+
+    if (tracker->rewrite || !tracker->ends_line)
+      ret = track_write_list(tracker);
+    else
+      ret = track_append_list(tracker);
+    if (ret <= 0)
+      return ret < 0 ? -1 : merged;
+  }
+
+  if (tracker->log)
+    fprintf(tracker->log, "'%s' keeps changing, it was not overwritten\n", tracker->list_path);
+  errno = EBUSY;
+  return -1;
+}
+
+/**
+ * @fn exechelp_tracker_set_compiled
+ * @brief Sets the compiled policy to update when lines are appended to the
+ * list, whose managed files list must be the tracked list. It is left as is
+ * when the list is rewritten, and must then be compiled again.
+ *
+ * @param compiled_path: the compiled policy, or NULL
+ * @return 0 on success, -1 on error
+ */
+int exechelp_tracker_set_compiled(ExecHelpTracker *tracker, const char *compiled_path)
+{
+  char *copy = compiled_path ? strdup(compiled_path) : NULL;
+
+  if (compiled_path && !copy)
+    return -1;
+
+  free(tracker->compiled_path);
+  tracker->compiled_path = copy;
+  return 0;
+}
+
+/**
+ * @fn exechelp_tracker_process
+ * @brief Applies all pending events to the list, and publishes it if any
+ * entry was added. Changes made to the list by someone else are merged
+ * first, even if no entry was added.
+ *
+ * @return the number of lines added or removed, or -1 on error
+ */
+int exechelp_tracker_process(ExecHelpTracker *tracker)
+{
+  char buf[TRACK_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+  int changed = 0, ret;
+  ssize_t len;
+
+  /* The two events of a move are queued together, but may be split between
+   * reads, so moves are only given up once the queue is empty */
+  while ((len = read(tracker->fd, buf, sizeof(buf))) > 0 || (len < 0 && errno == EINTR))
+  {
+    char *iter = buf;
+
+    while (len > 0 && iter < buf + len)
+    {
+      const struct inotify_event *event = (const struct inotify_event *) iter;
+
+      ret = track_handle_event(tracker, event);
+      if (ret < 0)
+        return -1;
+      changed += ret;
+      iter += sizeof(struct inotify_event) + event->len;
+    }
+  }
+
+  if (len < 0 && errno != EAGAIN)
+    return -1;
+
+  track_drop_moves(tracker);
+
+  if ((ret = changed ? track_publish(tracker) : track_merge_list(tracker)) < 0)
+    return -1;
+
+  return changed + ret;
+}
+
+/**
+ * @fn exechelp_tracker_rescan
+ * @brief Removes the entries that were deleted or moved away and whose path
+ * still does not exist, and rewrites the list if any was removed. Entries
+ * whose path exists again are kept and followed as before. Changes made to
+ * the list by someone else are merged first.
+ *
+ * @return the number of lines added or removed, or -1 on error
+ */
+int exechelp_tracker_rescan(ExecHelpTracker *tracker)
+{
+  struct stat sb;
+  int pruned = 0, merged, ret;
+  size_t i;
+
+  if ((merged = track_merge_list(tracker)) < 0)
+    return -1;
+
+  for (i = 0; i < tracker->n_lines; ++i)
+  {
+    char *key;
+
+    if (!tracker->lines[i] || !tracker->gone[i] || !(key = track_entry_key(tracker->lines[i])))
+      continue;
+
+    /* Only entries known not to exist are removed */
+    tracker->gone[i] = 0;
+    if (lstat(key, &sb) == 0 || (errno != ENOENT && errno != ENOTDIR))
+    {
+      free(key);
+      continue;
+    }
+
+    if (tracker->log)
+      fprintf(tracker->log, "Removed '%s', which no longer exists\n", tracker->lines[i]);
+
+    free(key);
+    track_drop_line(tracker, i);
+    tracker->rewrite = 1;
+    tracker->stats.pruned++;
+    pruned++;
+  }
+
+  if (pruned && (ret = track_publish(tracker)) < 0)
+    return -1;
+  if (pruned)
+    merged += ret;
+
+  return pruned + merged;
+}
+
+void exechelp_tracker_free(ExecHelpTracker *tracker)
+{
+  size_t i;
+
+  if (!tracker)
+    return;
+
+  if (tracker->fd >= 0)
+    close(tracker->fd);
+  for (i = 0; i < tracker->n_lines; ++i)
+    free(tracker->lines[i]);
+  for (i = 0; i < tracker->n_watches; ++i)
+    free(tracker->watches[i].path);
+  for (i = 0; i < tracker->n_moves; ++i)
+    free(tracker->moves[i].path);
+  if (tracker->entries)
+    exechelp_hash_table_destroy(tracker->entries);
+  if (tracker->published)
+    exechelp_hash_table_destroy(tracker->published);
+  if (tracker->by_wd)
+    exechelp_hash_table_destroy(tracker->by_wd);
+  free(tracker->lines);
+  free(tracker->gone);
+  free(tracker->watches);
+  free(tracker->moves);
+  free(tracker->list_path);
+  free(tracker->compiled_path);
+  free(tracker);
+}
@@ -0,0 +1,333 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Worst-case inputs for the exec decision pipeline. A sandboxed app controls
+ * argv, so each input below is one it could craft to make a decision as
+ * costly as possible. The limits in common.h bound the cost of each input:
+ *
+ *  - an argument costs at most EXECHELP_MAX_PATH_COMPONENTS lstat calls and
+ *    EXECHELP_MAX_SYMLINKS readlink calls per canonicalization pass, and
+ *    arguments of EXECHELP_MAX_ARG_LEN bytes or more are not canonicalized,
+ *    since they are too long to be paths
+ *  - a decision checks at most EXECHELP_MAX_ARGS arguments
+ *  - colliding names only reach the symlink loop detection table, which holds
+ *    at most EXECHELP_MAX_SYMLINKS entries; policy lists are not under the
+ *    app's control, but a list of colliding lines is measured nonetheless
+ *
+ * Inputs that go over a limit are delegated, except for arguments that are
+ * too long to be paths, which are allowed. Each input declares a bound on
+ * the time of one decision, which is loose enough for slow machines but
+ * orders of magnitude below what the input costs without the limits. The
+ * benchmark fails when an input goes over its bound.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "policy.h"
+
+#define BENCH_RUNS          5
+#define BENCH_CHAIN_LENGTH  100
+#define BENCH_COLLISIONS    11   /* 2^11 colliding names */
+
+typedef struct _AdversarialInput {
+  const char  *name;
+  char       **argv;
+  long         bound_us;
+  int          legacy;      /* also run through the legacy pipeline */
+} AdversarialInput;
+
+static ExecHelpPolicy *collision_policy = NULL;
+
+/* Returns a string made of count copies of unit */
+static char *repeat(const char *prefix, const char *unit, size_t count)
+{
+  size_t len = strlen(unit), i;
+  char *str = malloc(strlen(prefix) + len * count + 1);
+  char *p = stpcpy(str, prefix);
+
+  for (i = 0; i < count; ++i)
+    p = stpcpy(p, unit);
+
+  return str;
+}
+
+static char **make_argv(size_t argc, char *(*make_arg)(size_t))
+{
+  char **argv = calloc(argc + 1, sizeof(char *));
+  size_t i;
+
+  argv[0] = strdup("vlc");
+  for (i = 1; i < argc; ++i)
+    argv[i] = make_arg(i);
+
+  return argv;
+}
+
+static void free_argv(char **argv)
+{
+  size_t i;
+  for (i = 0; argv[i]; ++i)
+    free(argv[i]);
+  free(argv);
+}
+
+/* Names that all have the same exechelp_str_hash, since "Ab" and "BA" do */
+static char *colliding_name(size_t i)
+{
+  char *str = malloc(2 * BENCH_COLLISIONS + 1);
+  int bit;
+
+  for (bit = 0; bit < BENCH_COLLISIONS; ++bit)
+    memcpy(str + 2 * bit, (i >> bit) & 1 ? "BA" : "Ab", 2);
+  str[2 * BENCH_COLLISIONS] = '\0';
+
+  return str;
+}
+
+static char *colliding_arg(size_t i)
+{
+  return colliding_name(i | (1 << (BENCH_COLLISIONS - 1)));
+}
+
+static char *short_arg(size_t i)
+{
+  return strdup("x");
+}
+
+static char *dotdot_arg(size_t i)
+{
+  return repeat("", "a/../", 50);
+}
+
+static char *chain_arg(size_t i)
+{
+  return strdup("chain0");
+}
+
+static char **make_single_argv(const char *arg)
+{
+  char **argv = calloc(3, sizeof(char *));
+
+  argv[0] = strdup("vlc");
+  argv[1] = strdup(arg);
+
+  return argv;
+}
+
+static int make_fixture(char *dir)
+{
+  char from[32], to[32];
+  int i;
+
+  if (!mkdtemp(dir) || chdir(dir) || mkdir("a", 0700))
+    return -1;
+
+  /* chain0 -> chain1 -> ... -> chainN -> a */
+  for (i = 0; i < BENCH_CHAIN_LENGTH; ++i)
+  {
+    snprintf(from, sizeof(from), "chain%d", i);
+    snprintf(to, sizeof(to), "chain%d", i + 1);
+    if (symlink(to, from))
+      return -1;
+  }
+  snprintf(from, sizeof(from), "chain%d", BENCH_CHAIN_LENGTH);
+  if (symlink("a", from))
+    return -1;
+
+  /* Each expansion of 'grow' adds more components that expand again */
+  if (symlink("grow/grow/grow/grow", "grow") ||
+      symlink("loop-b", "loop-a") || symlink("loop-a", "loop-b"))
+    return -1;
+
+  /* A worst-case managed files list, all of whose lines collide with each
+   * other and with the arguments, which are the other half of the names */
+  FILE *f = fopen("managed-files.list", "w");
+  if (!f)
+    return -1;
+  for (i = 0; i < (1 << (BENCH_COLLISIONS - 1)); ++i)
+  {
+    char *name = colliding_name(i);
+    fprintf(f, "%s/%s\n", dir, name);
+    free(name);
+  }
+  fclose(f);
+
+  return setenv("HOME", dir, 1);
+}
+
+static void remove_fixture(const char *dir)
+{
+  char path[32];
+  int i;
+
+  for (i = 0; i <= BENCH_CHAIN_LENGTH; ++i)
+  {
+    snprintf(path, sizeof(path), "chain%d", i);
+    unlink(path);
+  }
+  unlink("grow");
+  unlink("loop-a");
+  unlink("loop-b");
+  unlink("managed-files.list");
+  rmdir("a");
+
+  if (chdir("/") || rmdir(dir))
+    fprintf(stderr, "Could not remove fixture directory '%s'\n", dir);
+}
+
+static ExecHelpVerdict decide(const AdversarialInput *input, int legacy)
+{
+  char *allowed_exec = NULL, *forbidden_exec = NULL;
+  char **allowed_argv = NULL, **forbidden_argv = NULL;
+  ExecHelpVerdict verdict;
+
+  if (!legacy)
+    return exechelp_policy_decide(input->legacy ? exechelp_policy_get_default() : collision_policy,
+                                  "/usr/bin/vlc", input->argv);
+
+  if (exechelp_filter_forbidden_exec("/usr/bin/vlc", input->argv, environ,
+                                     &allowed_exec, &allowed_argv,
+                                     &forbidden_exec, &forbidden_argv))
+    verdict = EXECHELP_VERDICT_ALLOW;
+  else
+    verdict = forbidden_exec ? EXECHELP_VERDICT_DELEGATE : EXECHELP_VERDICT_DENY;
+
+  free(allowed_exec);
+  free(forbidden_exec);
+  free(allowed_argv);
+  free(forbidden_argv);
+
+  return verdict;
+}
+
+static int compare_longs(const void *a, const void *b)
+{
+  long la = *(const long *) a, lb = *(const long *) b;
+  return (la > lb) - (la < lb);
+}
+
+/* Returns the median time of one decision, in microseconds */
+static long measure(const AdversarialInput *input, int legacy, ExecHelpVerdict *verdict)
+{
+  long runs[BENCH_RUNS];
+  int i;
+
+  for (i = 0; i < BENCH_RUNS; ++i)
+  {
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    *verdict = decide(input, legacy);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    runs[i] = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000;
+  }
+
+  qsort(runs, BENCH_RUNS, sizeof(long), compare_longs);
+  return runs[BENCH_RUNS / 2];
+}
+
+int main(void)
+{
+  char dir[] = "/tmp/exechelper-adversarial-XXXXXX";
+  char *path;
+  int failed = 0;
+  size_t i;
+
+  if (make_fixture(dir))
+  {
+    fprintf(stderr, "Could not create fixture directory: %s\n", strerror(errno));
+    return 1;
+  }
+
+  if (asprintf(&path, "%s/managed-files.list", dir) < 0)
+    return 1;
+  collision_policy = exechelp_policy_new(NULL, NULL, path);
+
+  char *long_path = repeat("", "/a", 4000);
+  char *deep_path = repeat("", "/a", 1000);
+  char *dotdot_path = repeat("", "a/../", 800);
+
+  AdversarialInput inputs[] = {
+    { "8000-byte path", NULL, 1000, 1 },
+    { "1000-component path", NULL, 1000, 1 },
+    { "800 dot-dot components", NULL, 5000, 1 },
+    { "100-link symlink chain", NULL, 5000, 1 },
+    { "exponential symlink", NULL, 5000, 1 },
+    { "symlink loop", NULL, 5000, 1 },
+    { "1024 args, 1 component", NULL, 50000, 1 },
+    { "1024 args, 100 components", NULL, 500000, 1 },
+    { "1024 chained args", NULL, 500000, 1 },
+    { "200000 args", NULL, 1000, 1 },
+    { "1024 colliding args", NULL, 500000, 0 },
+  };
+
+  inputs[0].argv = make_single_argv(long_path);
+  inputs[1].argv = make_single_argv(deep_path);
+  inputs[2].argv = make_single_argv(dotdot_path);
+  inputs[3].argv = make_single_argv("chain0");
+  inputs[4].argv = make_single_argv("grow");
+  inputs[5].argv = make_single_argv("loop-a");
+  inputs[6].argv = make_argv(EXECHELP_MAX_ARGS, short_arg);
+  inputs[7].argv = make_argv(EXECHELP_MAX_ARGS, dotdot_arg);
+  inputs[8].argv = make_argv(EXECHELP_MAX_ARGS, chain_arg);
+  inputs[9].argv = make_argv(200000, short_arg);
+  inputs[10].argv = make_argv(EXECHELP_MAX_ARGS, colliding_arg);
+
+  printf("ExecHelper adversarial inputs (limits: %d args, %d bytes, %d components, %d symlinks)\n\n",
+         EXECHELP_MAX_ARGS, EXECHELP_MAX_ARG_LEN, EXECHELP_MAX_PATH_COMPONENTS, EXECHELP_MAX_SYMLINKS);
+  printf("%-36s %-9s %10s %10s  %s\n", "input", "verdict", "us", "bound", "result");
+
+  for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i)
+  {
+    int legacy;
+    for (legacy = 0; legacy <= inputs[i].legacy; ++legacy)
+    {
+      ExecHelpVerdict verdict;
+      long us = measure(&inputs[i], legacy, &verdict);
+      int over = us > inputs[i].bound_us;
+      char label[64];
+
+      snprintf(label, sizeof(label), "%s [%s]", inputs[i].name, legacy ? "legacy" : "engine");
+      printf("%-36s %-9s %10ld %10ld  %s\n", label, exechelp_verdict_to_string(verdict),
+             us, inputs[i].bound_us, over ? "OVER BOUND" : "ok");
+      failed |= over;
+    }
+    free_argv(inputs[i].argv);
+  }
+
+  free(long_path);
+  free(deep_path);
+  free(dotdot_path);
+  exechelp_policy_free(collision_policy);
+  free(path);
+  remove_fixture(dir);
+
+  printf("\n%s\n", failed ? "FAILED" : "PASSED");
+  return failed;
+}
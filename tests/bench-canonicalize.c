@@ -0,0 +1,339 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Compares path canonicalizers on a sweep of path shapes: depth, share of
+ * components that are symlinks, absolute versus relative input, and existing
+ * versus missing leaf. The candidates are:
+ *  - coreutils: exechelp_coreutils_realpath(), used on arguments (two passes,
+ *    missing components allowed)
+ *  - existing:  exechelp_coreutils_canonicalize_existing(), used on binaries
+ *  - glibc:     realpath(3), which fails on a missing leaf
+ *  - openat2:   the kernel resolves the path (or its parent, if the leaf is
+ *    missing) with openat2(O_PATH), and the result is read back from
+ *    /proc/self/fd
+ * For each, the report gives ns/op and syscalls/op, the latter counted with
+ * ptrace for a single call.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef SYS_openat2
+#include <linux/openat2.h>
+#endif
+
+#include "common.h"
+#include "realpath.h"
+
+#define BENCH_MAX_DEPTH     64
+#define BENCH_ITERATIONS    2000
+#define MARKER_SYSCALL      SYS_getppid
+
+typedef char *(*Canonicalizer)(const char *path);
+
+typedef struct _CanonicalizerImpl {
+  const char    *name;
+  Canonicalizer  func;
+} CanonicalizerImpl;
+
+static char *glibc_realpath(const char *path)
+{
+  return realpath(path, NULL);
+}
+
+#ifdef SYS_openat2
+static char *openat2_fd_path(int fd)
+{
+  char proc[64], buf[PATH_MAX];
+  ssize_t len;
+
+  snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+  len = readlink(proc, buf, sizeof(buf) - 1);
+  if (len < 0)
+    return NULL;
+  buf[len] = '\0';
+
+  return strdup(buf);
+}
+
+static int openat2_path(const char *path)
+{
+  struct open_how how;
+
+  memset(&how, 0, sizeof(how));
+  how.flags = O_PATH | O_CLOEXEC;
+  return syscall(SYS_openat2, AT_FDCWD, path, &how, sizeof(how));
+}
+
+static char *openat2_realpath(const char *path)
+{
+  int fd = openat2_path(path);
+  char *result;
+
+  if (fd >= 0)
+  {
+    result = openat2_fd_path(fd);
+    close(fd);
+    return result;
+  }
+
+  if (errno != ENOENT)
+    return NULL;
+
+  /* Missing leaf: resolve the parent, and append the leaf */
+  const char *slash = strrchr(path, '/');
+  char *parent = slash ? strndup(path, slash == path ? 1 : slash - path) : strdup(".");
+  const char *leaf = slash ? slash + 1 : path;
+
+  fd = openat2_path(parent);
+  free(parent);
+  if (fd < 0)
+    return NULL;
+
+  char *dir = openat2_fd_path(fd);
+  close(fd);
+  if (!dir || asprintf(&result, "%s/%s", strcmp(dir, "/") ? dir : "", leaf) < 0)
+    result = NULL;
+  free(dir);
+
+  return result;
+}
+#endif
+
+static const CanonicalizerImpl impls[] = {
+  { "coreutils", exechelp_coreutils_realpath },
+  { "existing", exechelp_coreutils_canonicalize_existing },
+  { "glibc", glibc_realpath },
+#ifdef SYS_openat2
+  { "openat2", openat2_realpath },
+#endif
+};
+
+#define N_IMPLS (sizeof(impls) / sizeof(impls[0]))
+
+/* Builds d0/d1/.../dN, with a file named leaf in each dI and a symlink
+ * lI -> dI next to each dI */
+static int make_fixture(char *root)
+{
+  char path[PATH_MAX];
+  size_t len;
+  int i, n;
+
+  if (!mkdtemp(root) || chdir(root))
+    return -1;
+
+  len = 0;
+  path[0] = '\0';
+  for (i = 0; i < BENCH_MAX_DEPTH; ++i)
+  {
+    char file[PATH_MAX], target[32];
+    int fd;
+
+    snprintf(target, sizeof(target), "d%d", i);
+    n = snprintf(file, sizeof(file), "%s%sl%d", path, len ? "/" : "", i);
+    if (n < 0 || (size_t) n >= sizeof(file) || symlink(target, file))
+      return -1;
+
+    n = snprintf(path + len, sizeof(path) - len, "%sd%d", len ? "/" : "", i);
+    if (n < 0 || (size_t) n >= sizeof(path) - len || mkdir(path, 0700))
+      return -1;
+    len += n;
+
+    n = snprintf(file, sizeof(file), "%s/leaf", path);
+    if (n < 0 || (size_t) n >= sizeof(file) || (fd = open(file, O_CREAT | O_WRONLY, 0600)) < 0)
+      return -1;
+    close(fd);
+  }
+
+  return 0;
+}
+
+static void remove_fixture(const char *root)
+{
+  char cmd[PATH_MAX + 16];
+
+  if (chdir("/"))
+    return;
+  snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root);
+  if (system(cmd))
+    fprintf(stderr, "Could not remove fixture directory '%s'\n", root);
+}
+
+/* Builds a path through depth levels, density percent of which go through
+ * a symlink */
+static void make_path(char *buf, size_t size, const char *root, int depth, int density, int missing)
+{
+  size_t len = 0;
+  int i, links = 0;
+
+  if (root)
+    len += snprintf(buf, size, "%s/", root);
+
+  for (i = 0; i < depth; ++i)
+  {
+    /* Spread symlinks evenly along the path */
+    int link = (i + 1) * density / 100 > links;
+    links += link;
+    len += snprintf(buf + len, size - len, "%c%d/", link ? 'l' : 'd', i);
+  }
+
+  snprintf(buf + len, size - len, "%s", missing ? "missing" : "leaf");
+}
+
+static long measure_ns(Canonicalizer func, const char *path)
+{
+  struct timespec start, end;
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < BENCH_ITERATIONS; ++i)
+    free(func(path));
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  return ((end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec)) / BENCH_ITERATIONS;
+}
+
+/* Counts the syscalls of one call in a traced child, or returns -1 */
+static long count_syscalls(Canonicalizer func, const char *path)
+{
+  long count = 0;
+  int status, measuring = 0, sig = 0;
+  pid_t child;
+
+  fflush(stdout);
+  child = fork();
+  if (child < 0)
+    return -1;
+
+  if (child == 0)
+  {
+    if (ptrace(PTRACE_TRACEME, 0, NULL, NULL))
+      _exit(2);
+    raise(SIGSTOP);
+    free(func(path));  /* warm up */
+    syscall(MARKER_SYSCALL);
+    free(func(path));
+    syscall(MARKER_SYSCALL);
+    _exit(0);
+  }
+
+  if (waitpid(child, &status, 0) < 0 || !WIFSTOPPED(status))
+    return -1;
+  ptrace(PTRACE_SETOPTIONS, child, NULL, PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL);
+
+  while (ptrace(PTRACE_SYSCALL, child, NULL, sig) == 0)
+  {
+    sig = 0;
+    if (waitpid(child, &status, 0) < 0 || WIFEXITED(status) || WIFSIGNALED(status))
+      break;
+
+    if (WSTOPSIG(status) != (SIGTRAP | 0x80))
+    {
+      sig = WSTOPSIG(status);
+      continue;
+    }
+
+    struct __ptrace_syscall_info info;
+    if (ptrace(PTRACE_GET_SYSCALL_INFO, child, sizeof(info), &info) <= 0
+        || info.op != PTRACE_SYSCALL_INFO_ENTRY)
+      continue;
+
+    if ((long) info.entry.nr == MARKER_SYSCALL)
+    {
+      if (measuring)
+      {
+        kill(child, SIGKILL);
+        waitpid(child, &status, 0);
+        return count;
+      }
+      measuring = 1;
+    }
+    else if (measuring)
+      count++;
+  }
+
+  return -1;
+}
+
+int main(void)
+{
+  char root[] = "/tmp/exechelper-canonicalize-XXXXXX";
+  static const int depths[] = { 1, 4, 16, 64 };
+  static const int densities[] = { 0, 50, 100 };
+  size_t d, s, a, m, i;
+
+  if (make_fixture(root))
+  {
+    fprintf(stderr, "Could not create fixture directory: %s\n", strerror(errno));
+    return 1;
+  }
+
+  printf("ExecHelper canonicalizers (%d iterations per case, syscalls counted for one call)\n\n",
+         BENCH_ITERATIONS);
+  printf("%-5s %-5s %-8s %-7s", "depth", "links", "input", "leaf");
+  for (i = 0; i < N_IMPLS; ++i)
+    printf(" %15s", "ns/op syscalls");
+  printf("\n%-28s", "");
+  for (i = 0; i < N_IMPLS; ++i)
+    printf(" %15s", impls[i].name);
+  printf("\n");
+
+  for (d = 0; d < sizeof(depths) / sizeof(depths[0]); ++d)
+  for (s = 0; s < sizeof(densities) / sizeof(densities[0]); ++s)
+  for (a = 0; a < 2; ++a)
+  for (m = 0; m < 2; ++m)
+  {
+    char path[PATH_MAX];
+
+    make_path(path, sizeof(path), a ? root : NULL, depths[d], densities[s], m);
+    printf("%-5d %4d%% %-8s %-7s", depths[d], densities[s], a ? "absolute" : "relative", m ? "missing" : "exists");
+
+    for (i = 0; i < N_IMPLS; ++i)
+    {
+      char *result = impls[i].func(path);
+      long ns = measure_ns(impls[i].func, path);
+      long syscalls = count_syscalls(impls[i].func, path);
+
+      if (syscalls < 0)
+        printf(" %8ld%s %5s", ns, result ? " " : "!", "?");
+      else
+        printf(" %8ld%s %5ld", ns, result ? " " : "!", syscalls);
+      free(result);
+    }
+    printf("\n");
+  }
+
+  printf("\n'!' marks canonicalizers that failed on the input: on a missing leaf for those that\n"
+         "require it to exist, and on paths through more than %d symlinks for all.\n", EXECHELP_MAX_SYMLINKS);
+
+  remove_fixture(root);
+  return 0;
+}
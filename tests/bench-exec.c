@@ -0,0 +1,372 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Exec microbenchmark of one or more builds of the library. For each library
+ * given on the command line, the benchmark runs a copy of itself with the
+ * library preloaded, which calls the interposed exec functions in a loop.
+ * A seccomp filter makes the execve system call itself fail in that copy, so
+ * the process survives every call and real targets can be used; the time of
+ * each call is thus the time of the decision plus that of a failing syscall.
+ *
+ * The workload is a set of scenarios similar to those of test-alloc and
+ * test-syscalls, followed by the records of an exec trace if one is given
+ * with -t (see EXECHELP_RECORD). The report gives ns/exec for each library,
+ * and the gain of each over the first one. The Makefile's release targets
+ * also use the benchmark as the training workload of profile-guided builds
+ * (-q skips the report), so preloaded copies exit normally to let the
+ * profile be written.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "trace.h"
+
+#include "check.h"
+
+#define BENCH_DEFAULT_ITERATIONS  2000
+#define BENCH_MAX_LIBS            8
+#define BENCH_MAX_ARGS            16
+
+typedef struct _ExecBenchScenario {
+  const char *name;
+  const char *target;
+  const char *argv[BENCH_MAX_ARGS];
+  int         resolve;  /* target is a file name looked up in PATH */
+} ExecBenchScenario;
+
+/* Relative paths are resolved against the fixture directory, which also
+ * serves as $HOME */
+static const ExecBenchScenario scenarios[] = {
+  { "no arguments", "/usr/bin/vlc", { "vlc", NULL }, 0 },
+  { "1 absolute arg", "/usr/bin/vlc", { "vlc", "/tmp/test.mp3", NULL }, 0 },
+  { "10 relative args", "/usr/bin/vlc", { "vlc", "a.mp3", "b.mp3", "c.mp3", "d.mp3", "e.mp3",
+                                          "f.mp3", "g.mp3", "h.mp3", "i.mp3", "j.mp3", NULL }, 0 },
+  { "10 home args", "/usr/bin/vlc", { "vlc", "~/a.mp3", "~/b.mp3", "~/c.mp3", "~/d.mp3", "~/e.mp3",
+                                      "~/f.mp3", "~/g.mp3", "~/h.mp3", "~/i.mp3", "~/j.mp3", NULL }, 0 },
+  { "symlinked arg", "/usr/bin/vlc", { "vlc", "link.mp3", NULL }, 0 },
+  { "managed arg", "/usr/bin/vlc", { "vlc", "/tmp/test-managed.mp3", NULL }, 0 },
+  { "mixed args", "/usr/bin/vlc", { "vlc", "/tmp/test.mp3", "/tmp/test-managed.mp3", "a.mp3", NULL }, 0 },
+  { "helper binary", "/usr/bin/cvlc", { "cvlc", "a.mp3", NULL }, 0 },
+  { "PATH lookup", "sh", { "sh", "-c", "true", NULL }, 1 },
+};
+
+#define N_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+#define ROW_TRACE   N_SCENARIOS
+#define ROW_TOTAL   (N_SCENARIOS + 1)
+#define N_ROWS      (N_SCENARIOS + 2)
+
+static const char *fixture_files[] = { "a.mp3", "b.mp3", "c.mp3", "d.mp3", "e.mp3",
+                                       "f.mp3", "g.mp3", "h.mp3", "i.mp3", "j.mp3", NULL };
+
+static int make_fixture(char *dir)
+{
+  int i;
+
+  if (!mkdtemp(dir) || chdir(dir))
+    return -1;
+
+  for (i = 0; fixture_files[i]; ++i)
+  {
+    FILE *f = fopen(fixture_files[i], "w");
+    if (!f)
+      return -1;
+    fclose(f);
+  }
+
+  if (symlink("a.mp3", "link.mp3") || setenv("HOME", dir, 1))
+    return -1;
+
+  return setenv("PATH", "/nonexistent/bin:/usr/local/bin:/usr/bin:/bin", 1);
+}
+
+static void remove_fixture(const char *dir)
+{
+  int i;
+
+  for (i = 0; fixture_files[i]; ++i)
+    unlink(fixture_files[i]);
+  unlink("link.mp3");
+
+  if (chdir("/") || rmdir(dir))
+    fprintf(stderr, "Could not remove fixture directory '%s'\n", dir);
+}
+
+/* Makes execve and execveat fail with ENOEXEC, so that allowed executions
+ * return like delegated ones do */
+static int forbid_exec_syscalls(void)
+{
+  struct sock_filter filter[] = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_execve, 1, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_execveat, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | ENOEXEC),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+  };
+  struct sock_fprog prog = { sizeof(filter) / sizeof(filter[0]), filter };
+
+  if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0))
+    return -1;
+
+  return prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog);
+}
+
+static void run_scenario(const ExecBenchScenario *s)
+{
+  if (s->resolve)
+    execvpe(s->target, (char *const *) s->argv, environ);
+  else
+    execve(s->target, (char *const *) s->argv, environ);
+}
+
+/* Replays every record of the trace once, from its recorded directory;
+ * returns the number of execs made */
+static long run_trace(ExecHelpTraceReader *reader, const char *home)
+{
+  ExecHelpTraceRecord record;
+  long execs = 0;
+
+  exechelp_trace_reader_rewind(reader);
+  while (exechelp_trace_reader_next(reader, &record) == 1)
+  {
+    if (record.cwd[0] == '\0' || chdir(record.cwd))
+      continue;
+    execve(record.target, record.argv, environ);
+    execs++;
+  }
+
+  if (chdir(home))
+    return -1;
+
+  return execs;
+}
+
+/* Runs in the preloaded copy: writes one "row ns-per-exec" line per row */
+static int child_main(int fd, int iterations, const char *trace)
+{
+  char dir[] = "/tmp/exechelper-exec-XXXXXX";
+  ExecHelpTraceReader reader;
+  long long total_ns = 0, start, elapsed;
+  long total_execs = 0;
+  size_t s;
+  int i;
+
+  if (trace && exechelp_trace_reader_open(&reader, trace))
+  {
+    fprintf(stderr, "Could not open trace '%s': %s\n", trace, strerror(errno));
+    return 1;
+  }
+
+  if (make_fixture(dir) || forbid_exec_syscalls())
+  {
+    fprintf(stderr, "Could not set up the benchmark process: %s\n", strerror(errno));
+    return 1;
+  }
+
+  for (s = 0; s < N_SCENARIOS; ++s)
+  {
+    /* Warm up the policy list cache */
+    run_scenario(&scenarios[s]);
+
+    start = now_ns();
+    for (i = 0; i < iterations; ++i)
+      run_scenario(&scenarios[s]);
+    elapsed = now_ns() - start;
+
+    dprintf(fd, "%zu %lld\n", s, elapsed / iterations);
+    total_ns += elapsed;
+    total_execs += iterations;
+  }
+
+  if (trace)
+  {
+    long execs = 0, n;
+    int runs = iterations / 100 ? iterations / 100 : 1;
+
+    run_trace(&reader, dir);
+    start = now_ns();
+    for (i = 0; i < runs && (n = run_trace(&reader, dir)) >= 0; ++i)
+      execs += n;
+    elapsed = now_ns() - start;
+
+    if (execs)
+      dprintf(fd, "%d %lld\n", (int) ROW_TRACE, elapsed / execs);
+    total_ns += elapsed;
+    total_execs += execs;
+    exechelp_trace_reader_close(&reader);
+  }
+
+  dprintf(fd, "%d %lld\n", (int) ROW_TOTAL, total_ns / total_execs);
+  remove_fixture(dir);
+
+  return 0;
+}
+
+/* Runs a preloaded copy of the benchmark and collects its results */
+static int run_lib(const char *self, const char *lib, int iterations, const char *trace, long long results[N_ROWS])
+{
+  char fd_arg[16], iter_arg[16], line[64];
+  int fds[2], status, row;
+  long long ns;
+  pid_t pid;
+  FILE *in;
+
+  if (pipe(fds))
+    return -1;
+
+  pid = fork();
+  if (pid < 0)
+    return -1;
+
+  if (pid == 0)
+  {
+    char *const argv[] = { (char *) self, "--child", fd_arg, iter_arg, (char *) trace, NULL };
+
+    close(fds[0]);
+    snprintf(fd_arg, sizeof(fd_arg), "%d", fds[1]);
+    snprintf(iter_arg, sizeof(iter_arg), "%d", iterations);
+    setenv("LD_PRELOAD", lib, 1);
+    execv(self, argv);
+    _exit(127);
+  }
+
+  close(fds[1]);
+  in = fdopen(fds[0], "r");
+  while (in && fgets(line, sizeof(line), in))
+    if (sscanf(line, "%d %lld", &row, &ns) == 2 && row >= 0 && row < (int) N_ROWS)
+      results[row] = ns;
+  if (in)
+    fclose(in);
+
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+    return -1;
+
+  return 0;
+}
+
+static void usage(const char *self)
+{
+  fprintf(stderr, "Usage: %s [-e engine|legacy] [-n iterations] [-t trace] [-q] lib.so [lib.so...]\n", self);
+}
+
+int main(int argc, char *argv[])
+{
+  static long long results[BENCH_MAX_LIBS][N_ROWS];
+  const char *engine = "legacy", *trace = NULL;
+  int iterations = BENCH_DEFAULT_ITERATIONS, quiet = 0, nlibs, opt, l;
+  size_t row;
+
+  if ((argc == 4 || argc == 5) && strcmp(argv[1], "--child") == 0)
+    return child_main(atoi(argv[2]), atoi(argv[3]), argc == 5 ? argv[4] : NULL);
+
+  while ((opt = getopt(argc, argv, "e:n:t:qh")) != -1)
+  {
+    switch (opt)
+    {
+      case 'e':
+        engine = optarg;
+        break;
+      case 'n':
+        iterations = atoi(optarg);
+        break;
+      case 't':
+        trace = optarg;
+        break;
+      case 'q':
+        quiet = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  nlibs = argc - optind;
+  if (nlibs < 1 || nlibs > BENCH_MAX_LIBS || iterations < 1)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  char self[PATH_MAX];
+  ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+  if (len < 0)
+    return 1;
+  self[len] = '\0';
+
+  setenv(EXECHELP_ENV_ENGINE, engine, 1);
+  for (l = 0; l < nlibs; ++l)
+  {
+    char *lib = realpath(argv[optind + l], NULL);
+
+    memset(results[l], 0, sizeof(results[l]));
+    if (!lib || run_lib(self, lib, iterations, trace, results[l]))
+    {
+      fprintf(stderr, "Could not benchmark '%s'\n", argv[optind + l]);
+      free(lib);
+      return 1;
+    }
+    free(lib);
+  }
+
+  if (quiet)
+    return 0;
+
+  printf("ExecHelper exec microbenchmark (engine: %s, %d iterations per scenario%s%s)\n\n",
+         engine, iterations, trace ? ", trace: " : "", trace ? trace : "");
+  printf("%-20s", "ns/exec");
+  for (l = 0; l < nlibs; ++l)
+    printf(" %30.30s", argv[optind + l]);
+  printf("\n");
+
+  for (row = 0; row < N_ROWS; ++row)
+  {
+    if (row == ROW_TRACE && !trace)
+      continue;
+
+    printf("%-20s", row < N_SCENARIOS ? scenarios[row].name : row == ROW_TRACE ? "trace records" : "all execs");
+    for (l = 0; l < nlibs; ++l)
+    {
+      if (l && results[0][row])
+        printf(" %20lld (%+6.1f%%)", results[l][row],
+               100.0 * (results[0][row] - results[l][row]) / results[0][row]);
+      else
+        printf(" %30lld", results[l][row]);
+    }
+    printf("\n");
+  }
+
+  if (nlibs > 1)
+    printf("\nPercentages are the gain over %s (positive is faster).\n", argv[optind]);
+
+  return 0;
+}
@@ -0,0 +1,377 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Baseline of ExecHelpHashTable with exechelp_str_hash on path-shaped keys.
+ * The corpus is a walk of /usr (or the paths listed in a file, one per line,
+ * given with -c) followed by the lines of the policy lists. Tables larger
+ * than the corpus reuse it under /N prefixes, so keys keep the prefix
+ * sharing of real paths. For each size, the report gives:
+ *
+ *  - ns/op of insert, lookup-hit, lookup-miss, remove and iterate; lookups
+ *    and removals go through the keys in a shuffled order
+ *  - the bytes the table holds per entry once filled (keys are not counted,
+ *    they are owned by the corpus), measured by interposing the allocator
+ *  - the number of resizes while inserting, and the time spent in the
+ *    inserts that resized (the only inserts that allocate)
+ *
+ * Sizes go from 10 to the -n maximum (1M by default, 10M takes about 2GB).
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "hash.h"
+
+#include "check.h"
+
+#define BENCH_DEFAULT_MAX   1000000
+#define BENCH_MISS_KEYS     1000000  /* at most, misses are reused beyond */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+typedef struct _AllocCounters {
+  unsigned long allocs;
+  long          live;
+} AllocCounters;
+
+typedef struct _Corpus {
+  char   **keys;
+  size_t   n;
+  size_t   size;
+} Corpus;
+
+static int counting = 0;
+static AllocCounters counters;
+static Corpus corpus;
+
+void *malloc(size_t size)
+{
+  void *ptr = __libc_malloc(size);
+  if (counting && ptr)
+  {
+    counters.allocs++;
+    counters.live += malloc_usable_size(ptr);
+  }
+  return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+  void *ptr = __libc_calloc(nmemb, size);
+  if (counting && ptr)
+  {
+    counters.allocs++;
+    counters.live += malloc_usable_size(ptr);
+  }
+  return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  if (counting && ptr)
+    counters.live -= malloc_usable_size(ptr);
+  ptr = __libc_realloc(ptr, size);
+  if (counting && ptr)
+  {
+    counters.allocs++;
+    counters.live += malloc_usable_size(ptr);
+  }
+  return ptr;
+}
+
+void free(void *ptr)
+{
+  if (counting && ptr)
+    counters.live -= malloc_usable_size(ptr);
+  __libc_free(ptr);
+}
+
+static int corpus_add(const char *key)
+{
+  if (corpus.n == corpus.size)
+  {
+    size_t size = corpus.size ? corpus.size * 2 : 4096;
+    char **keys = realloc(corpus.keys, size * sizeof(char *));
+
+    if (!keys)
+      return -1;
+    corpus.keys = keys;
+    corpus.size = size;
+  }
+
+  if (!(corpus.keys[corpus.n] = strdup(key)))
+    return -1;
+  corpus.n++;
+
+  return 0;
+}
+
+static int corpus_walk_cb(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+{
+  (void) sb;
+  (void) typeflag;
+  (void) ftwbuf;
+
+  return corpus_add(fpath);
+}
+
+static int corpus_add_file(const char *path)
+{
+  char *line = NULL;
+  size_t len = 0;
+  ssize_t read;
+  FILE *fp = fopen(path, "r");
+
+  if (!fp)
+    return -1;
+
+  while ((read = getline(&line, &len, fp)) > 0)
+  {
+    if (line[read - 1] == '\n')
+      line[--read] = '\0';
+    if (read && corpus_add(line))
+      break;
+  }
+
+  free(line);
+  fclose(fp);
+  return 0;
+}
+
+/* Grows the corpus to n keys by reusing it under /1, /2, ... prefixes */
+static int corpus_extend(size_t n)
+{
+  size_t base = corpus.n, i;
+
+  for (i = base; i < n; ++i)
+  {
+    char key[PATH_MAX + 32];
+
+    snprintf(key, sizeof(key), "/%zu%s", i / base, corpus.keys[i % base]);
+    if (corpus_add(key))
+      return -1;
+  }
+
+  return 0;
+}
+
+/* Returns a random permutation of 0..n-1; the seed is fixed so that runs
+ * are comparable */
+static size_t *make_order(size_t n)
+{
+  size_t *order = malloc(n * sizeof(size_t)), i;
+  unsigned int seed = 42;
+
+  if (!order)
+    return NULL;
+
+  for (i = 0; i < n; ++i)
+    order[i] = i;
+  for (i = n - 1; i > 0; --i)
+  {
+    size_t j = rand_r(&seed) % (i + 1), tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+
+  return order;
+}
+
+/* Repeats small workloads so that each measure lasts long enough */
+static int repeats_for(size_t n)
+{
+  return n >= 100000 ? 1 : (int) (100000 / n);
+}
+
+static void bench_size(size_t n, char **misses, size_t nmisses)
+{
+  size_t *order = make_order(n), i;
+  int repeats = repeats_for(n), r;
+  long long start, insert_ns = 0, hit_ns = 0, miss_ns = 0, remove_ns = 0, iter_ns = 0;
+  long long resize_ns = 0, resize_max_ns = 0;
+  unsigned long resizes = 0, found = 0;
+  long table_bytes = 0;
+
+  if (!order)
+    return;
+
+  for (r = 0; r < repeats; ++r)
+  {
+    ExecHelpHashTable *table;
+    ExecHelpHashTableIter iter;
+    void *key, *value;
+
+    /* Insert, timing each insert to isolate those that resize */
+    memset(&counters, 0, sizeof(counters));
+    counting = 1;
+    table = exechelp_hash_table_new(exechelp_str_hash, exechelp_str_equal);
+    for (i = 0; i < n; ++i)
+    {
+      unsigned long allocs = counters.allocs;
+
+      start = now_ns();
+      exechelp_hash_table_insert(table, corpus.keys[i], corpus.keys[i]);
+      long long elapsed = now_ns() - start;
+
+      insert_ns += elapsed;
+      if (counters.allocs != allocs)
+      {
+        resizes++;
+        resize_ns += elapsed;
+        if (elapsed > resize_max_ns)
+          resize_max_ns = elapsed;
+      }
+    }
+    table_bytes = counters.live;
+    counting = 0;
+
+    start = now_ns();
+    for (i = 0; i < n; ++i)
+      found += exechelp_hash_table_lookup(table, corpus.keys[order[i]]) != NULL;
+    hit_ns += now_ns() - start;
+
+    start = now_ns();
+    for (i = 0; i < n; ++i)
+      found += exechelp_hash_table_lookup(table, misses[order[i] % nmisses]) != NULL;
+    miss_ns += now_ns() - start;
+
+    start = now_ns();
+    exechelp_hash_table_iter_init(&iter, table);
+    while (exechelp_hash_table_iter_next(&iter, &key, &value))
+      found += key == value;
+    iter_ns += now_ns() - start;
+
+    start = now_ns();
+    for (i = 0; i < n; ++i)
+      exechelp_hash_table_remove(table, corpus.keys[order[i]]);
+    remove_ns += now_ns() - start;
+
+    exechelp_hash_table_destroy(table);
+  }
+
+  /* Each key is found once by its lookup and once by the iteration */
+  if (found != 2 * n * repeats)
+    fprintf(stderr, "Unexpected number of keys found at size %zu: %lu\n", n, found / repeats);
+
+  double ops = (double) n * repeats;
+  printf("%10zu %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8lu %12.1f %10.1f\n", n,
+         insert_ns / ops, hit_ns / ops, miss_ns / ops, remove_ns / ops, iter_ns / ops,
+         (double) table_bytes / n, resizes / repeats,
+         resize_ns / 1000.0 / repeats, resize_max_ns / 1000.0);
+
+  free(order);
+}
+
+static void usage(const char *self)
+{
+  fprintf(stderr, "Usage: %s [-n max-size] [-c corpus-file]\n", self);
+}
+
+int main(int argc, char *argv[])
+{
+  static const char *lists[] = {
+    EXECHELP_HELPER_BINS_PATH,
+    EXECHELP_MANAGED_BINS_PATH,
+    EXECHELP_MANAGED_FILES_PATH,
+    NULL
+  };
+  const char *corpus_file = NULL;
+  size_t max = BENCH_DEFAULT_MAX, n, i;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:c:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n':
+        max = strtoul(optarg, NULL, 10);
+        break;
+      case 'c':
+        corpus_file = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  if (max < 10 || optind != argc)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (corpus_file ? corpus_add_file(corpus_file) : nftw("/usr", corpus_walk_cb, 64, FTW_PHYS))
+  {
+    fprintf(stderr, "Could not read corpus '%s': %s\n", corpus_file ? corpus_file : "/usr", strerror(errno));
+    return 1;
+  }
+  for (i = 0; lists[i]; ++i)
+    corpus_add_file(lists[i]);
+
+  size_t unique = corpus.n;
+  if (!unique || corpus_extend(max))
+  {
+    fprintf(stderr, "Could not build a corpus of %zu keys\n", max);
+    return 1;
+  }
+
+  /* Misses share the prefixes of hits, and only differ by their end */
+  size_t nmisses = max < BENCH_MISS_KEYS ? max : BENCH_MISS_KEYS;
+  char **misses = malloc(nmisses * sizeof(char *));
+  if (!misses)
+    return 1;
+  for (i = 0; i < nmisses; ++i)
+    if (asprintf(&misses[i], "%s.missing", corpus.keys[i]) < 0)
+      return 1;
+
+  printf("ExecHelper hash table (%zu unique paths from %s and the policy lists)\n\n",
+         unique, corpus_file ? corpus_file : "/usr");
+  printf("%10s %8s %8s %8s %8s %8s %8s %8s %12s %10s\n", "", "insert", "hit", "miss", "remove", "iterate",
+         "bytes/", "", "resize", "max resize");
+  printf("%10s %8s %8s %8s %8s %8s %8s %8s %12s %10s\n", "entries", "ns/op", "ns/op", "ns/op", "ns/op", "ns/op",
+         "entry", "resizes", "total (us)", "(us)");
+
+  for (n = 10; n <= max; n *= 10)
+    bench_size(n, misses, nmisses);
+  if (n / 10 != max)
+    bench_size(max, misses, nmisses);
+
+  printf("\nInserts are timed one by one, which adds the clock overhead to their ns/op.\n");
+
+  for (i = 0; i < nmisses; ++i)
+    free(misses[i]);
+  free(misses);
+  for (i = 0; i < corpus.n; ++i)
+    free(corpus.keys[i]);
+  free(corpus.keys);
+
+  return 0;
+}
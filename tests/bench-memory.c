@@ -0,0 +1,321 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Memory footprint of the library across many concurrently preloaded
+ * processes. The benchmark spawns groups of N copies of itself, with and
+ * without the library preloaded, that either stay idle or first make a number
+ * of exec decisions (execve calls on a path that does not exist, so the
+ * process survives them). Once all processes of a group are ready, their
+ * /proc/<pid>/smaps_rollup and smaps are sampled.
+ *
+ * For each group, the report gives per-process averages of RSS, PSS and USS
+ * (private clean + dirty), and of the PSS, shared and private bytes of the
+ * library's own mappings. The private bytes attributable to the library are
+ * the USS of a preloaded group minus that of its control group.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define BENCH_DEFAULT_PROCESSES 50
+#define BENCH_DEFAULT_EXECS     100
+#define BENCH_DEFAULT_LIB       "./exec-helper-bench.so"
+#define BENCH_MISSING_TARGET    "/nonexistent/exechelper-bench/vlc"
+
+typedef struct _MemorySample {
+  unsigned long rss;
+  unsigned long pss;
+  unsigned long uss;
+  unsigned long lib_pss;
+  unsigned long lib_shared;
+  unsigned long lib_private;
+} MemorySample;
+
+typedef struct _BenchGroup {
+  const char   *name;
+  int           preload;
+  int           execs;
+  MemorySample  avg;
+} BenchGroup;
+
+/* Child side: optionally make exec decisions, report readiness, then wait to
+ * be measured and killed */
+static int bench_child(int ready_fd, int execs)
+{
+  char *const argv[] = { "vlc", "/tmp/test-managed.mp3", "/etc/passwd", "./a.mp3", "~/b.mp3", NULL };
+  int i;
+
+  for (i = 0; i < execs; ++i)
+    execve(BENCH_MISSING_TARGET, argv, environ);
+
+  if (write(ready_fd, "", 1) != 1)
+    return 1;
+  close(ready_fd);
+
+  for (;;)
+    pause();
+  return 0;
+}
+
+static unsigned long bench_parse_kb(const char *line, const char *field)
+{
+  size_t len = strlen(field);
+  if (strncmp(line, field, len) || line[len] != ':')
+    return 0;
+  return strtoul(line + len + 1, NULL, 10) * 1024;
+}
+
+/* Sums the rollup of the whole process, and the mappings of the library */
+static int bench_sample(pid_t pid, const char *lib, MemorySample *sample)
+{
+  char path[64], line[PATH_MAX + 128];
+  FILE *f;
+
+  memset(sample, 0, sizeof(MemorySample));
+
+  snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", pid);
+  if (!(f = fopen(path, "r")))
+    return -1;
+  while (fgets(line, sizeof(line), f))
+  {
+    sample->rss += bench_parse_kb(line, "Rss");
+    sample->pss += bench_parse_kb(line, "Pss");
+    sample->uss += bench_parse_kb(line, "Private_Clean");
+    sample->uss += bench_parse_kb(line, "Private_Dirty");
+  }
+  fclose(f);
+
+  if (!lib)
+    return 0;
+
+  snprintf(path, sizeof(path), "/proc/%d/smaps", pid);
+  if (!(f = fopen(path, "r")))
+    return -1;
+
+  int in_lib = 0;
+  while (fgets(line, sizeof(line), f))
+  {
+    /* Mapping headers start with an address range, fields with a name */
+    if (strchr(line, '-') && strchr(line, '-') < strchr(line, ' '))
+    {
+      char *name = strchr(line, '/');
+      line[strcspn(line, "\n")] = '\0';
+      in_lib = name && strcmp(name, lib) == 0;
+    }
+    else if (in_lib)
+    {
+      sample->lib_pss += bench_parse_kb(line, "Pss");
+      sample->lib_shared += bench_parse_kb(line, "Shared_Clean");
+      sample->lib_shared += bench_parse_kb(line, "Shared_Dirty");
+      sample->lib_private += bench_parse_kb(line, "Private_Clean");
+      sample->lib_private += bench_parse_kb(line, "Private_Dirty");
+    }
+  }
+  fclose(f);
+
+  return 0;
+}
+
+static int bench_group(BenchGroup *group, int n, const char *self, const char *lib)
+{
+  pid_t *pids = calloc(n, sizeof(pid_t));
+  int fds[2], i, spawned = 0, ret = 0;
+  char fd_arg[16], execs_arg[16];
+
+  if (!pids || pipe(fds))
+  {
+    free(pids);
+    return -1;
+  }
+
+  snprintf(fd_arg, sizeof(fd_arg), "%d", fds[1]);
+  snprintf(execs_arg, sizeof(execs_arg), "%d", group->execs);
+
+  for (i = 0; i < n; ++i)
+  {
+    pid_t pid = fork();
+    if (pid < 0)
+      break;
+
+    if (pid == 0)
+    {
+      char *const argv[] = { (char *) self, "--child", fd_arg, execs_arg, NULL };
+      close(fds[0]);
+      if (group->preload)
+        setenv("LD_PRELOAD", lib, 1);
+      else
+        unsetenv("LD_PRELOAD");
+      execv(self, argv);
+      _exit(127);
+    }
+
+    pids[spawned++] = pid;
+  }
+  close(fds[1]);
+
+  /* Wait for every child to be ready */
+  char c;
+  for (i = 0; i < spawned; ++i)
+    if (read(fds[0], &c, 1) != 1)
+      break;
+  close(fds[0]);
+
+  if (spawned < n || i < spawned)
+  {
+    fprintf(stderr, "Only %d of %d processes of group '%s' started\n", i, n, group->name);
+    ret = -1;
+  }
+
+  memset(&group->avg, 0, sizeof(MemorySample));
+  for (i = 0; i < spawned && ret == 0; ++i)
+  {
+    MemorySample sample;
+    if (bench_sample(pids[i], group->preload ? lib : NULL, &sample))
+    {
+      fprintf(stderr, "Could not sample process %d: %s\n", pids[i], strerror(errno));
+      ret = -1;
+      break;
+    }
+
+    group->avg.rss += sample.rss;
+    group->avg.pss += sample.pss;
+    group->avg.uss += sample.uss;
+    group->avg.lib_pss += sample.lib_pss;
+    group->avg.lib_shared += sample.lib_shared;
+    group->avg.lib_private += sample.lib_private;
+  }
+
+  if (spawned)
+  {
+    group->avg.rss /= spawned;
+    group->avg.pss /= spawned;
+    group->avg.uss /= spawned;
+    group->avg.lib_pss /= spawned;
+    group->avg.lib_shared /= spawned;
+    group->avg.lib_private /= spawned;
+  }
+
+  for (i = 0; i < spawned; ++i)
+  {
+    kill(pids[i], SIGKILL);
+    waitpid(pids[i], NULL, 0);
+  }
+  free(pids);
+
+  return ret;
+}
+
+static void usage(const char *self)
+{
+  fprintf(stderr, "Usage: %s [-n processes] [-k execs] [-e engine|legacy] [-l library]\n", self);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *lib_arg = BENCH_DEFAULT_LIB, *engine = "legacy";
+  int n = BENCH_DEFAULT_PROCESSES, execs = BENCH_DEFAULT_EXECS, opt;
+  char self[PATH_MAX], lib[PATH_MAX];
+  ssize_t len;
+
+  if (argc == 4 && strcmp(argv[1], "--child") == 0)
+    return bench_child(atoi(argv[2]), atoi(argv[3]));
+
+  while ((opt = getopt(argc, argv, "n:k:e:l:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n':
+        n = atoi(optarg);
+        break;
+      case 'k':
+        execs = atoi(optarg);
+        break;
+      case 'e':
+        engine = optarg;
+        break;
+      case 'l':
+        lib_arg = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  if (n < 1 || execs < 0)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if ((len = readlink("/proc/self/exe", self, sizeof(self) - 1)) < 0)
+  {
+    fprintf(stderr, "Could not find the benchmark binary: %s\n", strerror(errno));
+    return 1;
+  }
+  self[len] = '\0';
+
+  if (!realpath(lib_arg, lib))
+  {
+    fprintf(stderr, "Could not find library '%s': %s\n", lib_arg, strerror(errno));
+    return 1;
+  }
+
+  setenv("EXECHELP_ENGINE", engine, 1);
+
+  BenchGroup groups[] = {
+    { "control, idle", 0, 0 },
+    { "control, exec-heavy", 0, execs },
+    { "preloaded, idle", 1, 0 },
+    { "preloaded, exec-heavy", 1, execs },
+  };
+  size_t n_groups = sizeof(groups) / sizeof(groups[0]), i;
+
+  printf("ExecHelper memory footprint (%d processes per group, %d execs, engine: %s)\n", n, execs, engine);
+  printf("library: %s\n\n", lib);
+  printf("%-24s %10s %10s %10s %10s %10s %10s\n", "group (bytes/process)",
+         "rss", "pss", "uss", "lib pss", "lib shared", "lib priv");
+
+  for (i = 0; i < n_groups; ++i)
+  {
+    if (bench_group(&groups[i], n, self, lib))
+      return 1;
+
+    printf("%-24s %10lu %10lu %10lu %10lu %10lu %10lu\n", groups[i].name,
+           groups[i].avg.rss, groups[i].avg.pss, groups[i].avg.uss,
+           groups[i].avg.lib_pss, groups[i].avg.lib_shared, groups[i].avg.lib_private);
+  }
+
+  printf("\nprivate bytes per process attributable to the library:\n");
+  printf("  idle:       %ld (of which %lu in its mappings)\n",
+         (long) groups[2].avg.uss - (long) groups[0].avg.uss, groups[2].avg.lib_private);
+  printf("  exec-heavy: %ld (of which %lu in its mappings)\n",
+         (long) groups[3].avg.uss - (long) groups[1].avg.uss, groups[3].avg.lib_private);
+
+  return 0;
+}
@@ -0,0 +1,471 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Policy propagation latency: how long it takes, after the trusted side
+ * publishes a change to a policy list, for running processes to enforce it.
+ * The benchmark starts N copies of itself with the library preloaded, which
+ * make the same exec decision at a fixed interval: running a player on a
+ * probe file. The probe is then added to and removed from managed-files.list
+ * in turns, and each worker reports the time of its first decision that
+ * enforces the new policy, i.e. that delegates the execution once the probe
+ * is managed and allows it once it is not.
+ *
+ * As in bench-exec, a seccomp filter makes the execve system call fail in
+ * the workers, so that allowed executions return (with ENOEXEC) as delegated
+ * ones do (with EACCES). Changes are published at a random offset within a
+ * second, since policy files may be compared by their mtime in seconds, and
+ * either by rewriting the list in place or by renaming a new list over it.
+ *
+ * The report gives the distribution of the latencies of all workers over all
+ * changes, for each engine and way of publishing, and the number of workers
+ * that still did not enforce a change when the next one was published. The
+ * library must be built with EXECHELP_POLICY_DIR set to the directory that
+ * the benchmark rewrites, as the Makefile does.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+
+#include "check.h"
+
+#define BENCH_DEFAULT_WORKERS   20
+#define BENCH_DEFAULT_CHANGES   6
+#define BENCH_DEFAULT_INTERVAL  1000   /* us between two decisions of a worker */
+#define BENCH_DEFAULT_TIMEOUT   3000   /* ms */
+#define BENCH_DEFAULT_LIB       "./exec-helper-bench-propagation.so"
+#define BENCH_SPREAD_MS         1000
+#define BENCH_PROBE_TARGET      "/usr/bin/vlc"
+#define BENCH_PROBE_FILE        EXECHELP_POLICY_DIR "probe.mp3"
+
+/* Sent by workers when their verdict changes, and once at startup */
+typedef struct _WorkerReport {
+  int        worker;
+  int        delegated;
+  long long  when;
+} WorkerReport;
+
+typedef struct _BenchGroup {
+  const char  *engine;
+  const char  *mechanism;
+  long long   *latencies;
+  int          n_latencies;
+  int          missed;
+} BenchGroup;
+
+/* Makes execve and execveat fail with ENOEXEC, so that allowed executions
+ * return like delegated ones do */
+static int forbid_exec_syscalls(void)
+{
+  struct sock_filter filter[] = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_execve, 1, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_execveat, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | ENOEXEC),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+  };
+  struct sock_fprog prog = { sizeof(filter) / sizeof(filter[0]), filter };
+
+  if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0))
+    return -1;
+
+  return prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog);
+}
+
+/* Worker side: decides on the probe until killed, and reports every change
+ * of verdict */
+static int bench_worker(int worker, int report_fd, long interval_us)
+{
+  char *const argv[] = { "vlc", BENCH_PROBE_FILE, NULL };
+  struct timespec interval = { interval_us / 1000000, (interval_us % 1000000) * 1000 };
+  int last = -1;
+
+  if (forbid_exec_syscalls())
+    return 1;
+
+  for (;;)
+  {
+    execve(BENCH_PROBE_TARGET, argv, environ);
+    int delegated = errno == EACCES;
+    long long when = now_ns();
+
+    if (delegated != last)
+    {
+      WorkerReport report = { worker, delegated, when };
+      if (write(report_fd, &report, sizeof(report)) != sizeof(report))
+        return 1;
+      last = delegated;
+    }
+
+    nanosleep(&interval, NULL);
+  }
+
+  return 0;
+}
+
+static int bench_write_file(const char *path, const char *contents)
+{
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  size_t len = strlen(contents);
+
+  if (fd < 0)
+    return -1;
+  if (write(fd, contents, len) != (ssize_t) len)
+  {
+    close(fd);
+    return -1;
+  }
+  return close(fd);
+}
+
+/* Publishes the list of managed files, with or without the probe */
+static int bench_publish(const char *mechanism, int managed)
+{
+  const char *contents = managed ? "/etc/firejail/\n" BENCH_PROBE_FILE "\n" : "/etc/firejail/\n";
+
+  if (strcmp(mechanism, "rewrite") == 0)
+    return bench_write_file(EXECHELP_MANAGED_FILES_PATH, contents);
+
+  if (bench_write_file(EXECHELP_MANAGED_FILES_PATH ".new", contents))
+    return -1;
+  return rename(EXECHELP_MANAGED_FILES_PATH ".new", EXECHELP_MANAGED_FILES_PATH);
+}
+
+static int bench_setup_policy(void)
+{
+  if (mkdir(EXECHELP_POLICY_DIR, 0755) != 0 && errno != EEXIST)
+    return -1;
+
+  if (bench_write_file(EXECHELP_HELPER_BINS_PATH, "/usr/bin/cvlc\n") ||
+      bench_write_file(EXECHELP_MANAGED_BINS_PATH, "/usr/bin/firefox\n") ||
+      bench_write_file(BENCH_PROBE_FILE, "") ||
+      bench_publish("rename", 0))
+    return -1;
+
+  return 0;
+}
+
+static void bench_remove_policy(void)
+{
+  unlink(EXECHELP_HELPER_BINS_PATH);
+  unlink(EXECHELP_MANAGED_BINS_PATH);
+  unlink(EXECHELP_MANAGED_FILES_PATH);
+  unlink(BENCH_PROBE_FILE);
+  rmdir(EXECHELP_POLICY_DIR);
+}
+
+/* Reads a report, giving up at the deadline */
+static int bench_read_report(int fd, long long deadline, WorkerReport *report)
+{
+  long long left = deadline - now_ns();
+  fd_set fds;
+
+  if (left <= 0)
+    return 0;
+
+  struct timeval timeout = { left / 1000000000LL, (left % 1000000000LL) / 1000 };
+  FD_ZERO(&fds);
+  FD_SET(fd, &fds);
+  if (select(fd + 1, &fds, NULL, NULL, &timeout) <= 0)
+    return 0;
+
+  return read(fd, report, sizeof(*report)) == sizeof(*report);
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+  long long x = *(const long long *) a, y = *(const long long *) b;
+
+  return (x > y) - (x < y);
+}
+
+static int bench_group(BenchGroup *group, int n, int changes, long interval_us, long timeout_ms,
+                       const char *self, const char *lib)
+{
+  pid_t *pids = calloc(n, sizeof(pid_t));
+  int *state = calloc(n, sizeof(int)), *done = calloc(n, sizeof(int));
+  int fds[2], i, spawned = 0, ready = 0, ret = 0;
+  char fd_arg[16], interval_arg[32], worker_arg[16];
+  WorkerReport report;
+
+  group->latencies = calloc((size_t) n * changes, sizeof(long long));
+  group->n_latencies = 0;
+  group->missed = 0;
+
+  if (!pids || !state || !done || !group->latencies || pipe(fds) ||
+      bench_publish(group->mechanism, 0))
+  {
+    free(pids);
+    free(state);
+    free(done);
+    return -1;
+  }
+
+  snprintf(fd_arg, sizeof(fd_arg), "%d", fds[1]);
+  snprintf(interval_arg, sizeof(interval_arg), "%ld", interval_us);
+
+  for (i = 0; i < n; ++i)
+  {
+    pid_t pid = fork();
+    if (pid < 0)
+      break;
+
+    if (pid == 0)
+    {
+      snprintf(worker_arg, sizeof(worker_arg), "%d", i);
+      char *const argv[] = { (char *) self, "--worker", worker_arg, fd_arg, interval_arg, NULL };
+      close(fds[0]);
+      setenv("LD_PRELOAD", lib, 1);
+      setenv("EXECHELP_ENGINE", group->engine, 1);
+      execv(self, argv);
+      _exit(127);
+    }
+
+    pids[spawned++] = pid;
+    state[i] = -1;
+  }
+  close(fds[1]);
+
+  /* Every worker first reports that it allows the execution */
+  long long deadline = now_ns() + timeout_ms * 1000000LL;
+  while (ready < spawned && bench_read_report(fds[0], deadline, &report))
+  {
+    if (report.worker >= 0 && report.worker < n && state[report.worker] == -1 && !report.delegated)
+      ready++;
+    if (report.worker >= 0 && report.worker < n)
+      state[report.worker] = report.delegated;
+  }
+
+  if (spawned < n || ready < spawned)
+  {
+    fprintf(stderr, "Only %d of %d workers of group %s/%s started\n", ready, n,
+            group->engine, group->mechanism);
+    ret = -1;
+  }
+
+  int change, managed = 0;
+  for (change = 0; change < changes && ret == 0; ++change)
+  {
+    /* Lands anywhere within a second, including the one of the last change */
+    struct timespec spread = { 0, (rand() % BENCH_SPREAD_MS) * 1000000L };
+    nanosleep(&spread, NULL);
+
+    managed = !managed;
+    long long published = now_ns();
+    if (bench_publish(group->mechanism, managed))
+    {
+      fprintf(stderr, "Could not publish the policy: %s\n", strerror(errno));
+      ret = -1;
+      break;
+    }
+
+    /* Workers that missed the last change already enforce this one */
+    int pending = 0;
+    for (i = 0; i < spawned; ++i)
+    {
+      done[i] = state[i] == managed;
+      pending += !done[i];
+    }
+
+    /* Reports made before the change cannot enforce it */
+    deadline = published + timeout_ms * 1000000LL;
+    while (pending && bench_read_report(fds[0], deadline, &report))
+    {
+      if (report.worker < 0 || report.worker >= spawned)
+        continue;
+      if (report.delegated == managed && !done[report.worker] && report.when >= published)
+      {
+        group->latencies[group->n_latencies++] = report.when - published;
+        done[report.worker] = 1;
+        pending--;
+      }
+      state[report.worker] = report.delegated;
+    }
+
+    group->missed += pending;
+  }
+
+  for (i = 0; i < spawned; ++i)
+  {
+    kill(pids[i], SIGKILL);
+    waitpid(pids[i], NULL, 0);
+  }
+  close(fds[0]);
+  free(pids);
+  free(state);
+  free(done);
+
+  qsort(group->latencies, group->n_latencies, sizeof(long long), bench_compare);
+  return ret;
+}
+
+static double bench_percentile(const BenchGroup *group, double p)
+{
+  if (!group->n_latencies)
+    return 0;
+
+  int i = (int) (p * (group->n_latencies - 1) + 0.5);
+  return group->latencies[i] / 1e6;
+}
+
+static void usage(const char *self)
+{
+  fprintf(stderr, "Usage: %s [-n workers] [-c changes] [-i interval-us] [-t timeout-ms] "
+                  "[-e engine|legacy] [-m rewrite|rename] [-l library]\n", self);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *lib_arg = BENCH_DEFAULT_LIB, *engine = NULL, *mechanism = NULL;
+  int n = BENCH_DEFAULT_WORKERS, changes = BENCH_DEFAULT_CHANGES, opt;
+  long interval_us = BENCH_DEFAULT_INTERVAL, timeout_ms = BENCH_DEFAULT_TIMEOUT;
+  char self[PATH_MAX], lib[PATH_MAX];
+  ssize_t len;
+
+  if (argc == 5 && strcmp(argv[1], "--worker") == 0)
+    return bench_worker(atoi(argv[2]), atoi(argv[3]), atol(argv[4]));
+
+  while ((opt = getopt(argc, argv, "n:c:i:t:e:m:l:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n':
+        n = atoi(optarg);
+        break;
+      case 'c':
+        changes = atoi(optarg);
+        break;
+      case 'i':
+        interval_us = atol(optarg);
+        break;
+      case 't':
+        timeout_ms = atol(optarg);
+        break;
+      case 'e':
+        engine = optarg;
+        break;
+      case 'm':
+        mechanism = optarg;
+        break;
+      case 'l':
+        lib_arg = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  if (n < 1 || changes < 1 || interval_us < 0 || timeout_ms < 1 ||
+      (mechanism && strcmp(mechanism, "rewrite") && strcmp(mechanism, "rename")))
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if ((len = readlink("/proc/self/exe", self, sizeof(self) - 1)) < 0)
+  {
+    fprintf(stderr, "Could not find the benchmark binary: %s\n", strerror(errno));
+    return 1;
+  }
+  self[len] = '\0';
+
+  if (!realpath(lib_arg, lib))
+  {
+    fprintf(stderr, "Could not find library '%s': %s\n", lib_arg, strerror(errno));
+    return 1;
+  }
+
+  if (bench_setup_policy())
+  {
+    fprintf(stderr, "Could not write the policy into '%s': %s\n", EXECHELP_POLICY_DIR, strerror(errno));
+    bench_remove_policy();
+    return 1;
+  }
+
+  srand(time(NULL) ^ getpid());
+
+  BenchGroup groups[] = {
+    { "legacy", "rewrite" },
+    { "legacy", "rename" },
+    { "engine", "rewrite" },
+    { "engine", "rename" },
+  };
+  size_t n_groups = sizeof(groups) / sizeof(groups[0]), i;
+  int ret = 0;
+
+  printf("ExecHelper policy propagation (%d workers deciding every %ldus, %d changes, timeout %ldms)\n",
+         n, interval_us, changes, timeout_ms);
+  printf("library: %s\npolicy:  %s\n\n", lib, EXECHELP_POLICY_DIR);
+  printf("%-16s %9s %9s %9s %9s %9s %9s %8s\n", "engine/publish", "min ms", "p50 ms", "p90 ms",
+         "p99 ms", "max ms", "mean ms", "missed");
+
+  for (i = 0; i < n_groups; ++i)
+  {
+    if ((engine && strcmp(engine, groups[i].engine)) ||
+        (mechanism && strcmp(mechanism, groups[i].mechanism)))
+      continue;
+
+    if (bench_group(&groups[i], n, changes, interval_us, timeout_ms, self, lib))
+    {
+      ret = 1;
+      free(groups[i].latencies);
+      break;
+    }
+
+    double mean = 0;
+    int j;
+    for (j = 0; j < groups[i].n_latencies; ++j)
+      mean += groups[i].latencies[j] / 1e6;
+    if (groups[i].n_latencies)
+      mean /= groups[i].n_latencies;
+
+    char name[32];
+    snprintf(name, sizeof(name), "%s/%s", groups[i].engine, groups[i].mechanism);
+    printf("%-16s %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %4d/%-3d\n", name,
+           bench_percentile(&groups[i], 0), bench_percentile(&groups[i], 0.5),
+           bench_percentile(&groups[i], 0.9), bench_percentile(&groups[i], 0.99),
+           bench_percentile(&groups[i], 1), mean, groups[i].missed, n * changes);
+    fflush(stdout);
+    free(groups[i].latencies);
+  }
+
+  printf("\nmissed: workers that did not enforce a change within the timeout\n");
+
+  bench_remove_policy();
+  return ret;
+}
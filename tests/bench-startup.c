@@ -0,0 +1,272 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Load-time cost of the library for processes that never exec. The benchmark
+ * starts copies of itself that exit as soon as they reach main, without the
+ * library and with each of the libraries given on the command line preloaded.
+ * Runs of all configurations are interleaved, so that they are equally
+ * affected by the state of the machine.
+ *
+ * For each configuration, the report gives the median time from fork to
+ * main and from fork to exit, the extra time over the run without preload,
+ * and, read from the library's ELF file, its size, its exported dynamic
+ * symbols and its dynamic relocations.
+ */
+
+#define _GNU_SOURCE
+
+#include <elf.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "check.h"
+
+#define BENCH_DEFAULT_RUNS  500
+#define BENCH_MAX_CONFIGS   8
+
+typedef struct _ElfStats {
+  long size;
+  long exported;
+  long relocs;
+  long plt_relocs;
+} ElfStats;
+
+typedef struct _StartupConfig {
+  const char  *lib;  /* NULL for no preload */
+  long long   *to_main;
+  long long   *to_exit;
+  ElfStats     elf;
+} StartupConfig;
+
+/* Counts the defined dynamic symbols and the dynamic relocations of a
+ * 64-bit shared object */
+static int read_elf_stats(const char *path, ElfStats *stats)
+{
+  struct stat sb;
+  int fd = open(path, O_RDONLY), i;
+
+  memset(stats, 0, sizeof(*stats));
+  if (fd < 0 || fstat(fd, &sb))
+    return -1;
+
+  const unsigned char *data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return -1;
+
+  const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *) data;
+  if ((size_t) sb.st_size < sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+      ehdr->e_ident[EI_CLASS] != ELFCLASS64)
+  {
+    munmap((void *) data, sb.st_size);
+    return -1;
+  }
+
+  const Elf64_Shdr *shdrs = (const Elf64_Shdr *) (data + ehdr->e_shoff);
+  const char *shstrtab = (const char *) data + shdrs[ehdr->e_shstrndx].sh_offset;
+
+  stats->size = sb.st_size;
+  for (i = 0; i < ehdr->e_shnum; ++i)
+  {
+    const Elf64_Shdr *shdr = &shdrs[i];
+
+    if (shdr->sh_type == SHT_DYNSYM)
+    {
+      const Elf64_Sym *syms = (const Elf64_Sym *) (data + shdr->sh_offset);
+      size_t n = shdr->sh_size / sizeof(Elf64_Sym), j;
+
+      for (j = 1; j < n; ++j)
+        stats->exported += syms[j].st_shndx != SHN_UNDEF;
+    }
+    else if (shdr->sh_type == SHT_RELA)
+    {
+      long n = shdr->sh_size / sizeof(Elf64_Rela);
+
+      if (strcmp(shstrtab + shdr->sh_name, ".rela.plt") == 0)
+        stats->plt_relocs += n;
+      else
+        stats->relocs += n;
+    }
+  }
+
+  munmap((void *) data, sb.st_size);
+  return 0;
+}
+
+static int run_once(const char *self, StartupConfig *config, int run)
+{
+  char fd_arg[16];
+  long long start, reached;
+  int fds[2], status;
+  pid_t pid;
+
+  if (pipe(fds))
+    return -1;
+
+  start = now_ns();
+  pid = fork();
+  if (pid < 0)
+    return -1;
+
+  if (pid == 0)
+  {
+    char *const argv[] = { (char *) self, "--child", fd_arg, NULL };
+
+    close(fds[0]);
+    snprintf(fd_arg, sizeof(fd_arg), "%d", fds[1]);
+    if (config->lib)
+      setenv("LD_PRELOAD", config->lib, 1);
+    else
+      unsetenv("LD_PRELOAD");
+    execv(self, argv);
+    _exit(127);
+  }
+
+  close(fds[1]);
+  ssize_t len = read(fds[0], &reached, sizeof(reached));
+  close(fds[0]);
+
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) ||
+      len != sizeof(reached))
+    return -1;
+
+  config->to_main[run] = reached - start;
+  config->to_exit[run] = now_ns() - start;
+
+  return 0;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+  long long x = *(const long long *) a, y = *(const long long *) b;
+
+  return (x > y) - (x < y);
+}
+
+static long long median(long long *values, int n)
+{
+  qsort(values, n, sizeof(long long), cmp_ll);
+  return values[n / 2];
+}
+
+static void usage(const char *self)
+{
+  fprintf(stderr, "Usage: %s [-n runs] lib.so [lib.so...]\n", self);
+}
+
+int main(int argc, char *argv[])
+{
+  StartupConfig configs[BENCH_MAX_CONFIGS];
+  int runs = BENCH_DEFAULT_RUNS, nconfigs, opt, c, r;
+
+  /* Child: report the time main was reached, and exit right away */
+  if (argc == 3 && strcmp(argv[1], "--child") == 0)
+  {
+    long long reached = now_ns();
+    return write(atoi(argv[2]), &reached, sizeof(reached)) == sizeof(reached) ? 0 : 1;
+  }
+
+  while ((opt = getopt(argc, argv, "n:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n':
+        runs = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  nconfigs = argc - optind + 1;
+  if (nconfigs < 2 || nconfigs > BENCH_MAX_CONFIGS || runs < 1)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  char self[PATH_MAX];
+  ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+  if (len < 0)
+    return 1;
+  self[len] = '\0';
+
+  for (c = 0; c < nconfigs; ++c)
+  {
+    StartupConfig *config = &configs[c];
+
+    config->lib = c ? realpath(argv[optind + c - 1], NULL) : NULL;
+    config->to_main = calloc(runs, sizeof(long long));
+    config->to_exit = calloc(runs, sizeof(long long));
+    if ((c && (!config->lib || read_elf_stats(config->lib, &config->elf))) ||
+        !config->to_main || !config->to_exit)
+    {
+      fprintf(stderr, "Could not read library '%s'\n", argv[optind + c - 1]);
+      return 1;
+    }
+  }
+
+  /* Warm up the page cache, then interleave the configurations */
+  for (c = 0; c < nconfigs; ++c)
+    run_once(self, &configs[c], 0);
+
+  for (r = 0; r < runs; ++r)
+    for (c = 0; c < nconfigs; ++c)
+      if (run_once(self, &configs[c], r))
+      {
+        fprintf(stderr, "Could not run %s\n", configs[c].lib ? configs[c].lib : "without preload");
+        return 1;
+      }
+
+  printf("ExecHelper startup cost (median of %d runs)\n\n", runs);
+  printf("%-36s %10s %10s %10s %9s %8s %7s %7s\n", "preload", "to main", "to exit", "overhead",
+         "size", "exported", "relocs", "plt");
+
+  long long base_main = 0;
+  for (c = 0; c < nconfigs; ++c)
+  {
+    StartupConfig *config = &configs[c];
+    long long to_main = median(config->to_main, runs), to_exit = median(config->to_exit, runs);
+    const char *name = config->lib ? strrchr(config->lib, '/') + 1 : "(none)";
+
+    if (!c)
+    {
+      base_main = to_main;
+      printf("%-36s %8.1fus %8.1fus %10s\n", name, to_main / 1000.0, to_exit / 1000.0, "");
+    }
+    else
+      printf("%-36s %8.1fus %8.1fus %8.1fus %9ld %8ld %7ld %7ld\n", name,
+             to_main / 1000.0, to_exit / 1000.0, (to_main - base_main) / 1000.0,
+             config->elf.size, config->elf.exported, config->elf.relocs, config->elf.plt_relocs);
+
+    free((char *) config->lib);
+    free(config->to_main);
+    free(config->to_exit);
+  }
+
+  return 0;
+}
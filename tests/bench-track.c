@@ -0,0 +1,213 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Cost of following a renamed managed file against the size of the managed
+ * files list. For each size, a scratch policy directory holds a list of
+ * that many entries spread over BENCH_DIRS directories, compiled into a
+ * policy, and each event renames one entry. The report gives, per event:
+ *
+ *  - publish: the time the tracker spends applying the event and publishing
+ *    the list, as exechelper-track -c does. New lines are appended to the
+ *    list and recorded in the compiled policy; once too many lines were
+ *    appended, the policy is compiled again, which is included here
+ *  - refresh: the time a process then spends refreshing its managed files
+ *    list with the indexed engine, which only indexes the appended lines
+ *
+ * For comparison, it also gives the time to compile the policy and to load
+ * the list from its file, which is what each event cost every process and
+ * the tracker when the list was rewritten for every event.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "compiled.h"
+#include "policy.h"
+#include "track.h"
+
+#include "check.h"
+
+#define BENCH_DEFAULT_MAX     100000
+#define BENCH_DEFAULT_EVENTS  200
+#define BENCH_DIRS            100
+
+static char root[] = "/tmp/exechelper-bench-track-XXXXXX";
+
+static void usage(const char *self)
+{
+  fprintf(stderr, "Usage: %s [-n max_entries] [-e events]\n", self);
+}
+
+static void touch(const char *path)
+{
+  FILE *file = fopen(path, "w");
+
+  if (file)
+    fclose(file);
+}
+
+static int bench_size(size_t n, int events)
+{
+  char paths[EXECHELP_COMPILED_N_LISTS][PATH_MAX], compiled_path[PATH_MAX], from[PATH_MAX], to[PATH_MAX];
+  const char *lists[EXECHELP_COMPILED_N_LISTS] = { paths[0], paths[1], paths[2] };
+  long long start, compile_ns, load_ns, publish_ns = 0, refresh_ns = 0;
+  size_t i, recompiles = 0;
+  int e, ok = 1;
+
+  snprintf(paths[0], PATH_MAX, "%s/helper-bins.list", root);
+  snprintf(paths[1], PATH_MAX, "%s/managed-bins.list", root);
+  snprintf(paths[2], PATH_MAX, "%s/managed-files.list", root);
+  snprintf(compiled_path, PATH_MAX, "%s/policy.ehc", root);
+
+  FILE *file = fopen(paths[2], "w");
+  if (!file)
+    return -1;
+  for (i = 0; i < BENCH_DIRS; ++i)
+  {
+    snprintf(from, PATH_MAX, "%s/dir-%zu", root, i);
+    mkdir(from, 0700);
+  }
+  for (i = 0; i < n; ++i)
+    fprintf(file, "%s/dir-%zu/file-%zu.pdf\n", root, i % BENCH_DIRS, i);
+  fclose(file);
+  for (e = 0; e < events; ++e)
+  {
+    snprintf(from, PATH_MAX, "%s/dir-%d/file-%d.pdf", root, e % BENCH_DIRS, e);
+    touch(from);
+  }
+
+  start = now_ns();
+  if (exechelp_compile_policy(lists, compiled_path, 1, 0, NULL, NULL) != 0)
+    return -1;
+  compile_ns = now_ns() - start;
+
+  ExecHelpPolicy *loaded = exechelp_policy_new(paths[0], paths[1], paths[2]);
+  start = now_ns();
+  exechelp_policy_list_refresh(&loaded->managed_files);
+  load_ns = now_ns() - start;
+  exechelp_policy_free(loaded);
+
+  ExecHelpPolicy *policy = exechelp_policy_new(paths[0], paths[1], paths[2]);
+  exechelp_policy_set_compiled(policy, compiled_path);
+  exechelp_policy_list_refresh(&policy->managed_files);
+
+  ExecHelpTracker *tracker = exechelp_tracker_new(paths[2], NULL);
+  if (!tracker || exechelp_tracker_set_compiled(tracker, compiled_path))
+    return -1;
+  const ExecHelpTrackStats *stats = exechelp_tracker_stats(tracker);
+
+  for (e = 0; e < events; ++e)
+  {
+    size_t patched = stats->patched;
+
+    snprintf(from, PATH_MAX, "%s/dir-%d/file-%d.pdf", root, e % BENCH_DIRS, e);
+    snprintf(to, PATH_MAX, "%s/dir-%d/moved-%d.pdf", root, e % BENCH_DIRS, e);
+    rename(from, to);
+
+    start = now_ns();
+    ok &= exechelp_tracker_process(tracker) == 1;
+    if (stats->patched == patched)
+    {
+      ok &= exechelp_compile_policy(lists, compiled_path, 1, 0, NULL, NULL) == 0;
+      recompiles++;
+    }
+    publish_ns += now_ns() - start;
+
+    start = now_ns();
+    exechelp_policy_list_refresh(&policy->managed_files);
+    refresh_ns += now_ns() - start;
+
+    ok &= policy->managed_files.compiled && exechelp_policy_list_contains(&policy->managed_files, to);
+  }
+
+  printf("%10zu %12.1f %12.1f %10zu %12.2f %12.2f\n", n, publish_ns / 1e3 / events,
+         refresh_ns / 1e3 / events, recompiles, compile_ns / 1e6, load_ns / 1e6);
+
+  exechelp_tracker_free(tracker);
+  exechelp_policy_free(policy);
+
+  for (e = 0; e < events; ++e)
+  {
+    snprintf(to, PATH_MAX, "%s/dir-%d/moved-%d.pdf", root, e % BENCH_DIRS, e);
+    unlink(to);
+  }
+  for (i = 0; i < BENCH_DIRS; ++i)
+  {
+    snprintf(from, PATH_MAX, "%s/dir-%zu", root, i);
+    rmdir(from);
+  }
+  unlink(paths[2]);
+  unlink(compiled_path);
+
+  return ok ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+  size_t max = BENCH_DEFAULT_MAX, n;
+  int events = BENCH_DEFAULT_EVENTS, opt, ret = 0;
+
+  while ((opt = getopt(argc, argv, "n:e:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n':
+        max = strtoul(optarg, NULL, 10);
+        break;
+      case 'e':
+        events = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  if (max < 1000 || events < 1 || optind != argc)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (!mkdtemp(root))
+  {
+    fprintf(stderr, "Could not create '%s': %s\n", root, strerror(errno));
+    return 1;
+  }
+
+  printf("ExecHelper tracker: cost per event against the size of the list, %d events\n\n", events);
+  printf("%10s %12s %12s %10s %12s %12s\n", "entries", "publish(us)", "refresh(us)", "recompiles",
+         "compile(ms)", "load(ms)");
+
+  for (n = 1000; n <= max && ret == 0; n *= 10)
+    ret = bench_size(n, events);
+
+  rmdir(root);
+
+  if (ret)
+    fprintf(stderr, "\nFAILED\n");
+  return ret ? 1 : 0;
+}
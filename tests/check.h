@@ -0,0 +1,57 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Helpers shared by the tests and benchmarks that report a result per check
+ * and time what they measure. A test includes this header once, and exits
+ * with failed once all its checks are reported.
+ */
+
+#ifndef __EH_TESTS_CHECK_H__
+#define __EH_TESTS_CHECK_H__
+
+#include <stdio.h>
+#include <time.h>
+
+/* Benchmarks only use the clocks */
+static int failed __attribute__((unused)) = 0;
+
+static inline void report(const char *name, int ok)
+{
+  printf("%-60s %s\n", name, ok ? "ok" : "FAILED");
+  failed |= !ok;
+}
+
+/* Wall time, for latencies */
+static inline long long now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* CPU time of the process, for bounds that must hold on a loaded machine */
+static inline long long cpu_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#endif /* __EH_TESTS_CHECK_H__ */
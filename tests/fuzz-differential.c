@@ -0,0 +1,783 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Differential fuzzing of the matchers and the canonicalizer. Each input is
+ * decoded into a fixture tree with symlinks (in the in-memory filesystem),
+ * three policy lists, a working directory, a target and an argument vector,
+ * and the reference implementations are compared with the optimized ones:
+ *
+ *  - managed files: exechelp_file_list_contains_path() against the indexed
+ *    list of the engine and the compiled list, on raw and canonical paths
+ *  - binary lists: the legacy strstr() check against the indexed and the
+ *    compiled lists, which match whole lines and so may only match less
+ *  - canonicalizer: _exechelp_canonicalize_filename_mode(), through
+ *    exechelp_coreutils_realpath() and _canonicalize_existing(), against the
+ *    path resolution of the filesystem, and checked to be idempotent
+ *  - decisions: the legacy argument checks against exechelp_policy_decide()
+ *    and exechelp_check_batch(), the latter with repeated requests so that
+ *    its cache is used
+ *
+ * Every canonicalization is also bounded in filesystem operations by the
+ * limits in common.h, and in time by the -t option of the standalone driver,
+ * so that inputs far slower than they should be are reported too.
+ *
+ * Mismatches abort after printing the decoded input; the fixture is printed
+ * in the format of exechelp_fs_memory_load so that exechelper-replay can
+ * load it. Built with -DEXECHELP_FUZZ_LIBFUZZER, the file only provides
+ * LLVMFuzzerTestOneInput. Otherwise it has a main that runs the files given
+ * as arguments (as AFL does with @@), or -n random inputs.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "compiled.h"
+#include "fsops.h"
+#include "policy.h"
+#include "realpath.h"
+
+#include "check.h"
+
+#define FUZZ_MAX_NODES      24
+#define FUZZ_MAX_LINES      8
+#define FUZZ_MAX_ARGS       8
+#define FUZZ_MAX_COMPONENTS 8
+#define FUZZ_MAX_DIRS       (FUZZ_MAX_NODES + 4)
+#define FUZZ_BATCH_REPEATS  3
+#define FUZZ_DEFAULT_RUNS   10000
+#define FUZZ_DEFAULT_SIZE   256
+#define FUZZ_DEFAULT_BOUND  50     /* ms per input */
+#define FUZZ_HOME           "/home"
+
+/* Filesystem operations a canonicalization may cost: two passes, each of at
+ * most one lstat per component and one readlink per symlink, plus the
+ * working directory and the final checks */
+#define FUZZ_MAX_CANON_OPS  (2 * (EXECHELP_MAX_PATH_COMPONENTS + EXECHELP_MAX_SYMLINKS) + 8)
+
+static const char *fuzz_names[] = { "a", "b", "c", "a.mp3", "ab", "doc" };
+static const char *fuzz_components[] = { "a", "b", "c", "a.mp3", "ab", "doc", ".", "..", "" };
+static const char *fuzz_list_names[EXECHELP_COMPILED_N_LISTS] = {
+  "/policy/helper-bins.list", "/policy/managed-bins.list", "/policy/managed-files.list"
+};
+
+#define FUZZ_N(array) (sizeof(array) / sizeof(array[0]))
+
+/* Decoded input; bytes past the end of the input read as zero */
+typedef struct _FuzzReader {
+  const uint8_t *data;
+  size_t         size;
+  size_t         pos;
+} FuzzReader;
+
+typedef struct _FuzzCase {
+  ExecHelpFsMemory *fs;
+  char             *fixture;      /* in the format of exechelp_fs_memory_load */
+  size_t            fixture_size;
+  FILE             *fixture_out;
+  char             *dirs[FUZZ_MAX_DIRS];
+  int               n_dirs;
+  char             *lists[EXECHELP_COMPILED_N_LISTS];
+  const char       *cwd;
+  char             *target;
+  char            **argv;
+} FuzzCase;
+
+static char fuzz_dir[] = "/tmp/exechelper-fuzz-XXXXXX";
+static char fuzz_compiled_path[PATH_MAX];
+static int fuzz_ready = 0;
+
+static unsigned int fuzz_byte(FuzzReader *in)
+{
+  return in->pos < in->size ? in->data[in->pos++] : 0;
+}
+
+static const char *fuzz_pick(FuzzReader *in, const char **choices, size_t n)
+{
+  return choices[fuzz_byte(in) % n];
+}
+
+/* Generates a path from the components of the fixture, absolute or not,
+ * possibly with a trailing slash. Some paths start with '~/', which the
+ * canonicalizer expands to HOME. */
+static char *fuzz_path(FuzzReader *in, FuzzCase *fc)
+{
+  unsigned int shape = fuzz_byte(in);
+  unsigned int n = fuzz_byte(in) % (FUZZ_MAX_COMPONENTS + 1), i;
+  char *path = NULL;
+  size_t size = 0;
+  FILE *out = open_memstream(&path, &size);
+
+  if (!out)
+    return NULL;
+
+  if ((shape & 3) == 0)
+    fputs(fc->dirs[fuzz_byte(in) % fc->n_dirs], out);
+  else if ((shape & 3) == 1)
+    fputs("/", out);
+  else if ((shape & 3) == 2 && (shape & 4))
+    fputs("~/", out);
+
+  for (i = 0; i < n; ++i)
+  {
+    if (i || ((shape & 3) == 0))
+      fputc('/', out);
+    fputs(fuzz_pick(in, fuzz_components, FUZZ_N(fuzz_components)), out);
+  }
+
+  if (shape & 8)
+    fputc('/', out);
+
+  if (fclose(out))
+    return NULL;
+  return path;
+}
+
+static void fuzz_add_dir(FuzzCase *fc, const char *path)
+{
+  if (exechelp_fs_memory_add_dir(fc->fs, path, 0755) == 0)
+  {
+    fprintf(fc->fixture_out, "d %s\n", path);
+    if (fc->n_dirs < FUZZ_MAX_DIRS)
+      fc->dirs[fc->n_dirs++] = strdup(path);
+  }
+}
+
+/* Builds the fixture tree: a few directories, then files, directories and
+ * symlinks with names and targets taken from the input */
+static void fuzz_fixture(FuzzReader *in, FuzzCase *fc)
+{
+  unsigned int n = fuzz_byte(in) % (FUZZ_MAX_NODES + 1), i;
+  char path[PATH_MAX];
+
+  fc->dirs[fc->n_dirs++] = strdup("/");
+  fuzz_add_dir(fc, "/a");
+  fuzz_add_dir(fc, FUZZ_HOME);
+  fuzz_add_dir(fc, "/policy");
+
+  for (i = 0; i < n; ++i)
+  {
+    unsigned int kind = fuzz_byte(in) % 3;
+    const char *parent = fc->dirs[fuzz_byte(in) % fc->n_dirs];
+    const char *name = fuzz_pick(in, fuzz_names, FUZZ_N(fuzz_names));
+
+    snprintf(path, sizeof(path), "%s%s%s", parent, strcmp(parent, "/") ? "/" : "", name);
+    if (kind == 0)
+      fuzz_add_dir(fc, path);
+    else if (kind == 1)
+    {
+      if (exechelp_fs_memory_add_file(fc->fs, path, 0644, "") == 0)
+        fprintf(fc->fixture_out, "f %s\n", path);
+    }
+    else
+    {
+      char *target = fuzz_path(in, fc);
+      if (target && exechelp_fs_memory_add_symlink(fc->fs, path, target) == 0)
+        fprintf(fc->fixture_out, "l %s %s\n", path, target);
+      free(target);
+    }
+  }
+}
+
+/* Builds a policy list of paths, some of them prefixes of others, with or
+ * without a trailing newline */
+static char *fuzz_list(FuzzReader *in, FuzzCase *fc)
+{
+  unsigned int n = fuzz_byte(in) % (FUZZ_MAX_LINES + 1), i;
+  char *list = NULL, *line;
+  size_t size = 0;
+  FILE *out = open_memstream(&list, &size);
+
+  if (!out)
+    return NULL;
+
+  for (i = 0; i < n; ++i)
+  {
+    if (i)
+      fputc('\n', out);
+    if ((line = fuzz_path(in, fc)))
+    {
+      unsigned int cut = fuzz_byte(in);
+      /* Truncated lines are prefixes of other paths, but not on '/' */
+      if (cut & 1)
+        line[strlen(line) * (cut >> 1) / 128] = '\0';
+      fputs(line, out);
+      free(line);
+    }
+  }
+
+  if (n && (fuzz_byte(in) & 1))
+    fputc('\n', out);
+
+  if (fclose(out))
+    return NULL;
+  return list;
+}
+
+/* Picks a line of a list, so that targets and arguments are often listed */
+static char *fuzz_listed(FuzzReader *in, const char *list)
+{
+  unsigned int n = 0, skip;
+  const char *c;
+
+  for (c = list; *c; ++c)
+    n += (*c == '\n');
+  skip = fuzz_byte(in) % (n + 1);
+
+  for (c = list; skip && *c; ++c)
+    skip -= (*c == '\n');
+
+  return strndup(c, strcspn(c, "\n"));
+}
+
+/* Arguments are either generated, or listed managed files, possibly with
+ * more components. A few have more components than the canonicalizer
+ * accepts, or are too long to be paths at all. */
+static char *fuzz_arg(FuzzReader *in, FuzzCase *fc)
+{
+  unsigned int kind = fuzz_byte(in) % 16, i, n;
+  char *line, *rest, *arg;
+
+  if (kind < 5)
+    return fuzz_path(in, fc);
+
+  if (kind == 15)
+  {
+    n = fuzz_byte(in) & 1 ? EXECHELP_MAX_ARG_LEN / 2 : EXECHELP_MAX_PATH_COMPONENTS;
+    if (!(rest = fuzz_path(in, fc)) || !(arg = malloc(2 * n + strlen(rest) + 1)))
+    {
+      free(rest);
+      return NULL;
+    }
+    for (i = 0; i < n; ++i)
+      memcpy(arg + 2 * i, "a/", 2);
+    strcpy(arg + 2 * i, rest);
+    free(rest);
+    return arg;
+  }
+
+  line = fuzz_listed(in, fc->lists[EXECHELP_COMPILED_MANAGED_FILES]);
+  if (kind < 10 || !line)
+    return line;
+
+  rest = fuzz_path(in, fc);
+  if (!rest || asprintf(&arg, "%s/%s", line, rest) < 0)
+    arg = NULL;
+  free(line);
+  free(rest);
+  return arg;
+}
+
+static int fuzz_decode(FuzzReader *in, FuzzCase *fc)
+{
+  unsigned int i, n;
+
+  memset(fc, 0, sizeof(FuzzCase));
+  if (!(fc->fs = exechelp_fs_memory_new()) ||
+      !(fc->fixture_out = open_memstream(&fc->fixture, &fc->fixture_size)))
+    return -1;
+
+  fuzz_fixture(in, fc);
+
+  for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+  {
+    if (!(fc->lists[i] = fuzz_list(in, fc)) ||
+        exechelp_fs_memory_add_file(fc->fs, fuzz_list_names[i], 0644, fc->lists[i]))
+      return -1;
+  }
+
+  fc->cwd = fc->dirs[fuzz_byte(in) % fc->n_dirs];
+  if (exechelp_fs_memory_chdir(fc->fs, fc->cwd))
+    return -1;
+
+  n = fuzz_byte(in);
+  if (n & 1)
+    fc->target = fuzz_listed(in, fc->lists[(n >> 1) & 1]);
+  else
+    fc->target = fuzz_path(in, fc);
+
+  /* A few executions have more arguments than the pipeline checks */
+  n = fuzz_byte(in);
+  n = n == 0xff ? EXECHELP_MAX_ARGS + 1 : n % (FUZZ_MAX_ARGS + 1);
+  if (!(fc->argv = calloc(n + 2, sizeof(char *))))
+    return -1;
+  fc->argv[0] = strdup("fuzz");
+  for (i = 1; i <= n; ++i)
+    fc->argv[i] = fuzz_arg(in, fc);
+  fc->argv[i] = NULL;
+
+  for (i = 0; i <= n; ++i)
+    if (!fc->argv[i])
+      return -1;
+
+  return fc->target && fflush(fc->fixture_out) == 0 ? 0 : -1;
+}
+
+static void fuzz_clear(FuzzCase *fc)
+{
+  int i;
+
+  if (fc->fixture_out)
+    fclose(fc->fixture_out);
+  free(fc->fixture);
+  for (i = 0; i < fc->n_dirs; ++i)
+    free(fc->dirs[i]);
+  for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+    free(fc->lists[i]);
+  free(fc->target);
+  for (i = 0; fc->argv && fc->argv[i]; ++i)
+    free(fc->argv[i]);
+  free(fc->argv);
+  exechelp_fs_memory_free(fc->fs);
+}
+
+static void fuzz_print_list(const char *name, const char *list)
+{
+  const char *c = list;
+
+  fprintf(stderr, "%s:\n", name);
+  while (*c)
+  {
+    size_t len = strcspn(c, "\n");
+    fprintf(stderr, "  '%.*s'\n", (int) len, c);
+    c += len + (c[len] == '\n');
+  }
+}
+
+static void fuzz_print_case(const FuzzCase *fc)
+{
+  int i;
+
+  fprintf(stderr, "fixture:\n%s", fc->fixture);
+  for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+    fuzz_print_list(fuzz_list_names[i], fc->lists[i]);
+  fprintf(stderr, "cwd: '%s'\ntarget: '%s'\nargv:", fc->cwd, fc->target);
+  for (i = 0; fc->argv[i] && i <= FUZZ_MAX_ARGS; ++i)
+    fprintf(stderr, " '%s'", fc->argv[i]);
+  while (fc->argv[i])
+    i++;
+  fprintf(stderr, "%s (%d arguments)\n", i > FUZZ_MAX_ARGS + 1 ? " ..." : "", i);
+}
+
+static void fuzz_fail(const FuzzCase *fc, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void fuzz_fail(const FuzzCase *fc, const char *format, ...)
+{
+  va_list args;
+
+  exechelp_fs_set_ops(&exechelp_fs_real);
+  fprintf(stderr, "\nMISMATCH: ");
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fprintf(stderr, "\n\n");
+  fuzz_print_case(fc);
+  abort();
+}
+
+static void fuzz_check_managed(const FuzzCase *fc, ExecHelpPolicy *policy,
+                               const ExecHelpCompiledPolicy *compiled, const char *path)
+{
+  char *copy = strdup(path);
+  if (!copy)
+    return;
+
+  int legacy = exechelp_file_list_contains_path(fc->lists[EXECHELP_COMPILED_MANAGED_FILES], path);
+  int indexed = exechelp_policy_list_has_prefix_of(&policy->managed_files, copy);
+  int comp = exechelp_compiled_list_has_prefix_of(&compiled->lists[EXECHELP_COMPILED_MANAGED_FILES], path);
+
+  if (strcmp(copy, path))
+    fuzz_fail(fc, "indexed prefix match modified '%s' into '%s'", path, copy);
+  if (legacy != indexed || legacy != comp)
+    fuzz_fail(fc, "managed file '%s': legacy %d, indexed %d, compiled %d", path, legacy, indexed, comp);
+  free(copy);
+}
+
+static void fuzz_check_bins(const FuzzCase *fc, ExecHelpPolicy *policy,
+                            const ExecHelpCompiledPolicy *compiled, const char *target)
+{
+  ExecHelpPolicyList *lists[] = { &policy->helper_bins, &policy->managed_bins };
+  int i;
+
+  for (i = 0; i < 2; ++i)
+  {
+    int legacy = strstr(fc->lists[i], target) != NULL;
+    int indexed = exechelp_policy_list_contains(lists[i], target);
+    int comp = exechelp_compiled_list_contains(&compiled->lists[i], target);
+
+    if (indexed != comp || (indexed && !legacy))
+      fuzz_fail(fc, "binary '%s' in %s: legacy %d, indexed %d, compiled %d", target,
+                fuzz_list_names[i], legacy, indexed, comp);
+  }
+}
+
+/* Canonicalizes with the reference canonicalizer, and checks its cost */
+static char *fuzz_realpath(const FuzzCase *fc, char *(*canonicalize)(const char *), const char *arg,
+                           int *error)
+{
+  unsigned long ops = exechelp_fs_memory_get_op_count(fc->fs);
+  char *real = canonicalize(arg);
+
+  *error = real ? 0 : errno;
+  ops = exechelp_fs_memory_get_op_count(fc->fs) - ops;
+  if (ops > FUZZ_MAX_CANON_OPS)
+    fuzz_fail(fc, "canonicalizing '%s' took %lu filesystem operations, more than %d", arg, ops,
+              FUZZ_MAX_CANON_OPS);
+  return real;
+}
+
+/* A canonical path is absolute, without '.', '..', repeated or trailing
+ * slashes, and none of its components is a symlink, except for symlinks
+ * that cannot be resolved: when missing components are allowed, '..' is
+ * applied to them lexically, which can lead back to the symlink, and the
+ * canonicalizer then leaves it in place like a loop */
+static int fuzz_is_canonical(const char *path)
+{
+  char prefix[PATH_MAX];
+  struct stat sb;
+  const char *c;
+
+  if (path[0] != '/' || strstr(path, "//") || strstr(path, "/./") || strstr(path, "/../"))
+    return 0;
+  if (path[1] && (path[strlen(path) - 1] == '/' || !strcmp(strrchr(path, '/'), "/.") ||
+                  !strcmp(strrchr(path, '/'), "/..")))
+    return 0;
+
+  for (c = path + 1; ; c = strchr(c, '/') + 1)
+  {
+    const char *end = strchr(c, '/');
+    size_t len = end ? (size_t) (end - path) : strlen(path);
+
+    memcpy(prefix, path, len);
+    prefix[len] = '\0';
+    if (exechelp_fs_lstat(prefix, &sb) == 0 && S_ISLNK(sb.st_mode) &&
+        exechelp_fs_stat(prefix, &sb) == 0)
+      return 0;
+    if (!end)
+      return 1;
+  }
+}
+
+static void fuzz_check_canonical(const FuzzCase *fc, const char *arg)
+{
+  struct stat by_fs, by_canon;
+  int error, error_existing;
+  char *real = fuzz_realpath(fc, exechelp_coreutils_realpath, arg, &error);
+  char *existing = fuzz_realpath(fc, exechelp_coreutils_canonicalize_existing, arg, &error_existing);
+
+  if (real && !fuzz_is_canonical(real))
+    fuzz_fail(fc, "'%s' canonicalized into '%s', which is not canonical", arg, real);
+
+  if (real)
+  {
+    char *again = fuzz_realpath(fc, exechelp_coreutils_realpath, real, &error);
+    if (!again || strcmp(again, real))
+      fuzz_fail(fc, "canonicalization is not idempotent: '%s' -> '%s' -> '%s'", arg, real,
+                again ? again : "(null)");
+    free(again);
+  }
+
+  if (existing && (!real || strcmp(existing, real)))
+    fuzz_fail(fc, "'%s' canonicalized into '%s' as an existing file, but into '%s'", arg, existing,
+              real ? real : "(null)");
+
+  /* The filesystem resolves the same file. Paths starting with '~' are
+   * relative to the working directory for it, and limits differ. */
+  if (arg[0] != '~' && !(existing == NULL && EXECHELP_REALPATH_OVER_LIMITS(error_existing)))
+  {
+    int found = exechelp_fs_stat(arg, &by_fs) == 0;
+    if (found != (existing != NULL) && !(!found && errno == ELOOP))
+      fuzz_fail(fc, "'%s' %s on the filesystem, but canonicalized into '%s'", arg,
+                found ? "exists" : "does not exist", existing ? existing : "(null)");
+    if (found && existing && (exechelp_fs_stat(existing, &by_canon) || by_canon.st_ino != by_fs.st_ino))
+      fuzz_fail(fc, "'%s' and its canonical path '%s' are different files", arg, existing);
+  }
+
+  free(real);
+  free(existing);
+}
+
+/* Decision of the legacy pipeline with the default policy, which lets every
+ * binary run and then checks its arguments if there are managed files (see
+ * exechelp_targets_sandbox_managed_file) */
+static ExecHelpVerdict fuzz_legacy_decide(const FuzzCase *fc)
+{
+  const char *managed = fc->lists[EXECHELP_COMPILED_MANAGED_FILES];
+  int i, error;
+
+  if (managed[0] == '\0')
+    return EXECHELP_VERDICT_ALLOW;
+
+  if (exechelp_argv_exceeds_limits(fc->argv))
+    return EXECHELP_VERDICT_DELEGATE;
+
+  for (i = 1; fc->argv[i]; ++i)
+  {
+    if (exechelp_arg_exceeds_len_limit(fc->argv[i]))
+      continue;
+
+    char *real = fuzz_realpath(fc, exechelp_coreutils_realpath, fc->argv[i], &error);
+    int managed_arg = real ? exechelp_file_list_contains_path(managed, real) : EXECHELP_REALPATH_OVER_LIMITS(error);
+
+    free(real);
+    if (managed_arg)
+      return EXECHELP_VERDICT_DELEGATE;
+  }
+
+  return EXECHELP_VERDICT_ALLOW;
+}
+
+static void fuzz_check_decisions(const FuzzCase *fc, ExecHelpPolicy *policy)
+{
+  ExecHelpCheckRequest requests[FUZZ_BATCH_REPEATS];
+  ExecHelpVerdict verdicts[FUZZ_BATCH_REPEATS];
+  int i;
+
+  ExecHelpVerdict legacy = fuzz_legacy_decide(fc);
+  ExecHelpVerdict engine = exechelp_policy_decide(policy, fc->target, fc->argv);
+  if (legacy != engine)
+    fuzz_fail(fc, "legacy decision %s, engine decision %s", exechelp_verdict_to_string(legacy),
+              exechelp_verdict_to_string(engine));
+
+  /* Batches resolve relative arguments against their own directory, and
+   * '~/' arguments against their own HOME when they have one */
+  for (i = 0; i < FUZZ_BATCH_REPEATS; ++i)
+  {
+    requests[i].cwd = fc->cwd;
+    requests[i].target = fc->target;
+    requests[i].argv = fc->argv;
+    requests[i].home = i % 2 ? getenv("HOME") : NULL;
+  }
+  exechelp_fs_memory_chdir(fc->fs, "/");
+  exechelp_check_batch(policy, requests, FUZZ_BATCH_REPEATS, verdicts);
+  exechelp_fs_memory_chdir(fc->fs, fc->cwd);
+
+  for (i = 0; i < FUZZ_BATCH_REPEATS; ++i)
+    if (verdicts[i] != engine)
+      fuzz_fail(fc, "batch decision %d is %s, engine decision %s", i,
+                exechelp_verdict_to_string(verdicts[i]), exechelp_verdict_to_string(engine));
+}
+
+/* Compiles the lists of the input; the compiler reads them from the fixture
+ * but writes a real file, which is then read back from the real filesystem */
+static int fuzz_compile(const FuzzCase *fc, ExecHelpCompiledPolicy *compiled)
+{
+  int ret;
+
+  if (exechelp_compile_policy(fuzz_list_names, fuzz_compiled_path, 1, 0, NULL, NULL))
+    return -1;
+
+  exechelp_fs_set_ops(&exechelp_fs_real);
+  ret = exechelp_compiled_open(compiled, fuzz_compiled_path);
+  exechelp_fs_set_ops(exechelp_fs_memory_get_ops(fc->fs));
+  return ret;
+}
+
+static void fuzz_cleanup(void)
+{
+  unlink(fuzz_compiled_path);
+  rmdir(fuzz_dir);
+}
+
+static int fuzz_setup(void)
+{
+  if (fuzz_ready)
+    return 0;
+
+  if (!mkdtemp(fuzz_dir))
+    return -1;
+  snprintf(fuzz_compiled_path, sizeof(fuzz_compiled_path), "%s/policy.compiled", fuzz_dir);
+  setenv("HOME", FUZZ_HOME, 1);
+  atexit(fuzz_cleanup);
+  fuzz_ready = 1;
+  return 0;
+}
+
+/**
+ * @fn fuzz_one
+ * @brief Decodes an input and compares the implementations on it, aborting
+ * on the first mismatch
+ *
+ * @param data: the input
+ * @param size: the size of the input
+ * @return 0, or -1 if the input could not be decoded for lack of memory
+ */
+static int fuzz_one(const uint8_t *data, size_t size)
+{
+  FuzzReader in = { data, size, 0 };
+  ExecHelpCompiledPolicy compiled;
+  ExecHelpPolicy *policy = NULL;
+  FuzzCase fc;
+  int i, ret = -1;
+
+  memset(&compiled, 0, sizeof(compiled));
+  memset(&fc, 0, sizeof(fc));
+  if (fuzz_setup() || fuzz_decode(&in, &fc))
+    goto out;
+
+  exechelp_fs_set_ops(exechelp_fs_memory_get_ops(fc.fs));
+  policy = exechelp_policy_new(fuzz_list_names[0], fuzz_list_names[1], fuzz_list_names[2]);
+  if (!policy || fuzz_compile(&fc, &compiled))
+    goto out;
+
+  exechelp_policy_list_refresh(&policy->helper_bins);
+  exechelp_policy_list_refresh(&policy->managed_bins);
+  exechelp_policy_list_refresh(&policy->managed_files);
+
+  fuzz_check_bins(&fc, policy, &compiled, fc.target);
+  for (i = 1; fc.argv[i] && i <= FUZZ_MAX_ARGS; ++i)
+  {
+    int error;
+    char *real = fuzz_realpath(&fc, exechelp_coreutils_realpath, fc.argv[i], &error);
+
+    fuzz_check_managed(&fc, policy, &compiled, fc.argv[i]);
+    if (real)
+      fuzz_check_managed(&fc, policy, &compiled, real);
+    fuzz_check_canonical(&fc, fc.argv[i]);
+    free(real);
+  }
+  fuzz_check_decisions(&fc, policy);
+  ret = 0;
+
+out:
+  exechelp_fs_set_ops(&exechelp_fs_real);
+  exechelp_compiled_close(&compiled);
+  if (policy)
+    exechelp_policy_free(policy);
+  fuzz_clear(&fc);
+  return ret;
+}
+
+#ifdef EXECHELP_FUZZ_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  fuzz_one(data, size);
+  return 0;
+}
+
+#else
+
+static void usage(const char *self)
+{
+  fprintf(stderr, "Usage: %s [-n runs] [-s seed] [-b bytes] [-t bound_ms] [input...]\n", self);
+}
+
+/* Runs an input, and reports it if it takes longer than the bound */
+static int fuzz_timed(const uint8_t *data, size_t size, long bound_ms, const char *name)
+{
+  /* CPU time, so that inputs do not look slow on a loaded machine */
+  long long start = cpu_now_ns();
+
+  if (fuzz_one(data, size))
+  {
+    fprintf(stderr, "%s: could not be decoded\n", name);
+    return 1;
+  }
+
+  long long elapsed = cpu_now_ns() - start;
+  if (elapsed > bound_ms * 1000000LL)
+  {
+    fprintf(stderr, "%s: took %.1fms, more than %ldms\n", name, elapsed / 1e6, bound_ms);
+    return 1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  long runs = FUZZ_DEFAULT_RUNS, bound_ms = FUZZ_DEFAULT_BOUND, r;
+  unsigned long seed = time(NULL);
+  size_t bytes = FUZZ_DEFAULT_SIZE, i;
+  int opt, slow = 0;
+
+  while ((opt = getopt(argc, argv, "n:s:b:t:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n':
+        runs = atol(optarg);
+        break;
+      case 's':
+        seed = strtoul(optarg, NULL, 0);
+        break;
+      case 'b':
+        bytes = strtoul(optarg, NULL, 0);
+        break;
+      case 't':
+        bound_ms = atol(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  /* Replays inputs, e.g. crashes saved by a fuzzer */
+  if (optind < argc)
+  {
+    for (; optind < argc; ++optind)
+    {
+      size_t size;
+      char *data = exechelp_fs_read_file(argv[optind], &size);
+      if (!data)
+      {
+        fprintf(stderr, "Could not read '%s': %s\n", argv[optind], strerror(errno));
+        return 1;
+      }
+      slow += fuzz_timed((const uint8_t *) data, size, bound_ms, argv[optind]);
+      free(data);
+    }
+    return slow != 0;
+  }
+
+  uint8_t *data = malloc(bytes);
+  if (!data)
+    return 1;
+
+  printf("ExecHelper differential fuzzing: %ld random inputs of %zu bytes, seed %lu\n", runs, bytes, seed);
+  fflush(stdout);
+
+  srandom(seed);
+  for (r = 0; r < runs; ++r)
+  {
+    char name[64];
+
+    for (i = 0; i < bytes; ++i)
+      data[i] = random();
+    snprintf(name, sizeof(name), "input %ld of seed %lu", r, seed);
+    slow += fuzz_timed(data, bytes, bound_ms, name);
+  }
+
+  free(data);
+  printf("%s\n", slow ? "FAILED" : "PASSED");
+  return slow != 0;
+}
+
+#endif /* EXECHELP_FUZZ_LIBFUZZER */
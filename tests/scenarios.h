@@ -0,0 +1,196 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Scenario matrix shared by the regression harnesses that put a budget on
+ * the cost of one exec decision. Each scenario carries one budget per
+ * harness, all expressed per exec with the policy lists already cached.
+ */
+
+#ifndef __EH_TESTS_SCENARIOS_H__
+#define __EH_TESTS_SCENARIOS_H__
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "policy.h"
+
+#define SCENARIO_MAX_ARGS 16
+
+typedef struct _ExecScenarioBudget {
+  unsigned long  allocs;    /* test-alloc */
+  unsigned long  bytes;     /* test-alloc */
+  unsigned long  syscalls;  /* test-syscalls */
+} ExecScenarioBudget;
+
+typedef struct _ExecScenario {
+  const char         *name;
+  const char         *target;
+  const char         *argv[SCENARIO_MAX_ARGS];
+  int                 resolve;  /* how the target is found, see below */
+  ExecScenarioBudget  legacy;   /* exechelp_filter_forbidden_exec */
+  ExecScenarioBudget  engine;   /* exechelp_policy_decide */
+} ExecScenario;
+
+/* The target is a path, a file name looked up in PATH, or a path opened
+ * once and then resolved from its file descriptor, as fexecve() does.
+ */
+#define RESOLVE_NONE 0
+#define RESOLVE_PATH 1
+#define RESOLVE_FD   2
+
+/* Decision pipelines a scenario is run through */
+#define PIPELINE_LEGACY 0
+#define PIPELINE_ENGINE 1
+#define N_PIPELINES     2
+
+static const char *pipeline_names[N_PIPELINES] = { "legacy", "engine" };
+
+/* Relative paths are resolved against the fixture directory, which also
+ * serves as $HOME.
+ */
+static const ExecScenario scenarios[] = {
+  { "no arguments",
+    "/usr/bin/vlc", { "vlc", NULL },
+    RESOLVE_NONE, { 3, 64, 2 }, { 0, 0, 0 } },
+  { "1 absolute arg",
+    "/usr/bin/vlc", { "vlc", "/tmp/test.mp3", NULL },
+    RESOLVE_NONE, { 5, 17408, 6 }, { 2, 17408, 5 } },
+  { "10 absolute args",
+    "/usr/bin/vlc", { "vlc", "/tmp/a.mp3", "/tmp/b.mp3", "/tmp/c.mp3", "/tmp/d.mp3",
+                      "/tmp/e.mp3", "/tmp/f.mp3", "/tmp/g.mp3", "/tmp/h.mp3",
+                      "/tmp/i.mp3", "/tmp/j.mp3", NULL },
+    RESOLVE_NONE, { 23, 165888, 42 }, { 20, 165888, 41 } },
+  { "10 relative args",
+    "/usr/bin/vlc", { "vlc", "a.mp3", "b.mp3", "c.mp3", "d.mp3", "e.mp3",
+                      "f.mp3", "g.mp3", "h.mp3", "i.mp3", "j.mp3", NULL },
+    RESOLVE_NONE, { 23, 207872, 62 }, { 20, 207872, 51 } },
+  { "10 home args",
+    "/usr/bin/vlc", { "vlc", "~/a.mp3", "~/b.mp3", "~/c.mp3", "~/d.mp3", "~/e.mp3",
+                      "~/f.mp3", "~/g.mp3", "~/h.mp3", "~/i.mp3", "~/j.mp3", NULL },
+    RESOLVE_NONE, { 23, 166912, 42 }, { 20, 166912, 41 } },
+  { "dotted relative arg",
+    "/usr/bin/vlc", { "vlc", "../../../../tmp/test.mp3", NULL },
+    RESOLVE_NONE, { 5, 21504, 7 }, { 2, 21504, 6 } },
+  { "symlinked arg",
+    "/usr/bin/vlc", { "vlc", "link.mp3", NULL },
+    RESOLVE_NONE, { 15, 30720, 10 }, { 12, 30720, 8 } },
+  { "managed arg",
+    "/usr/bin/vlc", { "vlc", "/tmp/test-managed.mp3", NULL },
+    RESOLVE_NONE, { 5, 17408, 6 }, { 2, 17408, 5 } },
+  { "mixed args",
+    "/usr/bin/vlc", { "vlc", "/tmp/test.mp3", "/tmp/test-managed.mp3", "a.mp3", NULL },
+    RESOLVE_NONE, { 9, 54272, 16 }, { 4, 33792, 9 } },
+  { "PATH lookup",
+    "sh", { "sh", "-c", "true", NULL },
+    RESOLVE_PATH, { 9, 42240, 18 }, { 6, 42240, 14 } },
+  { "fd target",
+    "/bin/sh", { "sh", "-c", "true", NULL },
+    RESOLVE_FD, { 8, 42240, 16 }, { 5, 42240, 12 } },
+};
+
+#define N_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+static const ExecScenarioBudget *scenario_budget(const ExecScenario *s, int pipeline)
+{
+  return pipeline == PIPELINE_ENGINE? &s->engine : &s->legacy;
+}
+
+/* Runs a decision pipeline the way the interposed exec functions do, minus
+ * the exec itself.
+ */
+static void run_scenario(const ExecScenario *s, int pipeline)
+{
+  char *path = NULL;
+  char *allowed_exec = NULL, *forbidden_exec = NULL;
+  char **allowed_argv = NULL, **forbidden_argv = NULL;
+
+  if (s->resolve == RESOLVE_PATH)
+  {
+    path = exechelp_resolve_path(s->target);
+    if (!path)
+      return;
+  }
+  else if (s->resolve == RESOLVE_FD)
+  {
+    /* Kept open across runs, so only the warm-up run opens it */
+    static int fd = -1;
+
+    if (fd < 0)
+      fd = open(s->target, O_PATH | O_CLOEXEC);
+    if (!(path = exechelp_fd_target(fd)))
+      return;
+  }
+
+  if (pipeline == PIPELINE_ENGINE)
+    exechelp_policy_decide(exechelp_policy_get_default(), path? path : s->target, (char *const *) s->argv);
+  else
+    exechelp_filter_forbidden_exec(path? path : s->target, (char *const *) s->argv, environ,
+                                   &allowed_exec, &allowed_argv,
+                                   &forbidden_exec, &forbidden_argv);
+
+  free(allowed_exec);
+  free(forbidden_exec);
+  free(allowed_argv);
+  free(forbidden_argv);
+  free(path);
+}
+
+static const char *fixture_files[] = { "a.mp3", "b.mp3", "c.mp3", "d.mp3", "e.mp3",
+                                       "f.mp3", "g.mp3", "h.mp3", "i.mp3", "j.mp3",
+                                       "link.mp3", NULL };
+
+/* Creates the fixture directory from a mkdtemp() template and moves into it */
+static int make_fixture(char *dir)
+{
+  int i;
+
+  if (!mkdtemp(dir) || chdir(dir))
+    return -1;
+
+  for (i = 0; fixture_files[i + 1]; ++i)
+  {
+    FILE *f = fopen(fixture_files[i], "w");
+    if (!f)
+      return -1;
+    fclose(f);
+  }
+
+  if (symlink("a.mp3", "link.mp3"))
+    return -1;
+
+  if (setenv("HOME", dir, 1))
+    return -1;
+
+  return setenv("PATH", "/nonexistent/bin:/usr/local/bin:/usr/bin:/bin", 1);
+}
+
+static void remove_fixture(const char *dir)
+{
+  int i;
+
+  for (i = 0; fixture_files[i]; ++i)
+    unlink(fixture_files[i]);
+
+  if (chdir("/") || rmdir(dir))
+    fprintf(stderr, "Could not remove fixture directory '%s'\n", dir);
+}
+
+#endif /* __EH_TESTS_SCENARIOS_H__ */
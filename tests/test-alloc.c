@@ -0,0 +1,147 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Allocation accounting for the exec decision pipeline. The allocator is
+ * interposed for the whole test binary (libc's internal allocations, e.g. in
+ * getcwd or strdup, are thus accounted too) but only counted while a scenario
+ * is being measured. Each scenario declares a budget of allocations and bytes
+ * per exec, and the test fails when a scenario goes over budget. Budgets must
+ * only ever be lowered; raising one needs a justification in the commit.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "scenarios.h"
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+typedef struct _AllocCounters {
+  unsigned long allocs;
+  unsigned long frees;
+  unsigned long bytes;
+} AllocCounters;
+
+static int counting = 0;
+static AllocCounters counters;
+
+void *malloc(size_t size)
+{
+  if (counting)
+  {
+    counters.allocs++;
+    counters.bytes += size;
+  }
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+  if (counting)
+  {
+    counters.allocs++;
+    counters.bytes += nmemb * size;
+  }
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  if (counting)
+  {
+    if (!ptr)
+      counters.allocs++;
+    else if (!size)
+      counters.frees++;
+    counters.bytes += size;
+  }
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+  if (counting && ptr)
+    counters.frees++;
+  __libc_free(ptr);
+}
+
+int main(void)
+{
+  char dir[] = "/tmp/exechelper-alloc-XXXXXX";
+  size_t i;
+  int failed = 0;
+
+  if (make_fixture(dir))
+  {
+    fprintf(stderr, "Could not create fixture directory: %s\n", strerror(errno));
+    return 1;
+  }
+
+  printf("ExecHelper allocation budgets (policy: %s)\n\n", EXECHELP_POLICY_DIR);
+  printf("%-32s %8s %8s %10s %8s %10s  %s\n",
+         "scenario", "allocs", "frees", "bytes", "budget", "budget(B)", "result");
+
+  for (i = 0; i < N_SCENARIOS * N_PIPELINES; ++i)
+  {
+    const ExecScenario *s = &scenarios[i / N_PIPELINES];
+    int pipeline = i % N_PIPELINES;
+    const ExecScenarioBudget *budget = scenario_budget(s, pipeline);
+    AllocCounters worst = { 0, 0, 0 };
+    char label[64];
+    int run;
+
+    /* Warm up the policy list cache, then keep the worst of a few runs */
+    run_scenario(s, pipeline);
+    for (run = 0; run < 3; ++run)
+    {
+      memset(&counters, 0, sizeof(counters));
+      counting = 1;
+      run_scenario(s, pipeline);
+      counting = 0;
+
+      if (counters.allocs > worst.allocs)
+        worst.allocs = counters.allocs;
+      if (counters.frees > worst.frees)
+        worst.frees = counters.frees;
+      if (counters.bytes > worst.bytes)
+        worst.bytes = counters.bytes;
+    }
+
+    int over = worst.allocs > budget->allocs || worst.bytes > budget->bytes;
+    int leak = worst.allocs != worst.frees;
+    snprintf(label, sizeof(label), "%s [%s]", s->name, pipeline_names[pipeline]);
+    printf("%-32s %8lu %8lu %10lu %8lu %10lu  %s\n", label,
+           worst.allocs, worst.frees, worst.bytes, budget->allocs, budget->bytes,
+           over? "OVER BUDGET" : leak? "LEAK" : "ok");
+    failed |= over || leak;
+  }
+
+  remove_fixture(dir);
+  printf("\n%s\n", failed? "FAILED" : "PASSED");
+  return failed;
+}
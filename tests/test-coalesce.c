@@ -0,0 +1,353 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Checks exechelp_coalesce_delegation with bursts of processes delegating at
+ * once, as a file manager opening many files does: exactly one process must
+ * delegate a batch holding the arguments of all, batches of different
+ * targets, directories or non-file arguments must not mix, the batch of a
+ * dead leader must be taken over, and
+ * an unsafe spool directory must be refused. The delay added to the leader
+ * is reported.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "coalesce.h"
+
+#include "check.h"
+
+#define TEST_BURST   20
+#define TEST_WINDOW  300
+#define TEST_TARGET  "/usr/bin/viewer"
+
+static char spool[] = "/tmp/exechelper-coalesce-test-XXXXXX";
+
+/* Delegates target with one file argument, and writes the outcome to fd as
+ * a line: the return value, then the batch's arguments if it was returned */
+static void delegate_and_report(int fd, const char *target, int file)
+{
+  char path[64], line[PIPE_BUF], **batch = NULL;
+  char *argv[] = { "viewer", "--new-window", path, NULL };
+  size_t len;
+  int ret, i;
+
+  snprintf(path, sizeof(path), "/home/user/file-%d.pdf", file);
+  ret = exechelp_coalesce_delegation(spool, TEST_WINDOW, target, argv, &batch);
+
+  /* Lines are written at once, so that those of processes do not mix */
+  len = snprintf(line, sizeof(line), "%d", ret);
+  for (i = 0; batch && batch[i] && len < sizeof(line); ++i)
+    len += snprintf(line + len, sizeof(line) - len, " %s", batch[i]);
+  if (len < sizeof(line) - 1)
+  {
+    line[len++] = '\n';
+    if (write(fd, line, len) < 0)
+      perror("write");
+  }
+  free(batch);
+}
+
+/* Runs n processes that wait for the write end of go to be closed and then
+ * delegate */
+static void spawn(int n, int out, int go[2], const char *target, int first_file)
+{
+  int i;
+
+  for (i = 0; i < n; ++i)
+  {
+    if (fork() == 0)
+    {
+      char c;
+      close(go[1]);
+      if (read(go[0], &c, 1) < 0)
+        _exit(1);
+      delegate_and_report(out, target, first_file + i);
+      _exit(0);
+    }
+  }
+}
+
+static int count_words(const char *line, const char *word)
+{
+  const char *iter = line;
+  size_t len = strlen(word);
+  int count = 0;
+
+  while ((iter = strstr(iter, word)))
+  {
+    if ((iter == line || iter[-1] == ' ') && (iter[len] == ' ' || iter[len] == '\n' || !iter[len]))
+      count++;
+    iter += len;
+  }
+
+  return count;
+}
+
+static void test_burst(void)
+{
+  int out[2], go[2], leaders = 0, joined = 0, complete = 0, i;
+  char buf[65536], *line, *save = NULL;
+  size_t done = 0;
+  ssize_t got;
+
+  if (pipe(out) || pipe(go))
+    return;
+
+  spawn(TEST_BURST, out[1], go, TEST_TARGET, 0);
+  spawn(1, out[1], go, "/usr/bin/editor", 1000);
+  close(out[1]);
+  close(go[0]);
+
+  long long start = now_ns();
+  close(go[1]);
+
+  while ((got = read(out[0], buf + done, sizeof(buf) - 1 - done)) > 0)
+    done += got;
+  buf[done] = '\0';
+  long long elapsed = now_ns() - start;
+  close(out[0]);
+  while (wait(NULL) > 0);
+
+  for (line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save))
+  {
+    if (line[0] == '1')
+      joined++;
+    else if (line[0] == '0' && count_words(line, "/home/user/file-1000.pdf"))
+      complete += count_words(line, "viewer") == 1;
+    else if (line[0] == '0')
+    {
+      int all = count_words(line, "viewer") == 1 && count_words(line, "--new-window") == 1 &&
+                !strncmp(line, "0 viewer ", 9);
+      for (i = 0; i < TEST_BURST; ++i)
+      {
+        char file[64];
+        snprintf(file, sizeof(file), "/home/user/file-%d.pdf", i);
+        all &= count_words(line, file) == 1;
+      }
+      leaders++;
+      complete += all;
+    }
+  }
+
+  report("a burst of delegations has a single leader", leaders == 1 && joined == TEST_BURST - 1);
+  report("the leader delegates every argument once", complete == 2);
+  printf("\n%d delegations in %.1fms, delegated as 1 (window of %dms)\n\n",
+         TEST_BURST, elapsed / 1e6, TEST_WINDOW);
+}
+
+static int batch_is_open(void)
+{
+  DIR *dir = opendir(spool);
+  struct dirent *entry;
+  int open = 0;
+
+  while (dir && (entry = readdir(dir)))
+  {
+    struct stat sb;
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s", spool, entry->d_name);
+    if (strstr(entry->d_name, ".batch") && stat(path, &sb) == 0 && sb.st_size > 0)
+      open = 1;
+  }
+
+  if (dir)
+    closedir(dir);
+  return open;
+}
+
+static void test_takeover(void)
+{
+  int out[2], go[2], i;
+  char buf[4096];
+  pid_t leader;
+
+  if (pipe(out) || pipe(go))
+    return;
+
+  leader = fork();
+  if (leader == 0)
+  {
+    delegate_and_report(out[1], TEST_TARGET, 1);
+    _exit(0);
+  }
+
+  for (i = 0; i < 1000 && !batch_is_open(); ++i)
+    usleep(1000);
+  kill(leader, SIGKILL);
+  waitpid(leader, NULL, 0);
+  close(out[1]);
+
+  delegate_and_report(go[1], TEST_TARGET, 2);
+  close(go[1]);
+  ssize_t got = read(go[0], buf, sizeof(buf) - 1);
+  buf[got > 0 ? got : 0] = '\0';
+
+  report("the batch of a dead leader is taken over",
+         !strcmp(buf, "0 viewer --new-window /home/user/file-2.pdf /home/user/file-1.pdf\n"));
+  close(out[0]);
+  close(go[0]);
+}
+
+/* Executions that differ by more than their file arguments are not
+ * coalesced: only those with the same working directory and other arguments
+ * join a batch. File arguments are canonicalized, and only they are
+ * deduplicated */
+static void test_keys(void)
+{
+  static const char *dirs[] = { "/tmp", "/tmp", "/", "/tmp" };
+  static char *argvs[][8] = {
+    { "viewer", "--page", "2", "--zoom", "2", "/home/user/a.pdf", NULL },
+    { "viewer", "--page", "5", "/home/user/b.pdf", NULL },
+    { "viewer", "--page", "2", "--zoom", "2", "/home/user/c.pdf", NULL },
+    { "viewer", "--page", "2", "--zoom", "2", "./../home/user/a.pdf", "/home/user/d.pdf" },
+  };
+  static const char *expected[] = {
+    "0 viewer --page 2 --zoom 2 /home/user/a.pdf /home/user/d.pdf",
+    "0 viewer --page 5 /home/user/b.pdf",
+    "0 viewer --page 2 --zoom 2 /home/user/c.pdf",
+  };
+  int out[2], go[2], found = 0, joined = 0, lines = 0, i;
+  char buf[4096], *line, *save = NULL;
+  size_t done = 0;
+  ssize_t got;
+
+  if (pipe(out) || pipe(go))
+    return;
+
+  for (i = 0; i < 4; ++i)
+  {
+    if (fork() == 0)
+    {
+      char **batch = NULL, c;
+      int ret, j;
+
+      close(go[1]);
+      if (read(go[0], &c, 1) < 0 || chdir(dirs[i]))
+        _exit(1);
+
+      ret = exechelp_coalesce_delegation(spool, TEST_WINDOW, TEST_TARGET, argvs[i], &batch);
+      done = snprintf(buf, sizeof(buf), "%d", ret);
+      for (j = 0; batch && batch[j] && done < sizeof(buf); ++j)
+        done += snprintf(buf + done, sizeof(buf) - done, " %s", batch[j]);
+      if (done < sizeof(buf) - 1)
+      {
+        buf[done++] = '\n';
+        if (write(out[1], buf, done) < 0)
+          perror("write");
+      }
+      _exit(0);
+    }
+  }
+  close(out[1]);
+  close(go[0]);
+  close(go[1]);
+
+  while ((got = read(out[0], buf + done, sizeof(buf) - 1 - done)) > 0)
+    done += got;
+  buf[done] = '\0';
+  close(out[0]);
+  while (wait(NULL) > 0);
+
+  for (line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save), ++lines)
+  {
+    joined += !strcmp(line, "1");
+    for (i = 0; i < 3; ++i)
+      found += !strcmp(line, expected[i]);
+  }
+
+  report("batches are keyed by directory and non-file arguments", lines == 4 && joined == 1 && found == 3);
+}
+
+/* Once delegated, a batch is closed and the next delegation starts another */
+static void test_alone(void)
+{
+  char **batch = NULL, *argv[] = { "viewer", "/home/user/file-3.pdf", NULL };
+  long long start = now_ns();
+  int ret = exechelp_coalesce_delegation(spool, 50, TEST_TARGET, argv, &batch);
+  long long elapsed = now_ns() - start;
+
+  report("a lone delegation is delayed by the window",
+         ret == 0 && batch && !strcmp(batch[0], "viewer") && !strcmp(batch[1], argv[1]) &&
+         !batch[2] && elapsed >= 50000000LL);
+  free(batch);
+}
+
+static void test_unsafe_spool(void)
+{
+  char **batch = NULL, *argv[] = { "viewer", NULL };
+
+  chmod(spool, 0755);
+  errno = 0;
+  report("spool directories open to others are refused",
+         exechelp_coalesce_delegation(spool, 50, TEST_TARGET, argv, &batch) == -1 &&
+         errno == EPERM && !batch);
+  chmod(spool, 0700);
+
+  report("relative targets are refused",
+         exechelp_coalesce_delegation(spool, 50, "viewer", argv, &batch) == -1 && errno == EINVAL);
+}
+
+static void remove_spool(void)
+{
+  DIR *dir = opendir(spool);
+  struct dirent *entry;
+
+  while (dir && (entry = readdir(dir)))
+  {
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s", spool, entry->d_name);
+    if (entry->d_name[0] != '.')
+      unlink(path);
+  }
+
+  if (dir)
+    closedir(dir);
+  rmdir(spool);
+}
+
+int main(void)
+{
+  if (!mkdtemp(spool))
+    return 1;
+
+  printf("ExecHelper delegation coalescing\n\n");
+
+  test_burst();
+  test_takeover();
+  test_keys();
+  test_alone();
+  test_unsafe_spool();
+
+  remove_spool();
+  printf("%s\n", failed ? "FAILED" : "PASSED");
+  return failed;
+}
@@ -0,0 +1,395 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Tests of the compiled policy: lists looked up in a compiled policy must
+ * answer exactly like the same lists indexed from their files, lists modified
+ * after compilation must be read from their files again, and compiled
+ * policies that are recompiled, corrupted or fail validation must be handled.
+ * The same goes for the profiles of a multi-profile snapshot.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "compiled.h"
+#include "policy.h"
+
+static const char *list_names[EXECHELP_COMPILED_N_LISTS] = {
+  "helper-bins.list", "managed-bins.list", "managed-files.list"
+};
+
+static const char *initial_lists[EXECHELP_COMPILED_N_LISTS] = {
+  "/usr/bin/cvlc\n/usr/bin/vlc-wrapper\n/usr/bin/cvlc\n",
+  "/usr/bin/firefox\n/usr/bin/thunar\n/usr/bin/firefox\n/usr/bin/ristretto",
+  "/etc/firejail/\n/tmp/test-managed.mp3\n/home/user/Documents/\n/home/user/Doc\n",
+};
+
+static const char *queries[] = {
+  "/usr/bin/cvlc", "/usr/bin/cvl", "/usr/bin/cvlc2", "/usr/bin/vlc-wrapper",
+  "/usr/bin/firefox", "/usr/bin/ristretto", "/usr/bin/thunar",
+  "/etc/firejail/", "/etc/firejail/x.profile", "/etc/firejail",
+  "/tmp/test-managed.mp3", "/tmp/test-managed.mp3.part", "/tmp/test",
+  "/home/user/Documents/report.pdf", "/home/user/Doc", "/home/user/Dob",
+  "/home/user/Music/a.mp3", "", "/",
+  "/srv/appended/a.mp3", "/srv/appended.mp3",
+  NULL
+};
+
+static char dir[] = "/tmp/exechelper-compiled-XXXXXX";
+static char *paths[EXECHELP_COMPILED_N_LISTS], *output;
+static int failed = 0;
+
+/* Replaces a file rather than rewriting it, so its inode changes too */
+static int write_file(const char *path, const char *contents)
+{
+  char *tmp;
+  FILE *f;
+  int ret;
+
+  if (asprintf(&tmp, "%s.new", path) < 0 || !(f = fopen(tmp, "w")))
+    return -1;
+  ret = fputs(contents, f) < 0;
+  ret |= fclose(f) != 0;
+  ret |= rename(tmp, path) != 0;
+  free(tmp);
+
+  return ret ? -1 : 0;
+}
+
+static void check(int ok, const char *what)
+{
+  printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+  failed |= !ok;
+}
+
+/* Creates a policy over the given lists, using the compiled policy or the
+ * given profile of the snapshot at compiled if set */
+static ExecHelpPolicy *new_policy_for(char *lists[EXECHELP_COMPILED_N_LISTS], const char *compiled,
+                                      const char *profile)
+{
+  ExecHelpPolicy *policy = exechelp_policy_new(lists[0], lists[1], lists[2]);
+
+  if (profile)
+    exechelp_policy_set_snapshot(policy, compiled, profile);
+  else
+    exechelp_policy_set_compiled(policy, compiled);
+
+  exechelp_policy_list_refresh(&policy->helper_bins);
+  exechelp_policy_list_refresh(&policy->managed_bins);
+  exechelp_policy_list_refresh(&policy->managed_files);
+
+  return policy;
+}
+
+static ExecHelpPolicy *new_policy(int compiled)
+{
+  return new_policy_for(paths, compiled ? output : NULL, NULL);
+}
+
+static int count_compiled(ExecHelpPolicy *policy)
+{
+  return (policy->helper_bins.compiled != NULL) +
+         (policy->managed_bins.compiled != NULL) +
+         (policy->managed_files.compiled != NULL);
+}
+
+/* Compares every lookup of a policy using a compiled policy to a policy
+ * indexing the same list files */
+static int same_answers(ExecHelpPolicy *compiled)
+{
+  char *lists[] = { (char *) compiled->helper_bins.path, (char *) compiled->managed_bins.path,
+                    (char *) compiled->managed_files.path };
+  ExecHelpPolicy *text = new_policy_for(lists, NULL, NULL);
+  ExecHelpPolicyList *a[] = { &compiled->helper_bins, &compiled->managed_bins, &compiled->managed_files };
+  ExecHelpPolicyList *b[] = { &text->helper_bins, &text->managed_bins, &text->managed_files };
+  int i, q, same = 1;
+
+  for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+  {
+    exechelp_policy_list_refresh(a[i]);
+    for (q = 0; queries[q]; ++q)
+    {
+      char path[PATH_MAX];
+
+      /* exechelp_policy_list_has_prefix_of truncates the path in place */
+      strcpy(path, queries[q]);
+      if (exechelp_policy_list_contains(a[i], path) != exechelp_policy_list_contains(b[i], path) ||
+          exechelp_policy_list_has_prefix_of(a[i], path) != exechelp_policy_list_has_prefix_of(b[i], path))
+      {
+        printf("  %s: '%s' differs\n", a[i]->path, queries[q]);
+        same = 0;
+      }
+    }
+  }
+
+  exechelp_policy_free(text);
+  return same;
+}
+
+static int compile(int strict, ExecHelpCompileStats stats[EXECHELP_COMPILED_N_LISTS])
+{
+  return exechelp_compile_policy((const char **) paths, output, 2, strict, NULL, stats);
+}
+
+/* Appends to a list file in place, as exechelper-track publishes new lines,
+ * and records the append in the compiled policy */
+static int append_file(const char *path, const char *contents)
+{
+  struct stat before, after;
+  FILE *f;
+  int ret;
+
+  if (stat(path, &before) || !(f = fopen(path, "a")))
+    return -1;
+  ret = fputs(contents, f) < 0;
+  ret |= fclose(f) != 0;
+  if (ret || stat(path, &after))
+    return -1;
+
+  return exechelp_compiled_append_source(output, EXECHELP_COMPILED_MANAGED_FILES, &before, &after);
+}
+
+static void run_append_tests(void)
+{
+  ExecHelpCompileStats stats[EXECHELP_COMPILED_N_LISTS];
+  ExecHelpPolicy *policy, *fresh;
+  struct stat before, after;
+  char big[8192];
+  int i;
+
+  printf("\n");
+  for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+    write_file(paths[i], initial_lists[i]);
+  check(compile(0, stats) == 0, "compile before appending");
+  policy = new_policy(1);
+
+  check(append_file(paths[2], "/srv/appended/\n") == 1, "appended lines recorded in the compiled policy");
+  fresh = new_policy(1);
+  check(count_compiled(fresh) == 3, "list appended to still uses the compiled policy");
+  check(same_answers(fresh), "appended lines are looked up too");
+  check(same_answers(policy) && count_compiled(policy) == 3, "policies follow the appended lines");
+  exechelp_policy_free(fresh);
+
+  /* A blank line matches every path, appended or not */
+  check(append_file(paths[2], "\n/srv/other/\n") == 1, "appended twice");
+  check(same_answers(policy) && count_compiled(policy) == 3, "lookups after appending twice");
+
+  /* The compiled policy must have been compiled from the version appended to */
+  stat(paths[2], &before);
+  write_file(paths[2], "/srv/appended/\n");
+  stat(paths[2], &after);
+  check(exechelp_compiled_append_source(output, EXECHELP_COMPILED_MANAGED_FILES, &before, &after) == 0,
+        "replaced list not recorded");
+  check(same_answers(policy) && count_compiled(policy) == 2, "replaced list read from its file");
+
+  /* Until there are too many appended lines */
+  check(compile(0, stats) == 0, "compile again");
+  memset(big, 'x', sizeof(big) - 2);
+  big[0] = '/';
+  big[sizeof(big) - 2] = '\n';
+  big[sizeof(big) - 1] = '\0';
+  check(append_file(paths[2], big) == 0, "too many appended lines not recorded");
+  check(same_answers(policy) && count_compiled(policy) == 2, "list with too many appended lines read from its file");
+
+  /* Appended lines must start a new line */
+  write_file(paths[2], "/srv/appended");
+  check(compile(0, stats) == 0, "compile a list without a final newline");
+  check(append_file(paths[2], ".mp3\n") == 1, "append to the last line");
+  check(same_answers(policy) && count_compiled(policy) == 2, "list appended to its last line read from its file");
+
+  exechelp_policy_free(policy);
+}
+
+/* Profiles of the snapshot tests, NULL for a missing list */
+static const char *profiles[][EXECHELP_COMPILED_N_LISTS + 1] = {
+  { "alpha", "/usr/bin/cvlc\n/usr/bin/vlc-wrapper\n", "/usr/bin/firefox\n", "/etc/firejail/\n/home/user/Documents/\n" },
+  { "beta",  "/usr/bin/cvlc\n/usr/bin/vlc-wrapper\n", "/usr/bin/thunar\n",  "/etc/firejail/\n/tmp/test-managed.mp3\n" },
+  { "gamma", NULL,                                     NULL,                   "/home/user/Doc\n\n" },
+};
+
+static int run_snapshot_tests(void)
+{
+  const size_t n_profiles = sizeof(profiles) / sizeof(profiles[0]);
+  char *root, *snapshot, *lists[n_profiles][EXECHELP_COMPILED_N_LISTS];
+  ExecHelpCompiledPolicy compiled;
+  ExecHelpSnapshotStats stats;
+  ExecHelpPolicy *policy;
+  size_t p, i;
+
+  printf("\n");
+  if (asprintf(&root, "%s/profiles", dir) < 0 || asprintf(&snapshot, "%s/policy.ehs", dir) < 0 ||
+      mkdir(root, 0755))
+    return 1;
+
+  for (p = 0; p < n_profiles; ++p)
+  {
+    char *profile_dir;
+
+    if (asprintf(&profile_dir, "%s/%s", root, profiles[p][0]) < 0 || mkdir(profile_dir, 0755))
+      return 1;
+    for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+      if (asprintf(&lists[p][i], "%s/%s", profile_dir, list_names[i]) < 0 ||
+          (profiles[p][i + 1] && write_file(lists[p][i], profiles[p][i + 1])))
+        return 1;
+    free(profile_dir);
+  }
+
+  check(exechelp_compile_snapshot(root, snapshot, 2, 0, NULL, &stats) == 0, "compile snapshot");
+  check(stats.profiles == 3 && stats.list_entries == 12 && stats.entries == 9, "lines shared between profiles");
+
+  for (p = 0; p < n_profiles; ++p)
+  {
+    char what[64];
+
+    policy = new_policy_for(lists[p], snapshot, profiles[p][0]);
+    snprintf(what, sizeof(what), "profile %s uses the snapshot", profiles[p][0]);
+    check(count_compiled(policy) == (profiles[p][1] ? 3 : 1), what);
+    snprintf(what, sizeof(what), "profile %s lookups match its list files", profiles[p][0]);
+    check(same_answers(policy), what);
+    exechelp_policy_free(policy);
+  }
+
+  /* Lists are only used for the files they were compiled from */
+  policy = new_policy_for(lists[0], snapshot, "beta");
+  check(count_compiled(policy) == 0, "lists of another profile not used");
+  exechelp_policy_free(policy);
+
+  check(exechelp_snapshot_open(&compiled, snapshot, "delta") != 0 && errno == ENOENT, "unknown profile");
+  check(exechelp_compiled_open(&compiled, snapshot) != 0, "snapshot is not a compiled policy");
+
+  /* One mapping serves all profiles */
+  ExecHelpCompiledList views[EXECHELP_COMPILED_N_LISTS];
+  int ok = exechelp_snapshot_open(&compiled, snapshot, NULL) == 0;
+  for (p = 0; ok && p < n_profiles; ++p)
+    ok = exechelp_snapshot_get_profile(&compiled, profiles[p][0], views) == 0 &&
+         exechelp_compiled_list_contains(&views[EXECHELP_COMPILED_MANAGED_BINS], "/usr/bin/thunar") == (p == 1);
+  check(ok, "profiles of a single mapping");
+  exechelp_compiled_close(&compiled);
+
+  for (p = 0; p < n_profiles; ++p)
+  {
+    for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+    {
+      unlink(lists[p][i]);
+      free(lists[p][i]);
+    }
+    char *profile_dir;
+    if (asprintf(&profile_dir, "%s/%s", root, profiles[p][0]) >= 0)
+    {
+      rmdir(profile_dir);
+      free(profile_dir);
+    }
+  }
+  rmdir(root);
+  unlink(snapshot);
+  free(root);
+  free(snapshot);
+
+  return 0;
+}
+
+int main(void)
+{
+  ExecHelpCompileStats stats[EXECHELP_COMPILED_N_LISTS];
+  ExecHelpPolicy *policy;
+  int i;
+
+  if (!mkdtemp(dir) || asprintf(&output, "%s/policy.ehc", dir) < 0)
+    return 1;
+  for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+    if (asprintf(&paths[i], "%s/%s", dir, list_names[i]) < 0 ||
+        write_file(paths[i], initial_lists[i]))
+      return 1;
+
+  check(compile(0, stats) == 0, "compile");
+  check(stats[0].lines == 3 && stats[0].entries == 2 && stats[0].duplicates == 1, "helper-bins deduplicated");
+  check(stats[1].lines == 4 && stats[1].entries == 3, "managed-bins last line without newline");
+  check(stats[2].lengths == 2, "managed-files distinct lengths");
+
+  policy = new_policy(1);
+  check(count_compiled(policy) == 3, "all lists use the compiled policy");
+  check(same_answers(policy), "compiled lookups match the list files");
+
+  /* A modified list is read from its file again, others stay compiled */
+  write_file(paths[2], "/home/user/Music/\n\n");
+  check(same_answers(policy), "modified list matches its file");
+  check(count_compiled(policy) == 2, "modified list no longer compiled");
+
+  /* Lists read from their file keep their index until the file changes */
+  check(compile(0, stats) == 0 && stats[2].warnings == 1, "recompile with a blank line");
+  check(same_answers(policy), "lookups after recompiling");
+  check(count_compiled(policy) == 2, "modified list still read from its file");
+
+  /* Blank lines match every path, in the compiled policy too. Lists of the
+   * previous compiled policy move to the new one */
+  write_file(paths[2], "/home/user/Music/\n\n/srv/media/\n");
+  check(compile(0, stats) == 0, "recompile after another change");
+  check(same_answers(policy), "recompiled lookups match the list files");
+  check(count_compiled(policy) == 3, "all lists use the recompiled policy");
+  exechelp_policy_free(policy);
+
+  policy = new_policy(1);
+  check(count_compiled(policy) == 3, "new policy uses the recompiled policy");
+  char anything[] = "/anything";
+  check(exechelp_policy_list_has_prefix_of(&policy->managed_files, anything), "blank line matches");
+  exechelp_policy_free(policy);
+
+  /* Strict mode refuses the blank line and leaves the compiled policy as is */
+  check(compile(1, stats) == 1, "strict compile fails on a blank line");
+  policy = new_policy(1);
+  check(count_compiled(policy) == 3, "failed compile keeps the previous policy");
+  exechelp_policy_free(policy);
+
+  /* A corrupted compiled policy is ignored */
+  write_file(output, "EHC1 but not a compiled policy");
+  policy = new_policy(1);
+  check(count_compiled(policy) == 0, "corrupted compiled policy ignored");
+  check(same_answers(policy), "lookups without the compiled policy");
+  exechelp_policy_free(policy);
+
+  /* A missing list compiles as an empty list */
+  unlink(paths[0]);
+  check(compile(0, stats) == 0 && stats[0].entries == 0, "missing list compiled as empty");
+  policy = new_policy(1);
+  check(count_compiled(policy) == 2, "missing list not loaded");
+  check(same_answers(policy), "lookups with a missing list");
+  exechelp_policy_free(policy);
+
+  run_append_tests();
+  failed |= run_snapshot_tests();
+
+  for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+  {
+    unlink(paths[i]);
+    free(paths[i]);
+  }
+  unlink(output);
+  free(output);
+  rmdir(dir);
+
+  printf("\n%s\n", failed ? "FAILED" : "PASSED");
+  return failed;
+}
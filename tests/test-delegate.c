@@ -0,0 +1,260 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Checks the delegation channel (see delegate.h) against a daemon built from
+ * the same helpers as exechelper-delegated: the handle of a delegated process
+ * must become readable when it exits and not before, failed executions and
+ * missing daemons must be reported, executions that the policy does not
+ * delegate from the directory and with the HOME of the app must be refused, delegated processes
+ * must run in that directory, and a delegated execve must leave its handle to
+ * exechelp_last_delegation_fd. How long after the exit the handle wakes up an
+ * epoll loop is reported.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "delegate.h"
+#include "policy.h"
+
+#include "check.h"
+
+#define TEST_SLEEP       "0.2"
+#define TEST_SLEEP_NS    200000000LL
+#define TEST_MANY_ARGS   (EXECHELP_MAX_ARGS + 8)
+/* Makes requests delegated under the test policy, see data-test/ */
+#define TEST_MANAGED     "/etc/firejail/delegated"
+
+static char dir[] = "/tmp/exechelper-delegate-test-XXXXXX";
+static char socket_path[PATH_MAX];
+
+/* Serves requests until killed */
+static pid_t start_daemon(void)
+{
+  int sock = exechelp_delegate_listen(socket_path);
+  if (sock < 0)
+    return -1;
+
+  pid_t daemon = fork();
+  if (daemon != 0)
+  {
+    close(sock);
+    return daemon;
+  }
+
+  signal(SIGCHLD, SIG_IGN);
+  for (;;)
+  {
+    int conn = accept(sock, NULL, NULL), exit_fd, fd = -1, error = 0;
+    char *cwd, *home, *target, **argv;
+    pid_t pid = 0;
+
+    if (conn < 0)
+      continue;
+    if (exechelp_delegate_receive(conn, &cwd, &home, &target, &argv) == 0)
+    {
+      if (exechelp_delegate_check(exechelp_policy_get_default(), cwd, home, target, argv) == 0)
+        fd = exechelp_delegate_spawn(cwd, target, argv, environ, &pid, &exit_fd);
+      error = fd < 0 ? errno : 0;
+      exechelp_delegate_reply(conn, error, pid, fd);
+      if (fd >= 0)
+        close(fd);
+      free(argv);
+    }
+    close(conn);
+  }
+}
+
+/* Waits for fd to become readable, returning the time it took or -1 */
+static long long wait_readable(int fd, int timeout_ms)
+{
+  struct epoll_event event = { .events = EPOLLIN }, ready;
+  int epfd = epoll_create1(EPOLL_CLOEXEC), n;
+  long long start = now_ns();
+
+  if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) != 0)
+    return -1;
+  do
+    n = epoll_wait(epfd, &ready, 1, timeout_ms);
+  while (n < 0 && errno == EINTR);
+  close(epfd);
+
+  return n == 1 ? now_ns() - start : -1;
+}
+
+static void test_no_daemon(void)
+{
+  char *argv[] = { "true", NULL };
+  char missing[PATH_MAX];
+
+  snprintf(missing, sizeof(missing), "%s/missing.sock", dir);
+  errno = 0;
+  report("a missing daemon is reported",
+         exechelp_delegate_request(missing, NULL, NULL, "/bin/true", argv, NULL) == -1 && errno == ENOENT);
+}
+
+static void test_completion(void)
+{
+  char *argv[] = { "sh", "-c", "exec sleep " TEST_SLEEP, TEST_MANAGED, NULL };
+  pid_t pid = 0;
+  long long start = now_ns();
+  int fd = exechelp_delegate_request(socket_path, NULL, NULL, "/bin/sh", argv, &pid);
+  long long request_ns = now_ns() - start;
+
+  report("the daemon returns a handle for the delegated process", fd >= 0 && pid > 0);
+  if (fd < 0)
+    return;
+
+  report("the handle is not readable while the process runs", wait_readable(fd, 0) == -1);
+
+  long long waited = wait_readable(fd, 5000);
+  long long total = now_ns() - start;
+  report("the handle becomes readable when the process exits",
+         waited >= 0 && total >= TEST_SLEEP_NS);
+  close(fd);
+
+  printf("\nrequest answered in %.2fms, exit of a %ss process seen after %.2fms\n\n",
+         request_ns / 1e6, TEST_SLEEP, total / 1e6);
+}
+
+static void test_failure(void)
+{
+  char *argv[] = { "missing", TEST_MANAGED, NULL };
+  char missing[PATH_MAX];
+
+  snprintf(missing, sizeof(missing), "%s/missing-binary", dir);
+  errno = 0;
+  report("failed executions are reported with their errno",
+         exechelp_delegate_request(socket_path, NULL, NULL, missing, argv, NULL) == -1 && errno == ENOENT);
+}
+
+/* The daemon decides from the directory of the app, and runs the process
+ * there, so relative arguments mean the same to the policy and the process */
+static void test_policy(void)
+{
+  char *allowed[] = { "true", NULL };
+  char script[PATH_MAX + 32], out[PATH_MAX], got[PATH_MAX] = "";
+  char *relative[] = { "sh", "-c", script, "firejail/delegated", NULL };
+
+  errno = 0;
+  report("executions the policy allows are refused",
+         exechelp_delegate_request(socket_path, NULL, NULL, "/bin/true", allowed, NULL) == -1 && errno == EPERM);
+
+  snprintf(out, sizeof(out), "%s/cwd", dir);
+  snprintf(script, sizeof(script), "pwd > '%s'", out);
+  errno = 0;
+  report("relative arguments are checked from the directory of the app",
+         exechelp_delegate_request(socket_path, dir, NULL, "/bin/sh", relative, NULL) == -1 && errno == EPERM);
+
+  int fd = exechelp_delegate_request(socket_path, "/etc", NULL, "/bin/sh", relative, NULL);
+  if (fd >= 0)
+  {
+    wait_readable(fd, 5000);
+    close(fd);
+  }
+
+  FILE *file = fopen(out, "r");
+  if (file)
+  {
+    if (!fgets(got, sizeof(got), file))
+      got[0] = '\0';
+    fclose(file);
+  }
+  unlink(out);
+  report("delegated processes run in the directory of the app", fd >= 0 && strcmp(got, "/etc\n") == 0);
+
+  char *home[] = { "true", "~/delegated", NULL };
+  errno = 0;
+  report("'~/' arguments are checked with the HOME of the app",
+         exechelp_delegate_request(socket_path, NULL, dir, "/bin/true", home, NULL) == -1 && errno == EPERM);
+
+  fd = exechelp_delegate_request(socket_path, NULL, "/etc/firejail", "/bin/true", home, NULL);
+  report("and are delegated when it has managed files", fd >= 0);
+  if (fd >= 0)
+    close(fd);
+}
+
+/* Executions with too many arguments to check are always delegated */
+static void test_execve(void)
+{
+  char *argv[TEST_MANY_ARGS + 2];
+  int i;
+
+  argv[0] = "true";
+  for (i = 1; i <= TEST_MANY_ARGS; ++i)
+    argv[i] = "x";
+  argv[i] = NULL;
+
+  setenv(EXECHELP_ENV_DELEGATE_SOCKET, socket_path, 1);
+  errno = 0;
+  int ret = execve("/bin/true", argv, environ);
+  int saved_errno = errno;
+  unsetenv(EXECHELP_ENV_DELEGATE_SOCKET);
+
+  int fd = exechelp_last_delegation_fd();
+  report("delegated executions still fail with EACCES", ret == -1 && saved_errno == EACCES);
+  report("their handle is left to exechelp_last_delegation_fd",
+         fd >= 0 && exechelp_last_delegation_fd() == -1 && wait_readable(fd, 5000) >= 0);
+  if (fd >= 0)
+    close(fd);
+
+  /* Without a daemon, the fake exec is used and there is no handle */
+  ret = execve("/bin/true", argv, environ);
+  report("delegations without a daemon leave no handle",
+         ret == -1 && errno == EACCES && exechelp_last_delegation_fd() == -1);
+}
+
+int main(void)
+{
+  if (!mkdtemp(dir))
+    return 1;
+  snprintf(socket_path, sizeof(socket_path), "%s/delegate.sock", dir);
+
+  printf("ExecHelper delegation channel\n\n");
+
+  pid_t daemon = start_daemon();
+  report("the daemon listens", daemon > 0);
+  if (daemon > 0)
+  {
+    test_no_daemon();
+    test_completion();
+    test_failure();
+    test_policy();
+    test_execve();
+
+    kill(daemon, SIGKILL);
+    waitpid(daemon, NULL, 0);
+  }
+
+  unlink(socket_path);
+  rmdir(dir);
+
+  printf("%s\n", failed ? "FAILED" : "PASSED");
+  return failed;
+}
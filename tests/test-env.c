@@ -0,0 +1,205 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Checks exechelp_env_build: children must preload ExecHelper and carry their
+ * own binary associations whatever the app did to its environment, every
+ * other entry must be passed on untouched and in order, and changes made to
+ * environ must be seen despite its index being cached. The cost of building
+ * the environment of a child is reported for environ, whose index is cached,
+ * and for another vector, which is indexed on every call.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "env.h"
+
+#include "check.h"
+
+#define TEST_LIB       "/usr/lib/libExecHelper.so"
+#define TEST_ENV_SIZE  100
+#define TEST_RUNS      100000
+
+/* The entries of a built environment, which must be the expected strings.
+ * An expected entry starting with '=' must be the very pointer of envp at
+ * the index that follows, as strings are shared and not copied. */
+static int env_is(char **env, char *const envp[], const char *expected[])
+{
+  int i;
+
+  if (!env)
+    return 0;
+
+  for (i = 0; expected[i]; ++i)
+  {
+    if (!env[i])
+      return 0;
+    if (expected[i][0] == '=')
+    {
+      if (env[i] != envp[atoi(expected[i] + 1)])
+        return 0;
+    }
+    else if (strcmp(env[i], expected[i]) != 0)
+      return 0;
+  }
+
+  return env[i] == NULL;
+}
+
+static void check(const char *name, char *const envp[], const char *preload,
+                  const char *associations, const char *expected[])
+{
+  char **env = exechelp_env_build(envp, preload, associations);
+
+  report(name, env_is(env, envp, expected));
+  free(env);
+}
+
+static void test_vectors(void)
+{
+  char *scrubbed[] = { "HOME=/home/user", "PATH=/usr/bin", NULL };
+  check("a scrubbed LD_PRELOAD is restored", scrubbed, TEST_LIB, NULL,
+        (const char *[]) { "=0", "=1", "LD_PRELOAD=" TEST_LIB, NULL });
+
+  char *other[] = { "HOME=/home/user", "LD_PRELOAD=/lib/other.so", "PATH=/usr/bin", NULL };
+  check("the app's own preloads are kept after ours", other, TEST_LIB, NULL,
+        (const char *[]) { "=0", "LD_PRELOAD=" TEST_LIB ":/lib/other.so", "=2", NULL });
+
+  char *kept[] = { "LD_PRELOAD=/lib/other.so " TEST_LIB, "HOME=/home/user", NULL };
+  check("a LD_PRELOAD that lists the library is not copied", kept, TEST_LIB, NULL,
+        (const char *[]) { "=0", "=1", NULL });
+
+  char *suffix[] = { "LD_PRELOAD=" TEST_LIB ".1", NULL };
+  check("library names must match whole", suffix, TEST_LIB, NULL,
+        (const char *[]) { "LD_PRELOAD=" TEST_LIB ":" TEST_LIB ".1", NULL });
+
+  char *empty_preload[] = { "LD_PRELOAD=", NULL };
+  check("an empty LD_PRELOAD is replaced", empty_preload, TEST_LIB, NULL,
+        (const char *[]) { "LD_PRELOAD=" TEST_LIB, NULL });
+
+  char *twice[] = { "LD_PRELOAD=" TEST_LIB, "A=1", "LD_PRELOAD=/lib/other.so", NULL };
+  check("the last LD_PRELOAD, which the linker uses, is fixed", twice, TEST_LIB, NULL,
+        (const char *[]) { "LD_PRELOAD=" TEST_LIB ":/lib/other.so", "=1", NULL });
+
+  char *twice_kept[] = { "LD_PRELOAD=/lib/other.so", "A=1", "LD_PRELOAD=" TEST_LIB, NULL };
+  check("duplicate LD_PRELOAD entries are merged", twice_kept, TEST_LIB, NULL,
+        (const char *[]) { "=2", "=1", NULL });
+  check("LD_PRELOAD is left alone without a library", twice, NULL, NULL,
+        (const char *[]) { "=0", "=1", "=2", NULL });
+
+  char *assoc[] = { EXECHELP_ENV_ASSOCIATIONS "=/usr/bin/old", "HOME=/home/user",
+                    EXECHELP_ENV_ASSOCIATIONS "=/usr/bin/older", NULL };
+  check("associations are replaced", assoc, NULL, "/usr/bin/a:/usr/bin/b",
+        (const char *[]) { EXECHELP_ENV_ASSOCIATIONS "=/usr/bin/a:/usr/bin/b", "=1", NULL });
+  check("inherited associations are removed", assoc, NULL, NULL,
+        (const char *[]) { "=1", NULL });
+  check("associations are added", scrubbed, TEST_LIB, "/usr/bin/a",
+        (const char *[]) { "=0", "=1", "LD_PRELOAD=" TEST_LIB,
+                           EXECHELP_ENV_ASSOCIATIONS "=/usr/bin/a", NULL });
+
+  check("a NULL envp is an empty environment", NULL, TEST_LIB, NULL,
+        (const char *[]) { "LD_PRELOAD=" TEST_LIB, NULL });
+}
+
+static int environ_has(const char *entry)
+{
+  char **env = exechelp_env_build(environ, TEST_LIB, NULL);
+  int i, found = 0;
+
+  for (i = 0; env && env[i]; ++i)
+    found |= strcmp(env[i], entry) == 0;
+
+  free(env);
+  return found;
+}
+
+static void test_environ(void)
+{
+  unsetenv("LD_PRELOAD");
+  int ok = environ_has("LD_PRELOAD=" TEST_LIB) && environ_has("LD_PRELOAD=" TEST_LIB);
+
+  setenv("LD_PRELOAD", "/lib/other.so", 1);
+  ok &= environ_has("LD_PRELOAD=" TEST_LIB ":/lib/other.so");
+
+  setenv("LD_PRELOAD", "/lib/third.so", 1);
+  ok &= environ_has("LD_PRELOAD=" TEST_LIB ":/lib/third.so");
+
+  unsetenv("LD_PRELOAD");
+  ok &= environ_has("LD_PRELOAD=" TEST_LIB);
+
+  static char entry[] = "EXECHELP_TEST_PUTENV=1";
+  putenv(entry);
+  ok &= environ_has(entry);
+  unsetenv("EXECHELP_TEST_PUTENV");
+  ok &= !environ_has(entry);
+
+  report("changes to environ are seen", ok);
+}
+
+static void test_timing(void)
+{
+  char *entries[TEST_ENV_SIZE + 1];
+  long long start, cached_ns, indexed_ns;
+  int i;
+
+  for (i = 0; i < TEST_ENV_SIZE; ++i)
+    if (asprintf(&entries[i], "EXECHELP_TEST_VAR_%d=/some/value/of/a/typical/length/%d", i, i) < 0)
+      return;
+  entries[TEST_ENV_SIZE] = NULL;
+
+  /* An environ of the same size, set up with the same functions as apps */
+  clearenv();
+  for (i = 0; i < TEST_ENV_SIZE; ++i)
+    putenv(entries[i]);
+  setenv("LD_PRELOAD", "/lib/other.so", 1);
+
+  start = now_ns();
+  for (i = 0; i < TEST_RUNS; ++i)
+    free(exechelp_env_build(environ, TEST_LIB, "/usr/bin/a"));
+  cached_ns = now_ns() - start;
+
+  start = now_ns();
+  for (i = 0; i < TEST_RUNS; ++i)
+    free(exechelp_env_build(entries, TEST_LIB, "/usr/bin/a"));
+  indexed_ns = now_ns() - start;
+
+  printf("\n%d variables: %.1f ns/exec for environ, %.1f ns/exec for other vectors\n\n",
+         TEST_ENV_SIZE, (double) cached_ns / TEST_RUNS, (double) indexed_ns / TEST_RUNS);
+
+  clearenv();
+  for (i = 0; i < TEST_ENV_SIZE; ++i)
+    free(entries[i]);
+}
+
+int main(void)
+{
+  printf("ExecHelper child environments\n\n");
+
+  test_vectors();
+  test_environ();
+  report("the library is not preloaded when built into a program",
+         exechelp_env_preload_path() == NULL);
+  test_timing();
+
+  printf("%s\n", failed ? "FAILED" : "PASSED");
+  return failed;
+}
@@ -0,0 +1,471 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Deterministic tests of the canonicalizer, the PATH resolver and both
+ * decision pipelines, run against the in-memory filesystem backend so they
+ * do not depend on the host (e.g. on /usr/bin/vlc existing). The number of
+ * filesystem operations of each case is reported, and is the same on every
+ * machine. The batch API is checked to reach the same verdicts.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "fsops.h"
+#include "policy.h"
+#include "realpath.h"
+
+#define CANON_MISSING   0  /* exechelp_coreutils_realpath */
+#define CANON_EXISTING  1  /* exechelp_coreutils_canonicalize_existing */
+#define CANON_RESOLVE   2  /* exechelp_resolve_path */
+
+typedef struct _PathCase {
+  int         mode;
+  const char *input;
+  const char *expected;  /* NULL if an error is expected */
+  int         expected_errno;
+} PathCase;
+
+typedef struct _DecisionCase {
+  const char      *name;
+  const char      *argv[4];
+  ExecHelpVerdict  expected;
+} DecisionCase;
+
+static const char *canon_names[] = { "missing", "existing", "resolve" };
+
+static const char *fixture[] = {
+  "d /usr",
+  "d /usr/bin",
+  "f /usr/bin/vlc 0755",
+  "f /usr/bin/noexec 0644",
+  "d /home",
+  "d /home/user",
+  "d /home/user/Documents",
+  "f /home/user/a.mp3",
+  "f /home/user/Documents/report.pdf",
+  "l /home/user/link.mp3 a.mp3",
+  "l /home/user/docs Documents",
+  "l /home/user/bin /usr/bin",
+  "l /home/user/loop-a loop-b",
+  "l /home/user/loop-b loop-a",
+  "d /home/user/locked 0600",
+  "f /home/user/locked/secret",
+  NULL
+};
+
+static const PathCase path_cases[] = {
+  { CANON_MISSING,  "a.mp3",                     "/home/user/a.mp3", 0 },
+  { CANON_MISSING,  "link.mp3",                  "/home/user/a.mp3", 0 },
+  { CANON_MISSING,  "~/docs/report.pdf",         "/home/user/Documents/report.pdf", 0 },
+  { CANON_MISSING,  "bin/vlc",                   "/usr/bin/vlc", 0 },
+  { CANON_MISSING,  "missing/../new.mp3",        "/home/user/new.mp3", 0 },
+  { CANON_MISSING,  "../../../usr/./bin//vlc",   "/usr/bin/vlc", 0 },
+  { CANON_MISSING,  "loop-a",                    "/home/user/loop-b", 0 },
+  { CANON_EXISTING, "/home/user/link.mp3",       "/home/user/a.mp3", 0 },
+  { CANON_EXISTING, "./docs/../bin/vlc",         "/usr/bin/vlc", 0 },
+  { CANON_EXISTING, "/home/user/missing",        NULL, ENOENT },
+  { CANON_EXISTING, "/home/user/a.mp3/x",        NULL, ENOTDIR },
+  { CANON_EXISTING, "/home/user/loop-a",         NULL, ELOOP },
+  { CANON_EXISTING, "~/a.mp3",                   NULL, ENOENT },
+  { CANON_RESOLVE,  "vlc",                       "/usr/bin/vlc", 0 },
+  { CANON_RESOLVE,  "noexec",                    NULL, EACCES },
+  { CANON_RESOLVE,  "missing",                   NULL, 0 },
+  { CANON_RESOLVE,  "./bin/vlc",                 "/usr/bin/vlc", 0 },
+};
+
+static const DecisionCase decision_cases[] = {
+  { "no arguments",        { "vlc", NULL },                               EXECHELP_VERDICT_ALLOW },
+  { "unmanaged file",      { "vlc", "a.mp3", NULL },                      EXECHELP_VERDICT_ALLOW },
+  { "managed file",        { "vlc", "Documents/report.pdf", NULL },       EXECHELP_VERDICT_DELEGATE },
+  { "managed via symlink", { "vlc", "docs/report.pdf", NULL },            EXECHELP_VERDICT_DELEGATE },
+  { "managed via home",    { "vlc", "a.mp3", "~/docs/report.pdf", NULL }, EXECHELP_VERDICT_DELEGATE },
+};
+
+static int add_policy_dir(ExecHelpFsMemory *fs)
+{
+  char *dir = strdup(EXECHELP_POLICY_DIR), *slash;
+
+  /* mkdir -p */
+  for (slash = strchr(dir + 1, '/'); slash; slash = strchr(slash + 1, '/'))
+  {
+    *slash = '\0';
+    if (exechelp_fs_memory_add_dir(fs, dir, 0755) && errno != EEXIST)
+    {
+      free(dir);
+      return -1;
+    }
+    *slash = '/';
+  }
+  free(dir);
+
+  return exechelp_fs_memory_add_file(fs, EXECHELP_HELPER_BINS_PATH, 0644, "/usr/bin/cvlc\n") ||
+         exechelp_fs_memory_add_file(fs, EXECHELP_MANAGED_BINS_PATH, 0644, "/usr/bin/firefox\n") ||
+         exechelp_fs_memory_add_file(fs, EXECHELP_MANAGED_FILES_PATH, 0644, "/home/user/Documents/\n");
+}
+
+static ExecHelpFsMemory *make_fixture(void)
+{
+  ExecHelpFsMemory *fs = exechelp_fs_memory_new();
+  char spec[] = "/tmp/exechelper-fsops-XXXXXX";
+  int i, fd, ret;
+
+  if (!fs || (fd = mkstemp(spec)) < 0)
+    return NULL;
+
+  for (i = 0; fixture[i]; ++i)
+    dprintf(fd, "%s\n", fixture[i]);
+  close(fd);
+
+  ret = exechelp_fs_memory_load(fs, spec);
+  unlink(spec);
+
+  if (ret || add_policy_dir(fs) || exechelp_fs_memory_chdir(fs, "/home/user"))
+  {
+    fprintf(stderr, "Could not build the fixture (line %d): %s\n", ret, strerror(errno));
+    exechelp_fs_memory_free(fs);
+    return NULL;
+  }
+
+  setenv("HOME", "/home/user", 1);
+  setenv("PATH", "/nonexistent:/usr/bin", 1);
+  return fs;
+}
+
+static int run_path_case(ExecHelpFsMemory *fs, const PathCase *c)
+{
+  unsigned long ops = exechelp_fs_memory_get_op_count(fs);
+  char *result;
+  int err, ok;
+
+  errno = 0;
+  if (c->mode == CANON_MISSING)
+    result = exechelp_coreutils_realpath(c->input);
+  else if (c->mode == CANON_EXISTING)
+    result = exechelp_coreutils_canonicalize_existing(c->input);
+  else
+    result = exechelp_resolve_path(c->input);
+  err = errno;
+  ops = exechelp_fs_memory_get_op_count(fs) - ops;
+
+  if (c->expected)
+    ok = result && strcmp(result, c->expected) == 0;
+  else
+    ok = !result && (!c->expected_errno || err == c->expected_errno);
+
+  printf("%-9s %-28s %-34s %4lu  %s\n", canon_names[c->mode], c->input,
+         result ? result : strerror(err), ops, ok ? "ok" : "FAILED");
+  if (!ok)
+    printf("          expected %s\n", c->expected ? c->expected : strerror(c->expected_errno));
+
+  free(result);
+  return !ok;
+}
+
+static ExecHelpVerdict legacy_decide(const char *target, char *const argv[])
+{
+  char *allowed_exec = NULL, *forbidden_exec = NULL;
+  char **allowed_argv = NULL, **forbidden_argv = NULL;
+  ExecHelpVerdict verdict;
+
+  if (exechelp_filter_forbidden_exec(target, argv, environ,
+                                     &allowed_exec, &allowed_argv,
+                                     &forbidden_exec, &forbidden_argv))
+    verdict = EXECHELP_VERDICT_ALLOW;
+  else
+    verdict = forbidden_exec ? EXECHELP_VERDICT_DELEGATE : EXECHELP_VERDICT_DENY;
+
+  free(allowed_exec);
+  free(forbidden_exec);
+  free(allowed_argv);
+  free(forbidden_argv);
+
+  return verdict;
+}
+
+static int run_decision_case(ExecHelpFsMemory *fs, const DecisionCase *c, int legacy)
+{
+  unsigned long ops = exechelp_fs_memory_get_op_count(fs);
+  ExecHelpVerdict verdict;
+  char label[64];
+
+  if (legacy)
+    verdict = legacy_decide("/usr/bin/vlc", (char *const *) c->argv);
+  else
+    verdict = exechelp_policy_decide(exechelp_policy_get_default(), "/usr/bin/vlc", (char *const *) c->argv);
+  ops = exechelp_fs_memory_get_op_count(fs) - ops;
+
+  snprintf(label, sizeof(label), "%s [%s]", c->name, legacy ? "legacy" : "engine");
+  printf("%-38s %-9s %-9s %4lu  %s\n", label, exechelp_verdict_to_string(verdict),
+         exechelp_verdict_to_string(c->expected), ops, verdict == c->expected ? "ok" : "FAILED");
+
+  return verdict != c->expected;
+}
+
+/* Decides on every decision case twice in a single batch, from another
+ * directory than the cases' one, so that relative arguments are resolved
+ * against the requests' directory and repeated ones come from the cache */
+static int run_batch_cases(ExecHelpFsMemory *fs)
+{
+  const size_t n = sizeof(decision_cases) / sizeof(decision_cases[0]);
+  ExecHelpCheckRequest requests[2 * n];
+  ExecHelpVerdict verdicts[2 * n];
+  unsigned long ops;
+  int failed = 0;
+  size_t i;
+
+  for (i = 0; i < 2 * n; ++i)
+  {
+    requests[i].cwd = "/home/user";
+    requests[i].target = "/usr/bin/vlc";
+    requests[i].argv = (char *const *) decision_cases[i % n].argv;
+    requests[i].home = NULL;
+  }
+
+  exechelp_fs_memory_chdir(fs, "/");
+  ops = exechelp_fs_memory_get_op_count(fs);
+  failed |= exechelp_check_batch(exechelp_policy_get_default(), requests, 2 * n, verdicts) != 0;
+  ops = exechelp_fs_memory_get_op_count(fs) - ops;
+  exechelp_fs_memory_chdir(fs, "/home/user");
+
+  for (i = 0; i < 2 * n; ++i)
+  {
+    char label[64];
+
+    snprintf(label, sizeof(label), "%s [batch %zu]", decision_cases[i % n].name, i / n + 1);
+    printf("%-38s %-9s %-9s %4s  %s\n", label, exechelp_verdict_to_string(verdicts[i]),
+           exechelp_verdict_to_string(decision_cases[i % n].expected), "",
+           verdicts[i] == decision_cases[i % n].expected ? "ok" : "FAILED");
+    failed |= verdicts[i] != decision_cases[i % n].expected;
+  }
+  printf("%-38s %-9s %-9s %4lu\n", "whole batch", "", "", ops);
+
+  return failed;
+}
+
+/* Without a managed-files list, arguments are not checked at all, so even an
+ * execution with too many arguments to check is allowed. This runs before
+ * the fixture's lists exist, as the legacy list cache only notices files
+ * whose mtime grows by a second or more */
+static int run_no_managed_files_case(void)
+{
+  ExecHelpFsMemory *fs = exechelp_fs_memory_new();
+  char *argv[EXECHELP_MAX_ARGS + 2];
+  int legacy, failed = 0;
+  size_t i;
+
+  if (!fs)
+    return 1;
+  exechelp_fs_set_ops(exechelp_fs_memory_get_ops(fs));
+
+  argv[0] = "vlc";
+  for (i = 1; i <= EXECHELP_MAX_ARGS; ++i)
+    argv[i] = "a.mp3";
+  argv[i] = NULL;
+
+  for (legacy = 1; legacy >= 0; --legacy)
+  {
+    ExecHelpVerdict verdict;
+    char label[64];
+
+    if (legacy)
+      verdict = legacy_decide("/usr/bin/vlc", argv);
+    else
+      verdict = exechelp_policy_decide(exechelp_policy_get_default(), "/usr/bin/vlc", argv);
+
+    snprintf(label, sizeof(label), "too many args, no list [%s]", legacy ? "legacy" : "engine");
+    printf("%-38s %-9s %-9s %4s  %s\n", label, exechelp_verdict_to_string(verdict),
+           exechelp_verdict_to_string(EXECHELP_VERDICT_ALLOW), "",
+           verdict == EXECHELP_VERDICT_ALLOW ? "ok" : "FAILED");
+    failed |= verdict != EXECHELP_VERDICT_ALLOW;
+  }
+
+  exechelp_fs_memory_free(fs);
+  return failed;
+}
+
+/* An argument too long to be a path cannot name a managed file, even when
+ * it starts like one, so it is not canonicalized and does not make the
+ * execution delegated. A shorter one with too many components does */
+static int run_long_argument_cases(void)
+{
+  static const char *names[] = { "too long to be a path", "too many components" };
+  static const ExecHelpVerdict expected[] = { EXECHELP_VERDICT_ALLOW, EXECHELP_VERDICT_DELEGATE };
+  int c, mode, failed = 0;
+  size_t i;
+
+  for (c = 0; c < 2; ++c)
+  {
+    /* "Documents/xxx..." or "Documents/x/x/..." */
+    size_t len = c ? 2 * (EXECHELP_MAX_PATH_COMPONENTS + 1) : EXECHELP_MAX_ARG_LEN;
+    char *arg = malloc(sizeof("Documents/") + len);
+    char *argv[] = { "vlc", arg, NULL };
+    ExecHelpCheckRequest request = { "/home/user", "/usr/bin/vlc", argv };
+
+    if (!arg)
+      return 1;
+    strcpy(arg, "Documents/");
+    for (i = 0; i < len; ++i)
+      arg[sizeof("Documents/") - 1 + i] = c && i % 2 ? '/' : 'x';
+    arg[sizeof("Documents/") - 1 + len] = '\0';
+
+    for (mode = 0; mode < 3; ++mode)
+    {
+      ExecHelpVerdict verdict;
+      char label[64];
+
+      if (mode == 0)
+        verdict = legacy_decide("/usr/bin/vlc", argv);
+      else if (mode == 1)
+        verdict = exechelp_policy_decide(exechelp_policy_get_default(), "/usr/bin/vlc", argv);
+      else if (exechelp_check_batch(exechelp_policy_get_default(), &request, 1, &verdict))
+        verdict = EXECHELP_VERDICT_DENY;
+
+      snprintf(label, sizeof(label), "%s [%s]", names[c], mode == 0 ? "legacy" : mode == 1 ? "engine" : "batch");
+      printf("%-38s %-9s %-9s %4s  %s\n", label, exechelp_verdict_to_string(verdict),
+             exechelp_verdict_to_string(expected[c]), "", verdict == expected[c] ? "ok" : "FAILED");
+      failed |= verdict != expected[c];
+    }
+
+    free(arg);
+  }
+
+  return failed;
+}
+
+/* The components of a request's directory do not count against the limits
+ * of its arguments, so a batch decides like exechelp_policy_decide does from
+ * that directory, even when the directory is deep. The argument has almost
+ * as many components as allowed, but they collapse into a short path */
+static int run_deep_batch_case(ExecHelpFsMemory *fs)
+{
+  const size_t depth = 16, n_pairs = EXECHELP_MAX_PATH_COMPONENTS - 8;
+  char dir[64] = "/home/user", *arg = malloc(5 * n_pairs + sizeof("a.mp3"));
+  char *argv[] = { "vlc", arg, NULL };
+  ExecHelpCheckRequest request = { dir, "/usr/bin/vlc", argv };
+  ExecHelpVerdict decided, batched;
+  size_t i;
+
+  if (!arg)
+    return 1;
+  for (i = 0; i < depth; ++i)
+  {
+    strcat(dir, "/d");
+    if (exechelp_fs_memory_add_dir(fs, dir, 0755) && errno != EEXIST)
+    {
+      free(arg);
+      return 1;
+    }
+  }
+  for (i = 0; i < n_pairs; ++i)
+    memcpy(arg + 5 * i, "x/../", 5);
+  strcpy(arg + 5 * n_pairs, "a.mp3");
+
+  exechelp_fs_memory_chdir(fs, dir);
+  decided = exechelp_policy_decide(exechelp_policy_get_default(), "/usr/bin/vlc", argv);
+  exechelp_fs_memory_chdir(fs, "/");
+  if (exechelp_check_batch(exechelp_policy_get_default(), &request, 1, &batched))
+    batched = EXECHELP_VERDICT_DENY;
+  exechelp_fs_memory_chdir(fs, "/home/user");
+
+  printf("%-38s %-9s %-9s %4s  %s\n", "deep directory [batch]", exechelp_verdict_to_string(batched),
+         exechelp_verdict_to_string(decided), "", batched == decided ? "ok" : "FAILED");
+
+  free(arg);
+  return batched != decided || decided != EXECHELP_VERDICT_ALLOW;
+}
+
+/* '~/' arguments of a request are expanded against its HOME rather than the
+ * caller's, which is /home/user, against the caller's without one, and not
+ * at all when it is empty */
+static int run_home_batch_cases(void)
+{
+  static const char *homes[] = { "/home/other", "/home/user", NULL, "/home/user/", "" };
+  static const ExecHelpVerdict expected[] = { EXECHELP_VERDICT_ALLOW, EXECHELP_VERDICT_DELEGATE,
+                                              EXECHELP_VERDICT_DELEGATE, EXECHELP_VERDICT_DELEGATE,
+                                              EXECHELP_VERDICT_ALLOW };
+  char *argv[] = { "vlc", "~//docs/report.pdf", NULL };
+  const size_t n = sizeof(homes) / sizeof(homes[0]);
+  ExecHelpCheckRequest requests[n];
+  ExecHelpVerdict verdicts[n];
+  int failed = 0;
+  size_t i;
+
+  for (i = 0; i < n; ++i)
+  {
+    requests[i].cwd = "/";
+    requests[i].target = "/usr/bin/vlc";
+    requests[i].argv = argv;
+    requests[i].home = homes[i];
+  }
+
+  failed |= exechelp_check_batch(exechelp_policy_get_default(), requests, n, verdicts) != 0;
+  for (i = 0; i < n; ++i)
+  {
+    char label[64];
+
+    snprintf(label, sizeof(label), "home %s [batch]", !homes[i] ? "of the caller" : homes[i][0] ? homes[i] : "empty");
+    printf("%-38s %-9s %-9s %4s  %s\n", label, exechelp_verdict_to_string(verdicts[i]),
+           exechelp_verdict_to_string(expected[i]), "", verdicts[i] == expected[i] ? "ok" : "FAILED");
+    failed |= verdicts[i] != expected[i];
+  }
+
+  return failed;
+}
+
+int main(void)
+{
+  int failed = 0;
+  size_t i;
+
+  printf("ExecHelper in-memory filesystem tests\n\n");
+  printf("%-38s %-9s %-9s %4s  %s\n", "decision", "verdict", "expected", "ops", "result");
+  failed |= run_no_managed_files_case();
+
+  ExecHelpFsMemory *fs = make_fixture();
+  if (!fs)
+    return 1;
+  exechelp_fs_set_ops(exechelp_fs_memory_get_ops(fs));
+
+  printf("\n");
+  printf("%-9s %-28s %-34s %4s  %s\n", "mode", "input", "result", "ops", "result");
+  for (i = 0; i < sizeof(path_cases) / sizeof(path_cases[0]); ++i)
+    failed |= run_path_case(fs, &path_cases[i]);
+
+  printf("\n%-38s %-9s %-9s %4s  %s\n", "decision", "verdict", "expected", "ops", "result");
+  for (i = 0; i < sizeof(decision_cases) / sizeof(decision_cases[0]); ++i)
+  {
+    failed |= run_decision_case(fs, &decision_cases[i], 1);
+    failed |= run_decision_case(fs, &decision_cases[i], 0);
+  }
+  failed |= run_batch_cases(fs);
+  failed |= run_long_argument_cases();
+  failed |= run_deep_batch_case(fs);
+  failed |= run_home_batch_cases();
+
+  exechelp_fs_memory_free(fs);
+
+  printf("\n%s\n", failed ? "FAILED" : "PASSED");
+  return failed;
+}
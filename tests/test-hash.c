@@ -0,0 +1,340 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Checks flat images of ExecHelpHashTable (see
+ * exechelp_hash_table_serialize): a table served from an image must answer
+ * lookups like the table it was made from, refuse modifications, and
+ * corrupt images must be rejected or only cause misses. The cost of building
+ * the table by insertion is compared to that of mapping its image.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "hash.h"
+
+#include "check.h"
+
+#define TEST_KEYS 20000
+
+/* Offsets of the image header fields the corruption cases alter */
+#define IMAGE_SIZE_OFFSET   8
+#define IMAGE_SHIFT_OFFSET  12
+#define IMAGE_BUCKETS       32
+
+static char *keys[TEST_KEYS];
+static char *values[TEST_KEYS];
+static int order[TEST_KEYS];
+
+/* A third of the keys have no value, a third are their own value */
+static ExecHelpHashTable *build_table(void)
+{
+  ExecHelpHashTable *table = exechelp_hash_table_new(exechelp_str_hash, exechelp_str_equal);
+  int i;
+
+  for (i = 0; i < TEST_KEYS; ++i)
+    exechelp_hash_table_insert(table, keys[i], values[i]);
+
+  return table;
+}
+
+static int same_string(const char *a, const char *b)
+{
+  return a == b || (a && b && !strcmp(a, b));
+}
+
+/* Every key must be found with its value, and near misses must not be */
+static int table_matches(ExecHelpHashTable *table)
+{
+  char miss[PATH_MAX];
+  int i;
+
+  if (exechelp_hash_table_size(table) != TEST_KEYS)
+    return 0;
+
+  for (i = 0; i < TEST_KEYS; ++i)
+  {
+    void *key = NULL, *value = NULL;
+
+    if (!exechelp_hash_table_lookup_extended(table, keys[i], &key, &value) ||
+        !same_string(key, keys[i]) || !same_string(value, values[i]) ||
+        !same_string(exechelp_hash_table_lookup(table, keys[i]), values[i]) ||
+        !exechelp_hash_table_contains(table, keys[i]))
+      return 0;
+
+    snprintf(miss, sizeof(miss), "%s.missing", keys[i]);
+    if (exechelp_hash_table_contains(table, miss) || exechelp_hash_table_lookup(table, miss))
+      return 0;
+  }
+
+  return !exechelp_hash_table_contains(table, "") && !exechelp_hash_table_lookup(table, NULL);
+}
+
+/* Values that are their key are stored once, so they are the same string */
+static void count_cb(void *key, void *value, void *user_data)
+{
+  int *count = user_data;
+
+  if (key && (!value || value == key || !strncmp(value, "/usr/bin/app-", 13)))
+    (*count)++;
+}
+
+static int image_rejected(const unsigned char *image, size_t size)
+{
+  ExecHelpHashTable *table = exechelp_hash_table_new_from_image(image, size);
+
+  if (table)
+  {
+    exechelp_hash_table_unref(table);
+    return 0;
+  }
+  return errno == EINVAL;
+}
+
+static void test_round_trip(unsigned char *image, size_t size)
+{
+  ExecHelpHashTable *table = exechelp_hash_table_new_from_image(image, size);
+
+  report("image answers lookups like the table", table && table_matches(table));
+  if (!table)
+    return;
+
+  int count = 0;
+  exechelp_hash_table_foreach(table, count_cb, &count);
+  report("foreach visits every entry of the image", count == TEST_KEYS);
+
+  int refused = !exechelp_hash_table_insert(table, "/new/key", "value") &&
+                !exechelp_hash_table_add(table, "/new/key") &&
+                !exechelp_hash_table_remove(table, keys[0]) &&
+                !exechelp_hash_table_steal(table, keys[1]);
+  exechelp_hash_table_remove_all(table);
+  report("image tables refuse modifications", refused && table_matches(table));
+
+  exechelp_hash_table_destroy(table);
+}
+
+static void test_mapped(const unsigned char *image, size_t size)
+{
+  char path[] = "/tmp/exechelper-hash-XXXXXX";
+  int fd = mkstemp(path);
+
+  if (fd < 0 || write(fd, image, size) != (ssize_t) size)
+  {
+    report("mapped image answers lookups like the table", 0);
+    if (fd >= 0)
+    {
+      close(fd);
+      unlink(path);
+    }
+    return;
+  }
+  close(fd);
+
+  long long start = now_ns();
+  ExecHelpHashTable *table = exechelp_hash_table_map_image(path);
+  long long map_ns = now_ns() - start;
+
+  start = now_ns();
+  ExecHelpHashTable *built = build_table();
+  long long build_ns = now_ns() - start;
+
+  report("mapped image answers lookups like the table", table && table_matches(table));
+
+  char **lookups = calloc(TEST_KEYS, sizeof(char *));
+  int i;
+
+  for (i = 0; lookups && i < TEST_KEYS; ++i)
+    lookups[i] = strdup(keys[order[i]]);
+
+  if (table && lookups)
+  {
+    long long table_ns, image_ns, cold_ns;
+    int found = 0;
+
+    /* The first pass over the image faults its pages in */
+    start = now_ns();
+    for (i = 0; i < TEST_KEYS; ++i)
+      found += !!lookups[i] && exechelp_hash_table_contains(table, lookups[i]);
+    cold_ns = now_ns() - start;
+
+    /* Keys are copies looked up in a shuffled order, as the table stores the
+     * very strings of keys[] and comparing them to themselves would be free */
+    start = now_ns();
+    for (i = 0; i < TEST_KEYS; ++i)
+      found += !!lookups[i] && exechelp_hash_table_contains(built, lookups[i]);
+    table_ns = now_ns() - start;
+
+    start = now_ns();
+    for (i = 0; i < TEST_KEYS; ++i)
+      found += !!lookups[i] && exechelp_hash_table_contains(table, lookups[i]);
+    image_ns = now_ns() - start;
+
+    printf("\n%d entries, %zu bytes: built in %.1fus, mapped in %.1fus\n"
+           "lookups: %.1f ns/op in the table, %.1f ns/op in the image (%.1f on first use)\n\n",
+           TEST_KEYS, size, build_ns / 1000.0, map_ns / 1000.0, (double) table_ns / TEST_KEYS,
+           (double) image_ns / TEST_KEYS, (double) cold_ns / TEST_KEYS);
+    report("mapped lookups found every key", found == 3 * TEST_KEYS);
+  }
+
+  for (i = 0; lookups && i < TEST_KEYS; ++i)
+    free(lookups[i]);
+  free(lookups);
+
+  exechelp_hash_table_destroy(table);
+  exechelp_hash_table_destroy(built);
+  unlink(path);
+}
+
+static void test_corrupt(const unsigned char *image, size_t size)
+{
+  unsigned char *copy = malloc(size + 4);
+  uint32_t value;
+
+  if (!copy)
+  {
+    report("corrupt images are rejected", 0);
+    return;
+  }
+
+  memcpy(copy, image, size);
+  copy[0] = 'X';
+  int ok = image_rejected(copy, size);
+
+  memcpy(copy, image, size);
+  ok &= image_rejected(copy, size - 1) && image_rejected(copy, 16);
+
+  copy[size - 1] = 'x';
+  ok &= image_rejected(copy, size);
+
+  memcpy(copy, image, size);
+  value = size + 1;
+  memcpy(copy + IMAGE_SIZE_OFFSET, &value, sizeof(value));
+  ok &= image_rejected(copy, size);
+
+  memcpy(copy, image, size);
+  value = 31;
+  memcpy(copy + IMAGE_SHIFT_OFFSET, &value, sizeof(value));
+  ok &= image_rejected(copy, size);
+
+  /* Images must be aligned */
+  memmove(copy + 1, image, size);
+  ok &= image_rejected(copy + 1, size);
+  report("corrupt images are rejected", ok);
+
+  /* Bucket offsets pointing out of the image only cause misses */
+  memcpy(copy, image, size);
+  uint32_t *buckets = (uint32_t *) (copy + IMAGE_BUCKETS);
+  uint32_t n_buckets = 1U << *(uint32_t *) (copy + IMAGE_SHIFT_OFFSET), i;
+  for (i = 0; i < n_buckets; ++i)
+  {
+    buckets[3 * i + 1] = UINT32_MAX;
+    buckets[3 * i + 2] = 4;
+  }
+
+  ExecHelpHashTable *table = exechelp_hash_table_new_from_image(copy, size);
+  int misses = table != NULL;
+  for (i = 0; table && i < TEST_KEYS; ++i)
+    misses &= !exechelp_hash_table_contains(table, keys[i]);
+  report("corrupt buckets only cause misses", misses);
+  exechelp_hash_table_unref(table);
+
+  free(copy);
+}
+
+static void test_unsupported(void)
+{
+  ExecHelpHashTable *table = exechelp_hash_table_new(exechelp_direct_hash, exechelp_direct_equal);
+  size_t size;
+
+  exechelp_hash_table_insert(table, keys[0], values[0]);
+  errno = 0;
+  report("tables without string keys cannot be serialized",
+         !exechelp_hash_table_serialize(table, &size) && errno == EINVAL);
+  exechelp_hash_table_destroy(table);
+
+  table = exechelp_hash_table_new(exechelp_str_hash, exechelp_str_equal);
+  void *image = exechelp_hash_table_serialize(table, &size);
+  ExecHelpHashTable *empty = exechelp_hash_table_new_from_image(image, size);
+  report("empty tables round trip",
+         empty && !exechelp_hash_table_size(empty) && !exechelp_hash_table_contains(empty, keys[0]));
+  exechelp_hash_table_destroy(empty);
+  exechelp_hash_table_destroy(table);
+  free(image);
+}
+
+int main(void)
+{
+  size_t size;
+  int i;
+
+  for (i = 0; i < TEST_KEYS; ++i)
+  {
+    if (asprintf(&keys[i], "/usr/lib/package-%d/lib/file-%d.so", i / 16, i) < 0)
+      return 1;
+    if (i % 3 == 1)
+      values[i] = keys[i];
+    else if (i % 3 == 2 && asprintf(&values[i], "/usr/bin/app-%d", i / 64) < 0)
+      return 1;
+  }
+
+  /* The seed is fixed so that runs are comparable */
+  unsigned int seed = 42;
+  for (i = 0; i < TEST_KEYS; ++i)
+    order[i] = i;
+  for (i = TEST_KEYS - 1; i > 0; --i)
+  {
+    int j = rand_r(&seed) % (i + 1), tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+
+  printf("ExecHelper hash table images\n\n");
+
+  ExecHelpHashTable *reference = build_table();
+  unsigned char *image = exechelp_hash_table_serialize(reference, &size);
+  report("table serializes", image != NULL);
+
+  if (image)
+  {
+    test_round_trip(image, size);
+    test_mapped(image, size);
+    test_corrupt(image, size);
+  }
+  test_unsupported();
+
+  exechelp_hash_table_destroy(reference);
+  free(image);
+  for (i = 0; i < TEST_KEYS; ++i)
+  {
+    if (values[i] != keys[i])
+      free(values[i]);
+    free(keys[i]);
+  }
+
+  printf("\n%s\n", failed ? "FAILED" : "PASSED");
+  return failed;
+}
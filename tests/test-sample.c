@@ -0,0 +1,314 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Checks call-site sampling (see sample.h). Each case runs in a new process,
+ * since the sampling settings are read once per process. Exec calls must be
+ * counted by call site, and one in N must be sampled, including when each
+ * call is made by another forked child. Forked children must not count the
+ * samples of their parent again, samples must be written before an allowed
+ * exec replaces the process, and exec calls without a target must still fail
+ * when sampled. The cost of a sample is reported.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "sample.h"
+
+#include "check.h"
+
+#define TEST_COST_CALLS       10000
+#define TEST_PERIOD           10
+#define TEST_PERIOD_CALLS     2000
+#define TEST_PERIOD_CHILDREN  300
+
+static char dir[] = "/tmp/exechelper-sample-test-XXXXXX";
+static char log_path[PATH_MAX];
+
+/* Too many arguments to be checked, so the exec is delegated and returns */
+static char *delegated_argv[EXECHELP_MAX_ARGS + 3];
+static char *allowed_argv[] = { "true", NULL };
+
+__attribute__((noinline)) static void site_a(void)
+{
+  execve("/bin/true", delegated_argv, environ);
+}
+
+__attribute__((noinline)) static void site_b(void)
+{
+  execv("/bin/true", delegated_argv);
+}
+
+/* Runs a case in a new process that samples one in period exec calls into a
+ * fresh log. The sampler is set up when the process starts, as in apps that
+ * are started with EXECHELP_SAMPLE set. */
+static int run_sampled(long period, const char *name)
+{
+  char value[32], *argv[] = { "exec-helper-test-sample", (char *) name, NULL };
+  int status;
+
+  unlink(log_path);
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    snprintf(value, sizeof(value), "%ld", period);
+    setenv(EXECHELP_ENV_SAMPLE, value, 1);
+    setenv(EXECHELP_ENV_SAMPLE_LOG, log_path, 1);
+    syscall(SYS_execve, "/proc/self/exe", argv, environ);
+    _exit(1);
+  }
+
+  return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/* Reads the log into lines of samples, period, target and frames */
+typedef struct _LogLine {
+  long  samples;
+  long  period;
+  char  target[PATH_MAX];
+  char  frames[4096];
+} LogLine;
+
+static int read_log(LogLine *lines, int max)
+{
+  FILE *file = fopen(log_path, "r");
+  char buf[8192];
+  int n = 0;
+
+  while (file && n < max && fgets(buf, sizeof(buf), file))
+  {
+    buf[strcspn(buf, "\n")] = '\0';
+    if (sscanf(buf, "%ld\t%ld\t%4095[^\t]\t%4095[^\n]", &lines[n].samples, &lines[n].period,
+               lines[n].target, lines[n].frames) == 4)
+      n++;
+  }
+
+  if (file)
+    fclose(file);
+  return n;
+}
+
+static void sites(void)
+{
+  int i;
+
+  for (i = 0; i < 3; ++i)
+    site_a();
+  for (i = 0; i < 2; ++i)
+    site_b();
+}
+
+static void test_sites(void)
+{
+  LogLine lines[4];
+  int n = (run_sampled(1, "sites"), read_log(lines, 4));
+
+  report("exec calls are counted by call site",
+         n == 2 && lines[0].samples + lines[1].samples == 5 &&
+         (lines[0].samples == 3 || lines[0].samples == 2) &&
+         !strcmp(lines[0].target, "/bin/true") && !strcmp(lines[1].target, "/bin/true") &&
+         strcmp(lines[0].frames, lines[1].frames) != 0);
+}
+
+static void one_site(void)
+{
+  int i;
+
+  for (i = 0; i < TEST_PERIOD_CALLS; ++i)
+    site_a();
+}
+
+/* Each child execs once, as when an app spawns helpers */
+static void many_children(void)
+{
+  int i;
+
+  for (i = 0; i < TEST_PERIOD_CHILDREN; ++i)
+  {
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      site_a();
+      _exit(127);
+    }
+    waitpid(pid, NULL, 0);
+  }
+}
+
+/* Sums up the samples of the log, which are expected to be 1 in period calls
+ * give or take 5 standard deviations */
+static int sampled_one_in(long period, long calls)
+{
+  LogLine lines[TEST_PERIOD_CHILDREN];
+  int n = read_log(lines, TEST_PERIOD_CHILDREN), i;
+  long samples = 0;
+
+  for (i = 0; i < n; ++i)
+    samples += lines[i].period == period ? lines[i].samples : 0;
+
+  double mean = (double) calls / period, dev = 5 * sqrt(mean * (1 - 1.0 / period));
+  printf("  %ld samples of %ld calls, %.0f expected\n", samples, calls, mean);
+  return samples >= mean - dev && samples <= mean + dev;
+}
+
+static void test_period(void)
+{
+  run_sampled(TEST_PERIOD, "one_site");
+  report("one in N exec calls is sampled", sampled_one_in(TEST_PERIOD, TEST_PERIOD_CALLS));
+
+  run_sampled(TEST_PERIOD, "many_children");
+  report("one in N forked children is sampled",
+         sampled_one_in(TEST_PERIOD, TEST_PERIOD_CHILDREN));
+}
+
+static void forking(void)
+{
+  site_a();
+
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    site_b();
+    _exit(127);
+  }
+  waitpid(pid, NULL, 0);
+}
+
+static void test_fork(void)
+{
+  LogLine lines[4];
+  int n = (run_sampled(1, "forking"), read_log(lines, 4));
+
+  report("forked children write only their own samples",
+         n == 2 && lines[0].samples == 1 && lines[1].samples == 1);
+}
+
+static void replaced(void)
+{
+  site_a();
+  execve("/bin/true", allowed_argv, environ);
+  _exit(1);
+}
+
+static void test_exec(void)
+{
+  LogLine lines[4];
+  int ret = run_sampled(1, "replaced");
+  int n = read_log(lines, 4);
+
+  report("samples are written before an allowed exec",
+         ret == 0 && n == 2 && lines[0].samples == 1 && lines[1].samples == 1);
+}
+
+static void null_target(void)
+{
+  /* Hidden from the compiler, which warns about a literal NULL */
+  char *volatile target = NULL;
+  int ret = execve(target, allowed_argv, environ);
+  exechelp_sample_flush();
+  exit(ret == -1 ? 0 : 1);
+}
+
+static void test_null_target(void)
+{
+  LogLine lines[4];
+  int ret = run_sampled(1, "null_target");
+  int n = read_log(lines, 4);
+
+  report("exec calls without a target are sampled and fail",
+         ret == 0 && n == 1 && !strcmp(lines[0].target, "(null)"));
+}
+
+static void cost(void)
+{
+  long long start = now_ns();
+  int i;
+
+  for (i = 0; i < TEST_COST_CALLS; ++i)
+    exechelp_sample_exec("/bin/true", NULL);
+
+  printf("%.0fns per call with %s=%s\n", (double) (now_ns() - start) / TEST_COST_CALLS,
+         EXECHELP_ENV_SAMPLE, getenv(EXECHELP_ENV_SAMPLE));
+  fflush(stdout);
+}
+
+static const struct {
+  const char  *name;
+  void       (*fn)(void);
+} cases[] = {
+  { "sites", sites },
+  { "one_site", one_site },
+  { "many_children", many_children },
+  { "forking", forking },
+  { "replaced", replaced },
+  { "null_target", null_target },
+  { "cost", cost },
+};
+
+int main(int argc, char *argv[])
+{
+  size_t c;
+  int i;
+
+  delegated_argv[0] = "true";
+  for (i = 1; i <= EXECHELP_MAX_ARGS + 1; ++i)
+    delegated_argv[i] = "x";
+  delegated_argv[i] = NULL;
+
+  if (argc == 2)
+  {
+    for (c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c)
+      if (!strcmp(argv[1], cases[c].name))
+        cases[c].fn();
+    exit(0);
+  }
+
+  if (!mkdtemp(dir))
+    return 1;
+  snprintf(log_path, sizeof(log_path), "%s/samples.log", dir);
+
+  printf("ExecHelper exec call-site sampling\n\n");
+
+  test_sites();
+  test_period();
+  test_fork();
+  test_exec();
+  test_null_target();
+
+  printf("\n");
+  run_sampled(1, "cost");
+  run_sampled(100, "cost");
+  printf("\n");
+
+  unlink(log_path);
+  rmdir(dir);
+
+  printf("%s\n", failed ? "FAILED" : "PASSED");
+  return failed;
+}
@@ -0,0 +1,201 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Checks exechelp_list_sort_with_data and exechelp_slist_sort_with_data on
+ * inputs of several shapes and sizes. A sort must keep every node, order
+ * them, keep nodes with equal keys in their original order and, for
+ * ExecHelpList, leave the prev pointers consistent. The time and number of
+ * comparisons of each sort are reported, the largest sizes being those of
+ * large policy lists.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "list.h"
+#include "slist.h"
+
+typedef struct _SortItem {
+  unsigned int key;
+  unsigned int seq;
+} SortItem;
+
+typedef enum _SortShape {
+  SHAPE_RANDOM = 0,
+  SHAPE_SORTED,
+  SHAPE_REVERSED,
+  SHAPE_FEW_KEYS,
+  SHAPE_RUNS,
+  N_SHAPES
+} SortShape;
+
+static const char *shape_names[N_SHAPES] = {
+  "random", "sorted", "reversed", "few keys", "sorted runs"
+};
+
+static const size_t sizes[] = { 0, 1, 2, 3, 10, 17, 1000, 100000 };
+#define N_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static int compare_items(const void *a, const void *b, void *user_data)
+{
+  const SortItem *ia = a, *ib = b;
+  unsigned long *comparisons = user_data;
+
+  (*comparisons)++;
+  return ia->key < ib->key ? -1 : ia->key > ib->key;
+}
+
+static void fill_items(SortItem *items, size_t n, SortShape shape)
+{
+  size_t i;
+
+  srandom(n * N_SHAPES + shape);
+  for (i = 0; i < n; ++i)
+  {
+    items[i].seq = i;
+    switch (shape)
+    {
+      case SHAPE_SORTED:
+        items[i].key = i;
+        break;
+      case SHAPE_REVERSED:
+        items[i].key = n - i;
+        break;
+      case SHAPE_FEW_KEYS:
+        items[i].key = random() % 4;
+        break;
+      case SHAPE_RUNS:
+        /* Lists loaded from several sorted files */
+        items[i].key = (i % 1000) * 16 + random() % 16;
+        break;
+      default:
+        items[i].key = random();
+        break;
+    }
+  }
+}
+
+static int items_in_order(const SortItem *a, const SortItem *b)
+{
+  return a->key < b->key || (a->key == b->key && a->seq < b->seq);
+}
+
+static long long elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+  return (end->tv_sec - start->tv_sec) * 1000000000LL + (end->tv_nsec - start->tv_nsec);
+}
+
+static int check_list(SortItem *items, size_t n, long long *ns, unsigned long *comparisons)
+{
+  ExecHelpList *list = NULL, *l, *prev = NULL;
+  struct timespec start, end;
+  size_t i, count = 0;
+  int ok = 1;
+
+  for (i = n; i > 0; --i)
+    list = exechelp_list_prepend(list, &items[i - 1]);
+
+  *comparisons = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  list = exechelp_list_sort_with_data(list, compare_items, comparisons);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  *ns = elapsed_ns(&start, &end);
+
+  for (l = list; l; prev = l, l = l->next, ++count)
+  {
+    if (l->prev != prev || (prev && !items_in_order(prev->data, l->data)))
+      ok = 0;
+  }
+
+  exechelp_list_free(list);
+  return ok && count == n;
+}
+
+static int check_slist(SortItem *items, size_t n, long long *ns, unsigned long *comparisons)
+{
+  ExecHelpSList *list = NULL, *l, *prev = NULL;
+  struct timespec start, end;
+  size_t i, count = 0;
+  int ok = 1;
+
+  for (i = n; i > 0; --i)
+    list = exechelp_slist_prepend(list, &items[i - 1]);
+
+  *comparisons = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  list = exechelp_slist_sort_with_data(list, compare_items, comparisons);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  *ns = elapsed_ns(&start, &end);
+
+  for (l = list; l; prev = l, l = l->next, ++count)
+  {
+    if (prev && !items_in_order(prev->data, l->data))
+      ok = 0;
+  }
+
+  exechelp_slist_free(list);
+  return ok && count == n;
+}
+
+int main(void)
+{
+  SortItem *items = malloc(sizes[N_SIZES - 1] * sizeof(SortItem));
+  size_t s;
+  int shape, failed = 0;
+
+  if (!items)
+    return 1;
+
+  printf("ExecHelper list sorts\n\n");
+  printf("%-12s %8s  %-6s %12s %12s  %s\n", "shape", "size", "list", "time", "comparisons", "result");
+
+  for (shape = 0; shape < N_SHAPES; ++shape)
+  {
+    for (s = 0; s < N_SIZES; ++s)
+    {
+      int pass;
+
+      for (pass = 0; pass < 2; ++pass)
+      {
+        unsigned long comparisons;
+        long long ns;
+        int ok;
+
+        fill_items(items, sizes[s], shape);
+        if (pass)
+          ok = check_slist(items, sizes[s], &ns, &comparisons);
+        else
+          ok = check_list(items, sizes[s], &ns, &comparisons);
+        failed |= !ok;
+
+        /* Only report the sizes worth timing, and any failure */
+        if (sizes[s] >= 1000 || !ok)
+          printf("%-12s %8zu  %-6s %10.2fms %12lu  %s\n", shape_names[shape], sizes[s],
+                 pass ? "slist" : "list", ns / 1e6, comparisons, ok ? "ok" : "FAILED");
+      }
+    }
+  }
+
+  free(items);
+
+  printf("\n%s\n", failed ? "FAILED" : "PASSED");
+  return failed;
+}
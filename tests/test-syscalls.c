@@ -0,0 +1,260 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Syscall budgets for the exec decision pipeline. The scenarios run in a
+ * child traced with ptrace, so that syscalls made inside libc (e.g. by
+ * realpath or fopen) are counted as well as those made by our own code. The
+ * child brackets each measured run with a getppid() marker, which the
+ * pipeline never calls itself. The test fails when a scenario goes over its
+ * budget.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "scenarios.h"
+
+#define MARKER_SYSCALL  SYS_getppid
+#define MAX_SYSCALL_NR  1024
+
+typedef struct _SyscallName {
+  long        nr;
+  const char *name;
+} SyscallName;
+
+/* The syscalls the pipeline is expected to make, for the per-scenario
+ * breakdown. Anything else is reported by number.
+ */
+static const SyscallName syscall_names[] = {
+#ifdef SYS_stat
+  { SYS_stat, "stat" },
+#endif
+#ifdef SYS_lstat
+  { SYS_lstat, "lstat" },
+#endif
+#ifdef SYS_newfstatat
+  { SYS_newfstatat, "fstatat" },
+#endif
+#ifdef SYS_statx
+  { SYS_statx, "statx" },
+#endif
+#ifdef SYS_fstat
+  { SYS_fstat, "fstat" },
+#endif
+#ifdef SYS_access
+  { SYS_access, "access" },
+#endif
+#ifdef SYS_faccessat
+  { SYS_faccessat, "faccessat" },
+#endif
+#ifdef SYS_faccessat2
+  { SYS_faccessat2, "faccessat2" },
+#endif
+#ifdef SYS_readlink
+  { SYS_readlink, "readlink" },
+#endif
+#ifdef SYS_readlinkat
+  { SYS_readlinkat, "readlinkat" },
+#endif
+#ifdef SYS_getcwd
+  { SYS_getcwd, "getcwd" },
+#endif
+#ifdef SYS_open
+  { SYS_open, "open" },
+#endif
+#ifdef SYS_openat
+  { SYS_openat, "openat" },
+#endif
+#ifdef SYS_read
+  { SYS_read, "read" },
+#endif
+#ifdef SYS_lseek
+  { SYS_lseek, "lseek" },
+#endif
+#ifdef SYS_close
+  { SYS_close, "close" },
+#endif
+#ifdef SYS_brk
+  { SYS_brk, "brk" },
+#endif
+#ifdef SYS_mmap
+  { SYS_mmap, "mmap" },
+#endif
+#ifdef SYS_munmap
+  { SYS_munmap, "munmap" },
+#endif
+};
+
+static const char *syscall_name(long nr)
+{
+  size_t i;
+  for (i = 0; i < sizeof(syscall_names) / sizeof(syscall_names[0]); ++i)
+    if (syscall_names[i].nr == nr)
+      return syscall_names[i].name;
+  return NULL;
+}
+
+static void traced_child(void)
+{
+  size_t i;
+
+  if (ptrace(PTRACE_TRACEME, 0, NULL, NULL))
+    _exit(2);
+  raise(SIGSTOP);
+
+  for (i = 0; i < N_SCENARIOS * N_PIPELINES; ++i)
+  {
+    /* Warm up the policy list cache first */
+    run_scenario(&scenarios[i / N_PIPELINES], i % N_PIPELINES);
+
+    syscall(MARKER_SYSCALL);
+    run_scenario(&scenarios[i / N_PIPELINES], i % N_PIPELINES);
+    syscall(MARKER_SYSCALL);
+  }
+
+  _exit(0);
+}
+
+static void print_breakdown(const unsigned long *counts)
+{
+  long nr;
+  int first = 1;
+
+  for (nr = 0; nr < MAX_SYSCALL_NR; ++nr)
+  {
+    if (!counts[nr])
+      continue;
+
+    const char *name = syscall_name(nr);
+    if (name)
+      printf("%s%s=%lu", first? "" : " ", name, counts[nr]);
+    else
+      printf("%s#%ld=%lu", first? "" : " ", nr, counts[nr]);
+    first = 0;
+  }
+  printf("\n");
+}
+
+int main(void)
+{
+  char dir[] = "/tmp/exechelper-syscalls-XXXXXX";
+  unsigned long counts[MAX_SYSCALL_NR];
+  unsigned long total = 0;
+  size_t scenario = 0;
+  int measuring = 0, failed = 0, status;
+  pid_t child;
+
+  if (make_fixture(dir))
+  {
+    fprintf(stderr, "Could not create fixture directory: %s\n", strerror(errno));
+    return 1;
+  }
+
+  fflush(stdout);
+  child = fork();
+  if (child < 0)
+  {
+    fprintf(stderr, "Could not fork: %s\n", strerror(errno));
+    remove_fixture(dir);
+    return 1;
+  }
+  if (child == 0)
+    traced_child();
+
+  if (waitpid(child, &status, 0) < 0 || !WIFSTOPPED(status))
+  {
+    fprintf(stderr, "Could not trace the scenario process, skipping\n");
+    remove_fixture(dir);
+    return 0;
+  }
+  ptrace(PTRACE_SETOPTIONS, child, NULL, PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL);
+
+  printf("ExecHelper syscall budgets (policy: %s)\n\n", EXECHELP_POLICY_DIR);
+  printf("%-32s %8s %8s  %-12s %s\n", "scenario", "syscalls", "budget", "result", "breakdown");
+
+  int sig = 0;
+  while (ptrace(PTRACE_SYSCALL, child, NULL, sig) == 0)
+  {
+    sig = 0;
+    if (waitpid(child, &status, 0) < 0 || WIFEXITED(status) || WIFSIGNALED(status))
+      break;
+
+    if (WSTOPSIG(status) != (SIGTRAP | 0x80))
+    {
+      sig = WSTOPSIG(status);
+      continue;
+    }
+
+    struct __ptrace_syscall_info info;
+    if (ptrace(PTRACE_GET_SYSCALL_INFO, child, sizeof(info), &info) <= 0
+        || info.op != PTRACE_SYSCALL_INFO_ENTRY)
+      continue;
+
+    long nr = (long) info.entry.nr;
+    if (nr == MARKER_SYSCALL)
+    {
+      if (!measuring)
+      {
+        memset(counts, 0, sizeof(counts));
+        total = 0;
+        measuring = 1;
+        continue;
+      }
+
+      const ExecScenario *s = &scenarios[scenario / N_PIPELINES];
+      int pipeline = scenario++ % N_PIPELINES;
+      unsigned long budget = scenario_budget(s, pipeline)->syscalls;
+      int over = total > budget;
+      char label[64];
+
+      snprintf(label, sizeof(label), "%s [%s]", s->name, pipeline_names[pipeline]);
+      printf("%-32s %8lu %8lu  %-12s ", label, total, budget,
+             over? "OVER BUDGET" : "ok");
+      print_breakdown(counts);
+      failed |= over;
+      measuring = 0;
+    }
+    else if (measuring)
+    {
+      total++;
+      if (nr >= 0 && nr < MAX_SYSCALL_NR)
+        counts[nr]++;
+    }
+  }
+
+  remove_fixture(dir);
+
+  if (scenario != N_SCENARIOS * N_PIPELINES)
+  {
+    fprintf(stderr, "The scenario process stopped after %zu runs\n", scenario);
+    failed = 1;
+  }
+
+  printf("\n%s\n", failed? "FAILED" : "PASSED");
+  return failed;
+}
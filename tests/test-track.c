@@ -0,0 +1,404 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Checks the tracker of managed files (see track.h) on a scratch directory:
+ * renaming an entry, moving a directory that contains entries and renaming a
+ * directory entry must add the new paths to the list, and keep the old ones.
+ * Deleted entries must be kept, moves out of the watched directories must be
+ * reported as lost, and a rescan must only remove the entries that are gone
+ * and still do not exist. The cost of following a change is then measured
+ * with a large list, against the time it takes to rewrite the list.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "compiled.h"
+#include "track.h"
+
+#include "check.h"
+
+#define TEST_LARGE_DIRS     100
+#define TEST_LARGE_ENTRIES  20000
+#define TEST_LARGE_MOVES    100
+
+static char root[] = "/tmp/exechelper-track-test-XXXXXX";
+static char list[PATH_MAX];
+
+/* Formats a path under the scratch directory */
+static const char *at(const char *fmt, ...)
+{
+  static char paths[4][PATH_MAX];
+  static int next = 0;
+  char *path = paths[next++ % 4];
+  va_list ap;
+  int len = snprintf(path, PATH_MAX, "%s/", root);
+
+  va_start(ap, fmt);
+  vsnprintf(path + len, PATH_MAX - len, fmt, ap);
+  va_end(ap);
+
+  return path;
+}
+
+static void touch(const char *path)
+{
+  FILE *file = fopen(path, "w");
+
+  if (file)
+    fclose(file);
+}
+
+static char *read_file(const char *path)
+{
+  char *contents = NULL;
+  size_t size = 0;
+  FILE *file = fopen(path, "r");
+
+  if (!file)
+    return NULL;
+  if (getdelim(&contents, &size, '\0', file) < 0)
+  {
+    free(contents);
+    contents = NULL;
+  }
+  fclose(file);
+  return contents;
+}
+
+/* Tells whether the list holds exactly the given lines, with root
+ * substituted for every '@' */
+static int list_is(const char *expected[])
+{
+  char *contents = read_file(list), buf[PATH_MAX * 8] = "";
+  size_t len = 0;
+  int i;
+
+  for (i = 0; expected[i]; ++i)
+  {
+    const char *at_sign = strchr(expected[i], '@');
+    if (at_sign)
+      len += snprintf(buf + len, sizeof(buf) - len, "%.*s%s%s\n", (int) (at_sign - expected[i]),
+                      expected[i], root, at_sign + 1);
+    else
+      len += snprintf(buf + len, sizeof(buf) - len, "%s\n", expected[i]);
+  }
+
+  int ok = contents && strcmp(contents, buf) == 0;
+  if (!ok)
+    fprintf(stderr, "Expected:\n%sGot:\n%s", buf, contents ? contents : "(null)\n");
+  free(contents);
+  return ok;
+}
+
+static void test_changes(void)
+{
+  mkdir(at("docs"), 0700);
+  mkdir(at("music"), 0700);
+  mkdir(at("elsewhere"), 0700);
+  touch(at("docs/a.pdf"));
+  touch(at("docs/b.pdf"));
+  touch(at("keep.txt"));
+  touch(at("other.txt"));
+
+  FILE *file = fopen(list, "w");
+  if (!file)
+    return;
+  fprintf(file, "/etc/firejail/\n%s\n%s\n%s/\n%s\n", at("docs/a.pdf"), at("docs/b.pdf"),
+          at("music"), at("keep.txt"));
+  fclose(file);
+
+  /* elsewhere/ holds no entry, so it is not watched */
+  ExecHelpTracker *tracker = exechelp_tracker_new(list, NULL);
+  report("the tracker starts", tracker != NULL);
+  if (!tracker)
+    return;
+
+  rename(at("docs/a.pdf"), at("docs/a2.pdf"));
+  rename(at("other.txt"), at("other2.txt"));
+  report("renamed entries are added under their new name",
+         exechelp_tracker_process(tracker) == 1 &&
+         list_is((const char *[]) { "/etc/firejail/", "@/docs/a.pdf", "@/docs/b.pdf", "@/music/",
+                                    "@/keep.txt", "@/docs/a2.pdf", NULL }));
+
+  rename(at("docs"), at("papers"));
+  report("entries follow the directories they are in",
+         exechelp_tracker_process(tracker) == 3 &&
+         list_is((const char *[]) { "/etc/firejail/", "@/docs/a.pdf", "@/docs/b.pdf", "@/music/",
+                                    "@/keep.txt", "@/docs/a2.pdf", "@/papers/a.pdf", "@/papers/b.pdf",
+                                    "@/papers/a2.pdf", NULL }));
+
+  rename(at("papers/b.pdf"), at("papers/c.pdf"));
+  rename(at("music"), at("audio"));
+  report("moved directories are still watched, under their new name",
+         exechelp_tracker_process(tracker) == 2 &&
+         list_is((const char *[]) { "/etc/firejail/", "@/docs/a.pdf", "@/docs/b.pdf", "@/music/",
+                                    "@/keep.txt", "@/docs/a2.pdf", "@/papers/a.pdf", "@/papers/b.pdf",
+                                    "@/papers/a2.pdf", "@/papers/c.pdf", "@/audio/", NULL }));
+
+  unlink(at("keep.txt"));
+  report("deleted entries are kept",
+         exechelp_tracker_process(tracker) == 0 && exechelp_tracker_stats(tracker)->gone == 1 &&
+         exechelp_tracker_stats(tracker)->appends == 3 && exechelp_tracker_stats(tracker)->rewrites == 0);
+  touch(at("keep.txt"));
+
+  /* As editors save: the file becomes a backup, and a new one is written */
+  rename(at("papers/a2.pdf"), at("papers/a2.pdf~"));
+  touch(at("papers/a2.pdf"));
+  report("a saved entry stays managed, and so does its backup",
+         exechelp_tracker_process(tracker) == 1 &&
+         list_is((const char *[]) { "/etc/firejail/", "@/docs/a.pdf", "@/docs/b.pdf", "@/music/",
+                                    "@/keep.txt", "@/docs/a2.pdf", "@/papers/a.pdf", "@/papers/b.pdf",
+                                    "@/papers/a2.pdf", "@/papers/c.pdf", "@/audio/", "@/papers/a2.pdf~",
+                                    NULL }));
+
+  rename(at("papers/c.pdf"), at("elsewhere/c.pdf"));
+  report("moves out of the watched directories are reported as lost",
+         exechelp_tracker_process(tracker) == 0 && exechelp_tracker_stats(tracker)->lost == 1);
+
+  report("a rescan only removes gone entries that do not exist",
+         exechelp_tracker_rescan(tracker) == 7 &&
+         list_is((const char *[]) { "/etc/firejail/", "@/keep.txt", "@/papers/a2.pdf", "@/audio/",
+                                    "@/papers/a2.pdf~", NULL }));
+
+  report("nothing happens without events", exechelp_tracker_process(tracker) == 0 &&
+         exechelp_tracker_rescan(tracker) == 0 && exechelp_tracker_stats(tracker)->appends == 4 &&
+         exechelp_tracker_stats(tracker)->rewrites == 1);
+
+  exechelp_tracker_free(tracker);
+}
+
+/* Writes the list as someone else would, renaming a new version over it */
+static void write_list(const char *lines[])
+{
+  char tmp[PATH_MAX + 8];
+  int i;
+
+  snprintf(tmp, sizeof(tmp), "%s.new", list);
+  FILE *file = fopen(tmp, "w");
+  if (!file)
+    return;
+  for (i = 0; lines[i]; ++i)
+    fprintf(file, "%s\n", lines[i][0] == '@' ? at("%s", lines[i] + 2) : lines[i]);
+  fclose(file);
+  rename(tmp, list);
+}
+
+static void test_outside_changes(void)
+{
+  mkdir(at("shared"), 0700);
+  touch(at("shared/a.odt"));
+  touch(at("shared/b.odt"));
+  touch(at("shared/c.odt"));
+  touch(at("shared/d.odt"));
+  write_list((const char *[]) { "@/shared/a.odt", "@/shared/b.odt", NULL });
+
+  ExecHelpTracker *tracker = exechelp_tracker_new(list, NULL);
+  if (!tracker)
+  {
+    report("changes made by someone else are merged", 0);
+    return;
+  }
+
+  /* Someone else removes b.odt and adds c.odt while a.odt is moved */
+  write_list((const char *[]) { "@/shared/a.odt", "@/shared/c.odt", NULL });
+  rename(at("shared/a.odt"), at("shared/a2.odt"));
+  report("changes made by someone else are merged",
+         exechelp_tracker_process(tracker) == 3 &&
+         list_is((const char *[]) { "@/shared/a.odt", "@/shared/c.odt", "@/shared/a2.odt", NULL }));
+
+  rename(at("shared/c.odt"), at("shared/c2.odt"));
+  rename(at("shared/b.odt"), at("shared/b2.odt"));
+  report("entries added by someone else are followed",
+         exechelp_tracker_process(tracker) == 1 &&
+         list_is((const char *[]) { "@/shared/a.odt", "@/shared/c.odt", "@/shared/a2.odt",
+                                    "@/shared/c2.odt", NULL }));
+
+  /* Changes are merged without events, and the list is not rewritten */
+  FILE *file = fopen(list, "a");
+  if (file)
+  {
+    fprintf(file, "%s\n", at("shared/d.odt"));
+    fclose(file);
+  }
+  size_t published = exechelp_tracker_stats(tracker)->appends + exechelp_tracker_stats(tracker)->rewrites;
+  report("lines appended by someone else are merged without publishing",
+         exechelp_tracker_process(tracker) == 1 && exechelp_tracker_stats(tracker)->merges == 2 &&
+         exechelp_tracker_stats(tracker)->appends + exechelp_tracker_stats(tracker)->rewrites == published);
+
+  rename(at("shared/d.odt"), at("shared/d2.odt"));
+  report("and are followed",
+         exechelp_tracker_process(tracker) == 1 &&
+         list_is((const char *[]) { "@/shared/a.odt", "@/shared/c.odt", "@/shared/a2.odt",
+                                    "@/shared/c2.odt", "@/shared/d.odt", "@/shared/d2.odt", NULL }));
+
+  exechelp_tracker_free(tracker);
+
+  unlink(at("shared/a2.odt"));
+  unlink(at("shared/b2.odt"));
+  unlink(at("shared/c2.odt"));
+  unlink(at("shared/d2.odt"));
+  rmdir(at("shared"));
+}
+
+/* Tells whether the compiled policy is up to date with the list */
+static int compiled_is_current(const char *compiled_path)
+{
+  ExecHelpCompiledPolicy compiled;
+  struct stat sb;
+  int current;
+
+  if (stat(list, &sb) || exechelp_compiled_open(&compiled, compiled_path))
+    return 0;
+  current = exechelp_compiled_source_matches(&compiled.lists[EXECHELP_COMPILED_MANAGED_FILES], &sb);
+  exechelp_compiled_close(&compiled);
+  return current;
+}
+
+static void test_compiled(void)
+{
+  const char *paths[EXECHELP_COMPILED_N_LISTS];
+  char compiled_path[PATH_MAX];
+
+  mkdir(at("pictures"), 0700);
+  touch(at("pictures/a.png"));
+  touch(at("pictures/b.png"));
+  write_list((const char *[]) { "@/pictures/a.png", "@/pictures/b.png", NULL });
+
+  snprintf(compiled_path, sizeof(compiled_path), "%s", at("policy.ehc"));
+  paths[0] = at("helper-bins.list");
+  paths[1] = at("managed-bins.list");
+  paths[2] = list;
+
+  ExecHelpTracker *tracker = exechelp_tracker_new(list, NULL);
+  if (!tracker || exechelp_tracker_set_compiled(tracker, compiled_path) ||
+      exechelp_compile_policy(paths, compiled_path, 1, 0, NULL, NULL) != 0)
+  {
+    report("appended lines are recorded in the compiled policy", 0);
+    exechelp_tracker_free(tracker);
+    return;
+  }
+
+  rename(at("pictures/a.png"), at("pictures/a2.png"));
+  report("appended lines are recorded in the compiled policy",
+         exechelp_tracker_process(tracker) == 1 && exechelp_tracker_stats(tracker)->patched == 1 &&
+         compiled_is_current(compiled_path));
+
+  rename(at("pictures/a2.png"), at("pictures/a3.png"));
+  report("and so are the next ones",
+         exechelp_tracker_process(tracker) == 1 && exechelp_tracker_stats(tracker)->patched == 2 &&
+         compiled_is_current(compiled_path));
+
+  unlink(at("pictures/b.png"));
+  exechelp_tracker_process(tracker);
+  report("a rewritten list must be compiled again",
+         exechelp_tracker_rescan(tracker) == 3 && exechelp_tracker_stats(tracker)->rewrites == 1 &&
+         !compiled_is_current(compiled_path));
+
+  exechelp_tracker_free(tracker);
+
+  unlink(compiled_path);
+  unlink(at("pictures/a3.png"));
+  rmdir(at("pictures"));
+}
+
+static void test_large(void)
+{
+  long long start, setup_ns, moves_ns;
+  int i, changed = 0;
+
+  FILE *file = fopen(list, "w");
+  if (!file)
+    return;
+  for (i = 0; i < TEST_LARGE_DIRS; ++i)
+    mkdir(at("large-%d", i), 0700);
+  for (i = 0; i < TEST_LARGE_ENTRIES; ++i)
+    fprintf(file, "%s\n", at("large-%d/file-%d.pdf", i % TEST_LARGE_DIRS, i));
+  fclose(file);
+  for (i = 0; i < TEST_LARGE_MOVES; ++i)
+    touch(at("large-%d/file-%d.pdf", i % TEST_LARGE_DIRS, i));
+
+  start = now_ns();
+  ExecHelpTracker *tracker = exechelp_tracker_new(list, NULL);
+  setup_ns = now_ns() - start;
+  if (!tracker)
+  {
+    report("large lists are tracked", 0);
+    return;
+  }
+
+  for (i = 0; i < TEST_LARGE_MOVES; ++i)
+    rename(at("large-%d/file-%d.pdf", i % TEST_LARGE_DIRS, i),
+           at("large-%d/moved-%d.pdf", i % TEST_LARGE_DIRS, i));
+
+  start = now_ns();
+  changed = exechelp_tracker_process(tracker);
+  moves_ns = now_ns() - start;
+
+  const ExecHelpTrackStats *stats = exechelp_tracker_stats(tracker);
+  report("large lists are tracked", changed == TEST_LARGE_MOVES && stats->appends == 1 && stats->rewrites == 0);
+
+  printf("\n%d entries in %zu directories, watched in %.1fms\n"
+         "%d renames followed in %.1fms, of which %.1fms appending to the list\n\n",
+         TEST_LARGE_ENTRIES, stats->watches, setup_ns / 1e6, TEST_LARGE_MOVES,
+         moves_ns / 1e6, stats->append_ns / 1e6);
+
+  exechelp_tracker_free(tracker);
+
+  for (i = 0; i < TEST_LARGE_MOVES; ++i)
+    unlink(at("large-%d/moved-%d.pdf", i % TEST_LARGE_DIRS, i));
+  for (i = 0; i < TEST_LARGE_DIRS; ++i)
+    rmdir(at("large-%d", i));
+}
+
+int main(void)
+{
+  if (!mkdtemp(root))
+    return 1;
+  snprintf(list, sizeof(list), "%s/managed-files.list", root);
+
+  printf("ExecHelper managed files tracker\n\n");
+
+  test_changes();
+  test_outside_changes();
+  test_compiled();
+  test_large();
+
+  unlink(at("papers/a2.pdf"));
+  unlink(at("papers/a2.pdf~"));
+  unlink(at("keep.txt"));
+  unlink(at("elsewhere/c.pdf"));
+  unlink(at("other2.txt"));
+  rmdir(at("papers"));
+  rmdir(at("audio"));
+  rmdir(at("elsewhere"));
+  unlink(list);
+  rmdir(root);
+
+  printf("%s\n", failed ? "FAILED" : "PASSED");
+  return failed;
+}
@@ -0,0 +1,195 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Compiles the policy lists of a policy directory into the policy file mapped
+ * by the indexed engine (see compiled.h), and reports what each list costs.
+ * The lists are indexed in parallel. Processes keep using the lists directly
+ * until the compiled policy is written, and fall back to a list's file as
+ * soon as it is modified, so the tool must be run again after every change
+ * to the policy for the compiled policy to be used.
+ *
+ * With -m, the policy directory is instead a directory holding one policy
+ * directory per profile, e.g. one per sandbox, and the tool writes a single
+ * multi-profile snapshot (policy.ehs by default) in which lines common to
+ * several profiles are stored once.
+ *
+ * The binary associations are compiled into the library and are not part of
+ * the compiled policy.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "compiled.h"
+
+static const char *list_names[EXECHELP_COMPILED_N_LISTS] = {
+  "helper-bins.list", "managed-bins.list", "managed-files.list"
+};
+
+static void usage(const char *self)
+{
+  fprintf(stderr, "Usage: %s [-p policy-dir] [-o output] [-j threads] [-s] [-q]\n"
+                  "       %s -m [-p profiles-dir] [-o output] [-j threads] [-s] [-q]\n", self, self);
+}
+
+static int compile_snapshot(const char *root, const char *output, int threads, int strict, int quiet)
+{
+  ExecHelpSnapshotStats stats;
+  char *default_output = NULL;
+  int ret;
+
+  if (!output)
+  {
+    if (asprintf(&default_output, "%s/policy.ehs", root) < 0)
+      return 1;
+    output = default_output;
+  }
+
+  ret = exechelp_compile_snapshot(root, output, threads, strict, quiet ? NULL : stderr, &stats);
+
+  if (ret < 0)
+    fprintf(stderr, "Could not compile the profiles of '%s' into '%s': %s\n", root, output, strerror(errno));
+  else if (ret > 0)
+    fprintf(stderr, "Policy did not validate, '%s' left unchanged\n", output);
+  else if (!quiet)
+  {
+    printf("ExecHelper snapshot of %s compiled into %s (%d thread(s))\n\n", root, output, threads);
+    printf("profiles:        %zu\n", stats.profiles);
+    printf("lines:           %zu (%zu warning(s))\n", stats.lines, stats.warnings);
+    printf("list entries:    %zu\n", stats.list_entries);
+    printf("shared entries:  %zu (%.1f lists per entry)\n", stats.entries,
+           stats.entries ? (double) stats.list_entries / stats.entries : 0.0);
+    printf("strings:         %zu bytes\n", stats.strings_bytes);
+    printf("index:           %zu bytes\n", stats.index_bytes);
+    printf("profile data:    %zu bytes (%.0f per profile)\n", stats.profile_bytes,
+           stats.profiles ? (double) stats.profile_bytes / stats.profiles : 0.0);
+    printf("\ntotal: %zu bytes in %.1fus\n", stats.bytes, stats.build_ns / 1000.0);
+  }
+
+  free(default_output);
+  return ret < 0 ? 1 : (ret ? 3 : 0);
+}
+
+int main(int argc, char *argv[])
+{
+  ExecHelpCompileStats stats[EXECHELP_COMPILED_N_LISTS];
+  const char *policy_dir = NULL, *output = NULL;
+  char *paths[EXECHELP_COMPILED_N_LISTS], *default_output = NULL;
+  int threads = sysconf(_SC_NPROCESSORS_ONLN), strict = 0, quiet = 0, snapshot = 0, opt, i;
+
+  while ((opt = getopt(argc, argv, "p:o:j:msqh")) != -1)
+  {
+    switch (opt)
+    {
+      case 'p':
+        policy_dir = optarg;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
+      case 'm':
+        snapshot = 1;
+        break;
+      case 's':
+        strict = 1;
+        break;
+      case 'q':
+        quiet = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  if (optind != argc || threads < 1)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  /* Profiles are found next to the default policy directory */
+  if (snapshot)
+  {
+    char root[] = EXECHELP_POLICY_DIR, *slash;
+
+    while ((slash = strrchr(root, '/')) && slash > root && !slash[1])
+      *slash = '\0';
+    if ((slash = strrchr(root, '/')) && slash > root)
+      *slash = '\0';
+
+    return compile_snapshot(policy_dir ? policy_dir : root, output, threads, strict, quiet);
+  }
+
+  if (!policy_dir)
+    policy_dir = EXECHELP_POLICY_DIR;
+
+  for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+    if (asprintf(&paths[i], "%s/%s", policy_dir, list_names[i]) < 0)
+      return 1;
+  if (!output)
+  {
+    if (asprintf(&default_output, "%s/policy.ehc", policy_dir) < 0)
+      return 1;
+    output = default_output;
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int ret = exechelp_compile_policy((const char **) paths, output, threads, strict,
+                                    quiet ? NULL : stderr, stats);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  if (ret < 0)
+    fprintf(stderr, "Could not compile the policy into '%s': %s\n", output, strerror(errno));
+  else if (ret > 0)
+    fprintf(stderr, "Policy did not validate, '%s' left unchanged\n", output);
+  else if (!quiet)
+  {
+    size_t total = sizeof(ExecHelpCompiledHeader);
+
+    printf("ExecHelper policy compiled into %s (%d thread(s))\n\n", output, threads);
+    printf("%-20s %8s %8s %6s %8s %7s %7s %10s %10s\n", "list", "lines", "entries", "dups",
+           "warnings", "lengths", "slots", "bytes", "build");
+    for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+    {
+      printf("%-20s %8zu %8zu %6zu %8zu %7zu %7zu %10zu %8.1fus\n", list_names[i],
+             stats[i].lines, stats[i].entries, stats[i].duplicates, stats[i].warnings,
+             stats[i].lengths, stats[i].slots, stats[i].bytes, stats[i].build_ns / 1000.0);
+      total += stats[i].bytes;
+    }
+    printf("\ntotal: %zu bytes in %.1fus\n", total,
+           ((end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec)) / 1000.0);
+  }
+
+  for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+    free(paths[i]);
+  free(default_output);
+
+  return ret < 0 ? 1 : (ret ? 3 : 0);
+}
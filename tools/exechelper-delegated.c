@@ -0,0 +1,259 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Reference delegation daemon (see delegate.h). It checks every request of
+ * the processes of the current user against the default policy, from the
+ * directory and with the HOME of the app, executes those that the policy
+ * delegates in the directory of the app, and returns a completion handle
+ * for each process it starts. A sandbox would decide how to run delegated
+ * executions here instead, e.g. by asking the user or by starting the
+ * target in its own sandbox.
+ *
+ * Apps find the daemon through EXECHELP_DELEGATE_SOCKET, which must be set to
+ * the socket path printed at startup.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "coalesce.h"
+#include "delegate.h"
+#include "policy.h"
+
+/* Processes whose completion handle is a pipe, closed once they are reaped */
+typedef struct _DelegatedChild {
+  pid_t pid;
+  int   exit_fd;
+} DelegatedChild;
+
+static DelegatedChild *children = NULL;
+static size_t n_children = 0, children_size = 0;
+
+static void usage(const char *self)
+{
+  fprintf(stderr, "Usage: %s [-s socket] [-q]\n", self);
+}
+
+static int delegated_track_child(pid_t pid, int exit_fd)
+{
+  if (n_children == children_size)
+  {
+    size_t size = children_size ? children_size * 2 : 16;
+    DelegatedChild *grown = realloc(children, sizeof(DelegatedChild) * size);
+    if (!grown)
+      return -1;
+    children = grown;
+    children_size = size;
+  }
+
+  children[n_children].pid = pid;
+  children[n_children].exit_fd = exit_fd;
+  n_children++;
+  return 0;
+}
+
+static void delegated_reap(int quiet)
+{
+  pid_t pid;
+  int status;
+  size_t i;
+
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+  {
+    for (i = 0; i < n_children; ++i)
+    {
+      if (children[i].pid == pid)
+      {
+        close(children[i].exit_fd);
+        children[i] = children[--n_children];
+        break;
+      }
+    }
+
+    if (!quiet)
+      fprintf(stderr, "Process %d exited with status %d\n", pid,
+              WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+  }
+}
+
+static void delegated_serve(int conn, int quiet)
+{
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  char *cwd, *home, *target, **argv;
+  int fd = -1, exit_fd = -1, error = 0;
+  pid_t pid = 0;
+
+  /* Only the processes of the user may have executions delegated */
+  if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || cred.uid != geteuid())
+  {
+    if (!quiet)
+      fprintf(stderr, "Refusing a connection from another user\n");
+    return;
+  }
+
+  /* Requests are served one at a time, so slow clients are cut short */
+  struct timeval timeout = { EXECHELP_DELEGATE_TIMEOUT / 1000, 0 };
+  setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  if (exechelp_delegate_receive(conn, &cwd, &home, &target, &argv) != 0)
+  {
+    if (!quiet)
+      fprintf(stderr, "Invalid request from process %d: %s\n", cred.pid, strerror(errno));
+    return;
+  }
+
+  /* Apps of the user must not get around the policy through the daemon */
+  if (exechelp_delegate_check(exechelp_policy_get_default(), cwd, home, target, argv) == 0)
+    fd = exechelp_delegate_spawn(cwd, target, argv, environ, &pid, &exit_fd);
+
+  if (fd < 0)
+    error = errno;
+  else if (exit_fd >= 0 && delegated_track_child(pid, exit_fd) != 0)
+    close(exit_fd);
+
+  if (!quiet)
+  {
+    if (error)
+      fprintf(stderr, "Process %d could not delegate '%s': %s\n", cred.pid, target, strerror(error));
+    else
+      fprintf(stderr, "Process %d delegated '%s' as process %d\n", cred.pid, target, pid);
+  }
+
+  exechelp_delegate_reply(conn, error, pid, fd);
+  if (fd >= 0)
+    close(fd);
+  free(argv);
+}
+
+int main(int argc, char *argv[])
+{
+  char *socket_path = NULL, *dir = NULL;
+  int quiet = 0, opt;
+
+  while ((opt = getopt(argc, argv, "s:qh")) != -1)
+  {
+    switch (opt)
+    {
+      case 's':
+        socket_path = strdup(optarg);
+        break;
+      case 'q':
+        quiet = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  if (optind != argc)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  /* By default, the socket is put next to the coalescing spool */
+  if (!socket_path)
+  {
+    dir = exechelp_coalesce_default_dir();
+    if (!dir || (mkdir(dir, 0700) != 0 && errno != EEXIST) ||
+        asprintf(&socket_path, "%s/delegate.sock", dir) < 0)
+    {
+      fprintf(stderr, "Could not create the directory of the socket: %s\n", strerror(errno));
+      return 1;
+    }
+  }
+
+  int sock = exechelp_delegate_listen(socket_path);
+  if (sock < 0)
+  {
+    fprintf(stderr, "Could not listen on '%s': %s\n", socket_path, strerror(errno));
+    return 1;
+  }
+
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGCHLD);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigprocmask(SIG_BLOCK, &signals, NULL);
+  int sfd = signalfd(-1, &signals, SFD_CLOEXEC);
+  if (sfd < 0)
+  {
+    fprintf(stderr, "Could not watch signals: %s\n", strerror(errno));
+    return 1;
+  }
+
+  printf("%s=%s\n", EXECHELP_ENV_DELEGATE_SOCKET, socket_path);
+  fflush(stdout);
+
+  struct pollfd pfds[2] = { { .fd = sock, .events = POLLIN }, { .fd = sfd, .events = POLLIN } };
+  int stopping = 0, ret = 0;
+
+  while (!stopping)
+  {
+    if (poll(pfds, 2, -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      ret = 1;
+      break;
+    }
+
+    if (pfds[1].revents & POLLIN)
+    {
+      struct signalfd_siginfo info;
+
+      if (read(sfd, &info, sizeof(info)) == sizeof(info) && info.ssi_signo != SIGCHLD)
+        stopping = 1;
+      delegated_reap(quiet);
+    }
+
+    if (pfds[0].revents & POLLIN)
+    {
+      int conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+      if (conn >= 0)
+      {
+        delegated_serve(conn, quiet);
+        close(conn);
+      }
+    }
+  }
+
+  unlink(socket_path);
+  close(sock);
+  close(sfd);
+  free(socket_path);
+  free(dir);
+  free(children);
+  return ret;
+}
@@ -0,0 +1,182 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Adds up the call-site samples written by the processes of an app (see
+ * sample.h), read from the files given as arguments or from stdin, and lists
+ * the call sites that made the most exec calls. Each sample stands for as
+ * many calls as its sampling period, so logs taken with different periods
+ * can be mixed.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "hash.h"
+
+typedef struct _Hotspot {
+  unsigned long  samples;
+  unsigned long  calls;
+  char          *site;  /* target\tframes */
+} Hotspot;
+
+static void usage(const char *self)
+{
+  fprintf(stderr, "Usage: %s [-n count] [sample-log...]\n", self);
+}
+
+static void hotspots_free(void *data)
+{
+  Hotspot *hotspot = data;
+
+  free(hotspot->site);
+  free(hotspot);
+}
+
+static int hotspots_compare(const void *a, const void *b)
+{
+  const Hotspot *x = *(Hotspot * const *) a, *y = *(Hotspot * const *) b;
+
+  return x->calls < y->calls ? 1 : x->calls > y->calls ? -1 : strcmp(x->site, y->site);
+}
+
+static int hotspots_read(FILE *file, ExecHelpHashTable *sites, unsigned long *total)
+{
+  char *line = NULL, *site, *end;
+  size_t size = 0;
+  ssize_t len;
+  int malformed = 0;
+
+  while ((len = getline(&line, &size, file)) > 0)
+  {
+    if (line[len - 1] == '\n')
+      line[len - 1] = '\0';
+
+    unsigned long samples = strtoul(line, &end, 10);
+    if (*end != '\t')
+      goto malformed;
+    unsigned long period = strtoul(end + 1, &site, 10);
+    if (*site != '\t' || period == 0)
+      goto malformed;
+    site++;
+
+    Hotspot *hotspot = exechelp_hash_table_lookup(sites, site);
+    if (!hotspot)
+    {
+      hotspot = calloc(1, sizeof(Hotspot));
+      if (!hotspot || !(hotspot->site = strdup(site)))
+      {
+        free(hotspot);
+        free(line);
+        return -1;
+      }
+      exechelp_hash_table_insert(sites, hotspot->site, hotspot);
+    }
+
+    hotspot->samples += samples;
+    hotspot->calls += samples * period;
+    *total += samples * period;
+    continue;
+
+  malformed:
+    malformed++;
+  }
+
+  free(line);
+  return malformed;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long total = 0;
+  int count = 20, malformed = 0, opt, i;
+
+  while ((opt = getopt(argc, argv, "n:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n':
+        count = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  ExecHelpHashTable *sites = exechelp_hash_table_new_full(exechelp_str_hash, exechelp_str_equal,
+                                                          NULL, hotspots_free);
+  if (!sites)
+    return 1;
+
+  for (i = optind; i < argc || (i == optind && argc == optind); ++i)
+  {
+    FILE *file = i < argc ? fopen(argv[i], "r") : stdin;
+    if (!file)
+    {
+      fprintf(stderr, "Could not open '%s': %s\n", argv[i], strerror(errno));
+      exechelp_hash_table_destroy(sites);
+      return 1;
+    }
+
+    int ret = hotspots_read(file, sites, &total);
+    if (file != stdin)
+      fclose(file);
+    if (ret < 0)
+    {
+      fprintf(stderr, "Could not read the samples: %s\n", strerror(errno));
+      exechelp_hash_table_destroy(sites);
+      return 1;
+    }
+    malformed += ret;
+  }
+
+  unsigned int n;
+  Hotspot **hotspots = (Hotspot **) exechelp_hash_table_get_keys_as_array(sites, &n);
+  for (i = 0; i < (int) n; ++i)
+    hotspots[i] = exechelp_hash_table_lookup(sites, hotspots[i]);
+  qsort(hotspots, n, sizeof(Hotspot *), hotspots_compare);
+
+  printf("ExecHelper exec hot spots: %lu exec calls estimated at %u call sites\n\n", total, n);
+  for (i = 0; i < (int) n && i < count; ++i)
+  {
+    char *frames = strchr(hotspots[i]->site, '\t'), *frame, *save = NULL;
+
+    printf("%10lu calls (%5.1f%%, %lu samples)  %.*s\n", hotspots[i]->calls,
+           100.0 * hotspots[i]->calls / total, hotspots[i]->samples,
+           frames ? (int) (frames - hotspots[i]->site) : (int) strlen(hotspots[i]->site),
+           hotspots[i]->site);
+
+    /* Printing the frames is the last use of the site, so it can be split */
+    for (frame = frames ? strtok_r(frames + 1, " ", &save) : NULL; frame;
+         frame = strtok_r(NULL, " ", &save))
+      printf("%16s %s\n", "", frame);
+  }
+
+  if (malformed)
+    fprintf(stderr, "%d malformed line(s) ignored\n", malformed);
+
+  free(hotspots);
+  exechelp_hash_table_destroy(sites);
+  return 0;
+}
@@ -0,0 +1,294 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Decides on executions read from stdin with the indexed engine, in batches
+ * (see exechelp_check_batch). Each line is a request made of tab-separated
+ * fields: the directory the execution happens in (empty for the current
+ * directory), the target binary and its arguments, starting with argv[0].
+ * Empty lines and lines starting with '#' are ignored. Arguments starting
+ * with '~/' are expanded against the HOME given with -H, or else against
+ * the HOME of exechelper-query, which must then be the one of the app.
+ *
+ * The verdict of each request is written to stdout, one per line and in
+ * order. Statistics are written to stderr: the number of queries, the time
+ * spent deciding on them and the throughput, both per second of wall time
+ * and per second of CPU time, i.e. per fully used core.
+ *
+ * With -j, each batch is split between several threads, each with its own
+ * copy of the policy. With -r, each batch is decided on several times, to
+ * measure the throughput of small inputs; verdicts are only written once.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "policy.h"
+
+#define QUERY_DEFAULT_BATCH 1024
+#define QUERY_MAX_THREADS   64
+
+typedef struct _QueryWorker {
+  pthread_t              thread;
+  ExecHelpPolicy        *policy;
+  ExecHelpCheckRequest  *requests;
+  ExecHelpVerdict       *verdicts;
+  size_t                 n_requests;
+  int                    repeat;
+  int                    started;
+} QueryWorker;
+
+static void usage(const char *self)
+{
+  fprintf(stderr, "Usage: %s [-p policy-dir] [-H home] [-b batch-size] [-j threads] [-r repeat] [-s]\n", self);
+}
+
+static inline long long now_ns(clockid_t clock)
+{
+  struct timespec ts;
+
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void *query_worker(void *data)
+{
+  QueryWorker *worker = data;
+  int r;
+
+  for (r = 0; r < worker->repeat; ++r)
+    exechelp_check_batch(worker->policy, worker->requests, worker->n_requests, worker->verdicts);
+
+  return NULL;
+}
+
+/* Splits a line into a request, in place */
+static int query_parse(char *line, ExecHelpCheckRequest *request)
+{
+  char **argv = NULL, *field, *next;
+  size_t argc = 0;
+
+  line[strcspn(line, "\n")] = '\0';
+  if (!(next = strchr(line, '\t')))
+    return -1;
+  *next++ = '\0';
+  request->cwd = line[0] ? line : NULL;
+
+  request->target = next;
+  if ((next = strchr(next, '\t')))
+    *next++ = '\0';
+
+  for (field = next; field; field = next)
+  {
+    char **grown = realloc(argv, (argc + 2) * sizeof(char *));
+    if (!grown)
+    {
+      free(argv);
+      return -1;
+    }
+    argv = grown;
+
+    if ((next = strchr(field, '\t')))
+      *next++ = '\0';
+    argv[argc++] = field;
+  }
+
+  if (!argv && !(argv = malloc(sizeof(char *))))
+    return -1;
+  argv[argc] = NULL;
+  request->argv = argv;
+
+  return 0;
+}
+
+static ExecHelpPolicy *query_policy_new(const char *paths[4])
+{
+  ExecHelpPolicy *policy = exechelp_policy_new(paths[0], paths[1], paths[2]);
+
+  if (policy)
+    exechelp_policy_set_compiled(policy, paths[3]);
+  return policy;
+}
+
+int main(int argc, char *argv[])
+{
+  QueryWorker workers[QUERY_MAX_THREADS];
+  const char *policy_dir = NULL, *home = NULL;
+  size_t batch_size = QUERY_DEFAULT_BATCH;
+  int threads = 1, repeat = 1, silent = 0, opt, t;
+
+  while ((opt = getopt(argc, argv, "p:H:b:j:r:sh")) != -1)
+  {
+    switch (opt)
+    {
+      case 'p':
+        policy_dir = optarg;
+        break;
+      case 'H':
+        home = optarg;
+        break;
+      case 'b':
+        batch_size = strtoul(optarg, NULL, 10);
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
+      case 'r':
+        repeat = atoi(optarg);
+        break;
+      case 's':
+        silent = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  if (optind != argc || batch_size < 1 || threads < 1 || threads > QUERY_MAX_THREADS || repeat < 1)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  char *owned[4] = { NULL, NULL, NULL, NULL };
+  const char *paths[4] = { EXECHELP_HELPER_BINS_PATH, EXECHELP_MANAGED_BINS_PATH,
+                           EXECHELP_MANAGED_FILES_PATH, EXECHELP_COMPILED_POLICY_PATH };
+  if (policy_dir)
+  {
+    if (asprintf(&owned[0], "%s/helper-bins.list", policy_dir) < 0 ||
+        asprintf(&owned[1], "%s/managed-bins.list", policy_dir) < 0 ||
+        asprintf(&owned[2], "%s/managed-files.list", policy_dir) < 0 ||
+        asprintf(&owned[3], "%s/policy.ehc", policy_dir) < 0)
+      return 1;
+    for (t = 0; t < 4; ++t)
+      paths[t] = owned[t];
+  }
+
+  for (t = 0; t < threads; ++t)
+  {
+    workers[t].repeat = repeat;
+    if (!(workers[t].policy = query_policy_new(paths)))
+      return 1;
+  }
+
+  ExecHelpCheckRequest *requests = calloc(batch_size, sizeof(ExecHelpCheckRequest));
+  ExecHelpVerdict *verdicts = calloc(batch_size, sizeof(ExecHelpVerdict));
+  char **lines = calloc(batch_size, sizeof(char *));
+  size_t *line_sizes = calloc(batch_size, sizeof(size_t));
+  if (!requests || !verdicts || !lines || !line_sizes)
+    return 1;
+
+  unsigned long queries = 0, malformed = 0, input_lines = 0;
+  unsigned long counts[3] = { 0, 0, 0 };
+  long long wall_ns = 0, cpu_ns = 0;
+  int eof = 0, ret = 0;
+
+  while (!eof)
+  {
+    size_t n = 0, i;
+
+    /* Lines are reused from one batch to the next */
+    while (n < batch_size)
+    {
+      if (getline(&lines[n], &line_sizes[n], stdin) < 0)
+      {
+        eof = 1;
+        break;
+      }
+      input_lines++;
+
+      if (lines[n][0] == '\n' || lines[n][0] == '#')
+        continue;
+      if (query_parse(lines[n], &requests[n]))
+      {
+        fprintf(stderr, "Malformed request on line %lu\n", input_lines);
+        malformed++;
+        continue;
+      }
+      requests[n].home = home;
+      n++;
+    }
+
+    if (!n)
+      continue;
+
+    /* Split the batch evenly, the calling thread decides on the last part */
+    size_t share = (n + threads - 1) / threads, offset = 0;
+    long long wall = now_ns(CLOCK_MONOTONIC), cpu = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+    int used = 0;
+
+    for (t = 0; t < threads && offset < n; ++t, offset += share)
+    {
+      workers[t].requests = requests + offset;
+      workers[t].verdicts = verdicts + offset;
+      workers[t].n_requests = n - offset < share ? n - offset : share;
+      used = t + 1;
+    }
+    for (t = 0; t < used - 1; ++t)
+      if (!(workers[t].started = pthread_create(&workers[t].thread, NULL, query_worker, &workers[t]) == 0))
+        query_worker(&workers[t]);
+    query_worker(&workers[used - 1]);
+    for (t = 0; t < used - 1; ++t)
+      if (workers[t].started)
+        pthread_join(workers[t].thread, NULL);
+
+    wall_ns += now_ns(CLOCK_MONOTONIC) - wall;
+    cpu_ns += now_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    queries += n * repeat;
+
+    for (i = 0; i < n; ++i)
+    {
+      if (verdicts[i] <= EXECHELP_VERDICT_ALLOW)
+        counts[verdicts[i]]++;
+      if (!silent && puts(exechelp_verdict_to_string(verdicts[i])) < 0)
+        ret = 1;
+      free((char **) requests[i].argv);
+    }
+  }
+
+  fprintf(stderr, "ExecHelper query (policy: %s, batches of %zu, %d thread(s))\n",
+          policy_dir ? policy_dir : EXECHELP_POLICY_DIR, batch_size, threads);
+  fprintf(stderr, "queries:    %lu (%lu malformed line(s) skipped)\n", queries, malformed);
+  fprintf(stderr, "verdicts:   allow=%lu delegate=%lu deny=%lu\n",
+          counts[EXECHELP_VERDICT_ALLOW], counts[EXECHELP_VERDICT_DELEGATE], counts[EXECHELP_VERDICT_DENY]);
+  if (queries)
+    fprintf(stderr, "throughput: %.0f queries/s, %.0f queries/s per core, %.3f us/query\n",
+            queries * 1e9 / (wall_ns ? wall_ns : 1), queries * 1e9 / (cpu_ns ? cpu_ns : 1),
+            cpu_ns / 1000.0 / queries);
+
+  for (t = 0; t < threads; ++t)
+    exechelp_policy_free(workers[t].policy);
+  for (t = 0; t < (int) batch_size; ++t)
+    free(lines[t]);
+  for (t = 0; t < 4; ++t)
+    free(owned[t]);
+  free(lines);
+  free(line_sizes);
+  free(requests);
+  free(verdicts);
+
+  return ret || malformed ? 1 : 0;
+}
@@ -0,0 +1,316 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Replays an exec trace recorded with EXECHELP_RECORD=<file> through a
+ * decision engine, and reports its throughput and the decisions that differ
+ * from the recorded verdicts. Each record is replayed from its recorded
+ * working directory and environment; only the decisions themselves are timed.
+ *
+ * With -f, the trace is replayed against an in-memory fixture filesystem
+ * described by a specification file (see exechelp_fs_memory_load), which must
+ * also contain the policy lists. -l injects a latency into every filesystem
+ * operation of the fixture.
+ *
+ * With -r, the trace is replayed inside a fixture root on the real filesystem
+ * instead (requires the privilege to chroot). The indexed engine loads its
+ * policy before entering the root, whereas the legacy pipeline reads the
+ * policy files compiled into it, which must then exist inside the root too.
+ * The indexed engine uses the compiled policy of the policy directory, if
+ * exechelper-compile was run on it since its lists last changed.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "fsops.h"
+#include "policy.h"
+#include "trace.h"
+
+#define REPLAY_MAX_REPORTED_DIFFS 20
+
+static const char *replay_env[] = EXECHELP_TRACE_ENV;
+
+static void usage(const char *self)
+{
+  fprintf(stderr, "Usage: %s [-e engine|legacy] [-p policy-dir] [-f fixture-spec [-l latency-ns] | -r fixture-root]\n"
+                  "       [-n iterations] [-q] trace\n", self);
+}
+
+static ExecHelpVerdict replay_legacy_decide(const char *target, char *const argv[])
+{
+  char *allowed_exec = NULL, *forbidden_exec = NULL;
+  char **allowed_argv = NULL, **forbidden_argv = NULL;
+  ExecHelpVerdict verdict;
+
+  if (exechelp_filter_forbidden_exec(target, argv, environ,
+                                     &allowed_exec, &allowed_argv,
+                                     &forbidden_exec, &forbidden_argv))
+    verdict = EXECHELP_VERDICT_ALLOW;
+  else if (forbidden_exec)
+    verdict = EXECHELP_VERDICT_DELEGATE;
+  else
+    verdict = EXECHELP_VERDICT_DENY;
+
+  free(allowed_exec);
+  free(forbidden_exec);
+  free(allowed_argv);
+  free(forbidden_argv);
+
+  return verdict;
+}
+
+/* Makes the recorded environment variables the current ones, and unsets
+ * those that were not set when the record was made */
+static void replay_apply_env(const ExecHelpTraceRecord *record)
+{
+  int i, j;
+
+  for (i = 0; replay_env[i]; ++i)
+  {
+    size_t len = strlen(replay_env[i]);
+    const char *value = NULL;
+
+    for (j = 0; j < record->nenv && !value; ++j)
+      if (strncmp(record->env[j], replay_env[i], len) == 0 && record->env[j][len] == '=')
+        value = record->env[j] + len + 1;
+
+    if (value)
+    {
+      const char *current = getenv(replay_env[i]);
+      if (!current || strcmp(current, value))
+        setenv(replay_env[i], value, 1);
+    }
+    else
+      unsetenv(replay_env[i]);
+  }
+}
+
+static void replay_report_diff(const ExecHelpTraceRecord *record, ExecHelpVerdict verdict)
+{
+  int i;
+
+  printf("DIFF recorded=%s replayed=%s cwd='%s' target='%s'\n",
+         exechelp_verdict_to_string(record->verdict),
+         exechelp_verdict_to_string(verdict),
+         record->cwd, record->target);
+  for (i = 0; i < record->argc; ++i)
+    printf("DIFF   argv[%d]='%s'\n", i, record->argv[i]);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *engine = "engine", *policy_dir = NULL, *root = NULL, *spec = NULL;
+  int iterations = 1, quiet = 0, opt;
+  long latency_ns = 0;
+
+  while ((opt = getopt(argc, argv, "e:p:f:l:r:n:qh")) != -1)
+  {
+    switch (opt)
+    {
+      case 'e':
+        engine = optarg;
+        break;
+      case 'p':
+        policy_dir = optarg;
+        break;
+      case 'f':
+        spec = optarg;
+        break;
+      case 'l':
+        latency_ns = atol(optarg);
+        break;
+      case 'r':
+        root = optarg;
+        break;
+      case 'n':
+        iterations = atoi(optarg);
+        break;
+      case 'q':
+        quiet = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  int use_engine = strcmp(engine, "engine") == 0;
+  if ((!use_engine && strcmp(engine, "legacy")) || iterations < 1 || optind != argc - 1 || (spec && root))
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (!use_engine && policy_dir)
+  {
+    fprintf(stderr, "The legacy pipeline can only use the policy it was built with (%s)\n", EXECHELP_POLICY_DIR);
+    return 2;
+  }
+
+  ExecHelpTraceReader reader;
+  if (exechelp_trace_reader_open(&reader, argv[optind]))
+  {
+    fprintf(stderr, "Could not open trace '%s': %s\n", argv[optind], strerror(errno));
+    return 1;
+  }
+
+  ExecHelpFsMemory *fixture = NULL;
+  if (spec)
+  {
+    int line;
+
+    if (!(fixture = exechelp_fs_memory_new()) || (line = exechelp_fs_memory_load(fixture, spec)))
+    {
+      fprintf(stderr, "Could not load fixture '%s' (line %d)\n", spec, fixture ? line : 0);
+      return 1;
+    }
+    exechelp_fs_memory_set_latency(fixture, latency_ns);
+    exechelp_fs_set_ops(exechelp_fs_memory_get_ops(fixture));
+  }
+
+  ExecHelpPolicy *policy = NULL;
+  char *paths[4] = { NULL, NULL, NULL, NULL };
+  if (use_engine)
+  {
+    if (policy_dir)
+    {
+      if (asprintf(&paths[0], "%s/helper-bins.list", policy_dir) < 0 ||
+          asprintf(&paths[1], "%s/managed-bins.list", policy_dir) < 0 ||
+          asprintf(&paths[2], "%s/managed-files.list", policy_dir) < 0 ||
+          asprintf(&paths[3], "%s/policy.ehc", policy_dir) < 0)
+        return 1;
+      policy = exechelp_policy_new(paths[0], paths[1], paths[2]);
+      exechelp_policy_set_compiled(policy, paths[3]);
+    }
+    else
+    {
+      policy = exechelp_policy_new(EXECHELP_HELPER_BINS_PATH,
+                                   EXECHELP_MANAGED_BINS_PATH,
+                                   EXECHELP_MANAGED_FILES_PATH);
+      exechelp_policy_set_compiled(policy, EXECHELP_COMPILED_POLICY_PATH);
+    }
+
+    /* Load the lists now, so that they survive entering the fixture root */
+    exechelp_policy_list_refresh(&policy->helper_bins);
+    exechelp_policy_list_refresh(&policy->managed_bins);
+    exechelp_policy_list_refresh(&policy->managed_files);
+  }
+
+  if (root && (chroot(root) || chdir("/")))
+  {
+    fprintf(stderr, "Could not enter fixture root '%s': %s\n", root, strerror(errno));
+    return 1;
+  }
+
+  unsigned long decisions = 0, skipped = 0, diffs = 0, records = 0;
+  unsigned long counts[3] = { 0, 0, 0 };
+  long long elapsed_ns = 0;
+  int corrupted = 0, iteration;
+  char *cwd = NULL;
+
+  for (iteration = 0; iteration < iterations && !corrupted; ++iteration)
+  {
+    ExecHelpTraceRecord record;
+    int ret;
+
+    exechelp_trace_reader_rewind(&reader);
+    while ((ret = exechelp_trace_reader_next(&reader, &record)) == 1)
+    {
+      if (iteration == 0)
+        records++;
+
+      if (!cwd || strcmp(cwd, record.cwd))
+      {
+        free(cwd);
+        cwd = NULL;
+        if (record.cwd[0] == '\0' ||
+            (fixture ? exechelp_fs_memory_chdir(fixture, record.cwd) : chdir(record.cwd)))
+        {
+          skipped++;
+          continue;
+        }
+        cwd = strdup(record.cwd);
+      }
+      replay_apply_env(&record);
+
+      struct timespec start, end;
+      ExecHelpVerdict verdict;
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      if (use_engine)
+        verdict = exechelp_policy_decide(policy, record.target, record.argv);
+      else
+        verdict = replay_legacy_decide(record.target, record.argv);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+
+      elapsed_ns += (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+      decisions++;
+
+      /* Diffs are the same on every iteration, only count them once */
+      if (iteration == 0)
+      {
+        if (verdict <= EXECHELP_VERDICT_ALLOW)
+          counts[verdict]++;
+
+        if (verdict != record.verdict)
+        {
+          if (!quiet && diffs < REPLAY_MAX_REPORTED_DIFFS)
+            replay_report_diff(&record, verdict);
+          diffs++;
+        }
+      }
+    }
+
+    if (ret < 0)
+    {
+      fprintf(stderr, "Trace '%s' is corrupted after %lu records\n", argv[optind], records);
+      corrupted = 1;
+    }
+  }
+
+  printf("ExecHelper replay (engine: %s, policy: %s%s%s%s%s)\n", engine,
+         policy_dir ? policy_dir : EXECHELP_POLICY_DIR,
+         root ? ", root: " : "", root ? root : "",
+         spec ? ", fixture: " : "", spec ? spec : "");
+  printf("records:    %lu (%lu skipped, missing cwd)\n", records, skipped / iterations);
+  printf("verdicts:   allow=%lu delegate=%lu deny=%lu\n",
+         counts[EXECHELP_VERDICT_ALLOW], counts[EXECHELP_VERDICT_DELEGATE], counts[EXECHELP_VERDICT_DENY]);
+  printf("diffs:      %lu\n", diffs);
+  if (decisions)
+    printf("throughput: %.0f decisions/s, %.3f us/decision over %d iteration(s)\n",
+           decisions * 1e9 / (elapsed_ns ? elapsed_ns : 1),
+           elapsed_ns / 1000.0 / decisions, iterations);
+
+  free(cwd);
+  free(paths[0]);
+  free(paths[1]);
+  free(paths[2]);
+  free(paths[3]);
+  exechelp_policy_free(policy);
+  exechelp_fs_memory_free(fixture);
+  exechelp_trace_reader_close(&reader);
+
+  return corrupted ? 1 : (diffs ? 3 : 0);
+}
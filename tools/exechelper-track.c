@@ -0,0 +1,220 @@
+/*
+    2015 (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>
+    This file is part of ExecHelper.
+
+    ExecHelper is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ExecHelper is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ExecHelper.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Keeps the managed-files.list of a policy directory up to date as managed
+ * files are renamed, moved or deleted (see track.h), instead of rescanning
+ * the file system and republishing the list. Runs on the trusted side until
+ * interrupted, and then reports what it did. SIGHUP removes the entries that
+ * are gone and still do not exist.
+ *
+ * Processes fall back to the lists as soon as one no longer matches the
+ * compiled policy. With -c, the tracker records the lines it appends in the
+ * compiled policy, and the policy is only compiled again when that was not
+ * possible: when lines were removed, when someone else changed the list, or
+ * once too many lines were appended since the policy was compiled.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "compiled.h"
+#include "track.h"
+
+static volatile sig_atomic_t stopping = 0;
+static volatile sig_atomic_t rescanning = 0;
+
+static void stop(int sig)
+{
+  stopping = 1;
+}
+
+static void rescan(int sig)
+{
+  rescanning = 1;
+}
+
+static void usage(const char *self)
+{
+  fprintf(stderr, "Usage: %s [-p policy-dir] [-c] [-o output] [-q]\n", self);
+}
+
+/* Tells whether the compiled policy is up to date with the managed files list */
+static int compiled_is_current(const char *output, const char *list)
+{
+  ExecHelpCompiledPolicy compiled;
+  struct stat sb;
+  int current;
+
+  if (stat(list, &sb) != 0 || exechelp_compiled_open(&compiled, output) != 0)
+    return 0;
+
+  current = exechelp_compiled_source_matches(&compiled.lists[EXECHELP_COMPILED_MANAGED_FILES], &sb);
+  exechelp_compiled_close(&compiled);
+  return current;
+}
+
+static int recompile(const char *policy_dir, const char *output, int quiet)
+{
+  static const char *names[EXECHELP_COMPILED_N_LISTS] = {
+    "helper-bins.list", "managed-bins.list", "managed-files.list"
+  };
+  ExecHelpCompileStats stats[EXECHELP_COMPILED_N_LISTS];
+  char *paths[EXECHELP_COMPILED_N_LISTS];
+  int i, ret;
+
+  for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+    if (asprintf(&paths[i], "%s/%s", policy_dir, names[i]) < 0)
+      return -1;
+
+  ret = exechelp_compile_policy((const char **) paths, output, 1, 0, quiet ? NULL : stderr, stats);
+  if (ret != 0)
+    fprintf(stderr, "Could not compile the policy into '%s': %s\n", output,
+            ret < 0 ? strerror(errno) : "the policy did not validate");
+
+  for (i = 0; i < EXECHELP_COMPILED_N_LISTS; ++i)
+    free(paths[i]);
+
+  return ret;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *policy_dir = EXECHELP_POLICY_DIR, *output = NULL;
+  char *list = NULL, *default_output = NULL;
+  int compile = 0, quiet = 0, opt;
+
+  while ((opt = getopt(argc, argv, "p:co:qh")) != -1)
+  {
+    switch (opt)
+    {
+      case 'p':
+        policy_dir = optarg;
+        break;
+      case 'c':
+        compile = 1;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'q':
+        quiet = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  if (optind != argc)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (asprintf(&list, "%s/managed-files.list", policy_dir) < 0)
+    return 1;
+  if (!output && asprintf(&default_output, "%s/policy.ehc", policy_dir) < 0)
+    return 1;
+  if (!output)
+    output = default_output;
+
+  ExecHelpTracker *tracker = exechelp_tracker_new(list, quiet ? NULL : stderr);
+  if (!tracker)
+  {
+    fprintf(stderr, "Could not track the entries of '%s': %s\n", list, strerror(errno));
+    return 1;
+  }
+
+  if (compile && exechelp_tracker_set_compiled(tracker, output) != 0)
+  {
+    fprintf(stderr, "Could not track the entries of '%s': %s\n", list, strerror(errno));
+    exechelp_tracker_free(tracker);
+    return 1;
+  }
+
+  const ExecHelpTrackStats *stats = exechelp_tracker_stats(tracker);
+  if (!quiet)
+    fprintf(stderr, "Tracking %zu entries of %s in %zu directories (%zu could not be watched)\n",
+            stats->entries, list, stats->watches, stats->unwatched);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = stop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sa.sa_handler = rescan;
+  sigaction(SIGHUP, &sa, NULL);
+
+  struct pollfd pfd = { .fd = exechelp_tracker_fd(tracker), .events = POLLIN };
+  int ret = 0;
+
+  while (!stopping)
+  {
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+    {
+      ret = 1;
+      break;
+    }
+
+    int changed = exechelp_tracker_process(tracker), pruned = 0;
+    if (changed >= 0 && rescanning)
+    {
+      rescanning = 0;
+      pruned = exechelp_tracker_rescan(tracker);
+    }
+    if (changed < 0 || pruned < 0)
+    {
+      fprintf(stderr, "Could not update '%s': %s\n", list, strerror(errno));
+      ret = 1;
+      break;
+    }
+    changed += pruned;
+
+    if (changed && compile && !compiled_is_current(output, list))
+      recompile(policy_dir, output, quiet);
+  }
+
+  if (!quiet)
+  {
+    printf("ExecHelper tracker of %s\n\n", list);
+    printf("entries:    %zu\n", stats->entries);
+    printf("watches:    %zu\n", stats->watches);
+    printf("events:     %zu (%zu overflow(s))\n", stats->events, stats->overflows);
+    printf("renamed:    %zu\n", stats->renamed);
+    printf("gone:       %zu (%zu pruned)\n", stats->gone, stats->pruned);
+    printf("lost:       %zu\n", stats->lost);
+    printf("merges:     %zu\n", stats->merges);
+    printf("rewrites:   %zu in %.1fus\n", stats->rewrites, stats->rewrite_ns / 1000.0);
+    printf("appends:    %zu in %.1fus (%zu recorded in the compiled policy)\n", stats->appends,
+           stats->append_ns / 1000.0, stats->patched);
+  }
+
+  exechelp_tracker_free(tracker);
+  free(list);
+  free(default_output);
+  return ret;
+}